@@ -24,118 +24,12 @@ template <typename T> class CacheFriendlyRangeSpaceSIMD;
 #ifndef CACHEFRIENDLYRANGESPACESIMD_H
 #define CACHEFRIENDLYRANGESPACESIMD_H
 
-#include <map>
 #include <vector>
-#include <iostream>
 #include <algorithm>
-#include <cmath>
-
-#ifdef WIN32
-#include <xmmintrin.h>
-#endif
 
 #include <centralised_log.h>
 
-#include "sse_allocator.h"
-
-class SIMDVector4 {
-
-    protected:
-
-    union U {
-        struct Raw {
-            float x, y, z, d;
-        } raw;
-        #ifdef WIN32
-        __m128 simd;
-        #else
-        float simd __attribute__ ((vector_size (16)));
-        #endif
-    };
-
-
-    public:
-
-    inline void updateAll (float x, float y, float z, float d)
-    {
-        u.raw.x = x;
-        u.raw.y = y;
-        u.raw.z = z;
-        u.raw.d = d;
-    }
-
-    inline float x(void) const { return u.raw.x; }
-    inline float y(void) const { return u.raw.y; }
-    inline float z(void) const { return u.raw.z; }
-    inline float d(void) const { return u.raw.d; }
-
-    SIMDVector4 operator- (const SIMDVector4 &b) const
-    {
-        SIMDVector4 r;
-        #ifdef WIN32
-        r.u.simd = _mm_sub_ps(u.simd, b.u.simd);
-        #else
-        r.u.simd = u.simd - b.u.simd;
-        #endif
-        return r;
-    }
-
-    SIMDVector4 operator* (const SIMDVector4 &b) const
-    {
-        SIMDVector4 r;
-        #ifdef WIN32
-        r.u.simd = _mm_mul_ps(u.simd, b.u.simd);
-        #else
-        r.u.simd = u.simd * b.u.simd;
-        #endif
-        return r;
-    }
-    SIMDVector4 &operator*= (SIMDVector4 &b)
-    {
-        *this = *this * b;
-        return *this;
-    }
-
-     protected:
-
-    U u;
-};
-
-// msvc needs a horrible wrapper class because it can't handle aligned parameters
-// thus operations like resize() and push_back() cause compile errors
-#ifdef WIN32
-class SIMDVector4s {
-
-    public:
-
-    struct Stupid { float x, y, z, d; };
-    typedef std::vector<Stupid,SSEAllocator<Stupid> > Wrapped;
-    typedef Wrapped::size_type size_type;
-
-    void pop_back (void) { wrapped.pop_back(); }
-
-    void push_back (const SIMDVector4 &v)
-    { wrapped.push_back(reinterpret_cast<const Stupid&>(v)); }
-
-    void clear (void) { wrapped.clear(); }
-
-    SIMDVector4 &operator[] (size_type index)
-    { return reinterpret_cast<SIMDVector4&>(wrapped[index]); }
-
-    const SIMDVector4 &operator[] (size_type index) const
-    { return reinterpret_cast<const SIMDVector4&>(wrapped[index]); }
-
-    Wrapped::size_type size (void) const { return wrapped.size(); }
-
-    void reserve (size_t s) { wrapped.reserve(s); }
-
-
-    protected:
-    Wrapped wrapped;
-};
-#else
-typedef std::vector<SIMDVector4,SSEAllocator<SIMDVector4> > SIMDVector4s;
-#endif
+#include "range_space_kernel.h"
 
 template <typename T>
 class CacheFriendlyRangeSpace {
@@ -151,7 +45,10 @@ class CacheFriendlyRangeSpace {
     void reserve (size_t s)
     {
         cargo.reserve(s);
-        positions.reserve(s);
+        xs.reserve(s);
+        ys.reserve(s);
+        zs.reserve(s);
+        ds.reserve(s);
     }
 
     void add (const T &o)
@@ -163,27 +60,19 @@ class CacheFriendlyRangeSpace {
         
         size_t index = cargo.size();
         cargo.push_back(o);
-        positions.push_back(SIMDVector4());
+        xs.push_back(0);
+        ys.push_back(0);
+        zs.push_back(0);
+        ds.push_back(0);
         o->updateIndex(index);
     }
 
     inline void updateSphere (size_t index, float x, float y, float z, float d)
     {
-        positions[index].updateAll(x,y,z,d);
-    }
-
-    // only meaningful if the radius is stored in pos.d and
-    // other.d is 0, thus the subtraction and squaring
-    // yields d^2
-    static inline bool isNear (const SIMDVector4 &pos,
-                               const SIMDVector4 &centre,
-                               const float factor2)
-    {
-        SIMDVector4 diff;
-        diff = pos - centre;
-        diff *= diff;
-        return diff.x() + diff.y() + diff.z()
-            < diff.d() * factor2;
+        xs[index] = x;
+        ys[index] = y;
+        zs[index] = z;
+        ds[index] = d;
     }
 
     void getPresent (const float x,
@@ -198,27 +87,23 @@ class CacheFriendlyRangeSpace {
         if (num>cargo.size()) num=cargo.size();
         if (hence>=cargo.size()) hence = 0;
 
-        // iterate from this point for a while
-        SIMDVector4s::size_type iter = hence, end = positions.size();        
-
-        if (num>positions.size()) {
-            iter = 0;
-            num = positions.size();
-        }
+        // iterate from this point for a while, wrapping around at the end
+        size_t first_end = std::min(hence + num, cargo.size());
+        size_t second_end = num - (first_end - hence);
 
-        SIMDVector4 home;
+        hits.resize(num + RANGE_SPACE_KERNEL_SLACK);
         float factor2 = factor*factor;
-        home.updateAll(x,y,z,0);
-        for (SIMDVector4s::size_type i=0 ; i<num ; ++i) {
-            SIMDVector4 &pos = positions[iter];
-            if (isNear(home,pos,factor2)) {
-                found.push_back(cargo[iter]);
-            }
-            iter++;
-            if (iter == end) iter=0;
+        size_t n = range_space_kernel(&xs[0], &ys[0], &zs[0], &ds[0], hence, first_end,
+                                      x, y, z, factor2, &hits[0]);
+        n += range_space_kernel(&xs[0], &ys[0], &zs[0], &ds[0], 0, second_end,
+                                x, y, z, factor2, &hits[n]);
+
+        found.reserve(found.size() + n);
+        for (size_t i=0 ; i<n ; ++i) {
+            found.push_back(cargo[hits[i]]);
         }
 
-        hence = iter;
+        hence = second_end > 0 ? second_end : first_end;
     }
 
     void remove (const T &o)
@@ -233,9 +118,16 @@ class CacheFriendlyRangeSpace {
         // otherwise, carefully remove it -
         size_t index = iter - begin;
 
-        positions[index] = positions[positions.size()-1];
-        positions.pop_back();
-        cargo[index] = cargo[cargo.size()-1];
+        size_t last = cargo.size() - 1;
+        xs[index] = xs[last];
+        ys[index] = ys[last];
+        zs[index] = zs[last];
+        ds[index] = ds[last];
+        xs.pop_back();
+        ys.pop_back();
+        zs.pop_back();
+        ds.pop_back();
+        cargo[index] = cargo[last];
         cargo[index]->updateIndex(index);
         cargo.pop_back();
         o->updateIndex(-1);
@@ -244,7 +136,10 @@ class CacheFriendlyRangeSpace {
     void clear (void)
     {
         cargo.clear();
-        positions.clear();
+        xs.clear();
+        ys.clear();
+        zs.clear();
+        ds.clear();
         hence = 0;
     }
 
@@ -254,8 +149,11 @@ class CacheFriendlyRangeSpace {
     protected:
 
     size_t hence;
-    SIMDVector4s positions;
+    // Sphere centres and radiuses, in structure of arrays form for range_space_kernel.
+    std::vector<float> xs, ys, zs, ds;
     Cargo cargo;
+    // Scratch space for the indexes found by range_space_kernel.
+    std::vector<unsigned> hits;
 };
 
 #endif
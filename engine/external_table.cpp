@@ -19,32 +19,89 @@
  * THE SOFTWARE.
  */
 
+#include <deque>
+#include <unordered_map>
+
 #include "external_table.h"
 #include "grit_lua_util.h"
 #include "lua_wrappers_primitives.h"
 
+namespace {
+    // Interned strings live in a deque so references to them stay valid as it grows.  Both are
+    // function statics so keys can be interned during static initialisation of other files.
+    std::deque<std::string> &key_strings (void)
+    {
+        static std::deque<std::string> strings;
+        return strings;
+    }
+
+    std::unordered_map<std::string, uint32_t> &key_ids (void)
+    {
+        static std::unordered_map<std::string, uint32_t> ids;
+        return ids;
+    }
+}
+
+ExternalTableKey::ExternalTableKey (const std::string &str)
+{
+    auto &ids = key_ids();
+    auto it = ids.find(str);
+    if (it != ids.end()) {
+        id = it->second;
+        return;
+    }
+    id = key_strings().size();
+    key_strings().push_back(str);
+    ids[str] = id;
+}
+
+ExternalTableKey ExternalTableKey::find (const std::string &str)
+{
+    auto &ids = key_ids();
+    auto it = ids.find(str);
+    return ExternalTableKey(it == ids.end() ? NONE : it->second);
+}
+
+const std::string &ExternalTableKey::str (void) const
+{
+    static const std::string none;
+    if (id == NONE) return none;
+    return key_strings()[id];
+}
+
+void ExternalTable::Value::release (lua_State *L)
+{
+    if (type == FUNCTION) {
+        luaL_unref(L, LUA_REGISTRYINDEX, func);
+        type = NONE;
+    } else if (type == TABLE) {
+        if (t.useCount() == 1) t->destroy(L);
+    }
+    reset();
+}
+
 void ExternalTable::destroy (lua_State *L)
 {
     clear(L);
 }
 
+void ExternalTable::moveFrom (lua_State *L, ExternalTable &other)
+{
+    if (&other == this) return;
+    clear(L);
+    fields = std::move(other.fields);
+    elements = std::move(other.elements);
+    other.fields.clear();
+    other.elements.clear();
+}
+
 void ExternalTable::clear (lua_State *L)
 {
     for (StringMap::iterator i=fields.begin(), i_=fields.end() ; i != i_ ; ++i) {
-        Value &v = i->second;
-        if (v.type == 8) {
-            v.func.setNil(L);
-        } else if (v.type == 5) {
-            v.t->destroy(L);
-        }
+        i->second.release(L);
     }
     for (NumberMap::iterator i=elements.begin(), i_=elements.end() ; i != i_ ; ++i) {
-        Value &v = i->second;
-        if (v.type == 8) {
-            v.func.setNil(L);
-        } else if (v.type == 5) {
-            v.t->destroy(L);
-        }
+        i->second.release(L);
     }
     fields.clear();
     elements.clear();
@@ -64,62 +121,62 @@ const char *ExternalTable::luaGet (lua_State *L) const
 static void push (lua_State *L, const ExternalTable::Value &v)
 {
     switch (v.type) {
-        case 0:
+        case ExternalTable::REAL:
         lua_pushnumber(L, v.real);
         break;
-        case 1:
-        lua_pushstring(L, v.str.c_str());
+        case ExternalTable::STRING:
+        lua_pushstring(L, v.str->c_str());
         break;
-        case 2:
-        push_v3(L, v.v3);
+        case ExternalTable::VECTOR3:
+        push_v3(L, Vector3(v.v[0], v.v[1], v.v[2]));
         break;
-        case 3:
-        push_quat(L, v.q);
+        case ExternalTable::QUATERNION:
+        push_quat(L, Quaternion(v.v[0], v.v[1], v.v[2], v.v[3]));
         break;
-        case 4:
+        case ExternalTable::BOOLEAN:
         lua_pushboolean(L, v.b);
         break;
-        case 5:
+        case ExternalTable::TABLE:
         v.t->dump(L);
         break;
-        case 6:
-        push(L, new Plot(v.plot), PLOT_TAG);
+        case ExternalTable::PLOT:
+        push(L, new Plot(*v.plot), PLOT_TAG);
         break;
-        case 7:
-        push(L, new PlotV3(v.plot_v3), PLOT_V3_TAG);
+        case ExternalTable::PLOT_V3:
+        push(L, new PlotV3(*v.plotV3), PLOT_V3_TAG);
         break;
-        case 8:
-        v.func.push(L);
+        case ExternalTable::FUNCTION:
+        lua_rawgeti(L, LUA_REGISTRYINDEX, v.func);
         break;
-        case 9:
-        push_v2(L, v.v2);
+        case ExternalTable::VECTOR2:
+        push_v2(L, Vector2(v.v[0], v.v[1]));
         break;
-        case 10:
-        push_v4(L, v.v4);
+        case ExternalTable::VECTOR4:
+        push_v4(L, Vector4(v.v[0], v.v[1], v.v[2], v.v[3]));
         break;
         default:
         CERR << "Unhandled ExternalTable type: " << v.type << std::endl;
     }
 }
 
-const char *ExternalTable::luaGet (lua_State *L, const std::string &key) const
+const char *ExternalTable::luaGet (lua_State *L, const Key &key) const
 {
-    auto it = fields.find(key);
-    if (it == fields.end()) {
+    const Value *v = fields.find(key);
+    if (v == nullptr) {
         lua_pushnil(L);
     } else {
-        push(L, it->second);
+        push(L, *v);
     }
     return NULL;
 }
 
 const char *ExternalTable::luaGet (lua_State *L, lua_Number key) const
 {
-    auto it = elements.find(key);
-    if (it == elements.end()) {
+    const Value *v = elements.find(key);
+    if (v == nullptr) {
         lua_pushnil(L);
     } else {
-        push(L, it->second);
+        push(L, *v);
     }
     return NULL;
 }
@@ -136,93 +193,82 @@ const char *ExternalTable::luaSet (lua_State *L)
     return "key was not a string or number";
 }
 
-const char *ExternalTable::luaSet (lua_State *L, const std::string &key)
+// Set v from the value at the top of the Lua stack.  A nil leaves v as NONE.
+static const char *lua_set_value (lua_State *L, ExternalTable::Value &v)
 {
+    v.release(L);
     if (lua_type(L, -1) == LUA_TNIL) {
-        unset(key);
+        // Leave it unset.
     } else if (lua_type(L, -1) == LUA_TSTRING) {
-        std::string val = lua_tostring(L, -1);
-        set(key, val);
+        size_t len;
+        const char *val = lua_tolstring(L, -1, &len);
+        v.set(std::string(val, len));
     } else if (lua_type(L, -1) == LUA_TNUMBER) {
         lua_Number val = luaL_checknumber(L, -1);
-        set(key, val);
+        v.set(val);
     } else if (lua_type(L, -1) == LUA_TBOOLEAN) {
         bool val = check_bool(L, -1);
-        set(key, val);
+        v.set(val);
     } else if (lua_type(L, -1) == LUA_TVECTOR3) {
         Vector3 val = check_v3(L, -1);
-        set(key, val);
+        v.set(val);
     } else if (lua_type(L, -1) == LUA_TQUAT) {
         Quaternion val = check_quat(L, -1);
-        set(key, val);
+        v.set(val);
     } else if (is_userdata(L, -1, PLOT_TAG)) {
         GET_UD_MACRO(Plot, self, -1, PLOT_TAG);
-        set(key, self);
+        v.set(self);
     } else if (is_userdata(L, -1, PLOT_V3_TAG)) {
         GET_UD_MACRO(PlotV3, self, -1, PLOT_V3_TAG);
-        set(key, self);
+        v.set(self);
     } else if (lua_type(L, -1) == LUA_TTABLE) {
         SharedPtr<ExternalTable> self = SharedPtr<ExternalTable>(new ExternalTable());
         self->takeTableFromLuaStack(L, lua_gettop(L));
-        set(key, self);
+        v.set(self);
     } else if (lua_type(L, -1) == LUA_TFUNCTION) {
-        Value &v = fields[key];
-        v.func.setNoPop(L);
-        v.type = 8;
+        lua_pushvalue(L, -1);
+        v.setFunc(luaL_ref(L, LUA_REGISTRYINDEX));
     } else if (lua_type(L, -1) == LUA_TVECTOR2) {
         Vector2 val = check_v2(L, -1);
-        set(key, val);
+        v.set(val);
     } else if (lua_type(L, -1) == LUA_TVECTOR4) {
         Vector4 val = check_v4(L, -1);
-        set(key, val);
+        v.set(val);
     } else {
         return "type not supported";
     }
     return NULL;
 }
 
+const char *ExternalTable::luaSet (lua_State *L, const Key &key)
+{
+    if (lua_type(L, -1) == LUA_TNIL) {
+        Value old = fields.take(key);
+        old.release(L);
+        return NULL;
+    }
+    Value v;
+    const char *err = lua_set_value(L, v);
+    if (err) return err;
+    Value &slot = fields[key];
+    slot.release(L);
+    slot = std::move(v);
+    return NULL;
+}
+
 const char *ExternalTable::luaSet (lua_State *L, lua_Number key)
 {
     if (lua_type(L, -1) == LUA_TNIL) {
-        unset(key);
-    } else if (lua_type(L, -1) == LUA_TSTRING) {
-        std::string val = lua_tostring(L, -1);
-        set(key, val);
-    } else if (lua_type(L, -1) == LUA_TNUMBER) {
-        lua_Number val = luaL_checknumber(L, -1);
-        set(key, val);
-    } else if (lua_type(L, -1) == LUA_TBOOLEAN) {
-        bool val = check_bool(L, -1);
-        set(key, val);
-    } else if (lua_type(L, -1) == LUA_TVECTOR3) {
-        Vector3 val = check_v3(L, -1);
-        set(key, val);
-    } else if (lua_type(L, -1) == LUA_TQUAT) {
-        Quaternion val = check_quat(L, -1);
-        set(key, val);
-    } else if (is_userdata(L, -1, PLOT_TAG)) {
-        GET_UD_MACRO(Plot, self, -1, PLOT_TAG);
-        set(key, self);
-    } else if (is_userdata(L, -1, PLOT_V3_TAG)) {
-        GET_UD_MACRO(PlotV3, self, -1, PLOT_V3_TAG);
-        set(key, self);
-    } else if (lua_type(L, -1) == LUA_TTABLE) {
-        SharedPtr<ExternalTable> self = SharedPtr<ExternalTable>(new ExternalTable());
-        self->takeTableFromLuaStack(L, -1);
-        set(key, self);
-    } else if (lua_type(L, -1) == LUA_TFUNCTION) {
-        Value &v = elements[key];
-        v.func.setNoPop(L);
-        v.type = 8;
-    } else if (lua_type(L, -1) == LUA_TVECTOR2) {
-        Vector2 val = check_v2(L, -1);
-        set(key, val);
-    } else if (lua_type(L, -1) == LUA_TVECTOR4) {
-        Vector4 val = check_v4(L, -1);
-        set(key, val);
-    } else {
-        return "type not supported";
+        Value old = elements.take(key);
+        old.release(L);
+        return NULL;
     }
+    Value v;
+    const char *err = lua_set_value(L, v);
+    if (err) return err;
+    Value &slot = elements[key];
+    slot.release(L);
+    slot = std::move(v);
     return NULL;
 }
 
@@ -230,7 +276,7 @@ void ExternalTable::dump (lua_State *L) const
 {
     lua_createtable(L, elements.size(), fields.size());
     for (StringMap::const_iterator i=fields.begin(), i_=fields.end() ; i != i_ ; ++i) {
-        const std::string &key = i->first;
+        const std::string &key = i->first.str();
         const Value &v = i->second;
         lua_pushstring(L, key.c_str());
         push(L, v);
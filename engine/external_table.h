@@ -25,14 +25,18 @@ class ExternalTable;
 #ifndef ExternalTable_h
 #define ExternalTable_h
 
-#include <map>
+#include <algorithm>
+#include <cstdint>
 #include <string>
+#include <utility>
+#include <vector>
 
 extern "C" {
     #include <lua.h>
     #include <lauxlib.h>
 }
 
+#include <centralised_log.h>
 #include <math_util.h>
 #include <spline_table.h>
 #include <stringf.h>
@@ -41,390 +45,408 @@ extern "C" {
 #include "shared_ptr.h"
 
 
-// Purpose of this class is to store lua data outside of lua so as to avoid
-// putting stress on the garbage collector.  Only certain kinds of primitive data
-// are supported.
-
-class ExternalTable {
-
-    public:
-
-    ExternalTable (void) { }
-
-    void destroy (lua_State *L);
-
-    bool has (const std::string &key) const { return fields.find(key) != fields.end(); }
-    bool has (lua_Number key) const { return elements.find(key) != elements.end(); }
-
-    template<class U> void get (const std::string &key, U &val, const U &def) const
-    {
-        if (!get(key, val)) val = def;
-        
-    }
+/** An interned string key.
+ *
+ * The string is hashed once, when the key is made, after which keys compare as integers.  Interned
+ * strings are never freed, which is fine as they are the field names used by classes and objects,
+ * a small and stable set.  Like the Lua state that the tables serve, the intern table is only
+ * used from the main thread, so it is not locked.  Finding a key still hashes the string, so
+ * code that looks up the same name repeatedly should make its key once and keep it.
+ */
+class ExternalTableKey {
 
-    template<class U> void get (lua_Number key, U &val, const U &def) const
-    {
-        if (!get(key, val)) val = def;
-        
-    }
+    uint32_t id;
 
-    template<class U, typename ...Args>
-    void getOrExcf (const std::string &key, U &val, const std::string &msgf, Args... args) const
-    {
-        if (!get(key, val)) EXCEPTF(msgf, args...);
-    }
+    explicit ExternalTableKey (uint32_t id) : id(id) { }
 
-    template<class U, typename ...Args>
-    void getOrExcf (lua_Number key, U &val, const std::string &msgf, Args... args) const
-    {
-        if (!get(key, val)) EXCEPTF(msgf, args...);
-    }
+    public:
 
-    bool get (const std::string &key, lua_Number &v) const
-    {
-        auto it = fields.find(key);
-        if (it == fields.end()) return false;
-        if (it->second.type != 0) return false;
-        v = it->second.real;
-        return true;
-    }
+    static const uint32_t NONE = 0xFFFFFFFF;
 
-    bool get (const std::string &key, std::string &v) const
-    {
-        auto it = fields.find(key);
-        if (it == fields.end()) return false;
-        if (it->second.type != 1) return false;
-        v = it->second.str;
-        return true;
-    }
+    /** Intern the given string (if necessary) and return its key. */
+    explicit ExternalTableKey (const std::string &str);
 
-    bool get (const std::string &key, Vector3 &v) const
-    {
-        auto it = fields.find(key);
-        if (it == fields.end()) return false;
-        if (it->second.type != 2) return false;
-        v = it->second.v3 ;
-        return true;
-    }
+    /** Return the key of a string without interning it.
+     *
+     * If the string has never been interned, no table can have it as a key, so the returned key
+     * is one that is not in any table (isNone() is true).
+     */
+    static ExternalTableKey find (const std::string &str);
 
-    bool get (const std::string &key, Quaternion &v) const
-    {
-        auto it = fields.find(key);
-        if (it == fields.end()) return false;
-        if (it->second.type != 3) return false;
-        v = it->second.q;
-        return true;
-    }
-
-    bool get (const std::string &key, bool &v) const
-    {
-        auto it = fields.find(key);
-        if (it == fields.end()) return false;
-        if (it->second.type != 4) return false;
-        v = it->second.b;
-        return true;
-    }
+    bool isNone (void) const { return id == NONE; }
 
-    bool get (const std::string &key, SharedPtr<ExternalTable> &v) const
-    {
-        auto it = fields.find(key);
-        if (it == fields.end()) return false;
-        if (it->second.type != 5) return false;
-        v = it->second.t;
-        return true;
-    }
+    const std::string &str (void) const;
 
-    bool get (const std::string &key, Plot &v) const
-    {
-        auto it = fields.find(key);
-        if (it == fields.end()) return false;
-        if (it->second.type != 6) return false;
-        v = it->second.plot;
-        return true;
-    }
+    operator const std::string & (void) const { return str(); }
 
-    bool get (const std::string &key, PlotV3 &v) const
-    {
-        auto it = fields.find(key);
-        if (it == fields.end()) return false;
-        if (it->second.type != 7) return false;
-        v = it->second.plot_v3;
-        return true;
-    }
-
-    bool get (const std::string &key, Vector2 &v) const
-    {
-        auto it = fields.find(key);
-        if (it == fields.end()) return false;
-        if (it->second.type != 9) return false;
-        v = it->second.v2;
-        return true;
-    }
+    bool operator== (const ExternalTableKey &other) const { return id == other.id; }
+    bool operator< (const ExternalTableKey &other) const { return id < other.id; }
+};
 
-    bool get (const std::string &key, Vector4 &v) const
-    {
-        auto it = fields.find(key);
-        if (it == fields.end()) return false;
-        if (it->second.type != 10) return false;
-        v = it->second.v4;
-        return true;
-    }
 
-    bool get (lua_Number key, lua_Number &v) const
-    {
-        auto it = elements.find(key);
-        if (it == elements.end()) return false;
-        if (it->second.type != 0) return false;
-        v = it->second.real;
-        return true;
-    }
+// Purpose of this class is to store lua data outside of lua so as to avoid
+// putting stress on the garbage collector.  Only certain kinds of primitive data
+// are supported.
+//
+// Values are a tagged union of 24 bytes, kept in flat vectors sorted by key.  String keys are
+// interned so lookups are a binary search over integers.
 
-    bool get (lua_Number key, std::string &v) const
-    {
-        auto it = elements.find(key);
-        if (it == elements.end()) return false;
-        if (it->second.type != 1) return false;
-        v = it->second.str;
-        return true;
-    }
+class ExternalTable {
 
-    bool get (lua_Number key, Vector3 &v) const
-    {
-        auto it = elements.find(key);
-        if (it == elements.end()) return false;
-        if (it->second.type != 2) return false;
-        v = it->second.v3 ;
-        return true;
-    }
+    public:
 
-    bool get (lua_Number key, Quaternion &v) const
-    {
-        auto it = elements.find(key);
-        if (it == elements.end()) return false;
-        if (it->second.type != 3) return false;
-        v = it->second.q;
-        return true;
-    }
+    typedef ExternalTableKey Key;
+
+    enum ValueType {
+        REAL = 0,
+        STRING = 1,
+        VECTOR3 = 2,
+        QUATERNION = 3,
+        BOOLEAN = 4,
+        TABLE = 5,
+        PLOT = 6,
+        PLOT_V3 = 7,
+        FUNCTION = 8,
+        VECTOR2 = 9,
+        VECTOR4 = 10,
+        NONE = 11
+    };
 
-    bool get (lua_Number key, bool &v) const
-    {
-        auto it = elements.find(key);
-        if (it == elements.end()) return false;
-        if (it->second.type != 4) return false;
-        v = it->second.b;
-        return true;
-    }
+    class Value {
+
+        void construct (Value &&other)
+        {
+            type = other.type;
+            switch (type) {
+                case TABLE: new (&t) SharedPtr<ExternalTable>(other.t); break;
+                case VECTOR2: case VECTOR3: case QUATERNION: case VECTOR4:
+                for (unsigned i = 0 ; i < 4 ; ++i) v[i] = other.v[i];
+                break;
+                case REAL: real = other.real; break;
+                case BOOLEAN: b = other.b; break;
+                case STRING: str = other.str; break;
+                case PLOT: plot = other.plot; break;
+                case PLOT_V3: plotV3 = other.plotV3; break;
+                case FUNCTION: func = other.func; break;
+                case NONE: break;
+            }
+            // Ownership of any heap data has been taken, so just forget it.
+            if (other.type == TABLE) other.t.~SharedPtr<ExternalTable>();
+            other.type = NONE;
+        }
 
-    bool get (lua_Number key, SharedPtr<ExternalTable> &v) const
-    {
-        auto it = elements.find(key);
-        if (it == elements.end()) return false;
-        if (it->second.type != 5) return false;
-        v = it->second.t;
-        return true;
-    }
+        public:
 
-    bool get (lua_Number key, Plot &v) const
-    {
-        auto it = elements.find(key);
-        if (it == elements.end()) return false;
-        if (it->second.type != 6) return false;
-        v = it->second.plot;
-        return true;
-    }
+        ValueType type;
+        union {
+            lua_Number real;
+            // Vector2, Vector3, Quaternion (w, x, y, z) and Vector4.
+            float v[4];
+            bool b;
+            std::string *str;
+            Plot *plot;
+            PlotV3 *plotV3;
+            // Registry reference, must be released with a lua_State.
+            int func;
+            SharedPtr<ExternalTable> t;
+        };
+
+        Value (void) : type(NONE), real(0) { }
+
+        Value (Value &&other) noexcept { construct(std::move(other)); }
+
+        Value &operator= (Value &&other) noexcept
+        {
+            if (this != &other) {
+                reset();
+                construct(std::move(other));
+            }
+            return *this;
+        }
+
+        Value (const Value &) = delete;
+        Value &operator= (const Value &) = delete;
+
+        ~Value (void) { reset(); }
+
+        /** Free any heap data.  A function reference cannot be released without a lua_State,
+         * so it leaks (like a LuaPtr that was not set to nil).  Use release(L) instead. */
+        void reset (void)
+        {
+            switch (type) {
+                case STRING: delete str; break;
+                case PLOT: delete plot; break;
+                case PLOT_V3: delete plotV3; break;
+                case TABLE: t.~SharedPtr<ExternalTable>(); break;
+                case FUNCTION:
+                CERR << "ExternalTable function was not released properly (call release(L))."
+                     << std::endl;
+                break;
+                default: break;
+            }
+            type = NONE;
+        }
+
+        /** Release the Lua reference of a function, then reset.  A nested table is destroyed
+         * only if this value holds the last reference to it, as tables got from one
+         * ExternalTable can be set in another. */
+        void release (lua_State *L);
+
+        void set (lua_Number r) { reset(); type = REAL; real = r; }
+        void set (const std::string &s) { reset(); type = STRING; str = new std::string(s); }
+        void set (bool b_) { reset(); type = BOOLEAN; b = b_; }
+        void set (const Plot &p) { reset(); type = PLOT; plot = new Plot(p); }
+        void set (const PlotV3 &p) { reset(); type = PLOT_V3; plotV3 = new PlotV3(p); }
+        void setFunc (int ref) { reset(); type = FUNCTION; func = ref; }
+
+        void set (const SharedPtr<ExternalTable> &t_)
+        {
+            reset();
+            type = TABLE;
+            new (&t) SharedPtr<ExternalTable>(t_);
+        }
+
+        void set (const Vector2 &v2)
+        {
+            reset();
+            type = VECTOR2;
+            v[0] = v2.x; v[1] = v2.y; v[2] = 0; v[3] = 0;
+        }
+
+        void set (const Vector3 &v3)
+        {
+            reset();
+            type = VECTOR3;
+            v[0] = v3.x; v[1] = v3.y; v[2] = v3.z; v[3] = 0;
+        }
+
+        void set (const Quaternion &q)
+        {
+            reset();
+            type = QUATERNION;
+            v[0] = q.w; v[1] = q.x; v[2] = q.y; v[3] = q.z;
+        }
+
+        void set (const Vector4 &v4)
+        {
+            reset();
+            type = VECTOR4;
+            v[0] = v4.x; v[1] = v4.y; v[2] = v4.z; v[3] = v4.w;
+        }
+
+        bool get (lua_Number &r) const { if (type != REAL) return false; r = real; return true; }
+        bool get (std::string &s) const { if (type != STRING) return false; s = *str; return true; }
+        bool get (bool &b_) const { if (type != BOOLEAN) return false; b_ = b; return true; }
+        bool get (Plot &p) const { if (type != PLOT) return false; p = *plot; return true; }
+        bool get (PlotV3 &p) const { if (type != PLOT_V3) return false; p = *plotV3; return true; }
+
+        bool get (SharedPtr<ExternalTable> &t_) const
+        {
+            if (type != TABLE) return false;
+            t_ = t;
+            return true;
+        }
+
+        bool get (Vector2 &v2) const
+        {
+            if (type != VECTOR2) return false;
+            v2 = Vector2(v[0], v[1]);
+            return true;
+        }
+
+        bool get (Vector3 &v3) const
+        {
+            if (type != VECTOR3) return false;
+            v3 = Vector3(v[0], v[1], v[2]);
+            return true;
+        }
+
+        bool get (Quaternion &q) const
+        {
+            if (type != QUATERNION) return false;
+            q = Quaternion(v[0], v[1], v[2], v[3]);
+            return true;
+        }
+
+        bool get (Vector4 &v4) const
+        {
+            if (type != VECTOR4) return false;
+            v4 = Vector4(v[0], v[1], v[2], v[3]);
+            return true;
+        }
+    };
 
-    bool get (lua_Number key, PlotV3 &v) const
-    {
-        auto it = elements.find(key);
-        if (it == elements.end()) return false;
-        if (it->second.type != 7) return false;
-        v = it->second.plot_v3;
-        return true;
-    }
+    /** A vector of (key, value) kept sorted by key. */
+    template<class K> class FlatMap {
 
-    bool get (lua_Number key, Vector2 &v) const
-    {
-        auto it = elements.find(key);
-        if (it == elements.end()) return false;
-        if (it->second.type != 9) return false;
-        v = it->second.v2;
-        return true;
-    }
+        public:
 
-    bool get (lua_Number key, Vector4 &v) const
-    {
-        auto it = elements.find(key);
-        if (it == elements.end()) return false;
-        if (it->second.type != 10) return false;
-        v = it->second.v4;
-        return true;
-    }
+        typedef std::pair<K, Value> Entry;
+        typedef typename std::vector<Entry>::iterator iterator;
+        typedef typename std::vector<Entry>::const_iterator const_iterator;
 
+        protected:
 
-    void set (const std::string &key, const lua_Number r)
-    {
-        fields[key].type = 0;
-        fields[key].real = r;
-    }
+        std::vector<Entry> entries;
 
-    void set (const std::string &key, const std::string &s)
-    {
-        fields[key].type = 1;
-        fields[key].str = s;
-    }
+        static bool entryLess (const Entry &a, const K &b) { return a.first < b; }
 
-    void set (const std::string &key, const Vector3 &v3)
-    {
-        fields[key].type = 2;
-        fields[key].v3 = v3;
-    }
+        public:
 
-    void set (const std::string &key, const Quaternion &q)
-    {
-        fields[key].type = 3;
-        fields[key].q = q;
-    }
+        iterator begin (void) { return entries.begin(); }
+        iterator end (void) { return entries.end(); }
+        const_iterator begin (void) const { return entries.begin(); }
+        const_iterator end (void) const { return entries.end(); }
+        size_t size (void) const { return entries.size(); }
+
+        const Value *find (const K &k) const
+        {
+            const_iterator it = std::lower_bound(entries.begin(), entries.end(), k, entryLess);
+            if (it == entries.end() || !(it->first == k)) return nullptr;
+            return &it->second;
+        }
+
+        Value *find (const K &k)
+        {
+            iterator it = std::lower_bound(entries.begin(), entries.end(), k, entryLess);
+            if (it == entries.end() || !(it->first == k)) return nullptr;
+            return &it->second;
+        }
+
+        /** Find or insert an empty value. */
+        Value &operator[] (const K &k)
+        {
+            iterator it = std::lower_bound(entries.begin(), entries.end(), k, entryLess);
+            if (it == entries.end() || !(it->first == k))
+                it = entries.insert(it, Entry(k, Value()));
+            return it->second;
+        }
+
+        /** Remove the key, returning its value (NONE if it was not there). */
+        Value take (const K &k)
+        {
+            Value r;
+            iterator it = std::lower_bound(entries.begin(), entries.end(), k, entryLess);
+            if (it == entries.end() || !(it->first == k)) return r;
+            r = std::move(it->second);
+            entries.erase(it);
+            return r;
+        }
+
+        void clear (void) { entries.clear(); }
+    };
 
-    void set (const std::string &key, bool b)
-    {
-        fields[key].type = 4;
-        fields[key].b = b;
-    }
+    ExternalTable (void) { }
 
-    void set (const std::string &key, const SharedPtr<ExternalTable> &t)
-    {
-        fields[key].type = 5;
-        fields[key].t = t;
-    }
+    void destroy (lua_State *L);
 
-    void set (const std::string &key, Plot plot)
-    {
-        fields[key].type = 6;
-        fields[key].plot = plot;
-    }
+    /** Release the current contents, then take those of other, leaving it empty. */
+    void moveFrom (lua_State *L, ExternalTable &other);
 
-    void set (const std::string &key, PlotV3 plot_v3)
-    {
-        fields[key].type = 7;
-        fields[key].plot_v3 = plot_v3;
-    }
+    bool has (const Key &key) const { return fields.find(key) != nullptr; }
+    bool has (const std::string &key) const { return has(Key::find(key)); }
+    bool has (lua_Number key) const { return elements.find(key) != nullptr; }
 
-    void set (const std::string &key, const Vector2 &v2)
+    template<class U> void get (const std::string &key, U &val, const U &def) const
     {
-        fields[key].type = 9;
-        fields[key].v2 = v2;
+        if (!get(key, val)) val = def;
+        
     }
 
-    void set (const std::string &key, const Vector4 &v4)
+    template<class U> void get (lua_Number key, U &val, const U &def) const
     {
-        fields[key].type = 10;
-        fields[key].v4 = v4;
+        if (!get(key, val)) val = def;
+        
     }
 
-    void set (lua_Number key, const lua_Number r)
+    template<class U, typename ...Args>
+    void getOrExcf (const Key &key, U &val, const std::string &msgf, Args... args) const
     {
-        elements[key].type = 0;
-        elements[key].real = r;
+        if (!get(key, val)) EXCEPTF(msgf, args...);
     }
 
-    void set (lua_Number key, const std::string &s)
+    template<class U, typename ...Args>
+    void getOrExcf (const std::string &key, U &val, const std::string &msgf, Args... args) const
     {
-        elements[key].type = 1;
-        elements[key].str = s;
+        if (!get(key, val)) EXCEPTF(msgf, args...);
     }
 
-    void set (lua_Number key, const Vector3 &v3)
+    template<class U, typename ...Args>
+    void getOrExcf (lua_Number key, U &val, const std::string &msgf, Args... args) const
     {
-        elements[key].type = 2;
-        elements[key].v3 = v3;
+        if (!get(key, val)) EXCEPTF(msgf, args...);
     }
 
-    void set (lua_Number &key, const Quaternion &q)
+    template<class U> bool get (const Key &key, U &v) const
     {
-        elements[key].type = 3;
-        elements[key].q = q;
+        const Value *val = fields.find(key);
+        return val != nullptr && val->get(v);
     }
 
-    void set (lua_Number &key, bool b)
+    template<class U> bool get (const std::string &key, U &v) const
     {
-        elements[key].type = 4;
-        elements[key].b = b;
+        return get(Key::find(key), v);
     }
 
-    void set (lua_Number &key, const SharedPtr<ExternalTable> &t)
+    template<class U> bool get (lua_Number key, U &v) const
     {
-        elements[key].type = 5;
-        elements[key].t = t;
+        const Value *val = elements.find(key);
+        return val != nullptr && val->get(v);
     }
 
-    void set (lua_Number &key, const Plot &plot)
-    {
-        elements[key].type = 6;
-        elements[key].plot = plot;
-    }
+    // The pointer types are taken by value, so they are not ambiguous with the number keys.
+    template<class U> void set (const Key &key, const U &v) { fields[key].set(v); }
+    template<class U> void set (const std::string &key, const U &v) { set(Key(key), v); }
+    template<class U> void set (lua_Number key, const U &v) { elements[key].set(v); }
 
-    void set (lua_Number &key, const PlotV3 &plot_v3)
-    {
-        elements[key].type = 7;
-        elements[key].plot_v3 = plot_v3;
-    }
+    void set (const Key &key, const char *v) { set(key, std::string(v)); }
+    void set (const std::string &key, const char *v) { set(Key(key), std::string(v)); }
+    void set (lua_Number key, const char *v) { set(key, std::string(v)); }
 
-    void set (lua_Number &key, const Vector2 &v2)
+    // As above, but release the old value properly if it may be a function.
+    template<class U> void set (lua_State *L, const Key &key, const U &v)
     {
-        elements[key].type = 9;
-        elements[key].v2 = v2;
+        Value &slot = fields[key];
+        slot.release(L);
+        slot.set(v);
     }
-
-    void set (lua_Number &key, const Vector4 &v4)
+    template<class U> void set (lua_State *L, const std::string &key, const U &v)
+    { set(L, Key(key), v); }
+    template<class U> void set (lua_State *L, lua_Number key, const U &v)
     {
-        elements[key].type = 10;
-        elements[key].v4 = v4;
+        Value &slot = elements[key];
+        slot.release(L);
+        slot.set(v);
     }
 
     const char *luaGet (lua_State *L) const;
     const char *luaSet (lua_State *L);
 
-    const char *luaGet (lua_State *L, const std::string &key) const;
-    const char *luaSet (lua_State *L, const std::string &key);
+    const char *luaGet (lua_State *L, const Key &key) const;
+    const char *luaSet (lua_State *L, const Key &key);
+
+    const char *luaGet (lua_State *L, const std::string &key) const
+    { return luaGet(L, Key::find(key)); }
+    const char *luaSet (lua_State *L, const std::string &key)
+    { return luaSet(L, Key(key)); }
 
     const char *luaGet (lua_State *L, lua_Number key) const;
     const char *luaSet (lua_State *L, lua_Number key);
 
-    void unset (const std::string &key) { fields.erase(key); }
-    void unset (lua_Number key) { elements.erase(key); }
+    void unset (const Key &key) { fields.take(key); }
+    void unset (const std::string &key) { unset(Key::find(key)); }
+    void unset (lua_Number key) { elements.take(key); }
+
+    void unset (lua_State *L, const Key &key) { fields.take(key).release(L); }
+    void unset (lua_State *L, const std::string &key) { unset(L, Key::find(key)); }
+    void unset (lua_State *L, lua_Number key) { elements.take(key).release(L); }
 
     void clear (lua_State *L);
 
     void dump (lua_State *L) const;
     void takeTableFromLuaStack (lua_State *L, int tab);
 
-    template<typename T> class UniquePtr {
-        T *ptr;
-        public:
-        UniquePtr () : ptr(NULL) { }
-        ~UniquePtr (void) { delete ptr; }
-        T *operator-> (void) const { return ptr; }
-        T &operator* (void) const { return *ptr; }
-        T *operator= (T *ptr_) { delete ptr; return ptr=ptr_; }
-    };
-
-    struct Value {
-        int type;
-        std::string str;
-        lua_Number real;
-        Vector3 v3;
-        Quaternion q;
-        bool b;
-        SharedPtr<ExternalTable> t;
-        Plot plot;
-        PlotV3 plot_v3;
-        // TODO(dcunnin): This is not destroyed properly, as setNil() is not called.
-        LuaPtr func;
-        Vector2 v2;
-        Vector4 v4;
-    };
-
-    typedef std::map<std::string, Value> StringMap;
+    typedef FlatMap<Key> StringMap;
 
     typedef StringMap::iterator KeyIterator;
     KeyIterator begin (void) { return fields.begin(); }
@@ -434,7 +456,7 @@ class ExternalTable {
     ConstKeyIterator begin (void) const { return fields.begin(); }
     ConstKeyIterator end (void) const { return fields.end(); }
 
-    typedef std::map<lua_Number, Value> NumberMap;
+    typedef FlatMap<lua_Number> NumberMap;
 
     protected:
 
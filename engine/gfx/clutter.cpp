@@ -509,20 +509,6 @@ void MovableClutterFactory::destroyInstance (Ogre::MovableObject* obj)
 
 typedef ClutterBuffer::SectionMap::const_iterator I;
 
-float RangedClutter::Item::calcFade (float range2)
-{
-    const float out = streamer_fade_out_factor;
-    float range = ::sqrtf(range2);
-                    
-    float fade = 1.0;       
-
-    if (range > out) {
-            fade = (1-range) / (1-out);
-    }           
-
-    return fade;
-}
-
 void RangedClutter::visitRenderables (Ogre::Renderable::Visitor *visitor, bool debug)
 {
     (void) debug;
@@ -561,75 +547,41 @@ void RangedClutter::_updateRenderQueue (Ogre::RenderQueue *queue)
     }
 }
 
-void RangedClutter::update (const Vector3 &new_pos)
-{
-    const float vis2 = mVisibility * mVisibility;
-    typedef Cargo::iterator I;
-
-    // iterate through all activated guys to see who is too far to stay activated
-    Cargo victims = activated;
-    for (I i=victims.begin(), i_=victims.end() ; i!=i_ ; ++i) {
-        Item *o = *i;
-         //note we use vis2 not visibility
-        float range2 = o->range2(new_pos) / vis2;
-
-        if (range2 > 1) {
-            // now out of range
-            mClutter.releaseGeometry(o->ticket);
-            o->activated = false;
-            Item *filler = activated[activated.size()-1];
-            activated[o->activatedIndex] = filler;
-            filler->activatedIndex = o->activatedIndex;
-            activated.pop_back();
-        } else {
-            // still in range, update visibility
-            float fade = o->calcFade(range2);
-            if (fade!=o->lastFade) {
-                mClutter.updateGeometry(o->ticket, to_ogre(o->pos), to_ogre(o->quat), fade);
-                o->lastFade = fade;
-            }
-        }
+struct RangedClutter::CellCallbacks {
+    RangedClutter *self;
+    bool activate (unsigned index, float fade)
+    {
+        Item &o = self->items[index];
+        o.ticket = self->mClutter.reserveGeometry(o.mesh);
+        if (!o.ticket.valid()) return false;
+        self->mClutter.updateGeometry(o.ticket, to_ogre(o.pos), to_ogre(o.quat), fade);
+        return true;
     }
-
-    Cargo cargo;
-    mSpace.getPresent(new_pos.x, new_pos.y, new_pos.z, mStepSize, mVisibility, cargo);
-    // iterate through the cargo to see who needs to become activated
-    for (Cargo::iterator i=cargo.begin(),i_=cargo.end() ; i!=i_ ; ++i) {
-        Item *o = *i;
-
-        if (o->activated) continue;
-
-        float range2 = o->range2(new_pos) / vis2;
-
-        // not in range yet
-        if (range2 > 1) continue;
-
-        float fade = o->calcFade(range2);
-        o->lastFade = fade;
-
-        //activate o
-        o->ticket = mClutter.reserveGeometry(o->mesh);
-        if (!o->ticket.valid()) continue;
-        mClutter.updateGeometry(o->ticket, to_ogre(o->pos), to_ogre(o->quat), fade);
-        o->activatedIndex = activated.size();
-        activated.push_back(o);
-        o->activated = true;
+    void deactivate (unsigned index)
+    {
+        self->mClutter.releaseGeometry(self->items[index].ticket);
+    }
+    void fade (unsigned index, float fade)
+    {
+        Item &o = self->items[index];
+        self->mClutter.updateGeometry(o.ticket, to_ogre(o.pos), to_ogre(o.quat), fade);
     }
+};
+
+void RangedClutter::update (const Vector3 &new_pos)
+{
+    CellCallbacks callbacks = { this };
+    mGrid.update(new_pos.x, new_pos.y, new_pos.z, mVisibility, streamer_fade_out_factor, callbacks);
 }
 
 void RangedClutter::push_back (const SimpleTransform &t)
 {
-    // it is very important that the number of samples does not increase over time, or
-    // the vector will resize and these pointers will become invalid
-    items.push_back(Item());
-    Item &item = items[items.size()-1];
-    item.parent = this;
-    item.activated = false;
+    Item item;
     item.mesh = mNextMesh;
+    item.pos = t.pos;
     item.quat = t.quat;
-    item.lastFade = 0;
-    mSpace.add(&item);
-    item.updateSphere(t.pos, mItemRenderingDistance);
+    items.push_back(item);
+    mGrid.add(t.pos.x, t.pos.y, t.pos.z, mItemRenderingDistance);
 }
 
 void RangedClutter::getUtilisation (size_t &used, size_t &rendered, size_t &total)
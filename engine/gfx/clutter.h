@@ -29,7 +29,7 @@ class ClutterFactory;
 
 #include <math_util.h>
 
-#include "../cache_friendly_range_space_simd.h"
+#include "../ranged_cell_grid.h"
 
 #include "../streamer.h"
 
@@ -315,9 +315,9 @@ class RangedClutter : public Ogre::MovableObject, public StreamerCallback {
         : Ogre::MovableObject(name),
           mItemRenderingDistance(40),
           mVisibility(1),
-          mStepSize(100000),
           mBoundingBox(Ogre::AxisAlignedBox::BOX_INFINITE), mBoundingRadius(FLT_MAX),
-          mClutter(this,triangles,tangents)
+          mClutter(this,triangles,tangents),
+          mGrid(20)
     { registerMe(); }
 
     virtual ~RangedClutter (void) { unregisterMe(); }
@@ -353,7 +353,7 @@ class RangedClutter : public Ogre::MovableObject, public StreamerCallback {
     void push_back (const SimpleTransform &t);
     void reserve (size_t s) {
         items.reserve(s);
-        mSpace.reserve(s);
+        mGrid.reserve(s);
     };
 
     void setNextMesh (const Ogre::MeshPtr &m) { mNextMesh = m; }
@@ -361,38 +361,20 @@ class RangedClutter : public Ogre::MovableObject, public StreamerCallback {
 
     float mItemRenderingDistance;
     float mVisibility;
-    float mStepSize;
 
-    size_t size (void) { return mSpace.size(); }
+    size_t size (void) { return items.size(); }
 
     void getUtilisation (size_t &used, size_t &rendered, size_t &total);
 
 
     protected:
 
+    // Indexed the same way as the items in mGrid.
     struct Item {
-        RangedClutter *parent;
-        int index; // maintained by the RangeSpace class
         Ogre::MeshPtr mesh;
         Vector3 pos;
         Quaternion quat;
-        bool activated;
-        int activatedIndex;
         ClutterBuffer::MTicket ticket;
-        float renderingDistance;
-        float lastFade;
-        void updateSphere (const Vector3 &pos_, float r_)
-        {
-            renderingDistance = r_;
-            pos = pos_;
-            parent->mSpace.updateSphere(index, pos.x, pos.y, pos.z, r_);
-        }
-        void updateIndex (int index_) { index = index_; }
-        float range2 (const Vector3 &new_pos) const
-        {
-            return (new_pos-pos).length2() / renderingDistance / renderingDistance;
-        }
-        float calcFade (float range2);
     };
     typedef std::vector<Item> Items;
 
@@ -400,11 +382,12 @@ class RangedClutter : public Ogre::MovableObject, public StreamerCallback {
     Ogre::AxisAlignedBox mBoundingBox;
     Ogre::Real mBoundingRadius;
     ClutterBuffer mClutter;
-    typedef CacheFriendlyRangeSpace<Item*> RS;
-    typedef RS::Cargo Cargo;
-    RS mSpace;
+
+    // Passed to mGrid.update() to (de)activate items and update their fade.
+    struct CellCallbacks;
+
+    RangedCellGrid mGrid;
     Items items;
-    Cargo activated;
 };
 
 
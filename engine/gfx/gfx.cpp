@@ -31,12 +31,14 @@
 #include "gfx_debug.h"
 #include "gfx_decal.h"
 #include "gfx_gl3_plus.h"
+#include "gfx_instances.h"
 #include "hud.h"
 #include "gfx_internal.h"
 #include "gfx_light.h"
 #include "gfx_material.h"
 #include "gfx_option.h"
 #include "gfx_pipeline.h"
+#include "gfx_scene_manager.h"
 #include "gfx_sky_body.h"
 #include "gfx_sky_material.h"
 #include "gfx_sprite_body.h"
@@ -539,6 +541,20 @@ void gfx_window_events_pump (void)
     Ogre::WindowEventUtilities::messagePump();
 }
 
+// Update the world transform of every node, and give the scene manager a new list of the ones
+// that are rendered.
+static void gather_scene_objects (void)
+{
+    gfx_scene_manager_frame_started();
+    for (unsigned long i=0 ; i<gfx_all_nodes.size() ; ++i) {
+        GfxNode *node = gfx_all_nodes[i];
+        node->updateWorldTransform();
+
+        if (auto *mo = dynamic_cast<Ogre::MovableObject*>(node))
+            gfx_scene_manager_add(mo);
+    }
+}
+
 void gfx_render (float elapsed, const Vector3 &cam_pos, const Quaternion &cam_dir)
 {
     time_since_started_rendering += elapsed;
@@ -547,19 +563,24 @@ void gfx_render (float elapsed, const Vector3 &cam_pos, const Quaternion &cam_di
     clipboard_pump();
 
     debug_drawer->frameCallback();
+    GfxInstances::frameStarted();
+    gfx_particle_frame_started();
     ogre_root_node->needUpdate();
 
     // try and do all "each object" processing in these loops
+    static std::vector<GfxBody*> animated_bodies;
+    animated_bodies.clear();
     for (unsigned long i=0 ; i<gfx_all_nodes.size() ; ++i) {
         GfxNode *node = gfx_all_nodes[i];
 
         if (auto *b = dynamic_cast<GfxBody*>(node))
-            b->updateBoneMatrixes();
+            if (b->hasBones()) animated_bodies.push_back(b);
     }
+    GfxBody::updateBoneMatrixes(animated_bodies);
     // must be done after updating bone matrixes
+    gather_scene_objects();
     for (unsigned long i=0 ; i<gfx_all_nodes.size() ; ++i) {
         GfxNode *node = gfx_all_nodes[i];
-        node->updateWorldTransform();
 
         if (auto *l = dynamic_cast<GfxLight*>(node))
             l->update(cam_pos);
@@ -684,6 +705,10 @@ void gfx_bake_env_cube (const std::string &filename, unsigned size, const Vector
         Quaternion(Degree(90), Vector3(1,0,0)) * Quaternion(Degree(180), Vector3(0,0,1)), // turn to face south, then look down
     };
 
+    // The scene manager still holds the objects of the last frame, some of which may have been
+    // destroyed since, so gather them again.
+    gather_scene_objects();
+
     // create 6 viewports and 6 pipelines
     for (unsigned i=0 ; i<6 ; ++i) {
         Ogre::Viewport *vp = rt->addViewport(NULL, 0, i/6.0, 0, 1.0/6, 1);
@@ -826,6 +851,7 @@ static GfxLastRenderStats stats_from_rt (Ogre::RenderTarget *rt)
     GfxLastRenderStats r;
     r.batches = float(rt->getBatchCount());
     r.triangles = float(rt->getTriangleCount());
+    gfx_scene_manager_cull_stats(rt->getViewport(0)->getCamera(), r);
     return r;
 }
 
@@ -835,12 +861,16 @@ GfxLastFrameStats gfx_last_frame_stats (void)
 
     r.left_deferred = eye_left->getDeferredStats();
     r.left_gbuffer = eye_left->getGBufferStats();
+    r.materialsRebuilt = eye_left->getMaterialsRebuilt();
 
     if (stereoscopic()) {
         r.right_deferred = eye_right->getGBufferStats();
         r.right_gbuffer = eye_right->getGBufferStats();
+        r.materialsRebuilt += eye_right->getMaterialsRebuilt();
     }
 
+    r.hud = hud_last_render_stats();
+
     if (gfx_option(GFX_SHADOW_CAST)) {
         for (int i=0 ; i<3 ; ++i) {
             r.shadow[i] = stats_from_rt(ogre_sm->getShadowTexture(i)->getBuffer()->getRenderTarget());
@@ -1063,7 +1093,7 @@ size_t gfx_init (GfxCallback &cb_)
         if (ftcv.isNull()) {
             CERR << "While initialising Grit, Ogre::FrameControllerValue could not be found!" << std::endl;
         }
-        ogre_sm = static_cast<Ogre::OctreeSceneManager*>(ogre_root->createSceneManager("OctreeSceneManager"));
+        ogre_sm = gfx_scene_manager_make();
         ogre_sm->addListener(&ogre_sm_listener);
         ogre_root_node = ogre_sm->getRootSceneNode();
         ogre_sm->setShadowCasterRenderBackFaces(false);
@@ -1147,7 +1177,10 @@ void gfx_shutdown (void)
 
         gfx_shader_shutdown();
         ftcv.setNull();
-        if (ogre_sm && ogre_root) ogre_root->destroySceneManager(ogre_sm);
+        if (ogre_sm && ogre_root) {
+            ogre_root->destroySceneManager(ogre_sm);
+            gfx_scene_manager_shutdown();
+        }
         if (ogre_root) OGRE_DELETE ogre_root; // internally deletes ogre_rs
         OGRE_DELETE octree;
         OGRE_DELETE cg;
@@ -185,15 +185,27 @@ struct GfxLastRenderStats {
     float batches;
     float triangles;
     float micros;
+    // Objects found to be visible, outside the frustum, and hidden behind occluders, and the
+    // time taken to find them.
+    float visible;
+    float culled;
+    float occluded;
+    float cullMicros;
     GfxLastRenderStats (const GfxLastRenderStats &o)
-        : batches(o.batches), triangles(o.triangles), micros(o.micros) { }
-    GfxLastRenderStats (void) : batches(0), triangles(0), micros(0) { }
+        : batches(o.batches), triangles(o.triangles), micros(o.micros),
+          visible(o.visible), culled(o.culled), occluded(o.occluded), cullMicros(o.cullMicros) { }
+    GfxLastRenderStats (void)
+        : batches(0), triangles(0), micros(0), visible(0), culled(0), occluded(0), cullMicros(0)
+    { }
     GfxLastRenderStats &operator+= (const GfxLastRenderStats &o) {
         batches += o.batches; triangles += o.triangles; micros += o.micros;
+        visible += o.visible; culled += o.culled; occluded += o.occluded;
+        cullMicros += o.cullMicros;
         return *this;
     }
     GfxLastRenderStats &operator/= (float time) {
         batches /= time; triangles /= time; micros /= time;
+        visible /= time; culled /= time; occluded /= time; cullMicros /= time;
         return *this;
     }
 };
@@ -205,6 +217,8 @@ struct GfxLastFrameStats {
     GfxLastRenderStats right_gbuffer;
     GfxLastRenderStats right_deferred;
     GfxLastRenderStats hud;
+    unsigned materialsRebuilt;
+    GfxLastFrameStats (void) : materialsRebuilt(0) { }
 };
 
 struct GfxRunningFrameStats {
@@ -20,13 +20,21 @@
  */
 
 #include <centralised_log.h>
+#include <sleep.h>
 
 #include "gfx_internal.h"
+#include "gfx_option.h"
+#include "gfx_parallel.h"
 
 #include "gfx_body.h"
 
+// Skeletons are posed in batches of this many, per thread.
+static const size_t BONE_UPDATE_GRAIN = 8;
+
 const std::string GfxBody::className = "GfxBody";
 
+GfxBoneUpdateStats GfxBody::boneStats;
+
 static std::set<GfxBody*> first_person_bodies;
 
 // {{{ Sub
@@ -105,22 +113,43 @@ const Ogre::MaterialPtr& GfxBody::Sub::getMaterial(void) const
 
 // {{{ RENDERING
 
-void GfxBody::updateBoneMatrixes (void)
+void GfxBody::updateBoneMatrixes (const std::vector<GfxBody*> &bodies)
 {
-    if (skeleton) {
+    boneStats = GfxBoneUpdateStats();
+    if (bodies.empty()) return;
+    unsigned threads = gfx_option(GFX_ANIMATION_THREADS);
 
-        //update the current hardware animation state
-        skeleton->setAnimationState(animationState);
-        skeleton->_getBoneMatrices(boneMatrixes);
+    unsigned long long before = micros();
 
-        updateWorldTransform();
+    // Each skeleton instance only touches its own bones, and the animations it shares with the
+    // other instances were prepared when it was created.
+    gfx_parallel_for(bodies.size(), BONE_UPDATE_GRAIN, threads, [&] (size_t from, size_t to) {
+        for (size_t i=from ; i<to ; ++i) {
+            GfxBody *b = bodies[i];
+            b->skeleton->setAnimationState(b->animationState);
+            b->skeleton->_getBoneMatrices(b->boneMatrixes);
+        }
+    });
 
-        Ogre::OptimisedUtil::getImplementation()->concatenateAffineMatrices(
-            toOgre(),
-            boneMatrixes,
-            boneWorldMatrixes,
-            numBoneMatrixes);
+    unsigned long long after_pose = micros();
+
+    for (GfxBody *b : bodies) {
+        b->updateWorldTransform();
+        boneStats.bones += b->numBoneMatrixes;
     }
+    boneStats.skeletons = bodies.size();
+
+    Ogre::OptimisedUtil *simd = Ogre::OptimisedUtil::getImplementation();
+    gfx_parallel_for(bodies.size(), BONE_UPDATE_GRAIN, threads, [&] (size_t from, size_t to) {
+        for (size_t i=from ; i<to ; ++i) {
+            GfxBody *b = bodies[i];
+            simd->concatenateAffineMatrices(b->toOgre(), b->boneMatrixes, b->boneWorldMatrixes,
+                                            b->numBoneMatrixes);
+        }
+    });
+
+    boneStats.poseMicros = after_pose - before;
+    boneStats.paletteMicros = micros() - after_pose;
 }
 
 void GfxBody::_updateRenderQueue(Ogre::RenderQueue* queue)
@@ -297,6 +326,7 @@ GfxBody::GfxBody (const DiskResourcePtr<GfxMeshDiskResource> &gdr, const GfxStri
     skeleton = NULL;
     wireframe = false;
     firstPerson = false;
+    occluder = false;
 
     reinitialise();
 }
@@ -340,6 +370,26 @@ void GfxBody::destroyGraphics (void)
     }
 }
 
+/* Ogre builds the keyframe time list of an animation, and its splines, the first time it is
+ * applied.  That data is shared by every instance of the skeleton, so build it here rather than
+ * from the threads that pose them.
+ */
+static void prepare_animations (Ogre::Skeleton *skel)
+{
+    for (unsigned short i=0 ; i<skel->getNumAnimations() ; ++i) {
+        Ogre::Animation *anim = skel->getAnimation(i);
+        anim->_applyBaseKeyFrame();
+        Ogre::TimeIndex index = anim->_getTimeIndex(0);
+        Ogre::Animation::NodeTrackIterator it = anim->getNodeTrackIterator();
+        while (it.hasMoreElements()) {
+            Ogre::NodeAnimationTrack *track = it.getNext();
+            if (track->getNumKeyFrames() == 0) continue;
+            Ogre::TransformKeyFrame kf(track, 0);
+            track->getInterpolatedKeyFrame(index, &kf);
+        }
+    }
+}
+
 void GfxBody::reinitialise (void)
 {
     APP_ASSERT(mesh->isLoaded());
@@ -362,6 +412,7 @@ void GfxBody::reinitialise (void)
 
 
     if (!mesh->getSkeleton().isNull()) {
+        prepare_animations(mesh->getSkeleton().get());
         skeleton = OGRE_NEW Ogre::SkeletonInstance(mesh->getSkeleton());
         skeleton->load();
         numBoneMatrixes = skeleton->getNumBones();
@@ -369,6 +420,12 @@ void GfxBody::reinitialise (void)
         boneWorldMatrixes = static_cast<Ogre::Matrix4*>(OGRE_MALLOC_SIMD(sizeof(Ogre::Matrix4) * numBoneMatrixes, Ogre::MEMCATEGORY_ANIMATION));
 
         mesh->_initAnimationState(&animationState);
+
+        if (occluder) {
+            CERR << "Mesh \"/" << mesh->getName() << "\" now has bones, so the body is no "
+                 << "longer an occluder." << std::endl;
+            setOccluder(false);
+        }
     } else {
         skeleton = NULL;
         numBoneMatrixes = 0;
@@ -389,6 +446,7 @@ void GfxBody::destroy (void)
     if (dead) THROW_DEAD(className);
     destroyGraphics();
     setFirstPerson(false);  // Remove it from the set.
+    setOccluder(false);  // Release the mesh's triangles.
     GfxFertileNode::destroy();
 }
 
@@ -488,6 +546,25 @@ void GfxBody::setWireframe (bool v)
     wireframe = v;
 }
 
+bool GfxBody::getOccluder (void)
+{
+    return occluder;
+}
+void GfxBody::setOccluder (bool v)
+{
+    if (dead) THROW_DEAD(className);
+    if (occluder == v) return;
+    // Occluders are rasterised in their bind pose, which an animated body can move out of.
+    if (v && skeleton != NULL)
+        GRIT_EXCEPT("Body with bones cannot be an occluder: \"" + getMeshName() + "\"");
+    if (v) {
+        gdr->acquireTriangles();
+    } else {
+        gdr->releaseTriangles();
+    }
+    occluder = v;
+}
+
 bool GfxBody::getFirstPerson (void)
 {
     return firstPerson;
@@ -744,6 +821,11 @@ std::string GfxBody::getMeshName (void) const
     return "/" + mesh->getName();
 }
 
+const GfxMeshTriangles &GfxBody::getMeshTriangles (void) const
+{
+    return gdr->getTriangles();
+}
+
 
 void GfxBody::renderFirstPerson (const GfxShaderGlobals &g,
                                  bool alpha_blend)
@@ -780,13 +862,27 @@ void GfxBody::renderFirstPerson (const GfxShaderGlobals &g,
 
         Ogre::SubMesh *sm = mesh->getSubMesh(i);
 
+        GfxShader *shader = mat->getShader();
+        const GfxShaderParamBlock &block = mat->getParamBlock();
+        GfxGslMeshEnvironment mesh_env;
+        shader->populateMeshEnv(instanced, bone_weights, mesh_env);
+
         if (do_regular) {
  
             // render sm using mat
             const GfxTextureStateMap &mat_texs = mat->getTextures();
-            mat->getShader()->bindShader(
-                GFX_GSL_PURPOSE_FIRST_PERSON, pass_fade_dither, instanced, bone_weights, g, world,
-                boneWorldMatrixes, numBoneMatrixes, fade, colours, mat_texs, mat->getBindings());
+            GfxGslMaterialEnvironment mat_env;
+            shader->populateMatEnv(pass_fade_dither, mat_texs, mat->getBindings(), mat_env);
+            if (gfx_option(GFX_PARAM_BLOCKS)) {
+                shader->bindShader(
+                    GFX_GSL_PURPOSE_FIRST_PERSON, mat_env, mesh_env, g, world,
+                    boneWorldMatrixes, numBoneMatrixes, fade, colours, mat_texs, block);
+            } else {
+                shader->bindShader(
+                    GFX_GSL_PURPOSE_FIRST_PERSON, mat_env, mesh_env, g, world,
+                    boneWorldMatrixes, numBoneMatrixes, fade, colours, mat_texs,
+                    mat->getBindings());
+            }
 
             switch (mat->getSceneBlend()) {
                 case GFX_MATERIAL_OPAQUE:
@@ -818,10 +914,19 @@ void GfxBody::renderFirstPerson (const GfxShaderGlobals &g,
 
         if (do_wireframe) {
 
-            mat->getShader()->bindShader(
-                GFX_GSL_PURPOSE_FIRST_PERSON_WIREFRAME, pass_fade_dither, instanced, bone_weights, g,
-                world, boneWorldMatrixes, numBoneMatrixes, fade, colours, GfxTextureStateMap(),
-                mat->getBindings());
+            GfxTextureStateMap no_texs;
+            GfxGslMaterialEnvironment mat_env;
+            shader->populateMatEnv(pass_fade_dither, no_texs, mat->getBindings(), mat_env);
+            if (gfx_option(GFX_PARAM_BLOCKS)) {
+                shader->bindShader(
+                    GFX_GSL_PURPOSE_FIRST_PERSON_WIREFRAME, mat_env, mesh_env, g, world,
+                    boneWorldMatrixes, numBoneMatrixes, fade, colours, no_texs, block);
+            } else {
+                shader->bindShader(
+                    GFX_GSL_PURPOSE_FIRST_PERSON_WIREFRAME, mat_env, mesh_env, g, world,
+                    boneWorldMatrixes, numBoneMatrixes, fade, colours, no_texs,
+                    mat->getBindings());
+            }
 
             ogre_rs->_setDepthBufferParams(true, false, Ogre::CMPF_LESS_EQUAL);
             ogre_rs->_setSceneBlending(Ogre::SBF_ONE, Ogre::SBF_ZERO);
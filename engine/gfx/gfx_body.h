@@ -30,6 +30,15 @@ typedef SharedPtr<GfxBody> GfxBodyPtr;
 #include "gfx_fertile_node.h"
 #include "gfx_material.h"
 
+/** CPU time spent on the skeletons of the last frame, see GfxBody::updateBoneMatrixes. */
+struct GfxBoneUpdateStats {
+    unsigned long skeletons;
+    unsigned long bones;
+    float poseMicros;
+    float paletteMicros;
+    GfxBoneUpdateStats (void) : skeletons(0), bones(0), poseMicros(0), paletteMicros(0) { }
+};
+
 // Must extend Ogre::MovableObject so that we can become attached to a node and
 // rendered by the regular Ogre scenemanager-based pipeline.
 class GfxBody : public GfxFertileNode, public Ogre::MovableObject {
@@ -93,6 +102,9 @@ class GfxBody : public GfxFertileNode, public Ogre::MovableObject {
     
 
 
+    private:
+    static GfxBoneUpdateStats boneStats;
+
     protected:
     static const std::string className;
     public: // HACK
@@ -106,6 +118,7 @@ class GfxBody : public GfxFertileNode, public Ogre::MovableObject {
     bool castShadows;
     bool wireframe;
     bool firstPerson;
+    bool occluder;
     std::vector<bool> manualBones;
     GfxStringMap initialMaterialMap;
     const DiskResourcePtr<GfxMeshDiskResource> gdr;
@@ -159,6 +172,13 @@ class GfxBody : public GfxFertileNode, public Ogre::MovableObject {
     bool getFirstPerson (void);
     void setFirstPerson (bool v);
 
+    /** Whether the mesh hides the bodies behind it from the occlusion culling.  Best used on a
+     * few large, closed, static bodies like buildings.  Bodies with bones cannot be occluders,
+     * as their triangles are only known in the bind pose.
+     */
+    bool getOccluder (void);
+    void setOccluder (bool v);
+
     GfxPaintColour getPaintColour (int i);
     void setPaintColour (int i, const GfxPaintColour &c);
 
@@ -188,7 +208,16 @@ class GfxBody : public GfxFertileNode, public Ogre::MovableObject {
     void setBoneLocalOrientation (unsigned n, const Quaternion &v);
     void setBoneLocalScale (unsigned n, const Vector3 &v);
 
-    void updateBoneMatrixes (void);
+    /** Pose the skeletons of the given bodies from their animation states and manual bones,
+     * then build the bone matrixes they are rendered with.  Each skeleton is independent, so they
+     * are posed across GFX_ANIMATION_THREADS threads.  The world transforms are updated on the
+     * calling thread in between, as bodies may be attached to the bones of other bodies.  Returns
+     * once everything is ready to render.
+     */
+    static void updateBoneMatrixes (const std::vector<GfxBody*> &bodies);
+    /** Between frames, the work done by updateBoneMatrixes for the frame that was just
+     * rendered. */
+    static const GfxBoneUpdateStats &getLastFrameBoneStats (void) { return boneStats; }
 
     std::vector<std::string> getAnimationNames (void);
     float getAnimationLength (const std::string &name);
@@ -206,6 +235,9 @@ class GfxBody : public GfxFertileNode, public Ogre::MovableObject {
 
     std::string getMeshName (void) const;
 
+    /** The triangles of the mesh, for occlusion culling. */
+    const GfxMeshTriangles &getMeshTriangles (void) const;
+
     friend class SharedPtr<GfxBody>;
     friend class GfxMeshDiskResource;
 };
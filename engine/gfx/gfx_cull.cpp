@@ -0,0 +1,192 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cfloat>
+
+#include "gfx_cull.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define GFX_CULL_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// As in range_space_kernel.cpp, the AVX kernel is compiled for AVX on its own, and only called
+// if the CPU supports it, so the engine as a whole does not need building with -mavx.
+#if defined(GFX_CULL_X86) && !defined(_MSC_VER)
+#define KERNEL_TARGET(x) __attribute__((target(x)))
+#else
+#define KERNEL_TARGET(x)
+#endif
+
+static const unsigned PADDING = 8;
+
+void GfxCullSpheres::clear (void)
+{
+    num = 0;
+    x.clear();
+    y.clear();
+    z.clear();
+    r.clear();
+}
+
+void GfxCullSpheres::add (const Vector3 &centre, float radius)
+{
+    if (num == r.size()) {
+        x.resize(num + PADDING, 0);
+        y.resize(num + PADDING, 0);
+        z.resize(num + PADDING, 0);
+        r.resize(num + PADDING, -FLT_MAX);
+    }
+    x[num] = centre.x;
+    y[num] = centre.y;
+    z[num] = centre.z;
+    r[num] = radius;
+    num++;
+}
+
+namespace {
+
+    typedef void Kernel (const GfxCullPlanes &planes, const float *x, const float *y,
+                         const float *z, const float *r, unsigned num,
+                         std::vector<unsigned> &visible);
+
+    #ifdef GFX_CULL_X86
+
+    inline void append_mask (unsigned mask, unsigned first, std::vector<unsigned> &visible)
+    {
+        for (unsigned i = first ; mask != 0 ; ++i, mask >>= 1) {
+            if (mask & 1) visible.push_back(i);
+        }
+    }
+
+    // The arrays are padded to a multiple of 8, so the kernels need no scalar tail.
+
+    KERNEL_TARGET("sse2")
+    void kernel_sse2 (const GfxCullPlanes &planes, const float *x, const float *y,
+                      const float *z, const float *r, unsigned num,
+                      std::vector<unsigned> &visible)
+    {
+        __m128 a[6], b[6], c[6], d[6];
+        for (unsigned j = 0 ; j < 6 ; ++j) {
+            a[j] = _mm_set1_ps(planes.p[j][0]);
+            b[j] = _mm_set1_ps(planes.p[j][1]);
+            c[j] = _mm_set1_ps(planes.p[j][2]);
+            d[j] = _mm_set1_ps(planes.p[j][3]);
+        }
+        for (unsigned i = 0 ; i < num ; i += 4) {
+            __m128 sx = _mm_loadu_ps(&x[i]);
+            __m128 sy = _mm_loadu_ps(&y[i]);
+            __m128 sz = _mm_loadu_ps(&z[i]);
+            __m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&r[i]));
+            __m128 inside = _mm_cmpeq_ps(sx, sx);
+            for (unsigned j = 0 ; j < 6 ; ++j) {
+                __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[j], sx), _mm_mul_ps(b[j], sy)),
+                                         _mm_add_ps(_mm_mul_ps(c[j], sz), d[j]));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(dist, neg_r));
+            }
+            append_mask(_mm_movemask_ps(inside), i, visible);
+        }
+    }
+
+    KERNEL_TARGET("avx")
+    void kernel_avx (const GfxCullPlanes &planes, const float *x, const float *y,
+                     const float *z, const float *r, unsigned num,
+                     std::vector<unsigned> &visible)
+    {
+        __m256 a[6], b[6], c[6], d[6];
+        for (unsigned j = 0 ; j < 6 ; ++j) {
+            a[j] = _mm256_set1_ps(planes.p[j][0]);
+            b[j] = _mm256_set1_ps(planes.p[j][1]);
+            c[j] = _mm256_set1_ps(planes.p[j][2]);
+            d[j] = _mm256_set1_ps(planes.p[j][3]);
+        }
+        for (unsigned i = 0 ; i < num ; i += 8) {
+            __m256 sx = _mm256_loadu_ps(&x[i]);
+            __m256 sy = _mm256_loadu_ps(&y[i]);
+            __m256 sz = _mm256_loadu_ps(&z[i]);
+            __m256 neg_r = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&r[i]));
+            __m256 inside = _mm256_cmp_ps(sx, sx, _CMP_EQ_OQ);
+            for (unsigned j = 0 ; j < 6 ; ++j) {
+                __m256 dist = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a[j], sx),
+                                                          _mm256_mul_ps(b[j], sy)),
+                                            _mm256_add_ps(_mm256_mul_ps(c[j], sz), d[j]));
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(dist, neg_r, _CMP_GE_OQ));
+            }
+            append_mask(_mm256_movemask_ps(inside), i, visible);
+        }
+    }
+
+    bool cpu_has_avx (void)
+    {
+        #ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 1);
+        // OSXSAVE and AVX, then check the OS saves the YMM registers.
+        if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) return false;
+        return (_xgetbv(0) & 0x6) == 0x6;
+        #else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx");
+        #endif
+    }
+
+    #else
+
+    void kernel_scalar (const GfxCullPlanes &planes, const float *x, const float *y,
+                        const float *z, const float *r, unsigned num,
+                        std::vector<unsigned> &visible)
+    {
+        for (unsigned i = 0 ; i < num ; ++i) {
+            bool inside = true;
+            for (unsigned j = 0 ; j < 6 ; ++j) {
+                const float *p = planes.p[j];
+                float dist = (p[0] * x[i] + p[1] * y[i]) + (p[2] * z[i] + p[3]);
+                inside = inside && dist >= -r[i];
+            }
+            if (inside) visible.push_back(i);
+        }
+    }
+
+    #endif
+
+    Kernel *selected = nullptr;
+
+    Kernel *current (void)
+    {
+        if (selected == nullptr) {
+            #ifdef GFX_CULL_X86
+            selected = cpu_has_avx() ? kernel_avx : kernel_sse2;
+            #else
+            selected = kernel_scalar;
+            #endif
+        }
+        return selected;
+    }
+
+}
+
+void GfxCullSpheres::cull (const GfxCullPlanes &planes, std::vector<unsigned> &visible) const
+{
+    if (num == 0) return;
+    current()(planes, &x[0], &y[0], &z[0], &r[0], num, visible);
+}
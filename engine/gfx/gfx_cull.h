@@ -0,0 +1,61 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <vector>
+
+#include <math_util.h>
+
+#ifndef GFX_CULL_H
+#define GFX_CULL_H
+
+/** The planes bounding a frustum, each as (a, b, c, d) where a*x + b*y + c*z + d is the signed
+ * distance of (x, y, z) from the plane, positive on the inside.
+ */
+struct GfxCullPlanes {
+    float p[6][4];
+};
+
+/** World-space bounding spheres, kept as separate arrays of each co-ordinate so that the culling
+ * kernel can test 8 (AVX) or 4 (SSE) of them against a plane at once.  The kernel is chosen on
+ * first use according to what the CPU supports.  Spheres are identified by
+ * the order in which they were added since the last clear.
+ */
+class GfxCullSpheres {
+    public:
+    GfxCullSpheres (void) : num(0) { }
+
+    unsigned size (void) const { return num; }
+
+    void clear (void);
+
+    void add (const Vector3 &centre, float radius);
+
+    /** Append to visible the indexes of the spheres that are not entirely on the outside of any
+     * of the planes, in ascending order.  This is the same test as Ogre::Camera::isVisible.
+     */
+    void cull (const GfxCullPlanes &planes, std::vector<unsigned> &visible) const;
+
+    private:
+    unsigned num;
+    // Padded to a multiple of 8 with spheres that are never visible.
+    std::vector<float> x, y, z, r;
+};
+
+#endif
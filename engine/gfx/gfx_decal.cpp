@@ -19,15 +19,31 @@
  * THE SOFTWARE.
  */
 
+#include <algorithm>
+#include <vector>
+
 #include "gfx_internal.h"
 #include "gfx_decal.h"
 #include "gfx_material.h"
+#include "gfx_pipeline.h"
+#include "gfx_scene_manager.h"
 
 const std::string GfxDecal::className = "GfxDecal";
 
+// Per decal: the rows of the 3x3 part of its world transform, its translation and its fade, as
+// read by get_inst_matrix in the instanced Gasoline shaders (same layout as GfxInstances).
+static const unsigned instance_data_floats = 13;
+static const unsigned instance_data_bytes = instance_data_floats*4;
+
 // vdata/idata to be allocated later because constructor requires ogre to be initialised
 static Ogre::RenderOperation box_op;
 
+// Instance data of every decal drawn this frame, in batch order.  Each batch is copied to the
+// start of inst_buf in turn.
+static std::vector<float> inst_buf_raw;
+static Ogre::HardwareVertexBufferSharedPtr inst_buf;
+static unsigned inst_buf_capacity = 0;
+
 // Samew winding order for quad as for triangles generated>
 #define quad_vertexes(a,b,c,d) a, b, d, a, d, c
 
@@ -50,10 +66,10 @@ void gfx_decal_init (void)
     struct Vertex { Vector3 position; Vector2 uv1; Vector2 uv2; };
     vdecl_size += vdata->vertexDeclaration->addElement(
         0, vdecl_size, Ogre::VET_FLOAT3, Ogre::VES_POSITION).getSize();
+    // The instanced decal shader reads uv1 and uv2 together as coord0, as the instance data
+    // takes coord1 onwards.
     vdecl_size += vdata->vertexDeclaration->addElement(
-        0, vdecl_size, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES, 0).getSize();
-    vdecl_size += vdata->vertexDeclaration->addElement(
-        0, vdecl_size, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES, 1).getSize();
+        0, vdecl_size, Ogre::VET_FLOAT4, Ogre::VES_TEXTURE_COORDINATES, 0).getSize();
 
     Ogre::HardwareVertexBufferSharedPtr vbuf =
         Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
@@ -72,6 +88,15 @@ void gfx_decal_init (void)
     };
     vbuf->writeData(vdata->vertexStart, vdata->vertexCount*vdecl_size, vdata_raw, true);
 
+    unsigned vdecl_inst_sz = 0;
+    for (unsigned i=1 ; i<=4 ; ++i) {
+        vdecl_inst_sz += vdata->vertexDeclaration->addElement(
+            1, vdecl_inst_sz, Ogre::VET_FLOAT3, Ogre::VES_TEXTURE_COORDINATES, i).getSize();
+    }
+    vdecl_inst_sz += vdata->vertexDeclaration->addElement(
+        1, vdecl_inst_sz, Ogre::VET_FLOAT1, Ogre::VES_TEXTURE_COORDINATES, 5).getSize();
+    APP_ASSERT(vdecl_inst_sz == instance_data_bytes);
+
     Ogre::IndexData *idata = OGRE_NEW Ogre::IndexData();
     box_op.indexData = idata;
     box_op.useIndexes = true;
@@ -94,18 +119,22 @@ void gfx_decal_init (void)
 void gfx_decal_shutdown (void)
 {
     // Referenced buffers are managed via sharedptr.
+    inst_buf.setNull();
+    inst_buf_capacity = 0;
     OGRE_DELETE box_op.vertexData;
     OGRE_DELETE box_op.indexData;
 }
 
 
 static std::set<GfxDecal*> all_decals;
+static unsigned long long next_decal_sequence = 0;
 
 GfxDecal::GfxDecal (GfxMaterial *material, const GfxNodePtr &par_)
   : GfxNode(par_),
     enabled(true),
     fade(1),
-    material(material)
+    material(material),
+    sequence(next_decal_sequence++)
 {
     all_decals.insert(this);
 }
@@ -157,17 +186,64 @@ void GfxDecal::setFade (float f)
 }
 
 
+static void reserve_instances (unsigned instances)
+{
+    if (instances <= inst_buf_capacity) return;
+    inst_buf_capacity = std::max(128u, unsigned(instances * 1.3));
+    inst_buf = Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
+        instance_data_bytes, inst_buf_capacity,
+        Ogre::HardwareBuffer::HBU_DYNAMIC_WRITE_ONLY_DISCARDABLE);
+    inst_buf->setIsInstanceData(true);
+    inst_buf->setInstanceDataStepRate(1);
+    box_op.vertexData->vertexBufferBinding->setBinding(1, inst_buf);
+}
+
+namespace {
+    struct DecalDraw {
+        GfxMaterial *material;
+        // Whether the camera is inside the box, which needs different culling and depth test.
+        bool inside;
+        Ogre::Matrix4 world;
+        float fade;
+        unsigned long long sequence;
+
+        // Group by shader, then by everything else bound by the batch, then keep creation order
+        // (all_decals is ordered by address, which changes as decals come and go).
+        bool operator< (const DecalDraw &other) const
+        {
+            if (material->getShader() != other.material->getShader())
+                return material->getShader() < other.material->getShader();
+            if (material != other.material)
+                return material < other.material;
+            if (inside != other.inside)
+                return inside < other.inside;
+            return sequence < other.sequence;
+        }
+    };
+}
+
+// Reused between frames to avoid reallocating.
+static std::vector<DecalDraw> draws;
+
+// The enabled decals, and their bounding spheres in the same order.
+static std::vector<GfxDecal*> candidates;
+static GfxCullSpheres candidate_spheres;
+static std::vector<unsigned> visible;
+
 /*
  * Read depth.  Write diffuse, normal, spec, gloss.  Alpha = 1.
  * Read depth, normal.  Write diffuse, spec, gloss.  Alpha = 1.
  * Read everything.  Write colour.  Alpha < 1.
+ *
+ * Draws [first, last) of draws, which share the material and whether the camera is inside, as
+ * one instanced batch of boxes.
  */
-void GfxDecal::render (const GfxShaderGlobals &g)
+static void render_batch (const GfxShaderGlobals &g, unsigned first, unsigned last)
 {
-    if (!enabled) return;
+    GfxMaterial *material = draws[first].material;
+    bool inside = draws[first].inside;
+    unsigned instances = last - first;
 
-    const Ogre::Matrix4 &world = node->_getFullTransform(); 
-    
     // ISSUE RENDER COMMANDS
     try {
         const GfxTextureStateMap &mat_texs = material->getTextures();
@@ -177,16 +253,16 @@ void GfxDecal::render (const GfxShaderGlobals &g)
         const GfxGslMaterialEnvironment &mat_env = material->getMaterialEnvironment();
 
         GfxGslMeshEnvironment mesh_env;
-        shader->populateMeshEnv(false, 0, mesh_env);
+        shader->populateMeshEnv(true, 0, mesh_env);
 
-        material->getShader()->bindShader(
-            GFX_GSL_PURPOSE_DECAL, mat_env, mesh_env, g, world, nullptr, 0, 1,
-            mat_texs, material->getBindings());
-        
-        
-        float dist = (world * Ogre::Vector4(1, 1, 1, 0)).xyz().length();
-        Ogre::Vector3 decal_to_cam = (world * Ogre::Vector4(0, 0, 0, 1)).xyz() - to_ogre(g.camPos);
-        bool inside = decal_to_cam.length() - 0.4 < dist;
+        // The world transform of each decal comes from the instance data.
+        shader->bindShader(
+            GFX_GSL_PURPOSE_DECAL, mat_env, mesh_env, g, Ogre::Matrix4::IDENTITY, nullptr, 0, 1,
+            mat_texs, material->getParamBlock());
+
+        inst_buf->writeData(0, instances * instance_data_bytes,
+                            &inst_buf_raw[first * instance_data_floats], true);
+        box_op.numberOfInstances = instances;
 
         ogre_rs->_setCullingMode(inside ? Ogre::CULL_ANTICLOCKWISE : Ogre::CULL_CLOCKWISE);
         // read but don't write depth buffer
@@ -227,10 +303,64 @@ void GfxDecal::render (const GfxShaderGlobals &g)
 void gfx_decal_render (GfxPipeline *p)
 {
     GfxShaderGlobals g = gfx_shader_globals_cam(p);
+    Ogre::Camera *cam = p->getCamera();
 
+    candidates.clear();
+    candidate_spheres.clear();
     for (GfxDecal *decal : all_decals) {
-        decal->render(g);
+        if (!decal->enabled) continue;
+
+        const Ogre::Matrix4 &world = decal->node->_getFullTransform();
+
+        // The unit box fits in a sphere of this radius, whatever the transform.
+        float radius = 0.5f * ((world * Ogre::Vector4(1, 0, 0, 0)).xyz().length()
+                               + (world * Ogre::Vector4(0, 1, 0, 0)).xyz().length()
+                               + (world * Ogre::Vector4(0, 0, 1, 0)).xyz().length());
+        candidates.push_back(decal);
+        candidate_spheres.add(from_ogre(world.getTrans()), radius);
     }
-}
 
+    visible.clear();
+    candidate_spheres.cull(gfx_cull_planes(cam), visible);
+
+    draws.clear();
+    for (unsigned i : visible) {
+        GfxDecal *decal = candidates[i];
+        const Ogre::Matrix4 &world = decal->node->_getFullTransform();
+        Ogre::Vector3 centre = world.getTrans();
+
+        float dist = (world * Ogre::Vector4(1, 1, 1, 0)).xyz().length();
+        Ogre::Vector3 decal_to_cam = centre - to_ogre(g.camPos);
+        bool inside = decal_to_cam.length() - 0.4 < dist;
 
+        draws.push_back(DecalDraw { decal->material, inside, world, decal->fade, decal->sequence });
+    }
+    if (draws.empty()) return;
+
+    std::sort(draws.begin(), draws.end());
+
+    inst_buf_raw.resize(draws.size() * instance_data_floats);
+    for (unsigned i=0 ; i<draws.size() ; ++i) {
+        const Ogre::Matrix4 &world = draws[i].world;
+        float *base = &inst_buf_raw[i * instance_data_floats];
+        for (int r=0 ; r<3 ; ++r) {
+            for (int c=0 ; c<3 ; ++c) {
+                base[r*3 + c] = world[r][c];
+            }
+        }
+        base[ 9] = world[0][3];
+        base[10] = world[1][3];
+        base[11] = world[2][3];
+        base[12] = draws[i].fade;
+    }
+
+    reserve_instances(draws.size());
+
+    for (unsigned first=0, last ; first<draws.size() ; first=last) {
+        for (last=first+1 ; last<draws.size() ; ++last) {
+            if (draws[last].material != draws[first].material) break;
+            if (draws[last].inside != draws[first].inside) break;
+        }
+        render_batch(g, first, last);
+    }
+}
@@ -37,6 +37,9 @@ class GfxDecal : public GfxNode {
     bool enabled;
     float fade;
     GfxMaterial *material;
+    // Creation order, which breaks ties when sorting draws, so overlapping alpha decals with the
+    // same material are drawn in the same order every frame.
+    unsigned long long sequence;
     
     protected:
 
@@ -56,14 +59,13 @@ class GfxDecal : public GfxNode {
     GfxMaterial *getMaterial (void);
     void setMaterial (GfxMaterial *m);
 
-    void render (const GfxShaderGlobals &g);
-
     void destroy (void);
 
     friend class SharedPtr<GfxDecal>;
+    friend void gfx_decal_render (GfxPipeline *p);
 };
 
-// called every frame
+// called every frame, culls the decals and draws them in instanced batches by material
 void gfx_decal_render (GfxPipeline *p);
 
 void gfx_decal_init (void);
@@ -0,0 +1,170 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef GFX_DIRTY_RANGES_H
+#define GFX_DIRTY_RANGES_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/** Tracks which elements of a host-side array have changed since it was last copied to a GPU
+ * buffer, so that only those parts need to be uploaded.
+ *
+ * Modified elements are recorded in a bitmap as they happen and turned into contiguous ranges
+ * at upload time, in index order without sorting.  Each write is costed as its bytes plus
+ * CALL_COST_BYTES, so clean gaps shorter than that are uploaded rather than split, and if the
+ * ranges would cost more than rewriting the whole array with discard (which avoids the driver
+ * having to preserve the old contents, so is counted at half its bytes) the whole thing is
+ * uploaded instead.
+ */
+class GfxDirtyRanges {
+
+    public:
+
+    /** Estimated fixed cost of issuing one write, in bytes uploaded in the same time. */
+    static const unsigned CALL_COST_BYTES = 4096;
+
+    /** Result of a flush, for statistics. */
+    struct Flush {
+        /** Number of elements written. */
+        unsigned elements;
+        /** Number of writes issued. */
+        unsigned ranges;
+        /** Whether the whole array was written (with discard). */
+        bool full;
+    };
+
+    protected:
+
+    const unsigned elementBytes;
+    std::vector<uint64_t> bits;
+    // Number of bits set.
+    unsigned count;
+    // Half-open range of the words of bits that may have bits set.
+    unsigned firstWord, lastWord;
+    bool all;
+
+    public:
+
+    GfxDirtyRanges (unsigned element_bytes)
+      : elementBytes(element_bytes), count(0), firstWord(0), lastWord(0), all(false)
+    { }
+
+    /** Record that element i of an array currently holding size elements has changed. */
+    void mark (unsigned i, unsigned size)
+    {
+        if (all) return;
+        unsigned w = i / 64;
+        if (w >= bits.size()) bits.resize(w + 1, 0);
+        uint64_t bit = uint64_t(1) << (i % 64);
+        if (bits[w] & bit) return;
+        bits[w] |= bit;
+        if (count == 0 || w < firstWord) firstWord = w;
+        if (count == 0 || w >= lastWord) lastWord = w + 1;
+        count++;
+        // Even as one write, this many elements cost as much as a full upload, so stop recording.
+        if (count >= size / 2) markAll();
+    }
+
+    /** Record that the whole array needs uploading, e.g. because the buffer was recreated. */
+    void markAll (void)
+    {
+        all = true;
+    }
+
+    bool empty (void) const { return !all && count == 0; }
+
+    /** Issue upload(from, to, discard) calls covering all elements changed since the last
+     * flush, for an array of the given size.  Indexes past the end (i.e. elements that have
+     * since been removed) are ignored.
+     */
+    template<class F> Flush flush (unsigned size, F upload)
+    {
+        Flush r = { 0, 0, false };
+        if (all || size == 0) {
+            bool was_all = all;
+            clear();
+            if (was_all && size > 0) return full(size, upload);
+            return r;
+        }
+        if (count == 0) return r;
+
+        // Uploading a clean gap shorter than this is cheaper than another write.
+        unsigned merge_gap = CALL_COST_BYTES / elementBytes;
+        unsigned long long full_cost =
+            (unsigned long long)size * elementBytes / 2 + CALL_COST_BYTES;
+
+        // Half-open ranges of dirty elements, and what writing them would cost so far.
+        std::vector<std::pair<unsigned, unsigned>> ranges;
+        unsigned long long ranged_cost = 0;
+        for (unsigned w = firstWord ; w < lastWord ; ++w) {
+            uint64_t word = bits[w];
+            if (word == 0) continue;
+            bits[w] = 0;
+            for (unsigned b = 0 ; word != 0 ; ++b, word >>= 1) {
+                if ((word & 1) == 0) continue;
+                unsigned i = w * 64 + b;
+                if (i >= size) break;
+                if (!ranges.empty() && i <= ranges.back().second + merge_gap) {
+                    unsigned added = i + 1 - ranges.back().second;
+                    ranged_cost += (unsigned long long)added * elementBytes;
+                    ranges.back().second = i + 1;
+                } else {
+                    ranged_cost += elementBytes + CALL_COST_BYTES;
+                    ranges.emplace_back(i, i + 1);
+                }
+            }
+            if (ranged_cost >= full_cost) {
+                // The rest can only add to it.
+                clear();
+                return full(size, upload);
+            }
+        }
+        count = 0;
+        if (ranges.empty()) return r;
+
+        for (const auto &range : ranges)
+            upload(range.first, range.second, false);
+        r.ranges = ranges.size();
+        return r;
+    }
+
+    protected:
+
+    void clear (void)
+    {
+        all = false;
+        count = 0;
+        bits.assign(bits.size(), 0);
+        firstWord = 0;
+        lastWord = 0;
+    }
+
+    template<class F> Flush full (unsigned size, F upload)
+    {
+        upload(0, size, true);
+        Flush r = { size, 1, true };
+        return r;
+    }
+};
+
+#endif
@@ -19,6 +19,8 @@
  * THE SOFTWARE.
  */
 
+#include <cstring>
+
 #include "gfx_disk_resource.h"
 #include "gfx_internal.h"
 #include "gfx_material.h"
@@ -45,7 +47,7 @@ double gfx_gpu_ram_used (void)
 
 
 GfxMeshDiskResource::GfxMeshDiskResource (const std::string &name)
-    : GfxGPUDiskResource(name)
+    : GfxGPUDiskResource(name), triangleUsers(0)
 {
     try {
         std::string ogre_name = name.substr(1);
@@ -80,9 +82,9 @@ class MyMeshDeserializer : public Ogre::Serializer {
         mVersion = "[MeshSerializer_v1.8]";
     }
     
-    void importMatNames (const Ogre::MeshPtr &pMesh, std::vector<std::string> &mat_names)
+    // Check the version and read up to the first chunk inside M_MESH.
+    void readMeshHeader (const Ogre::MeshPtr &pMesh)
     {
-
         mStream->seek(0);
 
         determineEndianness(mStream);
@@ -109,7 +111,13 @@ class MyMeshDeserializer : public Ogre::Serializer {
 
         bool skeletallyAnimated;
         readBools(mStream, &skeletallyAnimated, 1);
+    }
+
+    void importMatNames (const Ogre::MeshPtr &pMesh, std::vector<std::string> &mat_names)
+    {
+        readMeshHeader(pMesh);
 
+        unsigned short streamID;
         for (streamID = readChunk(mStream) ; !mStream->eof() ; streamID = readChunk(mStream)) {
             bool broken = false;
             switch (streamID) {
@@ -169,6 +177,155 @@ class MyMeshDeserializer : public Ogre::Serializer {
         mStream->seek(0);
 
     }
+
+    // The triangle list submeshes, with the positions of the vertexes they use.
+    void importTriangles (const Ogre::MeshPtr &pMesh, GfxMeshTriangles &tris)
+    {
+        tris.positions.clear();
+        tris.indexes.clear();
+
+        readMeshHeader(pMesh);
+
+        std::vector<float> shared;
+        // Where the shared vertexes start in tris.positions, once they have been added.
+        uint32_t shared_first = 0;
+        bool shared_added = false;
+
+        for (unsigned short streamID = readChunk(mStream) ; !mStream->eof() ;
+             streamID = readChunk(mStream)) {
+            size_t end = mStream->tell() + mCurrentstreamLen - STREAM_OVERHEAD_SIZE;
+            switch (streamID) {
+                case Ogre::M_GEOMETRY:
+                readPositions(shared);
+                break;
+
+                case Ogre::M_SUBMESH: {
+                    readString(mStream);
+                    bool use_shared;
+                    readBools(mStream, &use_shared, 1);
+                    uint32_t index_count;
+                    readInts(mStream, &index_count, 1);
+                    bool idx32;
+                    readBools(mStream, &idx32, 1);
+                    std::vector<uint32_t> indexes(index_count);
+                    if (index_count > 0) {
+                        if (idx32) {
+                            readInts(mStream, &indexes[0], index_count);
+                        } else {
+                            std::vector<unsigned short> narrow(index_count);
+                            readShorts(mStream, &narrow[0], index_count);
+                            indexes.assign(narrow.begin(), narrow.end());
+                        }
+                    }
+
+                    std::vector<float> own;
+                    unsigned short op_type = Ogre::RenderOperation::OT_TRIANGLE_LIST;
+                    while (mStream->tell() < end) {
+                        unsigned short sub_id = readChunk(mStream);
+                        size_t sub_end = mStream->tell() + mCurrentstreamLen - STREAM_OVERHEAD_SIZE;
+                        if (sub_id == Ogre::M_GEOMETRY) readPositions(own);
+                        if (sub_id == Ogre::M_SUBMESH_OPERATION) readShorts(mStream, &op_type, 1);
+                        mStream->seek(sub_end);
+                    }
+
+                    if (op_type != Ogre::RenderOperation::OT_TRIANGLE_LIST) break;
+                    const std::vector<float> &positions = use_shared ? shared : own;
+                    if (positions.empty()) break;
+                    uint32_t num_vertexes = positions.size() / 3;
+                    uint32_t first = tris.positions.size() / 3;
+                    if (use_shared && shared_added) {
+                        first = shared_first;
+                    } else {
+                        tris.positions.insert(tris.positions.end(),
+                                              positions.begin(), positions.end());
+                        if (use_shared) {
+                            shared_first = first;
+                            shared_added = true;
+                        }
+                    }
+                    for (uint32_t index : indexes) {
+                        if (index >= num_vertexes) {
+                            CERR << "Corrupted mesh, not occluding: \"" << pMesh->getName()
+                                 << "\", index " << index << " of " << num_vertexes << std::endl;
+                            tris.positions.clear();
+                            tris.indexes.clear();
+                            mStream->seek(0);
+                            return;
+                        }
+                        tris.indexes.push_back(first + index);
+                    }
+                } break;
+
+                default:
+                break;
+            }
+            mStream->seek(end);
+        }
+
+        mStream->seek(0);
+    }
+
+    private:
+
+    static const size_t STREAM_OVERHEAD_SIZE = 6; // not exposed from Ogre
+
+    // The float3 positions of the M_GEOMETRY chunk whose header has just been read, or nothing
+    // if it has none.
+    void readPositions (std::vector<float> &positions)
+    {
+        size_t end = mStream->tell() + mCurrentstreamLen - STREAM_OVERHEAD_SIZE;
+        uint32_t vertex_count;
+        readInts(mStream, &vertex_count, 1);
+
+        bool found = false;
+        unsigned short source = 0, offset = 0;
+        while (mStream->tell() < end) {
+            unsigned short streamID = readChunk(mStream);
+            size_t chunk_end = mStream->tell() + mCurrentstreamLen - STREAM_OVERHEAD_SIZE;
+            switch (streamID) {
+                case Ogre::M_GEOMETRY_VERTEX_DECLARATION:
+                while (mStream->tell() < chunk_end) {
+                    unsigned short elementID = readChunk(mStream);
+                    size_t element_end =
+                        mStream->tell() + mCurrentstreamLen - STREAM_OVERHEAD_SIZE;
+                    if (elementID == Ogre::M_GEOMETRY_VERTEX_ELEMENT) {
+                        // source, type, semantic, offset, index
+                        unsigned short e[5];
+                        readShorts(mStream, e, 5);
+                        if (e[2] == Ogre::VES_POSITION && e[1] == Ogre::VET_FLOAT3) {
+                            found = true;
+                            source = e[0];
+                            offset = e[3];
+                        }
+                    }
+                    mStream->seek(element_end);
+                }
+                break;
+
+                case Ogre::M_GEOMETRY_VERTEX_BUFFER: {
+                    unsigned short bind_index, vertex_size;
+                    readShorts(mStream, &bind_index, 1);
+                    readShorts(mStream, &vertex_size, 1);
+                    if (!found || bind_index != source || vertex_count == 0) break;
+                    if (readChunk(mStream) != Ogre::M_GEOMETRY_VERTEX_BUFFER_DATA) break;
+                    std::vector<unsigned char> data(size_t(vertex_count) * vertex_size);
+                    mStream->read(&data[0], data.size());
+                    positions.resize(size_t(vertex_count) * 3);
+                    for (size_t v = 0 ; v < vertex_count ; ++v) {
+                        float *p = &positions[v * 3];
+                        std::memcpy(p, &data[v * vertex_size + offset], 3 * sizeof(float));
+                        flipFromLittleEndian(p, sizeof(float), 3);
+                    }
+                } break;
+
+                default:
+                break;
+            }
+            mStream->seek(chunk_end);
+        }
+    }
+
+    public:
     
     Ogre::MeshSerializerListener *mListener;
 };
@@ -227,6 +384,7 @@ void GfxMeshDiskResource::reloadImpl(void)
     try {
         rp->reload();
         if (rp->hasSkeleton()) rp->getSkeleton()->reload();
+        if (triangleUsers > 0) readTriangles();
         for (unsigned long i=0 ; i<gfx_all_nodes.size() ; ++i) {
             GfxNode *leaf = gfx_all_nodes[i];
             GfxBody *b = dynamic_cast<GfxBody*>(leaf);
@@ -241,6 +399,33 @@ void GfxMeshDiskResource::reloadImpl(void)
     }       
 }  
 
+void GfxMeshDiskResource::readTriangles (void)
+{
+    Ogre::DataStreamPtr mesh_data =
+        Ogre::ResourceGroupManager::getSingleton().openResource(rp->getName(), rp->getGroup());
+    MyMeshDeserializer mmd(mesh_data, Ogre::MeshManager::getSingleton().getListener());
+    mmd.importTriangles(rp, triangles);
+}
+
+void GfxMeshDiskResource::acquireTriangles (void)
+{
+    if (triangleUsers == 0) {
+        try {
+            readTriangles();
+        } catch (Ogre::Exception &e) {
+            GRIT_EXCEPT(e.getDescription());
+        }
+    }
+    triangleUsers++;
+}
+
+void GfxMeshDiskResource::releaseTriangles (void)
+{
+    APP_ASSERT(triangleUsers > 0);
+    triangleUsers--;
+    if (triangleUsers == 0) triangles = GfxMeshTriangles();
+}
+
 void GfxMeshDiskResource::unloadImpl(void)
 {
     if (gfx_disk_resource_verbose_loads)
@@ -27,6 +27,9 @@ class GfxColourGradeLUTDiskResource;
 #ifndef GFX_DISK_RESOURCE_H
 #define GFX_DISK_RESOURCE_H
 
+#include <cstdint>
+#include <vector>
+
 #include <math_util.h>
 
 #include <centralised_log.h>
@@ -119,6 +122,14 @@ class GfxTextureDiskResource : public GfxBaseTextureDiskResource {
  * to use a different texture, the list of dependencies may become stale.  This
  * is not currently handled correctly.
  */
+/** The triangle lists of a mesh, kept in system memory for occlusion culling. */
+struct GfxMeshTriangles {
+    /** 3 floats per vertex. */
+    std::vector<float> positions;
+    /** 3 per triangle, indexing positions by vertex. */
+    std::vector<uint32_t> indexes;
+};
+
 class GfxMeshDiskResource : public GfxGPUDiskResource {
 
   public:
@@ -128,10 +139,32 @@ class GfxMeshDiskResource : public GfxGPUDiskResource {
     /** Return the internal Ogre object. */
     const Ogre::MeshPtr &getOgreMeshPtr (void) { return rp; }
 
+    /** The triangles of the mesh, for occlusion culling.  Empty unless acquired. */
+    const GfxMeshTriangles &getTriangles (void) const { return triangles; }
+
+    /** Called when a body using the mesh becomes an occluder.  The first time, the triangles
+     * are read from the mesh file, since the hardware buffers are write only.
+     */
+    void acquireTriangles (void);
+
+    /** Called when a body using the mesh stops being an occluder.  The triangles are freed once
+     * no occluder uses them.
+     */
+    void releaseTriangles (void);
+
   private:
     /** The ogre representation. */
     Ogre::MeshPtr rp;
 
+    /** Positions and indexes only. */
+    GfxMeshTriangles triangles;
+
+    /** Number of occluders using the triangles. */
+    unsigned triangleUsers;
+
+    /** Parse the triangles out of the mesh file. */
+    void readTriangles (void);
+
     /** Load via Ogre (i.e. prepare it in Ogre terminology). */
     virtual void loadImpl (void);
     /** Reload from disk via Ogre calls. */
@@ -21,6 +21,7 @@
 #include "gfx_gasoline.h"
 #include "gfx_gasoline_parser.h"
 #include "gfx_gasoline_type_system.h"
+#include "gfx_gasoline_optimiser.h"
 #include "gfx_gasoline_backend_gsl.h"
 #include "gfx_gasoline_backend_cg.h"
 #include "gfx_gasoline_backend_glsl.h"
@@ -231,6 +232,7 @@ GfxGslGlobalFuncTypeMap make_func_types (GfxGslAllocator &alloc)
     m["ddx"] = ts;  // Only available in fragment shader
     m["ddy"] = ts;  // Only available in fragment shader
     m["sqrt"] = ts;
+    m["log"] = ts;
     m["fract"] = ts;
     m["floor"] = ts;
     m["ceil"] = ts;
@@ -497,12 +499,23 @@ typedef GfxGasolineResult Continuation (const GfxGslContext &ctx,
                                         const GfxGslAst *additional_ast,
                                         const GfxGslMetadata &md);
 
-// Intended to be called with lambdas that finish off compilation.
+// Which out fields of the fragment shaders the backend uses.  A shader that is not used at all
+// keeps nothing alive in the vertex shader.
+struct LiveOuts {
+    bool dangsUsed;
+    std::set<std::string> dangs;
+    bool additionalUsed;
+    std::set<std::string> additional;
+};
+
+// Intended to be called with lambdas that finish off compilation.  If live is given, the shaders
+// are optimised for that usage before the continuation sees them.
 template<class Continuation>
 static GfxGasolineResult type_check (const std::string &vert_prog,
                                      const std::string &dangs_prog,
                                      const std::string &additional_prog,
                                      const GfxGslMetadata &md,
+                                     const LiveOuts *live,
                                      Continuation cont)
 {
     GfxGslAllocator alloc;
@@ -543,7 +556,47 @@ static GfxGasolineResult type_check (const std::string &vert_prog,
         EXCEPT << "Additional shader: " << e << ENDL;
     }
 
-    return cont(ctx, vert_ts, vert_ast, dangs_ts, dangs_ast, additional_ts, additional_ast, md);
+    if (live == nullptr)
+        return cont(ctx, vert_ts, vert_ast, dangs_ts, dangs_ast, additional_ts, additional_ast, md);
+
+    // Optimise the fragment shaders first, so the vertex shader only keeps what they capture.
+    // Each optimised shader is type-checked again so the backends see what is left.
+    GfxGslTypeSystem vert_ts2(ctx, GFX_GSL_VERTEX);
+    GfxGslTypeSystem dangs_ts2(ctx, GFX_GSL_DANGS);
+    GfxGslTypeSystem additional_ts2(ctx, GFX_GSL_COLOUR_ALPHA);
+    const GfxGslTypeSystem *dangs_final = &dangs_ts;
+    const GfxGslTypeSystem *additional_final = &additional_ts;
+    std::set<std::string> captured;
+    auto capture = [&captured] (const GfxGslTypeSystem &ts) {
+        for (const auto &tran : ts.getTrans()) {
+            if (tran.kind == GfxGslTrans::USER)
+                captured.insert(tran.path[0]);
+        }
+    };
+
+    try {
+        if (live->dangsUsed) {
+            gfx_gasoline_optimise(ctx, dangs_ast, vert_ast->vars, live->dangs, { });
+            dangs_ts2.inferAndSet(dangs_ast, vert_ast->vars);
+            dangs_final = &dangs_ts2;
+            capture(dangs_ts2);
+        }
+        if (live->additionalUsed) {
+            gfx_gasoline_optimise(ctx, additional_ast, vert_ast->vars, live->additional, { });
+            additional_ts2.inferAndSet(additional_ast, vert_ast->vars);
+            additional_final = &additional_ts2;
+            capture(additional_ts2);
+        }
+        gfx_gasoline_optimise(ctx, vert_ast, GfxGslDefMap { }, { "position" }, captured);
+        vert_ts2.inferAndSet(vert_ast, GfxGslDefMap { });
+    } catch (const Exception &) {
+        // Only possible for code the type system can generate but not check again, e.g.
+        // conversions to integer vectors.  Start again from the source, without optimising.
+        return type_check(vert_prog, dangs_prog, additional_prog, md, nullptr, cont);
+    }
+
+    return cont(ctx, vert_ts2, vert_ast, *dangs_final, dangs_ast,
+                *additional_final, additional_ast, md);
 }
 
 void gfx_gasoline_check (const std::string &vert_prog,
@@ -564,7 +617,7 @@ void gfx_gasoline_check (const std::string &vert_prog,
         return GfxGasolineResult();
     };
 
-    type_check(vert_prog, dangs_prog, additional_prog, md, cont);
+    type_check(vert_prog, dangs_prog, additional_prog, md, nullptr, cont);
 }
 
 static GfxGasolineResult gfx_gasoline_compile_colour (const GfxGslBackend backend,
@@ -603,7 +656,8 @@ static GfxGasolineResult gfx_gasoline_compile_colour (const GfxGslBackend backen
         return {vert_out, frag_out};
     };
 
-    return type_check(vert_prog, "", colour_prog, md, cont);
+    LiveOuts live = { false, { }, true, { "colour", "alpha" } };
+    return type_check(vert_prog, "", colour_prog, md, &live, cont);
 }
 
 static GfxGasolineResult gfx_gasoline_compile_body (const GfxGslBackend backend,
@@ -647,7 +701,18 @@ static GfxGasolineResult gfx_gasoline_compile_body (const GfxGslBackend backend,
         return {vert_out, frag_out};
     };
 
-    return type_check(vert_prog, dangs_prog, additional_prog, md, cont);
+    // Shadow casting only runs the dangs shader for its discards, the gbuffer has no alpha, and
+    // the alpha output of the additional shader is never used.
+    LiveOuts live;
+    live.dangsUsed = !wireframe;
+    if (!cast) {
+        live.dangs = { "diffuse", "normal", "gloss", "specular" };
+        if (!forward_only)
+            live.dangs.insert("alpha");
+    }
+    live.additionalUsed = !(cast || forward_only);
+    live.additional = { "colour" };
+    return type_check(vert_prog, dangs_prog, additional_prog, md, &live, cont);
 }
 
 GfxGasolineResult gfx_gasoline_compile (GfxGslPurpose purpose,
@@ -720,7 +785,10 @@ GfxGasolineResult gfx_gasoline_compile (GfxGslPurpose purpose,
                 return {vert_out, frag_out};
             };
 
-            return type_check("", dangs_prog, additional_prog, md, cont);
+            LiveOuts live = {
+                true, { "diffuse", "alpha", "normal", "gloss", "specular" }, true, { "colour" }
+            };
+            return type_check("", dangs_prog, additional_prog, md, &live, cont);
         }
 
         case GFX_GSL_PURPOSE_DEFERRED_AMBIENT_SUN:
@@ -736,6 +736,28 @@ std::string gfx_gasoline_preamble_fade (void)
     return ss.str();
 }
 
+std::string gfx_gasoline_generate_decal_inv_world (void)
+{
+    std::stringstream ss;
+
+    // The rows of the instance transform are coord1..3 with the translation in coord4 (see
+    // get_inst_matrix).  The columns of the inverse of the 3x3 part are the cross products of
+    // pairs of its rows, over the determinant.
+    ss << "    Float3 inv_col0 = cross(vert_coord2.xyz, vert_coord3.xyz);\n";
+    ss << "    Float3 inv_col1 = cross(vert_coord3.xyz, vert_coord1.xyz);\n";
+    ss << "    Float3 inv_col2 = cross(vert_coord1.xyz, vert_coord2.xyz);\n";
+    ss << "    Float inv_det = 1.0 / dot(vert_coord1.xyz, inv_col0);\n";
+    for (unsigned i=0 ; i<3 ; ++i) {
+        const char *c = i == 0 ? "x" : i == 1 ? "y" : "z";
+        ss << "    Float3 inv_row" << i << " = Float3(inv_col0." << c << ", inv_col1." << c
+           << ", inv_col2." << c << ") * inv_det;\n";
+        ss << "    internal_inv_world" << i << " = Float4(inv_row" << i << ", -dot(inv_row" << i
+           << ", vert_coord4.xyz));\n";
+    }
+
+    return ss.str();
+}
+
 
 std::string gfx_gasoline_preamble_transformation (bool first_person,
                                                   const GfxGslMeshEnvironment &mesh_env)
@@ -96,6 +96,10 @@ std::string gfx_gasoline_preamble_lighting (const GfxGslConfigEnvironment &cfg_e
 /** Generate general purpose utility functions for dither fading. */
 std::string gfx_gasoline_preamble_fade (void);
 
+/** Generate vertex shader statements computing internal_inv_world0..2, the rows of the inverse
+ * of the instance transform, for instanced decals. */
+std::string gfx_gasoline_generate_decal_inv_world (void);
+
 /** Generate general purpose utility functions for transforming geometry to world space. */
 std::string gfx_gasoline_preamble_transformation (bool first_person,
                                                   const GfxGslMeshEnvironment &mesh_env);
@@ -108,7 +112,7 @@ static inline void gfx_gasoline_add_internal_trans(const GfxGslInternalMap &inte
         if (pair.second->dim == 1) {
             trans.emplace_back(GfxGslTrans{ GfxGslTrans::INTERNAL, {pair.first}, pair.second });
         } else {
-            const char *chars[] = {"x", "y", "z"};
+            const char *chars[] = {"x", "y", "z", "w"};
             for (unsigned i = 0; i < pair.second->dim ; ++i) {
                 trans.emplace_back(
                     GfxGslTrans{ GfxGslTrans::INTERNAL, {pair.first, chars[i]}, pair.second });
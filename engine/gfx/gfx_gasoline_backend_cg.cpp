@@ -22,7 +22,7 @@
 #include "gfx_gasoline_backend_cg.h"
 #include "gfx_gasoline_type_system.h"
 
-static std::map<std::string, std::string> vert_semantic = {
+static const std::map<std::string, std::string> vert_semantic = {
     {"position", "POSITION"},
     {"coord0", "TEXCOORD0"},
     {"coord1", "TEXCOORD1"},
@@ -248,7 +248,7 @@ static std::string generate_vert_header (const GfxGslContext &ctx,
 
     // In (vertex attributes)
     for (const auto &f : vert_in) {
-        ss << "in " << ts->getVertType(f) << " vert_" << f << " : " << vert_semantic[f] << ";\n";
+        ss << "in " << ts->getVertType(f) << " vert_" << f << " : " << vert_semantic.at(f) << ";\n";
     }
     ss << gfx_gasoline_generate_global_fields(ctx, true);
 
@@ -784,6 +784,12 @@ void gfx_gasoline_unparse_decal_cg(const GfxGslContext &ctx,
     vert_in.insert("coord0");
     vert_in.insert("coord1");
     vert_in.insert("normal");
+    if (mesh_env.instanced) {
+        vert_in.insert("coord2");
+        vert_in.insert("coord3");
+        vert_in.insert("coord4");
+        vert_in.insert("coord5");
+    }
 
     GfxGslTypeMap vert_vars, frag_vars;
     for (const auto &pair : dangs_ts->getVars())
@@ -795,16 +801,31 @@ void gfx_gasoline_unparse_decal_cg(const GfxGslContext &ctx,
     std::vector<GfxGslTrans> trans;
     auto *f3 = ctx.alloc.makeType<GfxGslFloatType>(3);
     auto *f4 = ctx.alloc.makeType<GfxGslFloatType>(4);
-    trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord0", "x" }, f4 });
-    trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord0", "y" }, f4 });
-    trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord1", "x" }, f4 });
-    trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord1", "y" }, f4 });
+    if (mesh_env.instanced) {
+        // Coord1 onwards carry the instance, so the uv rect is packed into coord0.
+        trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord0", "x" }, f4 });
+        trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord0", "y" }, f4 });
+        trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord0", "z" }, f4 });
+        trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord0", "w" }, f4 });
+    } else {
+        trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord0", "x" }, f4 });
+        trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord0", "y" }, f4 });
+        trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord1", "x" }, f4 });
+        trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord1", "y" }, f4 });
+    }
     trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "normal", "x" }, f3 });
     trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "normal", "y" }, f3 });
     trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "normal", "z" }, f3 });
 
     std::map<std::string, const GfxGslFloatType *> internals;
     internals["normal"] = ctx.alloc.makeType<GfxGslFloatType>(3);
+    if (mesh_env.instanced) {
+        // Each instance has its own transform and fade, so they can't be uniforms.
+        internals["fade"] = ctx.alloc.makeType<GfxGslFloatType>(1);
+        internals["inv_world0"] = f4;
+        internals["inv_world1"] = f4;
+        internals["inv_world2"] = f4;
+    }
 
     gfx_gasoline_add_internal_trans(internals, trans);
 
@@ -851,6 +872,11 @@ void gfx_gasoline_unparse_decal_cg(const GfxGslContext &ctx,
     vert_ss << "{\n";
     vert_ss << "    Float3 pos_ws = transform_to_world(vert_position.xyz);\n";
     vert_ss << "    internal_normal = rotate_to_world(Float3(0, 1, 0));\n";
+    if (mesh_env.instanced) {
+        vert_ss << gfx_gasoline_generate_decal_inv_world();
+        // The 0.5/255 is necessary because apparently we lose some precision through rasterisation.
+        vert_ss << "    internal_fade = vert_coord5.x + 0.5/255;\n";
+    }
     vert_ss << "    Float3 pos_vs = mul(global_view, Float4(pos_ws, 1)).xyz;\n";
     vert_ss << "    Float4 clip_pos = mul(global_proj, Float4(pos_vs, 1));\n";
     if (ctx.d3d9) {
@@ -912,7 +938,13 @@ void gfx_gasoline_unparse_decal_cg(const GfxGslContext &ctx,
     frag_ss << "    Float normalised_cam_dist = unpack_deferred_cam_dist(texel0, texel1, texel2);\n";
     frag_ss << "    Float3 pos_ws = normalised_cam_dist * ray + global_cameraPos;\n";
     // Apply world backwards
-    frag_ss << "    Float3 pos_os = mul(internal_inv_world, Float4(pos_ws, 1)).xyz;\n";
+    if (mesh_env.instanced) {
+        frag_ss << "    Float3 pos_os = Float3(dot(internal_inv_world0, Float4(pos_ws, 1)),\n";
+        frag_ss << "                           dot(internal_inv_world1, Float4(pos_ws, 1)),\n";
+        frag_ss << "                           dot(internal_inv_world2, Float4(pos_ws, 1)));\n";
+    } else {
+        frag_ss << "    Float3 pos_os = mul(internal_inv_world, Float4(pos_ws, 1)).xyz;\n";
+    }
     frag_ss << "    pos_os += Float3(0.5, 0, 0.5);\n";
     frag_ss << "    if (pos_os.x < 0) discard;\n";
     frag_ss << "    if (pos_os.x > 1) discard;\n";
@@ -922,7 +954,11 @@ void gfx_gasoline_unparse_decal_cg(const GfxGslContext &ctx,
     frag_ss << "    if (pos_os.y > 0.5) discard;\n";
     // Overwriting the vertex coord is a bit weird but it's the easiest way to make it available
     // to the dangs shader.
-    frag_ss << "    vert_coord0.xy = lerp(vert_coord0.xy, vert_coord1.xy, pos_os.xz);\n";
+    if (mesh_env.instanced) {
+        frag_ss << "    vert_coord0.xy = lerp(vert_coord0.xy, vert_coord0.zw, pos_os.xz);\n";
+    } else {
+        frag_ss << "    vert_coord0.xy = lerp(vert_coord0.xy, vert_coord1.xy, pos_os.xz);\n";
+    }
     frag_ss << "    vert_coord0.zw = Float2(1 - abs(2 * pos_os.y), 0);\n";
     frag_ss << "    vert_normal.xyz = internal_normal;\n";
 
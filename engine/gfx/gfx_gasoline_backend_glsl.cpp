@@ -23,7 +23,7 @@
 #include "gfx_gasoline_backend.h"
 #include "gfx_gasoline_backend_cg.h"
 
-static std::map<std::string, std::string> vert_global = {
+static const std::map<std::string, std::string> vert_global = {
     {"position", "vertex"},
     {"normal", "normal"},
     {"tangent", "tangent"},
@@ -204,7 +204,7 @@ static std::string generate_vert_header (bool glsl33,
     for (const auto &f : vert_in) {
         // I don't think it's possible to use the layout qualifier here, without
         // changing (or at least examining) the way that Ogre::Mesh maps to gl buffers.
-        ss << "in " << ts->getVertType(f) << " " << vert_global[f] << ";\n";
+        ss << "in " << ts->getVertType(f) << " " << vert_global.at(f) << ";\n";
         ss << ts->getVertType(f) << " vert_" << f << ";\n";
     }
     ss << gfx_gasoline_generate_global_fields(ctx, false);
@@ -365,7 +365,7 @@ void gfx_gasoline_unparse_glsl (const GfxGslContext &ctx,
     vert_ss << "void main (void)\n";
     vert_ss << "{\n";
     for (const auto &f : vert_in)
-        vert_ss << "    vert_" << f << " = " << vert_global[f] << ";\n";
+        vert_ss << "    vert_" << f << " = " << vert_global.at(f) << ";\n";
     vert_ss << "    Float3 world_pos;\n";
     vert_ss << "    func_user_vertex(world_pos);\n";
     if (das) {
@@ -559,7 +559,7 @@ void gfx_gasoline_unparse_body_glsl(const GfxGslContext &ctx,
     vert_ss << "void main (void)\n";
     vert_ss << "{\n";
     for (const auto &f : vert_in)
-        vert_ss << "    vert_" << f << " = " << vert_global[f] << ";\n";
+        vert_ss << "    vert_" << f << " = " << vert_global.at(f) << ";\n";
     vert_ss << "    Float3 pos_ws;\n";
     vert_ss << "    func_user_vertex(pos_ws);\n";
     if (cast) {
@@ -740,6 +740,12 @@ void gfx_gasoline_unparse_decal_glsl(const GfxGslContext &ctx,
     vert_in.insert("coord0");
     vert_in.insert("coord1");
     vert_in.insert("normal");
+    if (mesh_env.instanced) {
+        vert_in.insert("coord2");
+        vert_in.insert("coord3");
+        vert_in.insert("coord4");
+        vert_in.insert("coord5");
+    }
 
     GfxGslTypeMap vert_vars, frag_vars;
     for (const auto &pair : dangs_ts->getVars())
@@ -751,16 +757,31 @@ void gfx_gasoline_unparse_decal_glsl(const GfxGslContext &ctx,
     std::vector<GfxGslTrans> trans;
     auto *f3 = ctx.alloc.makeType<GfxGslFloatType>(3);
     auto *f4 = ctx.alloc.makeType<GfxGslFloatType>(4);
-    trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord0", "x" }, f4 });
-    trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord0", "y" }, f4 });
-    trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord1", "x" }, f4 });
-    trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord1", "y" }, f4 });
+    if (mesh_env.instanced) {
+        // Coord1 onwards carry the instance, so the uv rect is packed into coord0.
+        trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord0", "x" }, f4 });
+        trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord0", "y" }, f4 });
+        trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord0", "z" }, f4 });
+        trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord0", "w" }, f4 });
+    } else {
+        trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord0", "x" }, f4 });
+        trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord0", "y" }, f4 });
+        trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord1", "x" }, f4 });
+        trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "coord1", "y" }, f4 });
+    }
     trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "normal", "x" }, f3 });
     trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "normal", "y" }, f3 });
     trans.emplace_back(GfxGslTrans{ GfxGslTrans::VERT, { "normal", "z" }, f3 });
 
     std::map<std::string, const GfxGslFloatType *> internals;
     internals["normal"] = ctx.alloc.makeType<GfxGslFloatType>(3);
+    if (mesh_env.instanced) {
+        // Each instance has its own transform and fade, so they can't be uniforms.
+        internals["fade"] = ctx.alloc.makeType<GfxGslFloatType>(1);
+        internals["inv_world0"] = f4;
+        internals["inv_world1"] = f4;
+        internals["inv_world2"] = f4;
+    }
 
     gfx_gasoline_add_internal_trans(internals, trans);
 
@@ -797,9 +818,14 @@ void gfx_gasoline_unparse_decal_glsl(const GfxGslContext &ctx,
     vert_ss << "void main (void)\n";
     vert_ss << "{\n";
     for (const auto &f : vert_in)
-        vert_ss << "    vert_" << f << " = " << vert_global[f] << ";\n";
+        vert_ss << "    vert_" << f << " = " << vert_global.at(f) << ";\n";
     vert_ss << "    Float3 pos_ws = transform_to_world(vert_position.xyz);\n";
     vert_ss << "    internal_normal = rotate_to_world(Float3(0, 1, 0));\n";
+    if (mesh_env.instanced) {
+        vert_ss << gfx_gasoline_generate_decal_inv_world();
+        // The 0.5/255 is necessary because apparently we lose some precision through rasterisation.
+        vert_ss << "    internal_fade = vert_coord5.x + 0.5/255;\n";
+    }
     vert_ss << "    gl_Position = mul(global_viewProj, Float4(pos_ws, 1));\n";
     vert_ss << "    gl_Position.y *= internal_rt_flip;\n";
     vert_ss << gfx_gasoline_generate_trans_encode(trans, "uvert_");
@@ -845,7 +871,13 @@ void gfx_gasoline_unparse_decal_glsl(const GfxGslContext &ctx,
     frag_ss << "    Float3 pos_ws = normalised_cam_dist * ray + global_cameraPos;\n";
 
     // Apply world backwards
-    frag_ss << "    Float3 pos_os = mul(internal_inv_world, Float4(pos_ws, 1)).xyz;\n";
+    if (mesh_env.instanced) {
+        frag_ss << "    Float3 pos_os = Float3(dot(internal_inv_world0, Float4(pos_ws, 1)),\n";
+        frag_ss << "                           dot(internal_inv_world1, Float4(pos_ws, 1)),\n";
+        frag_ss << "                           dot(internal_inv_world2, Float4(pos_ws, 1)));\n";
+    } else {
+        frag_ss << "    Float3 pos_os = mul(internal_inv_world, Float4(pos_ws, 1)).xyz;\n";
+    }
     frag_ss << "    pos_os += Float3(0.5, 0, 0.5);\n";
     frag_ss << "    if (pos_os.x < 0) discard;\n";
     frag_ss << "    if (pos_os.x > 1) discard;\n";
@@ -855,7 +887,11 @@ void gfx_gasoline_unparse_decal_glsl(const GfxGslContext &ctx,
     frag_ss << "    if (pos_os.y > 0.5) discard;\n";
     // Overwriting the vertex coord is a bit weird but it's the easiest way to make it available
     // to the dangs shader.
-    frag_ss << "    vert_coord0.xy = lerp(vert_coord0.xy, vert_coord1.xy, pos_os.xz);\n";
+    if (mesh_env.instanced) {
+        frag_ss << "    vert_coord0.xy = lerp(vert_coord0.xy, vert_coord0.zw, pos_os.xz);\n";
+    } else {
+        frag_ss << "    vert_coord0.xy = lerp(vert_coord0.xy, vert_coord1.xy, pos_os.xz);\n";
+    }
     frag_ss << "    vert_coord0.zw = Float2(1 - abs(2 * pos_os.y), 0);\n";
     frag_ss << "    vert_normal.xyz = internal_normal;\n";
 
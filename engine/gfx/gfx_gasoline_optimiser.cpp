@@ -0,0 +1,929 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+
+#include <map>
+#include <sstream>
+#include <typeinfo>
+
+#include <centralised_log.h>
+
+#include "gfx_gasoline_optimiser.h"
+
+namespace {
+
+    typedef std::set<std::string> Names;
+
+    // Out fields share the namespace of variables when tracking what is read.  This cannot
+    // clash because identifiers cannot contain a '.'.
+    std::string out_key (const std::string &id)
+    {
+        return "out." + id;
+    }
+
+    bool is_sample (const std::string &func)
+    {
+        return func == "sample" || func == "sampleGrad" || func == "sampleLod";
+    }
+
+    bool swizzle_offset (char c, unsigned &offset)
+    {
+        switch (c) {
+            case 'x': case 'r': offset = 0; return true;
+            case 'y': case 'g': offset = 1; return true;
+            case 'z': case 'b': offset = 2; return true;
+            case 'w': case 'a': offset = 3; return true;
+        }
+        return false;
+    }
+
+    // Literals are unparsed with the default stream precision, so only fold to values that
+    // survive the round trip.
+    bool prints_exactly (float v)
+    {
+        if (!std::isfinite(v)) return false;
+        std::stringstream ss;
+        ss << v;
+        return strtof(ss.str().c_str(), nullptr) == v;
+    }
+
+    // Whether every component of a literal scalar or vector constructor is v.
+    bool is_constant (const GfxGslAst *ast_, float v)
+    {
+        if (auto *ast = dynamic_cast<const GfxGslLiteralFloat*>(ast_))
+            return ast->val == v;
+        if (auto *ast = dynamic_cast<const GfxGslLiteralInt*>(ast_))
+            return ast->val == v;
+        if (auto *ast = dynamic_cast<const GfxGslCall*>(ast_)) {
+            if (ast->func != "Float" && ast->func != "Float2" && ast->func != "Float3"
+                && ast->func != "Float4")
+                return false;
+            for (auto *arg : ast->args) {
+                if (!is_constant(arg, v)) return false;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // Structural equality of expressions.
+    bool same (const GfxGslAst *a_, const GfxGslAst *b_)
+    {
+        if (typeid(*a_) != typeid(*b_)) return false;
+        if (auto *a = dynamic_cast<const GfxGslVar*>(a_)) {
+            return a->id == static_cast<const GfxGslVar*>(b_)->id;
+        } else if (auto *a = dynamic_cast<const GfxGslField*>(a_)) {
+            auto *b = static_cast<const GfxGslField*>(b_);
+            return a->id == b->id && same(a->target, b->target);
+        } else if (auto *a = dynamic_cast<const GfxGslCall*>(a_)) {
+            auto *b = static_cast<const GfxGslCall*>(b_);
+            if (a->func != b->func || a->args.size() != b->args.size()) return false;
+            for (unsigned i=0 ; i<a->args.size() ; ++i) {
+                if (!same(a->args[i], b->args[i])) return false;
+            }
+            return true;
+        } else if (auto *a = dynamic_cast<const GfxGslBinary*>(a_)) {
+            auto *b = static_cast<const GfxGslBinary*>(b_);
+            return a->op == b->op && same(a->a, b->a) && same(a->b, b->b);
+        } else if (auto *a = dynamic_cast<const GfxGslLiteralFloat*>(a_)) {
+            return a->val == static_cast<const GfxGslLiteralFloat*>(b_)->val;
+        } else if (auto *a = dynamic_cast<const GfxGslLiteralInt*>(a_)) {
+            return a->val == static_cast<const GfxGslLiteralInt*>(b_)->val;
+        } else if (auto *a = dynamic_cast<const GfxGslLiteralBoolean*>(a_)) {
+            return a->val == static_cast<const GfxGslLiteralBoolean*>(b_)->val;
+        }
+        // The object keywords have no state.
+        return dynamic_cast<const GfxGslGlobal*>(a_) || dynamic_cast<const GfxGslMat*>(a_)
+               || dynamic_cast<const GfxGslVert*>(a_) || dynamic_cast<const GfxGslFrag*>(a_);
+    }
+
+    // The variable or out field (as an out_key) written by assigning to target, or "" for
+    // objects whose writes always matter.
+    std::string written_key (const GfxGslAst *target)
+    {
+        while (true) {
+            if (auto *ast = dynamic_cast<const GfxGslVar*>(target))
+                return ast->id;
+            if (auto *ast = dynamic_cast<const GfxGslField*>(target)) {
+                if (dynamic_cast<const GfxGslOut*>(ast->target))
+                    return out_key(ast->id);
+                target = ast->target;
+            } else if (auto *ast = dynamic_cast<const GfxGslArrayLookup*>(target)) {
+                target = ast->target;
+            } else {
+                return "";
+            }
+        }
+    }
+
+    // Call f on a reference to each child of the node (which may be null), and whether that
+    // child only runs conditionally.
+    template<class F> void each_child (GfxGslAst *ast_, F f)
+    {
+        if (auto *ast = dynamic_cast<GfxGslBlock*>(ast_)) {
+            for (auto *&stmt : ast->stmts)
+                f(stmt, false);
+        } else if (auto *ast = dynamic_cast<GfxGslDecl*>(ast_)) {
+            f(ast->init, false);
+        } else if (auto *ast = dynamic_cast<GfxGslIf*>(ast_)) {
+            f(ast->cond, false);
+            f(ast->yes, true);
+            f(ast->no, true);
+        } else if (auto *ast = dynamic_cast<GfxGslFor*>(ast_)) {
+            f(ast->init, false);
+            f(ast->cond, true);
+            f(ast->inc, true);
+            f(ast->body, true);
+        } else if (auto *ast = dynamic_cast<GfxGslAssign*>(ast_)) {
+            f(ast->target, false);
+            f(ast->expr, false);
+        } else if (auto *ast = dynamic_cast<GfxGslCall*>(ast_)) {
+            for (auto *&arg : ast->args)
+                f(arg, false);
+        } else if (auto *ast = dynamic_cast<GfxGslField*>(ast_)) {
+            f(ast->target, false);
+        } else if (auto *ast = dynamic_cast<GfxGslArrayLookup*>(ast_)) {
+            f(ast->target, false);
+            f(ast->index, false);
+        } else if (auto *ast = dynamic_cast<GfxGslLiteralArray*>(ast_)) {
+            for (auto *&el : ast->elements)
+                f(el, false);
+        } else if (auto *ast = dynamic_cast<GfxGslBinary*>(ast_)) {
+            f(ast->a, false);
+            f(ast->b, false);
+        }
+    }
+
+    class Optimiser {
+        GfxGslContext &ctx;
+        GfxGslShader *shader;
+        const GfxGslDefMap &outer;
+        const Names &liveOuts;
+        const Names &captured;
+
+        // Set whenever dead code elimination removes something, as that may make more dead.
+        bool changed;
+
+        // Variables and out fields that are read, other than to compute their own new value.
+        Names reads;
+
+        // Variables that hold the same value wherever they are read: declared once at top level
+        // (or by the previous shader) and never assigned.
+        Names immutable;
+        // Every variable name used, so new ones do not clash.
+        Names identifiers;
+        unsigned nextTemp;
+
+        // Immutable variables initialised to literals.
+        std::map<std::string, const GfxGslAst*> constants;
+        bool propagated;
+
+        struct SampleUse {
+            GfxGslAst **slot;
+            bool conditional;
+            unsigned stmt;
+        };
+
+        GfxGslLiteralFloat *makeFloat (const GfxGslLocation &loc, float v)
+        {
+            auto *r = ctx.alloc.makeAst<GfxGslLiteralFloat>(loc, v);
+            r->type = ctx.alloc.makeType<GfxGslFloatType>(1);
+            return r;
+        }
+
+        GfxGslLiteralInt *makeInt (const GfxGslLocation &loc, int32_t v)
+        {
+            auto *r = ctx.alloc.makeAst<GfxGslLiteralInt>(loc, v);
+            r->type = ctx.alloc.makeType<GfxGslIntType>(1);
+            return r;
+        }
+
+        GfxGslLiteralBoolean *makeBool (const GfxGslLocation &loc, bool v)
+        {
+            auto *r = ctx.alloc.makeAst<GfxGslLiteralBoolean>(loc, v);
+            r->type = ctx.alloc.makeType<GfxGslBoolType>();
+            return r;
+        }
+
+        GfxGslAst *makeFloatVec (const GfxGslLocation &loc, const float *v, unsigned dim)
+        {
+            if (dim == 1)
+                return makeFloat(loc, v[0]);
+            const char *names[] = { "Float", "Float2", "Float3", "Float4" };
+            GfxGslAsts args;
+            for (unsigned i=0 ; i<dim ; ++i)
+                args.push_back(makeFloat(loc, v[i]));
+            auto *r = ctx.alloc.makeAst<GfxGslCall>(loc, names[dim - 1], args);
+            r->type = ctx.alloc.makeType<GfxGslFloatType>(dim);
+            return r;
+        }
+
+        GfxGslBlock *makeBlock (const GfxGslLocation &loc, GfxGslAst *stmt)
+        {
+            GfxGslAsts stmts;
+            if (stmt != nullptr)
+                stmts.push_back(stmt);
+            auto *r = ctx.alloc.makeAst<GfxGslBlock>(loc, stmts);
+            r->type = ctx.alloc.makeType<GfxGslVoidType>();
+            return r;
+        }
+
+        // The components of a vector constructor whose arguments are all literals.
+        bool literalVector (const GfxGslAst *ast_, float *v, unsigned &dim)
+        {
+            auto *ast = dynamic_cast<const GfxGslCall*>(ast_);
+            if (ast == nullptr) return false;
+            auto *type = dynamic_cast<const GfxGslFloatType*>(ast->type);
+            if (type == nullptr || ast->func.compare(0, 5, "Float") != 0) return false;
+            dim = type->dim;
+            if (ast->args.size() != 1 && ast->args.size() != dim) return false;
+            for (unsigned i=0 ; i<dim ; ++i) {
+                const GfxGslAst *arg = ast->args[ast->args.size() == 1 ? 0 : i];
+                if (auto *f = dynamic_cast<const GfxGslLiteralFloat*>(arg)) {
+                    v[i] = f->val;
+                } else if (auto *n = dynamic_cast<const GfxGslLiteralInt*>(arg)) {
+                    if (ast->args.size() != 1) return false;  // Would not type check.
+                    v[i] = n->val;
+                } else {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        GfxGslAst *foldMatField (GfxGslField *ast)
+        {
+            auto it = ctx.staticValues.find(ast->id);
+            if (it == ctx.staticValues.end() || !gfx_gasoline_param_is_static(it->second))
+                return ast;
+            const GfxGslParam &p = it->second;
+            const float fs[] = { p.fs.r, p.fs.g, p.fs.b, p.fs.a };
+            switch (p.t) {
+                case GFX_GSL_STATIC_FLOAT1: return makeFloatVec(ast->loc, fs, 1);
+                case GFX_GSL_STATIC_FLOAT2: return makeFloatVec(ast->loc, fs, 2);
+                case GFX_GSL_STATIC_FLOAT3: return makeFloatVec(ast->loc, fs, 3);
+                case GFX_GSL_STATIC_FLOAT4: return makeFloatVec(ast->loc, fs, 4);
+                case GFX_GSL_STATIC_INT1: return makeInt(ast->loc, p.is.r);
+                // Integer vectors have no constructor function in the language.
+                default: return ast;
+            }
+        }
+
+        GfxGslAst *foldFloat (GfxGslBinary *ast, float v)
+        {
+            if (!prints_exactly(v)) return ast;
+            return makeFloat(ast->loc, v);
+        }
+
+        GfxGslAst *foldInt (GfxGslBinary *ast, int64_t v)
+        {
+            if (v < INT32_MIN || v > INT32_MAX) return ast;
+            return makeInt(ast->loc, int32_t(v));
+        }
+
+        GfxGslAst *foldBinary (GfxGslBinary *ast)
+        {
+            const GfxGslLocation &loc = ast->loc;
+            ast->a = fold(ast->a);
+            ast->b = fold(ast->b);
+
+            auto *fa = dynamic_cast<GfxGslLiteralFloat*>(ast->a);
+            auto *fb = dynamic_cast<GfxGslLiteralFloat*>(ast->b);
+            if (fa != nullptr && fb != nullptr) {
+                float a = fa->val, b = fb->val;
+                switch (ast->op) {
+                    case GFX_GSL_OP_ADD: return foldFloat(ast, a + b);
+                    case GFX_GSL_OP_SUB: return foldFloat(ast, a - b);
+                    case GFX_GSL_OP_MUL: return foldFloat(ast, a * b);
+                    case GFX_GSL_OP_DIV: return b == 0 ? ast : foldFloat(ast, a / b);
+                    case GFX_GSL_OP_EQ: return makeBool(loc, a == b);
+                    case GFX_GSL_OP_NE: return makeBool(loc, a != b);
+                    case GFX_GSL_OP_LT: return makeBool(loc, a < b);
+                    case GFX_GSL_OP_LTE: return makeBool(loc, a <= b);
+                    case GFX_GSL_OP_GT: return makeBool(loc, a > b);
+                    case GFX_GSL_OP_GTE: return makeBool(loc, a >= b);
+                    // The backends differ in the sign of mod.
+                    default: return ast;
+                }
+            }
+
+            auto *ia = dynamic_cast<GfxGslLiteralInt*>(ast->a);
+            auto *ib = dynamic_cast<GfxGslLiteralInt*>(ast->b);
+            if (ia != nullptr && ib != nullptr) {
+                int64_t a = ia->val, b = ib->val;
+                switch (ast->op) {
+                    case GFX_GSL_OP_ADD: return foldInt(ast, a + b);
+                    case GFX_GSL_OP_SUB: return foldInt(ast, a - b);
+                    case GFX_GSL_OP_MUL: return foldInt(ast, a * b);
+                    // Rounding of negative division is not the same everywhere.
+                    case GFX_GSL_OP_DIV: return a >= 0 && b > 0 ? foldInt(ast, a / b) : ast;
+                    case GFX_GSL_OP_EQ: return makeBool(loc, a == b);
+                    case GFX_GSL_OP_NE: return makeBool(loc, a != b);
+                    case GFX_GSL_OP_LT: return makeBool(loc, a < b);
+                    case GFX_GSL_OP_LTE: return makeBool(loc, a <= b);
+                    case GFX_GSL_OP_GT: return makeBool(loc, a > b);
+                    case GFX_GSL_OP_GTE: return makeBool(loc, a >= b);
+                    default: return ast;
+                }
+            }
+
+            float va[4], vb[4];
+            unsigned da, db;
+            if (literalVector(ast->a, va, da) && literalVector(ast->b, vb, db) && da == db) {
+                float r[4];
+                for (unsigned i=0 ; i<da ; ++i) {
+                    switch (ast->op) {
+                        case GFX_GSL_OP_ADD: r[i] = va[i] + vb[i]; break;
+                        case GFX_GSL_OP_SUB: r[i] = va[i] - vb[i]; break;
+                        case GFX_GSL_OP_MUL: r[i] = va[i] * vb[i]; break;
+                        case GFX_GSL_OP_DIV:
+                        if (vb[i] == 0) return ast;
+                        r[i] = va[i] / vb[i];
+                        break;
+                        default: return ast;
+                    }
+                    if (!prints_exactly(r[i])) return ast;
+                }
+                return makeFloatVec(loc, r, da);
+            }
+
+            // Expressions have no side effects, so the other operand can be dropped.
+            auto *ba = dynamic_cast<GfxGslLiteralBoolean*>(ast->a);
+            auto *bb = dynamic_cast<GfxGslLiteralBoolean*>(ast->b);
+            if (ba != nullptr && bb != nullptr) {
+                switch (ast->op) {
+                    case GFX_GSL_OP_EQ: return makeBool(loc, ba->val == bb->val);
+                    case GFX_GSL_OP_NE: return makeBool(loc, ba->val != bb->val);
+                    default: break;
+                }
+            }
+            if (ast->op == GFX_GSL_OP_AND) {
+                if (ba != nullptr) return ba->val ? ast->b : ba;
+                if (bb != nullptr) return bb->val ? ast->a : bb;
+            } else if (ast->op == GFX_GSL_OP_OR) {
+                if (ba != nullptr) return ba->val ? ba : ast->b;
+                if (bb != nullptr) return bb->val ? bb : ast->a;
+            }
+
+            // Identities.  Both operands have the type of the result after unification.
+            switch (ast->op) {
+                case GFX_GSL_OP_ADD:
+                if (is_constant(ast->b, 0)) return ast->a;
+                if (is_constant(ast->a, 0)) return ast->b;
+                break;
+                case GFX_GSL_OP_SUB:
+                if (is_constant(ast->b, 0)) return ast->a;
+                break;
+                case GFX_GSL_OP_MUL:
+                if (is_constant(ast->b, 1)) return ast->a;
+                if (is_constant(ast->a, 1)) return ast->b;
+                break;
+                case GFX_GSL_OP_DIV:
+                if (is_constant(ast->b, 1)) return ast->a;
+                break;
+                default: break;
+            }
+            return ast;
+        }
+
+        GfxGslAst *foldField (GfxGslField *ast)
+        {
+            if (dynamic_cast<GfxGslMat*>(ast->target))
+                return foldMatField(ast);
+            ast->target = fold(ast->target);
+
+            // Swizzle of a constant.
+            if (auto *f = dynamic_cast<GfxGslLiteralFloat*>(ast->target)) {
+                if (ast->id.length() == 1) return f;
+            }
+            float v[4];
+            unsigned dim;
+            if (literalVector(ast->target, v, dim)) {
+                float r[4];
+                for (unsigned i=0 ; i<ast->id.length() ; ++i) {
+                    unsigned offset;
+                    if (!swizzle_offset(ast->id[i], offset) || offset >= dim) return ast;
+                    r[i] = v[offset];
+                }
+                return makeFloatVec(ast->loc, r, ast->id.length());
+            }
+            return ast;
+        }
+
+        GfxGslAst *foldCall (GfxGslCall *ast)
+        {
+            for (auto *&arg : ast->args)
+                arg = fold(arg);
+
+            // Unbound textures that are not uniforms sample to a constant colour.
+            if (is_sample(ast->func) && ast->args.size() > 0) {
+                auto *tex = dynamic_cast<GfxGslField*>(ast->args[0]);
+                if (tex != nullptr && dynamic_cast<GfxGslMat*>(tex->target)) {
+                    auto it = ctx.ubt.find(tex->id);
+                    auto *tt = dynamic_cast<GfxGslTextureType*>(tex->type);
+                    if (it != ctx.ubt.end() && !it->second && tt != nullptr) {
+                        const float v[] = { tt->solid.r, tt->solid.g, tt->solid.b, tt->solid.a };
+                        return makeFloatVec(ast->loc, v, 4);
+                    }
+                }
+            }
+
+            // Conversion of a literal.
+            if (ast->func == "Float" && ast->args.size() == 1) {
+                if (auto *f = dynamic_cast<GfxGslLiteralFloat*>(ast->args[0]))
+                    return f;
+                if (auto *n = dynamic_cast<GfxGslLiteralInt*>(ast->args[0])) {
+                    if (int64_t(float(n->val)) == n->val)
+                        return makeFloat(ast->loc, n->val);
+                }
+            }
+            return ast;
+        }
+
+        // Returns nullptr for statements that turn out to do nothing.
+        GfxGslAst *fold (GfxGslAst *ast_)
+        {
+            if (ast_ == nullptr) return nullptr;
+
+            if (auto *ast = dynamic_cast<GfxGslBlock*>(ast_)) {
+                foldStmts(ast->stmts);
+                return ast;
+
+            } else if (auto *ast = dynamic_cast<GfxGslDecl*>(ast_)) {
+                if (auto *arr = dynamic_cast<GfxGslLiteralArray*>(ast->init)) {
+                    for (auto *&el : arr->elements)
+                        el = fold(el);
+                } else {
+                    ast->init = fold(ast->init);
+                }
+                return ast;
+
+            } else if (auto *ast = dynamic_cast<GfxGslIf*>(ast_)) {
+                ast->cond = fold(ast->cond);
+                if (auto *cond = dynamic_cast<GfxGslLiteralBoolean*>(ast->cond)) {
+                    GfxGslAst *branch = fold(cond->val ? ast->yes : ast->no);
+                    if (branch == nullptr) return nullptr;
+                    // Keep any variables in their own scope.
+                    if (dynamic_cast<GfxGslBlock*>(branch) == nullptr)
+                        branch = makeBlock(branch->loc, branch);
+                    return branch;
+                }
+                ast->yes = fold(ast->yes);
+                if (ast->yes == nullptr)
+                    ast->yes = makeBlock(ast->loc, nullptr);
+                ast->no = fold(ast->no);
+                return ast;
+
+            } else if (auto *ast = dynamic_cast<GfxGslFor*>(ast_)) {
+                ast->init = fold(ast->init);
+                ast->cond = fold(ast->cond);
+                ast->inc = fold(ast->inc);
+                ast->body = fold(ast->body);
+                if (ast->body == nullptr)
+                    ast->body = makeBlock(ast->loc, nullptr);
+                return ast;
+
+            } else if (auto *ast = dynamic_cast<GfxGslAssign*>(ast_)) {
+                ast->expr = fold(ast->expr);
+                return ast;
+
+            } else if (auto *ast = dynamic_cast<GfxGslCall*>(ast_)) {
+                return foldCall(ast);
+
+            } else if (auto *ast = dynamic_cast<GfxGslField*>(ast_)) {
+                return foldField(ast);
+
+            } else if (auto *ast = dynamic_cast<GfxGslArrayLookup*>(ast_)) {
+                ast->index = fold(ast->index);
+                return ast;
+
+            } else if (auto *ast = dynamic_cast<GfxGslBinary*>(ast_)) {
+                return foldBinary(ast);
+            }
+            return ast_;
+        }
+
+        void foldStmts (GfxGslAsts &stmts)
+        {
+            GfxGslAsts r;
+            for (auto *stmt : stmts) {
+                stmt = fold(stmt);
+                if (stmt != nullptr) r.push_back(stmt);
+            }
+            stmts = r;
+        }
+
+
+        // Dead code elimination.
+
+        // Reads in the target of an assignment, i.e. array indexes.
+        void countTargetReads (const GfxGslAst *target, const std::string &self)
+        {
+            if (auto *ast = dynamic_cast<const GfxGslField*>(target)) {
+                countTargetReads(ast->target, self);
+            } else if (auto *ast = dynamic_cast<const GfxGslArrayLookup*>(target)) {
+                countTargetReads(ast->target, self);
+                countReads(ast->index, self);
+            }
+        }
+
+        // Self is the variable or out field being assigned, reading it to compute its own new
+        // value does not make it live.
+        void countReads (const GfxGslAst *ast_, const std::string &self)
+        {
+            if (ast_ == nullptr) return;
+
+            if (auto *ast = dynamic_cast<const GfxGslBlock*>(ast_)) {
+                for (auto *stmt : ast->stmts)
+                    countReads(stmt, "");
+            } else if (auto *ast = dynamic_cast<const GfxGslDecl*>(ast_)) {
+                if (auto *arr = dynamic_cast<const GfxGslLiteralArray*>(ast->init)) {
+                    for (auto *el : arr->elements)
+                        countReads(el, "");
+                } else {
+                    countReads(ast->init, "");
+                }
+            } else if (auto *ast = dynamic_cast<const GfxGslIf*>(ast_)) {
+                countReads(ast->cond, "");
+                countReads(ast->yes, "");
+                countReads(ast->no, "");
+            } else if (auto *ast = dynamic_cast<const GfxGslFor*>(ast_)) {
+                countReads(ast->init, "");
+                countReads(ast->cond, "");
+                countReads(ast->inc, "");
+                countReads(ast->body, "");
+            } else if (auto *ast = dynamic_cast<const GfxGslAssign*>(ast_)) {
+                std::string key = written_key(ast->target);
+                countTargetReads(ast->target, key);
+                countReads(ast->expr, key);
+            } else if (auto *ast = dynamic_cast<const GfxGslCall*>(ast_)) {
+                for (auto *arg : ast->args)
+                    countReads(arg, self);
+            } else if (auto *ast = dynamic_cast<const GfxGslField*>(ast_)) {
+                if (dynamic_cast<const GfxGslOut*>(ast->target)) {
+                    std::string key = out_key(ast->id);
+                    if (key != self) reads.insert(key);
+                } else {
+                    countReads(ast->target, self);
+                }
+            } else if (auto *ast = dynamic_cast<const GfxGslArrayLookup*>(ast_)) {
+                countReads(ast->target, self);
+                countReads(ast->index, self);
+            } else if (auto *ast = dynamic_cast<const GfxGslLiteralArray*>(ast_)) {
+                for (auto *el : ast->elements)
+                    countReads(el, self);
+            } else if (auto *ast = dynamic_cast<const GfxGslVar*>(ast_)) {
+                if (ast->id != self) reads.insert(ast->id);
+            } else if (auto *ast = dynamic_cast<const GfxGslBinary*>(ast_)) {
+                countReads(ast->a, self);
+                countReads(ast->b, self);
+            }
+        }
+
+        bool isLive (const std::string &key)
+        {
+            if (key == "" || reads.find(key) != reads.end()) return true;
+            if (key.compare(0, 4, "out.") == 0)
+                return liveOuts.find(key.substr(4)) != liveOuts.end();
+            return captured.find(key) != captured.end();
+        }
+
+        // Returns nullptr if the statement has no effect.
+        GfxGslAst *prune (GfxGslAst *ast_)
+        {
+            if (ast_ == nullptr) return nullptr;
+
+            if (auto *ast = dynamic_cast<GfxGslBlock*>(ast_)) {
+                pruneStmts(ast->stmts);
+                return ast->stmts.empty() ? nullptr : ast;
+
+            } else if (auto *ast = dynamic_cast<GfxGslDecl*>(ast_)) {
+                if (isLive(ast->id)) return ast;
+
+            } else if (auto *ast = dynamic_cast<GfxGslAssign*>(ast_)) {
+                if (isLive(written_key(ast->target))) return ast;
+
+            } else if (auto *ast = dynamic_cast<GfxGslIf*>(ast_)) {
+                ast->yes = prune(ast->yes);
+                ast->no = prune(ast->no);
+                if (ast->yes != nullptr || ast->no != nullptr) {
+                    if (ast->yes == nullptr)
+                        ast->yes = makeBlock(ast->loc, nullptr);
+                    return ast;
+                }
+
+            } else if (auto *ast = dynamic_cast<GfxGslFor*>(ast_)) {
+                ast->body = prune(ast->body);
+                if (ast->body != nullptr) return ast;
+                // Otherwise the loop can only assign its own variable.
+                if (ast->id == "") {
+                    ast->body = makeBlock(ast->loc, nullptr);
+                    return ast;
+                }
+
+            } else {
+                return ast_;
+            }
+
+            changed = true;
+            return nullptr;
+        }
+
+        void pruneStmts (GfxGslAsts &stmts)
+        {
+            GfxGslAsts r;
+            for (auto *stmt : stmts) {
+                stmt = prune(stmt);
+                if (stmt != nullptr) r.push_back(stmt);
+            }
+            stmts = r;
+        }
+
+        void eliminateDeadCode (void)
+        {
+            do {
+                changed = false;
+                reads.clear();
+                for (auto *stmt : shader->stmts)
+                    countReads(stmt, "");
+                pruneStmts(shader->stmts);
+            } while (changed);
+        }
+
+
+        // Constant propagation.
+
+        void findNames (GfxGslAst *ast_, std::map<std::string, unsigned> &decls,
+                        Names &assigned, bool top_level)
+        {
+            if (ast_ == nullptr) return;
+            if (auto *ast = dynamic_cast<GfxGslDecl*>(ast_)) {
+                // Count nested declarations twice so the name is never considered immutable.
+                decls[ast->id] += top_level ? 1 : 2;
+                identifiers.insert(ast->id);
+            } else if (auto *ast = dynamic_cast<GfxGslFor*>(ast_)) {
+                if (ast->id != "") {
+                    decls[ast->id] += 2;
+                    identifiers.insert(ast->id);
+                }
+            } else if (auto *ast = dynamic_cast<GfxGslAssign*>(ast_)) {
+                assigned.insert(written_key(ast->target));
+            } else if (auto *ast = dynamic_cast<GfxGslVar*>(ast_)) {
+                identifiers.insert(ast->id);
+            }
+            each_child(ast_, [&] (GfxGslAst *child, bool) {
+                findNames(child, decls, assigned, false);
+            });
+        }
+
+        void findImmutable (void)
+        {
+            std::map<std::string, unsigned> decls;
+            Names assigned;
+            immutable.clear();
+            for (auto *stmt : shader->stmts)
+                findNames(stmt, decls, assigned, true);
+            for (const auto &pair : outer) {
+                identifiers.insert(pair.first);
+                if (decls.find(pair.first) == decls.end() && assigned.count(pair.first) == 0)
+                    immutable.insert(pair.first);
+            }
+            for (const auto &pair : decls) {
+                if (pair.second == 1 && outer.count(pair.first) == 0
+                    && assigned.count(pair.first) == 0)
+                    immutable.insert(pair.first);
+            }
+        }
+
+        bool isLiteral (const GfxGslAst *ast)
+        {
+            float v[4];
+            unsigned dim;
+            return dynamic_cast<const GfxGslLiteralFloat*>(ast)
+                   || dynamic_cast<const GfxGslLiteralInt*>(ast)
+                   || dynamic_cast<const GfxGslLiteralBoolean*>(ast)
+                   || literalVector(ast, v, dim);
+        }
+
+        // The literal must satisfy isLiteral.
+        GfxGslAst *copyLiteral (const GfxGslAst *ast_, const GfxGslLocation &loc)
+        {
+            if (auto *ast = dynamic_cast<const GfxGslLiteralFloat*>(ast_))
+                return makeFloat(loc, ast->val);
+            if (auto *ast = dynamic_cast<const GfxGslLiteralInt*>(ast_))
+                return makeInt(loc, ast->val);
+            if (auto *ast = dynamic_cast<const GfxGslLiteralBoolean*>(ast_))
+                return makeBool(loc, ast->val);
+            float v[4];
+            unsigned dim;
+            literalVector(ast_, v, dim);
+            return makeFloatVec(loc, v, dim);
+        }
+
+        void propagate (GfxGslAst *&slot)
+        {
+            if (auto *ast = dynamic_cast<GfxGslVar*>(slot)) {
+                auto it = constants.find(ast->id);
+                if (it != constants.end()) {
+                    slot = copyLiteral(it->second, ast->loc);
+                    propagated = true;
+                }
+                return;
+            }
+            each_child(slot, [this] (GfxGslAst *&child, bool) {
+                if (child != nullptr) propagate(child);
+            });
+        }
+
+        // Returns whether anything changed, so it is worth folding again.
+        bool propagateConstants (void)
+        {
+            findImmutable();
+            constants.clear();
+            for (auto *stmt : shader->stmts) {
+                auto *decl = dynamic_cast<GfxGslDecl*>(stmt);
+                if (decl == nullptr || immutable.find(decl->id) == immutable.end()) continue;
+                if (isLiteral(decl->init))
+                    constants[decl->id] = decl->init;
+            }
+            propagated = false;
+            if (!constants.empty()) {
+                for (auto *&stmt : shader->stmts)
+                    propagate(stmt);
+            }
+            return propagated;
+        }
+
+
+        // Sharing of texture samples.
+
+        // Whether the expression has the same value everywhere in the shader.
+        bool invariant (const GfxGslAst *ast_)
+        {
+            if (auto *ast = dynamic_cast<const GfxGslVar*>(ast_)) {
+                return immutable.find(ast->id) != immutable.end();
+            } else if (auto *ast = dynamic_cast<const GfxGslField*>(ast_)) {
+                // Out and body fields can be written.
+                if (dynamic_cast<const GfxGslOut*>(ast->target)) return false;
+                if (dynamic_cast<const GfxGslBody*>(ast->target)) return false;
+                return invariant(ast->target);
+            } else if (auto *ast = dynamic_cast<const GfxGslCall*>(ast_)) {
+                for (auto *arg : ast->args) {
+                    if (!invariant(arg)) return false;
+                }
+                return true;
+            } else if (auto *ast = dynamic_cast<const GfxGslBinary*>(ast_)) {
+                return invariant(ast->a) && invariant(ast->b);
+            }
+            return dynamic_cast<const GfxGslLiteralFloat*>(ast_)
+                   || dynamic_cast<const GfxGslLiteralInt*>(ast_)
+                   || dynamic_cast<const GfxGslLiteralBoolean*>(ast_)
+                   || dynamic_cast<const GfxGslGlobal*>(ast_)
+                   || dynamic_cast<const GfxGslMat*>(ast_)
+                   || dynamic_cast<const GfxGslVert*>(ast_)
+                   || dynamic_cast<const GfxGslFrag*>(ast_);
+        }
+
+        void findSamples (GfxGslAst *&slot, bool conditional, unsigned stmt,
+                          std::vector<SampleUse> &uses)
+        {
+            if (auto *ast = dynamic_cast<GfxGslCall*>(slot)) {
+                if (is_sample(ast->func) && invariant(ast)) {
+                    uses.push_back(SampleUse { &slot, conditional, stmt });
+                    return;
+                }
+            }
+            each_child(slot, [&] (GfxGslAst *&child, bool cond) {
+                if (child != nullptr) findSamples(child, conditional || cond, stmt, uses);
+            });
+        }
+
+        std::string freshName (void)
+        {
+            while (true) {
+                std::stringstream ss;
+                ss << "sample_" << nextTemp++;
+                if (identifiers.find(ss.str()) == identifiers.end()) return ss.str();
+            }
+        }
+
+        void shareSamples (void)
+        {
+            findImmutable();
+
+            std::vector<SampleUse> uses;
+            for (unsigned i=0 ; i<shader->stmts.size() ; ++i)
+                findSamples(shader->stmts[i], false, i, uses);
+
+            // Group identical samples, in order of first use.
+            std::vector<std::vector<SampleUse>> groups;
+            for (const auto &use : uses) {
+                bool found = false;
+                for (auto &group : groups) {
+                    if (same(*group[0].slot, *use.slot)) {
+                        group.push_back(use);
+                        found = true;
+                        break;
+                    }
+                }
+                if (!found) groups.push_back({use});
+            }
+
+            // Hoist to a variable before the first use.  A sample that only happens
+            // conditionally is left alone, to avoid doing it when it was not needed.
+            std::map<unsigned, GfxGslAsts> hoisted;
+            for (const auto &group : groups) {
+                if (group.size() < 2) continue;
+                bool unconditional = false;
+                for (const auto &use : group)
+                    unconditional = unconditional || !use.conditional;
+                if (!unconditional) continue;
+                GfxGslAst *sample = *group[0].slot;
+                std::string name = freshName();
+                hoisted[group[0].stmt].push_back(
+                    ctx.alloc.makeAst<GfxGslDecl>(sample->loc, name, nullptr, sample));
+                for (const auto &use : group) {
+                    GfxGslAst *var = ctx.alloc.makeAst<GfxGslVar>((*use.slot)->loc, name);
+                    var->type = sample->type;
+                    *use.slot = var;
+                }
+            }
+            if (hoisted.empty()) return;
+
+            GfxGslAsts stmts;
+            for (unsigned i=0 ; i<shader->stmts.size() ; ++i) {
+                auto it = hoisted.find(i);
+                if (it != hoisted.end())
+                    stmts.insert(stmts.end(), it->second.begin(), it->second.end());
+                stmts.push_back(shader->stmts[i]);
+            }
+            shader->stmts = stmts;
+        }
+
+
+        // Forget the scopes from the previous type check, so it can be done again.
+        void resetScopes (GfxGslAst *ast_)
+        {
+            if (auto *ast = dynamic_cast<GfxGslBlock*>(ast_)) {
+                ast->vars.clear();
+            } else if (auto *ast = dynamic_cast<GfxGslIf*>(ast_)) {
+                ast->yesVars.clear();
+                ast->noVars.clear();
+            } else if (auto *ast = dynamic_cast<GfxGslFor*>(ast_)) {
+                ast->vars.clear();
+            }
+            each_child(ast_, [this] (GfxGslAst *child, bool) {
+                if (child != nullptr) resetScopes(child);
+            });
+        }
+
+        public:
+
+        Optimiser (GfxGslContext &ctx, GfxGslShader *shader, const GfxGslDefMap &outer,
+                   const Names &live_outs, const Names &captured)
+          : ctx(ctx), shader(shader), outer(outer), liveOuts(live_outs), captured(captured),
+            changed(false), nextTemp(0), propagated(false)
+        { }
+
+        void run (void)
+        {
+            do {
+                foldStmts(shader->stmts);
+            } while (propagateConstants());
+            eliminateDeadCode();
+            shareSamples();
+            shader->vars.clear();
+            for (auto *stmt : shader->stmts)
+                resetScopes(stmt);
+        }
+    };
+
+}
+
+void gfx_gasoline_optimise (GfxGslContext &ctx, GfxGslShader *ast, const GfxGslDefMap &outer,
+                            const std::set<std::string> &live_outs,
+                            const std::set<std::string> &captured)
+{
+    Optimiser(ctx, ast, outer, live_outs, captured).run();
+}
@@ -0,0 +1,48 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <set>
+#include <string>
+
+#include "gfx_gasoline_parser.h"
+#include "gfx_gasoline_type_system.h"
+
+#ifndef GFX_GASOLINE_OPTIMISER_H
+#define GFX_GASOLINE_OPTIMISER_H
+
+/** Simplify a type-checked shader in place, before it is given to a backend.
+ *
+ * Static material parameters and unbound textures are replaced by their values, constant
+ * expressions and branches are evaluated, statements that cannot affect a live out field, a
+ * discard, or a variable captured by a later shader are removed, and identical texture samples
+ * are computed once.  The AST must then be type-checked again with a fresh GfxGslTypeSystem so
+ * that the variables, fields read and captured values reflect what is left.
+ *
+ * \param outer The variables in scope from the previous shader (vertex variables for a fragment
+ * shader).
+ * \param live_outs The out fields whose final values are used once the shader has run.
+ * \param captured The top level variables of this shader read by a later shader.
+ */
+void gfx_gasoline_optimise (GfxGslContext &ctx, GfxGslShader *ast, const GfxGslDefMap &outer,
+                            const std::set<std::string> &live_outs,
+                            const std::set<std::string> &captured);
+
+#endif
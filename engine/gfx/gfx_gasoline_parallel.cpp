@@ -0,0 +1,106 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <exception.h>
+
+#include "gfx_gasoline_parallel.h"
+
+static void run_job (GfxGslCompileJob &job)
+{
+    auto before = std::chrono::steady_clock::now();
+    try {
+        job.result = gfx_gasoline_compile(job.purpose, job.backend, *job.vertProg,
+                                          *job.dangsProg, *job.additionalProg, job.md);
+    } catch (const Exception &e) {
+        job.error = e.msg;
+    } catch (const std::exception &e) {
+        job.error = e.what();
+    }
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - before;
+    job.seconds = d.count();
+}
+
+void gfx_gasoline_compile_parallel (std::vector<GfxGslCompileJob> &jobs, unsigned threads,
+                                    const std::function<void(GfxGslCompileJob &)> &done)
+{
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads > jobs.size()) threads = jobs.size();
+
+    if (threads <= 1) {
+        for (auto &job : jobs) {
+            run_job(job);
+            done(job);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    std::mutex mutex;
+    std::condition_variable cond;
+    // Indexes of jobs that have finished but not been passed to done.
+    std::vector<size_t> finished;
+
+    auto worker = [&] () {
+        while (true) {
+            size_t i = next++;
+            if (i >= jobs.size()) return;
+            run_job(jobs[i]);
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.push_back(i);
+            cond.notify_one();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 0 ; i < threads ; ++i)
+        pool.emplace_back(worker);
+
+    std::vector<size_t> batch;
+    try {
+        for (size_t reported = 0 ; reported < jobs.size() ; ) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [&] { return !finished.empty(); });
+                batch.swap(finished);
+            }
+            // Called without the lock, so workers are never blocked on the callback.
+            for (size_t i : batch)
+                done(jobs[i]);
+            reported += batch.size();
+            batch.clear();
+        }
+    } catch (...) {
+        // Let the workers finish their current job and stop, then pass the error on.
+        next = jobs.size();
+        for (auto &t : pool)
+            t.join();
+        throw;
+    }
+
+    for (auto &t : pool)
+        t.join();
+}
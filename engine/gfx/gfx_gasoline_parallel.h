@@ -0,0 +1,59 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "gfx_gasoline.h"
+
+#ifndef GFX_GASOLINE_PARALLEL_H
+#define GFX_GASOLINE_PARALLEL_H
+
+/** One call to gfx_gasoline_compile, and its outcome. */
+struct GfxGslCompileJob {
+    GfxGslPurpose purpose;
+    GfxGslBackend backend;
+    // Not owned, must outlive the compilation.
+    const std::string *vertProg;
+    const std::string *dangsProg;
+    const std::string *additionalProg;
+    GfxGslMetadata md;
+
+    // Filled in by the compilation.
+    GfxGasolineResult result;
+    // Empty unless compilation failed.
+    std::string error;
+    double seconds;
+};
+
+/** Run all the jobs across the given number of threads (0 means one per hardware thread).
+ *
+ * The front-end and backends are pure CPU code with no shared mutable state (each compilation
+ * builds its AST and types in its own GfxGslAllocator), so jobs run independently.  The done
+ * callback is called on the calling thread for each job as soon as it finishes, in completion
+ * order, so that thread can hand the generated code to the driver while the rest compile.
+ * Errors are reported through GfxGslCompileJob::error rather than thrown.
+ */
+void gfx_gasoline_compile_parallel (std::vector<GfxGslCompileJob> &jobs, unsigned threads,
+                                    const std::function<void(GfxGslCompileJob &)> &done);
+
+#endif
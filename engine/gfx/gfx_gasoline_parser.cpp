@@ -551,8 +551,8 @@ static const int precedence_apply = 1;
 static const int precedence_uop = 2;
 static const int precedence_max = 7;
 
-// Can't make this const, as [] is not a const operator.
-static std::map<GfxGslOp, int> precedence_op = {
+// Const (and read with at) so that concurrent compilations can share it.
+static const std::map<GfxGslOp, int> precedence_op = {
     {GFX_GSL_OP_MUL, 3},
     {GFX_GSL_OP_DIV, 3},
     {GFX_GSL_OP_MOD, 3},
@@ -810,7 +810,7 @@ namespace {
                     }
                 } else {
                     GfxGslOp op;
-                    if (is_op(sym, op) && precedence==precedence_op[op]) {
+                    if (is_op(sym, op) && precedence==precedence_op.at(op)) {
                         auto op_tok = pop();
                         auto *b = parseExpr(precedence-1);
                         a = alloc.makeAst<GfxGslBinary>(op_tok.loc, a, op, b);
@@ -914,6 +914,37 @@ namespace {
     };
 }
 
+void *GfxGslAllocator::allocate (size_t bytes)
+{
+    bytes = (bytes + ALIGN - 1) / ALIGN * ALIGN;
+    if (bytes > size_t(limit - next)) {
+        blocks.reserve(blocks.size() + 1);
+        if (bytes > BLOCK_SIZE / 4) {
+            // Give big objects a block of their own, rather than abandoning the current one.
+            char *block = static_cast<char*>(::operator new(bytes));
+            blocks.push_back(block);
+            return block;
+        }
+        char *block = static_cast<char*>(::operator new(BLOCK_SIZE));
+        blocks.push_back(block);
+        next = block;
+        limit = block + BLOCK_SIZE;
+    }
+    void *r = next;
+    next += bytes;
+    return r;
+}
+
+GfxGslAllocator::~GfxGslAllocator (void)
+{
+    for (Dtor *d = dtors ; d != nullptr ; ) {
+        Dtor *after = d->next;
+        d->destroy(reinterpret_cast<char*>(d) + HEADER);
+        d = after;
+    }
+    for (char *block : blocks) ::operator delete(block);
+}
+
 GfxGslShader *gfx_gasoline_parse (GfxGslAllocator &alloc, const std::string &shader)
 {
     auto tokens = lex(shader);
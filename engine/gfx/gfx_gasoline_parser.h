@@ -18,11 +18,15 @@
  * THE SOFTWARE.
  */
 
+#include <cstddef>
 #include <cstdlib>
 #include <cstdint>
 
 #include <map>
+#include <new>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include <exception.h>
@@ -289,35 +293,67 @@ struct GfxGslReturn : public GfxGslAst {
     GfxGslReturn (const GfxGslLocation &loc) : GfxGslAst(loc) { }
 };
 
+/** Arena for the AST nodes, types and defs of a single compile.
+ *
+ * A compile creates thousands of small objects that all die together, so rather than a heap
+ * allocation each, they are bumped out of large blocks that are released in one go when the
+ * allocator is destroyed.  The objects still own strings, vectors and maps, so destructors are
+ * run (in reverse order of construction) via a chain threaded through the blocks.
+ */
 class GfxGslAllocator {
-    std::vector<GfxGslAst*> poolAst;
-    std::vector<GfxGslType*> poolType;
-    std::vector<GfxGslDef*> poolDef;
-    public:
-    GfxGslAllocator (void) { }
-    ~GfxGslAllocator (void)
+    struct Dtor {
+        Dtor *next;
+        void (*destroy) (void *);
+    };
+
+    static const size_t ALIGN = alignof(std::max_align_t);
+    static const size_t HEADER = (sizeof(Dtor) + ALIGN - 1) / ALIGN * ALIGN;
+    static const size_t BLOCK_SIZE = 64 * 1024;
+
+    std::vector<char*> blocks;
+    char *next;
+    char *limit;
+    Dtor *dtors;
+
+    void *allocate (size_t bytes);
+
+    template<class T> static void destroy (void *p)
     {
-        for (auto a : poolAst) delete a;
-        for (auto t : poolType) delete t;
-        for (auto t : poolDef) delete t;
+        static_cast<T*>(p)->~T();
     }
-    template<class T, class... Args> T *makeAst (Args... args)
+
+    template<class T, class... Args> T *make (Args&&... args)
     {
-        auto *r = new T(args...);
-        poolAst.push_back(r);
+        static_assert(alignof(T) <= ALIGN, "Over-aligned type in GfxGslAllocator.");
+        if (std::is_trivially_destructible<T>::value)
+            return new (allocate(sizeof(T))) T(std::forward<Args>(args)...);
+        char *mem = static_cast<char*>(allocate(HEADER + sizeof(T)));
+        T *r = new (mem + HEADER) T(std::forward<Args>(args)...);
+        // Only chain the destructor once the constructor has succeeded.
+        Dtor *d = reinterpret_cast<Dtor*>(mem);
+        d->next = dtors;
+        d->destroy = destroy<T>;
+        dtors = d;
         return r;
     }
-    template<class T, class... Args> T *makeType (Args... args)
+
+    public:
+    GfxGslAllocator (void) : next(nullptr), limit(nullptr), dtors(nullptr) { }
+    GfxGslAllocator (const GfxGslAllocator &) = delete;
+    GfxGslAllocator &operator= (const GfxGslAllocator &) = delete;
+    ~GfxGslAllocator (void);
+
+    template<class T, class... Args> T *makeAst (Args&&... args)
     {
-        auto *r = new T(args...);
-        poolType.push_back(r);
-        return r;
+        return make<T>(std::forward<Args>(args)...);
     }
-    template<class T, class... Args> T *makeDef (Args... args)
+    template<class T, class... Args> T *makeType (Args&&... args)
     {
-        auto *r = new T(args...);
-        poolDef.push_back(r);
-        return r;
+        return make<T>(std::forward<Args>(args)...);
+    }
+    template<class T, class... Args> T *makeDef (Args&&... args)
+    {
+        return make<T>(std::forward<Args>(args)...);
     }
 };
 
@@ -18,11 +18,13 @@
  * THE SOFTWARE.
  */
 
+#include <chrono>
 #include <fstream>
 #include <string>
 #include <vector>
 
 #include "gfx_gasoline.h"
+#include "gfx_gasoline_parallel.h"
 
 #include <exception.h>
 
@@ -42,6 +44,7 @@ const char *usage =
     "              | -e | --env1                     One env box\n"
     "              | -E | --env2                     Two env boxes\n"
     "              | -b | --bones <n>                Number of blended bones\n"
+    "              | -B | --benchmark <threads>      Also time compiling all permutations\n"
     "              | --                              End options passing\n"
 ;
 
@@ -85,6 +88,66 @@ static GfxGslParam from_string (const std::string &type_name)
 }
 
 
+// Compile every mesh environment, dither setting and (for bodies) purpose of the given shader,
+// across the given number of threads, and report how long it took.
+static void benchmark (unsigned threads, GfxGslPurpose purpose, GfxGslBackend backend,
+                       const std::string &vert_code, const std::string &dangs_code,
+                       const std::string &additional_code, const GfxGslMetadata &md)
+{
+    std::vector<GfxGslPurpose> purposes = { purpose };
+    bool body = false;
+    switch (purpose) {
+        case GFX_GSL_PURPOSE_FORWARD:
+        case GFX_GSL_PURPOSE_ALPHA:
+        case GFX_GSL_PURPOSE_FIRST_PERSON:
+        case GFX_GSL_PURPOSE_FIRST_PERSON_WIREFRAME:
+        case GFX_GSL_PURPOSE_CAST:
+        purposes = {
+            GFX_GSL_PURPOSE_FORWARD, GFX_GSL_PURPOSE_ALPHA, GFX_GSL_PURPOSE_FIRST_PERSON,
+            GFX_GSL_PURPOSE_FIRST_PERSON_WIREFRAME, GFX_GSL_PURPOSE_CAST
+        };
+        body = true;
+        break;
+        default:;
+    }
+
+    std::vector<GfxGslCompileJob> jobs;
+    for (GfxGslPurpose p : purposes) {
+        for (unsigned bones = 0 ; bones <= (body ? 4 : 0) ; ++bones) {
+            for (bool instanced : {false, true}) {
+                if (instanced && !body) continue;
+                for (bool fade_dither : {false, true}) {
+                    GfxGslCompileJob job;
+                    job.purpose = p;
+                    job.backend = backend;
+                    job.vertProg = &vert_code;
+                    job.dangsProg = &dangs_code;
+                    job.additionalProg = &additional_code;
+                    job.md = md;
+                    job.md.meshEnv.boneWeights = bones;
+                    job.md.meshEnv.instanced = instanced;
+                    job.md.matEnv.fadeDither = fade_dither;
+                    job.md.lightingTextures = gfx_gasoline_does_lighting(p);
+                    jobs.push_back(job);
+                }
+            }
+        }
+    }
+
+    double compile_seconds = 0;
+    unsigned failed = 0;
+    auto before = std::chrono::steady_clock::now();
+    gfx_gasoline_compile_parallel(jobs, threads, [&] (GfxGslCompileJob &job) {
+        compile_seconds += job.seconds;
+        if (!job.error.empty()) failed++;
+    });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - before;
+
+    std::cout << jobs.size() << " permutations (" << failed << " failed) on " << threads
+              << " threads: " << elapsed.count() * 1000 << " ms wall, "
+              << compile_seconds * 1000 << " ms compiling" << std::endl;
+}
+
 CentralisedLog clog;
 void assert_triggered (void) { }
 
@@ -99,6 +162,7 @@ int main (int argc, char **argv)
         bool internal = false;
         unsigned env_boxes = 0;
         unsigned bones = 0;
+        int benchmark_threads = -1;
         std::vector<std::string> args;
         std::string language = "GLSL33";
         GfxGslRunParams params;
@@ -149,6 +213,15 @@ int main (int argc, char **argv)
                     return EXIT_FAILURE;
                 }
                 bones = unsigned(num);
+            } else if (arg=="-B" || arg=="--benchmark") {
+                std::string num_str = next_arg(so_far, argc, argv);
+                char **nptr = nullptr;
+                long long num = strtoll(num_str.c_str(), nptr, 10);
+                if (num < 0) {
+                    std::cerr<<"Number of threads must not be negative." << std::endl;
+                    return EXIT_FAILURE;
+                }
+                benchmark_threads = int(num);
             } else {
                 args.push_back(arg);
             }
@@ -246,6 +319,10 @@ int main (int argc, char **argv)
             md.lightingTextures = gfx_gasoline_does_lighting(purpose);
             shaders = gfx_gasoline_compile(purpose, backend, vert_code, dangs_code,
                                            additional_code, md);
+            if (benchmark_threads >= 0) {
+                benchmark(benchmark_threads, purpose, backend, vert_code, dangs_code,
+                          additional_code, md);
+            }
         } catch (const Exception &e) {
             EXCEPT << vert_in_filename << ", " << dangs_in_filename << ", "
                    << additional_in_filename << ": " << e.msg << ENDL;
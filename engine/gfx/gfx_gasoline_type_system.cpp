@@ -747,6 +747,9 @@ void GfxGslTypeSystem::inferAndSet (GfxGslAst *ast_, const Ctx &c)
     } else if (auto *ast = dynamic_cast<GfxGslLiteralFloat*>(ast_)) {
         ast->type = ctx.alloc.makeType<GfxGslFloatType>(1);
 
+    } else if (auto *ast = dynamic_cast<GfxGslLiteralBoolean*>(ast_)) {
+        ast->type = ctx.alloc.makeType<GfxGslBoolType>();
+
     } else if (auto *ast = dynamic_cast<GfxGslVar*>(ast_)) {
         const GfxGslDef *def = c.lookupVar(ast->id);
         if (def == nullptr) {
@@ -29,6 +29,8 @@
 
 const std::string GfxInstances::className = "GfxInstances";
 
+GfxInstancesUploadStats GfxInstances::uploadStats;
+
 const unsigned instance_data_floats = 13;
 const unsigned instance_data_bytes = instance_data_floats*4;
 
@@ -80,7 +82,7 @@ GfxInstancesPtr GfxInstances::make (const std::string &mesh_name, const GfxNodeP
 
 GfxInstances::GfxInstances (const DiskResourcePtr<GfxMeshDiskResource> &gdr, const GfxNodePtr &par_)
   : GfxNode(par_),
-    dirty(false),
+    dirty(instance_data_bytes),
     enabled(true),
     gdr(gdr),
     mBoundingBox(Ogre::AxisAlignedBox::BOX_INFINITE),
@@ -150,7 +152,7 @@ void GfxInstances::reserveSpace (unsigned new_capacity)
                         Ogre::HardwareBuffer::HBU_DYNAMIC_WRITE_ONLY);
         instBuf->setIsInstanceData(true);
         instBuf->setInstanceDataStepRate(1);
-        dirty = true; // will be lazily copied from host
+        dirty.markAll(); // will be lazily copied from host
     }
     sharedVertexData->vertexBufferBinding->setBinding(1, instBuf);
 
@@ -172,7 +174,13 @@ unsigned GfxInstances::getBatches (void)
 
 void GfxInstances::copyToGPU (void)
 {
-    copyToGPU(0, indexes.size(), true);
+    auto upload = [this] (unsigned from, unsigned to, bool discard) {
+        copyToGPU(from, to, discard);
+    };
+    GfxDirtyRanges::Flush f = dirty.flush(indexes.size(), upload);
+    uploadStats.bytes += f.elements * instance_data_bytes;
+    uploadStats.writes += f.ranges;
+    if (f.full) uploadStats.fullUploads++;
 }
 
 void GfxInstances::copyToGPU (unsigned from, unsigned to, bool discard)
@@ -225,7 +233,7 @@ void GfxInstances::update (unsigned sparse_index, const Vector3 &pos, const Quat
     base[10] = pos.y;
     base[11] = pos.z;
     base[12] = fade;
-    dirty = true;
+    dirty.mark(dense_index, indexes.size());
 }
 
 void GfxInstances::del (unsigned sparse_index)
@@ -240,13 +248,12 @@ void GfxInstances::del (unsigned sparse_index)
         for (unsigned i=0 ; i<instance_data_floats ; ++i) {
             instBufRaw[dense_index * instance_data_floats + i] = instBufRaw[last * instance_data_floats + i];
         }
+        dirty.mark(dense_index, last);
     }
-
+    // Nothing to upload for the removed slot at the end, it is no longer drawn.
 
     instBufRaw.resize(instance_data_floats * last);
     for (unsigned i=0 ; i<numSections ; ++i) sections[i]->setNumInstances(last);
-
-    dirty = true;
 }
 
 
@@ -290,10 +297,7 @@ void GfxInstances::_updateRenderQueue(Ogre::RenderQueue *queue)
 {
     if (indexes.size() == 0) return;
     if (!enabled) return;
-    if (dirty) {
-        copyToGPU();
-        dirty = false;
-    }
+    if (!dirty.empty()) copyToGPU();
     for (unsigned i=0 ; i<numSections ; ++i) {
         Section *s = sections[i];
 
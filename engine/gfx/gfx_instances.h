@@ -30,14 +30,25 @@ typedef SharedPtr<GfxInstances> GfxInstancesPtr;
 
 #include "../dense_index_map.h"
 
+#include "gfx_dirty_ranges.h"
 #include "gfx_disk_resource.h"
 #include "gfx_node.h"
 #include "gfx_fertile_node.h"
 
+/** Instance buffer traffic over one frame, summed over all GfxInstances. */
+struct GfxInstancesUploadStats {
+    unsigned long bytes;
+    unsigned long writes;
+    unsigned long fullUploads;
+    GfxInstancesUploadStats (void) : bytes(0), writes(0), fullUploads(0) { }
+};
+
 class GfxInstances : public GfxNode, public Ogre::MovableObject {
 
     protected:
 
+    static GfxInstancesUploadStats uploadStats;
+
     static const std::string className;
 
     DenseIndexMap indexes;
@@ -51,7 +62,8 @@ class GfxInstances : public GfxNode, public Ogre::MovableObject {
     Ogre::VertexData *sharedVertexData;
     Ogre::HardwareVertexBufferSharedPtr instBuf;
     std::vector<float> instBufRaw;
-    bool dirty;
+    // Dense indexes of instBufRaw that have not yet been copied to instBuf.
+    GfxDirtyRanges dirty;
     bool enabled;
     const DiskResourcePtr<GfxMeshDiskResource> gdr;
 
@@ -79,12 +91,18 @@ class GfxInstances : public GfxNode, public Ogre::MovableObject {
     unsigned getTrianglesPerInstance (void);
     unsigned getBatches (void);
 
+    /** Called at the start of each frame, to reset the upload statistics. */
+    static void frameStarted (void) { uploadStats = GfxInstancesUploadStats(); }
+    /** Between frames, this is the traffic of the frame that was just rendered. */
+    static const GfxInstancesUploadStats &getLastFrameUploadStats (void) { return uploadStats; }
+
     protected:
 
     void updateSections (void);
     void updateProperties (void);
     void reinitialise (void);
 
+    // Upload whatever has changed since the last call.
     void copyToGPU ();
     void copyToGPU (unsigned from, unsigned to, bool discard);
 
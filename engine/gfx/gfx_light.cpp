@@ -251,3 +251,100 @@ void GfxLight::updateVisibility (void)
     light->setDiffuseColour(to_ogre_cv(fade * diffuse));
     light->setSpecularColour(to_ogre_cv(fade * specular));
 }
+
+// Screen tiles and depth slices of the cluster grid.  The tiles are 120 pixels square at 1080p.
+static const unsigned CLUSTER_TILES_X = 16;
+static const unsigned CLUSTER_TILES_Y = 9;
+static const unsigned CLUSTER_SLICES = 24;
+
+GfxLightClusterGrid gfx_light_cluster_grid (const Ogre::Frustum &frustum)
+{
+    float left, right, top, bottom;
+    frustum.getFrustumExtents(left, right, top, bottom);
+    float near_clip = frustum.getNearClipDistance();
+
+    GfxLightClusterGrid grid;
+    grid.tilesX = CLUSTER_TILES_X;
+    grid.tilesY = CLUSTER_TILES_Y;
+    grid.slices = CLUSTER_SLICES;
+    grid.left = left / near_clip;
+    grid.right = right / near_clip;
+    grid.bottom = bottom / near_clip;
+    grid.top = top / near_clip;
+    grid.nearClip = near_clip;
+    grid.farClip = frustum.getFarClipDistance();
+    return grid;
+}
+
+// The colours and angles are read from the Ogre light, which its GfxLight keeps up to date as
+// they are set.  The position and direction are given, as they are only copied to it by update.
+static void cluster_add_light (const Ogre::Light *l, const Vector3 &pos, const Vector3 &dir,
+                               const Ogre::Matrix4 &view, GfxLightClusters &clusters,
+                               std::vector<float> &light_data)
+{
+    const Ogre::ColourValue &diff = l->getDiffuseColour();
+    const Ogre::ColourValue &spec = l->getSpecularColour();
+    float inner = Ogre::Math::Cos(l->getSpotlightInnerAngle());
+    float outer = Ogre::Math::Cos(l->getSpotlightOuterAngle());
+    float range = l->getAttenuationRange();
+
+    // The shader only applies the cone if the angles differ.
+    Vector3 centre;
+    float radius;
+    gfx_light_bounding_sphere(pos, dir, range, inner == outer ? -1 : outer, centre, radius);
+    clusters.add(from_ogre(view * to_ogre(centre)), radius);
+
+    float texels[] = {
+        pos.x, pos.y, pos.z, range,
+        dir.x, dir.y, dir.z, inner,
+        diff.r, diff.g, diff.b, outer,
+        spec.r, spec.g, spec.b, 0,
+    };
+    light_data.insert(light_data.end(), texels, texels + 16);
+}
+
+void gfx_light_cluster_gather (const Ogre::LightList &lights, const Ogre::Matrix4 &view,
+                               GfxLightClusters &clusters, std::vector<float> &light_data)
+{
+    clusters.clear();
+    light_data.clear();
+    for (Ogre::Light *l : lights) {
+        if (l == ogre_sun) continue;
+        cluster_add_light(l, from_ogre(l->getDerivedPosition()),
+                          from_ogre(l->getDerivedDirection()), view, clusters, light_data);
+    }
+}
+
+unsigned gfx_light_cluster_assign (const Vector3 &cam_pos, const Quaternion &cam_dir,
+                                   unsigned &entries)
+{
+    // Ogre cameras point towards Z whereas in Grit the convention
+    // is that 'unrotated' means pointing towards y (north)
+    Ogre::Matrix4 view =
+        Ogre::Math::makeViewMatrix(to_ogre(cam_pos),
+                                   to_ogre(cam_dir*Quaternion(Degree(90),Vector3(1,0,0))),
+                                   nullptr);
+
+    Ogre::Frustum frustum;
+    frustum.setFOVy(Ogre::Degree(gfx_option(GFX_FOV)));
+    frustum.setAspectRatio(float(ogre_win->getWidth()) / ogre_win->getHeight());
+    frustum.setNearClipDistance(gfx_option(GFX_NEAR_CLIP));
+    frustum.setFarClipDistance(gfx_option(GFX_FAR_CLIP));
+
+    // Only read the lights, their Ogre lights and coronas are left as the last frame set them.
+    static GfxLightClusters clusters;
+    static std::vector<float> light_data;
+    clusters.clear();
+    light_data.clear();
+    for (unsigned long i=0 ; i<gfx_all_nodes.size() ; ++i) {
+        auto *l = dynamic_cast<GfxLight*>(gfx_all_nodes[i]);
+        if (l == nullptr) continue;
+        if (!l->isEnabled() || l->getFade() <= 0.001) continue;
+        Transform world = l->getWorldTransform();
+        cluster_add_light(l->light, world.pos, world.removeTranslation() * Vector3(0,1,0), view,
+                          clusters, light_data);
+    }
+    unsigned in_view = clusters.assign(gfx_light_cluster_grid(frustum));
+    entries = clusters.indexes.size();
+    return in_view;
+}
@@ -27,6 +27,7 @@ typedef SharedPtr<GfxLight> GfxLightPtr;
 
 #include "gfx.h"
 #include "gfx_fertile_node.h"
+#include "gfx_light_cluster.h"
 #include "gfx_particle_system.h"
 
 class GfxLight : public GfxNode {
@@ -93,4 +94,22 @@ class GfxLight : public GfxNode {
     friend class SharedPtr<GfxLight>;
 };
 
+/** The cluster grid used by the deferred lighting pass for the given camera frustum. */
+GfxLightClusterGrid gfx_light_cluster_grid (const Ogre::Frustum &frustum);
+
+/** Add the lights, other than the sun, to the clusters as bounding spheres in the space of the
+ * given view matrix.  For each one, 16 floats are appended to light_data for the deferred
+ * shader: position and range, direction and the cosine of the inner angle, diffuse colour and the
+ * cosine of the outer angle, and specular colour.
+ */
+void gfx_light_cluster_gather (const Ogre::LightList &lights, const Ogre::Matrix4 &view,
+                               GfxLightClusters &clusters, std::vector<float> &light_data);
+
+/** Bin every enabled light into the clusters of a camera, as the deferred lighting pass does,
+ * but without rendering anything.  Returns the number of lights in view, and sets entries to the
+ * total length of the per-cluster light lists.
+ */
+unsigned gfx_light_cluster_assign (const Vector3 &cam_pos, const Quaternion &cam_dir,
+                                   unsigned &entries);
+
 #endif
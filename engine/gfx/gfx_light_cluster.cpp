@@ -0,0 +1,248 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "gfx_light_cluster.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define GFX_LIGHT_CLUSTER_SSE 1
+#include <xmmintrin.h>
+#endif
+
+void gfx_light_bounding_sphere (const Vector3 &pos, const Vector3 &dir, float range, float outer,
+                                Vector3 &centre, float &radius)
+{
+    if (outer <= 0) {
+        centre = pos;
+        radius = range;
+    } else if (outer >= 0.70710678f) {
+        // Half angle of 45 degrees or less: the sphere through the apex and the rim of the cone.
+        radius = range / (2 * outer);
+        centre = pos + radius * dir;
+    } else {
+        // The sphere around the rim of the cone, which also contains the apex.
+        radius = range * std::sqrt(1 - outer * outer);
+        centre = pos + range * outer * dir;
+    }
+}
+
+float GfxLightClusterGrid::sliceScale (void) const
+{
+    return slices / std::log(farClip / nearClip);
+}
+
+void GfxLightClusters::add (const Vector3 &centre, float r)
+{
+    posX.push_back(centre.x);
+    posY.push_back(centre.y);
+    posZ.push_back(centre.z);
+    radius.push_back(r);
+}
+
+void GfxLightClusters::clear (void)
+{
+    posX.clear();
+    posY.clear();
+    posZ.clear();
+    radius.clear();
+}
+
+namespace {
+
+    // Planes through the eye and the lines at a view depth of 1 where lateral is lines[i], as the
+    // coefficients of the lateral co-ordinate and z in the signed distance.  Positive distances
+    // are on the side where lateral is greater if sign is 1, or less if sign is -1.
+    void make_planes (const std::vector<float> &lines, unsigned from, unsigned n, float sign,
+                      std::vector<float> &lat, std::vector<float> &z)
+    {
+        lat.resize(n);
+        z.resize(n);
+        for (unsigned i = 0 ; i < n ; ++i) {
+            float l = lines[from + i];
+            float inv_len = 1 / std::sqrt(1 + l * l);
+            lat[i] = sign * inv_len;
+            z[i] = sign * l * inv_len;
+        }
+    }
+
+    // Find the first and last of columns (or rows) from..n-1 that a sphere touches, i.e. where
+    // it is neither entirely behind the column's lo plane nor entirely beyond its hi plane.  If
+    // any is true, first has already been found among the earlier columns.  Returns whether
+    // there were any at all.
+    bool touched_scalar (const float *lo_lat, const float *lo_z,
+                         const float *hi_lat, const float *hi_z, unsigned from, unsigned n,
+                         float lat, float z, float r, bool any, unsigned &first, unsigned &last)
+    {
+        for (unsigned i = from ; i < n ; ++i) {
+            float d_lo = lo_lat[i] * lat + lo_z[i] * z;
+            float d_hi = hi_lat[i] * lat + hi_z[i] * z;
+            if (d_lo > -r && d_hi < r) {
+                if (!any) first = i;
+                last = i;
+                any = true;
+            }
+        }
+        return any;
+    }
+
+    #ifdef GFX_LIGHT_CLUSTER_SSE
+    // The same, 4 columns at a time, leaving the last few to touched_scalar.  The sums are done
+    // in the same order, so the two agree exactly.
+    bool touched_sse (const float *lo_lat, const float *lo_z,
+                      const float *hi_lat, const float *hi_z, unsigned n,
+                      float lat, float z, float r, unsigned &first, unsigned &last)
+    {
+        const __m128 vlat = _mm_set1_ps(lat);
+        const __m128 vz = _mm_set1_ps(z);
+        const __m128 vr = _mm_set1_ps(r);
+        const __m128 vnegr = _mm_set1_ps(-r);
+        bool any = false;
+        unsigned i = 0;
+        for ( ; i + 4 <= n ; i += 4) {
+            __m128 d_lo = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(lo_lat + i), vlat),
+                                     _mm_mul_ps(_mm_loadu_ps(lo_z + i), vz));
+            __m128 d_hi = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(hi_lat + i), vlat),
+                                     _mm_mul_ps(_mm_loadu_ps(hi_z + i), vz));
+            int mask = _mm_movemask_ps(_mm_and_ps(_mm_cmpgt_ps(d_lo, vnegr),
+                                                  _mm_cmplt_ps(d_hi, vr)));
+            if (mask == 0) continue;
+            if (!any) {
+                unsigned j = 0;
+                while (!(mask & (1 << j))) j++;
+                first = i + j;
+            }
+            unsigned j = 3;
+            while (!(mask & (1 << j))) j--;
+            last = i + j;
+            any = true;
+        }
+        return touched_scalar(lo_lat, lo_z, hi_lat, hi_z, i, n, lat, z, r, any, first, last);
+    }
+    #endif
+
+    bool touched (const float *lo_lat, const float *lo_z,
+                  const float *hi_lat, const float *hi_z, unsigned n,
+                  float lat, float z, float r, unsigned &first, unsigned &last)
+    {
+        #ifdef GFX_LIGHT_CLUSTER_SSE
+        return touched_sse(lo_lat, lo_z, hi_lat, hi_z, n, lat, z, r, first, last);
+        #else
+        return touched_scalar(lo_lat, lo_z, hi_lat, hi_z, 0, n, lat, z, r, false, first, last);
+        #endif
+    }
+
+    unsigned slice_at (float depth, float near_clip, float scale, unsigned slices)
+    {
+        float s = std::floor(std::log(depth / near_clip) * scale);
+        if (s < 0) return 0;
+        if (s >= slices) return slices - 1;
+        return unsigned(s);
+    }
+
+}
+
+void GfxLightClusters::updatePlanes (const GfxLightClusterGrid &grid)
+{
+    if (planesValid && planesGrid == grid) return;
+
+    std::vector<float> xs(grid.tilesX + 1);
+    for (unsigned i = 0 ; i <= grid.tilesX ; ++i)
+        xs[i] = grid.left + (grid.right - grid.left) * i / grid.tilesX;
+    // The camera looks down -Z, so a point at depth 1 is at z = -1, and the distance to the
+    // plane through x = xs[i] is proportional to x + xs[i] * z.
+    make_planes(xs, 0, grid.tilesX, 1, leftX, leftZ);
+    make_planes(xs, 1, grid.tilesX, 1, rightX, rightZ);
+
+    std::vector<float> ys(grid.tilesY + 1);
+    for (unsigned i = 0 ; i <= grid.tilesY ; ++i)
+        ys[i] = grid.top - (grid.top - grid.bottom) * i / grid.tilesY;
+    make_planes(ys, 0, grid.tilesY, -1, topY, topZ);
+    make_planes(ys, 1, grid.tilesY, -1, bottomY, bottomZ);
+
+    planesGrid = grid;
+    planesValid = true;
+}
+
+unsigned GfxLightClusters::assign (const GfxLightClusterGrid &grid)
+{
+    updatePlanes(grid);
+
+    float scale = grid.sliceScale();
+    size_t n = size();
+    boxes.resize(n);
+    counts.assign(grid.size(), 0);
+
+    unsigned lights_in_view = 0;
+    for (size_t i = 0 ; i < n ; ++i) {
+        Box &b = boxes[i];
+        b.x0 = 1;
+        b.x1 = 0;
+
+        float x = posX[i], y = posY[i], z = posZ[i], r = radius[i];
+        float depth = -z;
+        if (depth + r <= grid.nearClip || depth - r >= grid.farClip) continue;
+
+        unsigned x0 = 0, x1 = 0, y0 = 0, y1 = 0;
+        if (!touched(&leftX[0], &leftZ[0], &rightX[0], &rightZ[0], grid.tilesX,
+                     x, z, r, x0, x1))
+            continue;
+        if (!touched(&topY[0], &topZ[0], &bottomY[0], &bottomZ[0], grid.tilesY,
+                     y, z, r, y0, y1))
+            continue;
+        unsigned z0 = slice_at(std::max(depth - r, grid.nearClip), grid.nearClip, scale, grid.slices);
+        unsigned z1 = slice_at(std::min(depth + r, grid.farClip), grid.nearClip, scale, grid.slices);
+
+        b.x0 = x0; b.x1 = x1;
+        b.y0 = y0; b.y1 = y1;
+        b.z0 = z0; b.z1 = z1;
+        lights_in_view++;
+
+        for (unsigned s = z0 ; s <= z1 ; ++s) {
+            for (unsigned row = y0 ; row <= y1 ; ++row) {
+                uint32_t *c = &counts[grid.index(0, row, s)];
+                for (unsigned col = x0 ; col <= x1 ; ++col) c[col]++;
+            }
+        }
+    }
+
+    offsets.resize(grid.size());
+    uint32_t total = 0;
+    for (unsigned c = 0 ; c < grid.size() ; ++c) {
+        offsets[c] = total;
+        total += counts[c];
+    }
+    indexes.resize(total);
+
+    cursors = offsets;
+    for (size_t i = 0 ; i < n ; ++i) {
+        const Box &b = boxes[i];
+        if (b.x1 < b.x0) continue;
+        for (unsigned s = b.z0 ; s <= b.z1 ; ++s) {
+            for (unsigned row = b.y0 ; row <= b.y1 ; ++row) {
+                uint32_t *c = &cursors[grid.index(0, row, s)];
+                for (unsigned col = b.x0 ; col <= b.x1 ; ++col) indexes[c[col]++] = i;
+            }
+        }
+    }
+
+    return lights_in_view;
+}
@@ -0,0 +1,117 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdint>
+#include <vector>
+
+#include <math_util.h>
+
+#ifndef GFX_LIGHT_CLUSTER_H
+#define GFX_LIGHT_CLUSTER_H
+
+/** The smallest sphere around the volume lit by a spot light, given the cosine of half the angle
+ * of its cone.  If that half angle is 90 degrees or more (outer <= 0), i.e. the cone is a
+ * hemisphere or wider, this is the sphere of the light's range.
+ */
+void gfx_light_bounding_sphere (const Vector3 &pos, const Vector3 &dir, float range, float outer,
+                                Vector3 &centre, float &radius);
+
+/** Divides the view frustum into a grid of clusters: tiles on screen, and slices in view depth.
+ *
+ * The slices are spaced exponentially between the clip distances, so they are roughly as deep as they
+ * are wide.  The extents of the frustum are given at a view depth of 1 and need not be
+ * symmetric, e.g. for stereo.
+ */
+struct GfxLightClusterGrid {
+    unsigned tilesX, tilesY, slices;
+    float left, right, bottom, top;
+    float nearClip, farClip;
+
+    unsigned size (void) const { return tilesX * tilesY * slices; }
+
+    // Rows count down from the top of the screen, and slices away from the camera.
+    unsigned index (unsigned column, unsigned row, unsigned slice) const
+    { return (slice * tilesY + row) * tilesX + column; }
+
+    // The slice at a view depth is floor(log(depth / nearClip) * sliceScale()).
+    float sliceScale (void) const;
+
+    bool operator== (const GfxLightClusterGrid &o) const
+    {
+        return tilesX == o.tilesX && tilesY == o.tilesY && slices == o.slices
+            && left == o.left && right == o.right && bottom == o.bottom && top == o.top
+            && nearClip == o.nearClip && farClip == o.farClip;
+    }
+};
+
+/** Bins lights into the clusters of a GfxLightClusterGrid, so the deferred shader only has to
+ * consider the lights of the cluster each fragment is in.
+ *
+ * Lights are given as bounding spheres in view space, where the camera looks down -Z.  A light
+ * goes in every cluster of the box of columns, rows and slices its sphere touches, so the lists
+ * are conservative.  The column and row tests run 4 planes at a time with SSE where available;
+ * the results do not depend on whether it is.
+ */
+class GfxLightClusters {
+    public:
+    std::vector<float> posX, posY, posZ, radius;
+
+    // For each cluster, where its lights start in indexes, and how many it has.
+    std::vector<uint32_t> offsets, counts;
+
+    // The lights of each cluster in turn, in the order they were added.
+    std::vector<uint32_t> indexes;
+
+    GfxLightClusters (void) : planesValid(false) { }
+
+    size_t size (void) const { return radius.size(); }
+
+    void add (const Vector3 &centre, float radius);
+
+    // Remove the lights, but not the lists from the last assign.
+    void clear (void);
+
+    /** Rebuild offsets, counts, and indexes from the lights.  Returns the number of lights that
+     * were in at least one cluster.
+     */
+    unsigned assign (const GfxLightClusterGrid &grid);
+
+    private:
+
+    // Range of clusters touched by a light, inclusive.  Empty if x1 < x0.
+    struct Box {
+        uint16_t x0, x1, y0, y1, z0, z1;
+    };
+
+    GfxLightClusterGrid planesGrid;
+    bool planesValid;
+
+    // Planes through the eye at either side of each column and row, as the coefficients of x (or
+    // y) and z in the signed distance, positive towards the right (or bottom) of the screen.
+    std::vector<float> leftX, leftZ, rightX, rightZ;
+    std::vector<float> topY, topZ, bottomY, bottomZ;
+
+    std::vector<Box> boxes;
+    std::vector<uint32_t> cursors;
+
+    void updatePlanes (const GfxLightClusterGrid &grid);
+};
+
+#endif
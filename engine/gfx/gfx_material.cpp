@@ -29,10 +29,18 @@
 // Global lock, see header for documentation.
 std::recursive_mutex gfx_material_lock;
 
+// Every GfxMaterial (they are never removed), so the per-frame update need not search
+// material_db for them.
+static std::vector<GfxMaterial*> all_materials;
+
+// The global shader environment the Ogre materials were last built against.
+static GfxGslConfigEnvironment built_scene_env;
+
 
 GfxBaseMaterial::GfxBaseMaterial(const std::string name, GfxShader *shader)
       : shader(shader),
         bindings(),
+        version(1),
         name(name)
 { }
 
@@ -50,6 +58,15 @@ void GfxBaseMaterial::setShader (GfxShader *v)
     shader = v;
     bindings.clear();
     textures.clear();
+    paramBlock.paramsVersion = 0;
+    version++;
+}
+
+const GfxShaderParamBlock &GfxBaseMaterial::getParamBlock (void) const
+{
+    if (paramBlock.paramsVersion != shader->getParamsVersion())
+        shader->packParams(bindings, paramBlock);
+    return paramBlock;
 }
 
 GfxMaterial::GfxMaterial (const std::string &name)
@@ -60,43 +77,52 @@ GfxMaterial::GfxMaterial (const std::string &name)
     additionalLighting(false),
     boneBlendWeights(0),
     shadowAlphaReject(false),
-    shadowBias(0.15)
+    shadowBias(0.15),
+    builtVersion(0),
+    builtShaderVersion(0)
 {
 }
 
 void GfxMaterial::setSceneBlend (GfxMaterialSceneBlend v)
 {
     sceneBlend = v;
+    version++;
 }
 
 void GfxMaterial::setBackfaces (bool v)
 {
     backfaces = v;
+    version++;
 }
 
 void GfxMaterial::setShadowBias (float v)
 {   
     shadowBias = v;
+    version++;
 }       
         
 void GfxMaterial::setCastShadows (bool v)
 {   
     castShadows = v;
+    version++;
 }       
         
 void GfxMaterial::setAdditionalLighting (bool v)
 {   
     additionalLighting = v;
+    version++;
 }       
         
 void GfxMaterial::setBoneBlendWeights (unsigned v)
 {
     boneBlendWeights = v;
+    version++;
 }
 
 void GfxMaterial::setShadowAlphaReject (bool v)
 {   
     shadowAlphaReject = v;
+    version++;
 }       
         
 
@@ -115,6 +141,9 @@ void GfxMaterial::buildOgreMaterials (void)
     bool fade_dither = sceneBlend == GFX_MATERIAL_OPAQUE;
     Ogre::Pass *p;
 
+    builtVersion = version;
+    builtShaderVersion = shader->getParamsVersion();
+
     shader->populateMatEnv(fade_dither, textures, bindings, matEnv);
     shader->populateMatEnv(false, textures, bindings, matEnvAdditional);
     shader->populateMeshEnv(false, boneBlendWeights, meshEnv);
@@ -197,39 +226,75 @@ void GfxMaterial::buildOgreMaterials (void)
 
 void GfxMaterial::updateOgreMaterials (const GfxShaderGlobals &globs)
 {
-    Ogre::Pass *p;
+    GfxGslPurpose regular = sceneBlend == GFX_MATERIAL_OPAQUE
+                          ? GFX_GSL_PURPOSE_FORWARD : GFX_GSL_PURPOSE_ALPHA;
 
     // TODO: wireframe for instanced geometry?
-    p = wireframeMat->getTechnique(0)->getPass(0);
-    shader->updatePass(p, globs, GFX_GSL_PURPOSE_WIREFRAME, matEnv, meshEnv, textures, bindings);
-
-    p = castMat->getTechnique(0)->getPass(0);
-    shader->updatePass(p, globs, GFX_GSL_PURPOSE_CAST, matEnv, meshEnv, textures, bindings);
-
-    p = instancingCastMat->getTechnique(0)->getPass(0);
-    shader->updatePass(p, globs, GFX_GSL_PURPOSE_CAST, matEnv, meshEnvInstanced,
-                       textures, bindings);
+    shader->updatePass(wireframeMat->getTechnique(0)->getPass(0), globs,
+                       GFX_GSL_PURPOSE_WIREFRAME);
+    shader->updatePass(castMat->getTechnique(0)->getPass(0), globs, GFX_GSL_PURPOSE_CAST);
+    shader->updatePass(instancingCastMat->getTechnique(0)->getPass(0), globs,
+                       GFX_GSL_PURPOSE_CAST);
+    shader->updatePass(regularMat->getTechnique(0)->getPass(0), globs, regular);
+    shader->updatePass(instancingMat->getTechnique(0)->getPass(0), globs, regular);
+    // TODO: additional lighting for instanced geometry?
+    shader->updatePass(additionalMat->getTechnique(0)->getPass(0), globs,
+                       GFX_GSL_PURPOSE_ADDITIONAL);
+}
 
-    p = regularMat->getTechnique(0)->getPass(0);
-    if (sceneBlend == GFX_MATERIAL_OPAQUE) {
-        shader->updatePass(p, globs, GFX_GSL_PURPOSE_FORWARD, matEnv, meshEnv, textures, bindings);
-    } else {
-        shader->updatePass(p, globs, GFX_GSL_PURPOSE_ALPHA, matEnv, meshEnv, textures, bindings);
+void GfxMaterial::getPermutations (std::vector<GfxShaderPermutation> &out) const
+{
+    GfxGslPurpose regular = sceneBlend == GFX_MATERIAL_OPAQUE
+                          ? GFX_GSL_PURPOSE_FORWARD : GFX_GSL_PURPOSE_ALPHA;
+    out.push_back({GFX_GSL_PURPOSE_WIREFRAME, matEnv, meshEnv});
+    out.push_back({GFX_GSL_PURPOSE_CAST, matEnv, meshEnv});
+    out.push_back({GFX_GSL_PURPOSE_CAST, matEnv, meshEnvInstanced});
+    out.push_back({regular, matEnv, meshEnv});
+    out.push_back({regular, matEnv, meshEnvInstanced});
+    out.push_back({GFX_GSL_PURPOSE_ADDITIONAL, matEnvAdditional, meshEnv});
+
+    // First person bodies only dither when fading, and draw wireframes without textures.
+    GfxGslMaterialEnvironment wireframe_env;
+    for (bool fade_dither : {false, true}) {
+        if (fade_dither && sceneBlend != GFX_MATERIAL_OPAQUE) continue;
+        const GfxGslMaterialEnvironment &env = fade_dither ? matEnv : matEnvAdditional;
+        out.push_back({GFX_GSL_PURPOSE_FIRST_PERSON, env, meshEnv});
+        shader->populateMatEnv(fade_dither, GfxTextureStateMap(), bindings, wireframe_env);
+        out.push_back({GFX_GSL_PURPOSE_FIRST_PERSON_WIREFRAME, wireframe_env, meshEnv});
     }
+}
 
-    p = instancingMat->getTechnique(0)->getPass(0);
-    if (sceneBlend == GFX_MATERIAL_OPAQUE) {
-        shader->updatePass(p, globs, GFX_GSL_PURPOSE_FORWARD, matEnv, meshEnvInstanced,
-                           textures, bindings);
-    } else {
-        shader->updatePass(p, globs, GFX_GSL_PURPOSE_ALPHA, matEnv, meshEnvInstanced,
-                           textures, bindings);
+unsigned gfx_material_update (const GfxShaderGlobals &globs)
+{
+    GFX_MAT_SYNC;
+    bool rebuild_all = !(built_scene_env == shader_scene_env);
+    built_scene_env = shader_scene_env;
+    unsigned rebuilt = 0;
+    for (GfxMaterial *mat : all_materials) {
+        if (rebuild_all || mat->isDirty()) {
+            // CVERB << "Rebuilding: " << mat->name << std::endl;
+            mat->buildOgreMaterials();
+            rebuilt++;
+        }
+        mat->updateOgreMaterials(globs);
     }
+    return rebuilt;
+}
 
-    // TODO: additional lighting for instanced geometry?
-    p = additionalMat->getTechnique(0)->getPass(0);
-    shader->updatePass(p, globs, GFX_GSL_PURPOSE_ADDITIONAL, matEnvAdditional, meshEnv,
-                       textures, bindings);
+GfxShaderPrecompileStats gfx_material_precompile (unsigned threads)
+{
+    GFX_MAT_SYNC;
+    std::vector<GfxShaderPrecompileJob> jobs;
+    std::vector<GfxShaderPermutation> perms;
+    for (const auto &pair : material_db) {
+        GfxMaterial *mat = dynamic_cast<GfxMaterial*>(pair.second);
+        if (mat == NULL) continue;
+        perms.clear();
+        mat->getPermutations(perms);
+        for (const auto &perm : perms)
+            jobs.push_back({mat->getShader(), perm});
+    }
+    return gfx_shader_precompile(jobs, threads);
 }
 
 GfxMaterial *gfx_material_add (const std::string &name)
@@ -238,6 +303,7 @@ GfxMaterial *gfx_material_add (const std::string &name)
     if (gfx_material_has_any(name)) GRIT_EXCEPT("Material already exists: \""+name+"\"");
     GfxMaterial *r = new GfxMaterial(name);
     material_db[name] = r;
+    all_materials.push_back(r);
     return r;
 }
 
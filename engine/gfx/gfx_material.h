@@ -50,6 +50,11 @@ class GfxBaseMaterial {
     GfxShader *shader;
     GfxShaderBindings bindings;
     GfxTextureStateMap textures;
+    // Bindings packed against the shader's params, rebuilt lazily when either changes.
+    mutable GfxShaderParamBlock paramBlock;
+    // Bumped by anything the native shaders or passes depend on, so derived materials can tell
+    // when they need rebuilding.
+    unsigned version;
     
     public:
 
@@ -59,15 +64,20 @@ class GfxBaseMaterial {
     const std::string name;
     
     const GfxTextureStateMap &getTextures (void) const { return textures; } 
-    void setTextures (const GfxTextureStateMap &v) { GFX_MAT_SYNC; textures = v; }
+    void setTextures (const GfxTextureStateMap &v) { GFX_MAT_SYNC; textures = v; version++; }
 
     void addDependencies (DiskResource *into) const;
 
     const GfxShaderBindings &getBindings (void) const { return bindings; }
-    void setBindings (const GfxShaderBindings &v) { bindings = v; }
+    void setBindings (const GfxShaderBindings &v)
+    { bindings = v; paramBlock.paramsVersion = 0; version++; }
+
+    const GfxShaderParamBlock &getParamBlock (void) const;
     
     GfxShader *getShader (void) const { return shader; }
     void setShader (GfxShader *v);
+
+    unsigned getVersion (void) const { return version; }
     
 };
 
@@ -113,6 +123,9 @@ class GfxMaterial : public GfxBaseMaterial {
     // TODO(dcunnin): Infer this from the dangs gasoline (is it possible to discard a fragment?)
     bool shadowAlphaReject;
     float shadowBias;
+    // What the Ogre materials were last built from, see isDirty.
+    unsigned builtVersion;
+    unsigned builtShaderVersion;
 
     // TODO: various addressing modes for textures
 
@@ -138,9 +151,19 @@ class GfxMaterial : public GfxBaseMaterial {
     bool getShadowAlphaReject (void) const { return shadowAlphaReject; }
     void setShadowAlphaReject (bool v);
 
+    /** Whether the material or its shader changed since buildOgreMaterials. */
+    bool isDirty (void) const
+    {
+        return builtVersion != version || builtShaderVersion != shader->getParamsVersion();
+    }
+
     void buildOgreMaterials (void);
     void updateOgreMaterials (const GfxShaderGlobals &globs);
 
+    /** Every permutation of the shader this material can be drawn with, as built by
+     * buildOgreMaterials plus those compiled on demand for first person bodies. */
+    void getPermutations (std::vector<GfxShaderPermutation> &out) const;
+
     const GfxGslMaterialEnvironment &getMaterialEnvironment (void) const { return matEnv; }
 
     friend GfxMaterial *gfx_material_add(const std::string &);
@@ -158,6 +181,15 @@ bool gfx_material_has_any (const std::string &name);
 
 bool gfx_material_has (const std::string &name);
 
+/** Rebuild the Ogre materials of every dirty material (or all of them if the global shader
+ * environment changed), then refresh the globals of all their passes.  Called every frame.
+ * Returns the number of materials rebuilt.
+ */
+unsigned gfx_material_update (const GfxShaderGlobals &globs);
+
+/** Build every permutation of every material's shader ahead of time, see gfx_shader_precompile. */
+GfxShaderPrecompileStats gfx_material_precompile (unsigned threads);
+
 void gfx_material_init (void);
 
 #endif
@@ -0,0 +1,258 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "gfx_occlusion.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define GFX_OCCLUSION_SSE 1
+#include <xmmintrin.h>
+#endif
+
+namespace {
+
+    /* Transform to screen space: x and y in pixels with rows counting down from the top, and
+     * depth.  Returns false if the point is not in front of the near clip plane.
+     */
+    inline bool project (const GfxOcclusionMatrix &m, float x, float y, float z,
+                         float width, float height, float *out)
+    {
+        const float (&r)[4][4] = m.m;
+        float cx = r[0][0] * x + r[0][1] * y + r[0][2] * z + r[0][3];
+        float cy = r[1][0] * x + r[1][1] * y + r[1][2] * z + r[1][3];
+        float cz = r[2][0] * x + r[2][1] * y + r[2][2] * z + r[2][3];
+        float cw = r[3][0] * x + r[3][1] * y + r[3][2] * z + r[3][3];
+        if (!(cw > 1e-6f) || cz < -cw) return false;
+        float inv_w = 1 / cw;
+        out[0] = (cx * inv_w * 0.5f + 0.5f) * width;
+        out[1] = (0.5f - cy * inv_w * 0.5f) * height;
+        out[2] = cz * inv_w;
+        return true;
+    }
+
+    // The function a * x + b * y + c that is zero on the line from p to q, and positive to the
+    // left of it (with y down the screen).  Where a is not 0, the line crosses each row at
+    // x = slope * y + offset.
+    struct Edge {
+        float a, b, c;
+        float slope, offset;
+        Edge (const float *p, const float *q)
+          : a(p[1] - q[1]), b(q[0] - p[0]), c(p[0] * q[1] - p[1] * q[0]),
+            slope(a == 0 ? 0 : -b / a), offset(a == 0 ? 0 : -c / a)
+        { }
+    };
+
+    // Narrow [x0, x1] to roughly the pixels of the row at py that are inside all of the edges.
+    // The span is widened by a pixel either side, the edges themselves decide exactly which
+    // pixels are inside.  Returns false if there are none.
+    inline bool span (const Edge &e0, const Edge &e1, const Edge &e2, float py,
+                      unsigned x0, unsigned x1, unsigned &from, unsigned &to)
+    {
+        float lo = float(x0), hi = float(x1);
+        const Edge *edges[] = { &e0, &e1, &e2 };
+        for (const Edge *e : edges) {
+            // The pixel centre at x + 0.5 is inside if a * (x + 0.5) + b * py + c >= 0.
+            float cross = e->slope * py + e->offset - 0.5f;
+            if (e->a > 0) {
+                lo = std::max(lo, cross - 1);
+            } else if (e->a < 0) {
+                hi = std::min(hi, cross + 1);
+            } else if (e->b * py + e->c < 0) {
+                return false;
+            }
+        }
+        if (!(lo <= hi)) return false;
+        from = unsigned(lo);
+        to = unsigned(hi);
+        return true;
+    }
+
+}
+
+GfxOcclusionBuffer::GfxOcclusionBuffer (unsigned width, unsigned height)
+  : width(width), height(height), tilesX(width / TILE_SIZE), tilesY(height / TILE_SIZE),
+    depth(width * height, FLT_MAX), tileMax(tilesX * tilesY, FLT_MAX)
+{
+}
+
+void GfxOcclusionBuffer::clear (void)
+{
+    std::fill(depth.begin(), depth.end(), FLT_MAX);
+    std::fill(tileMax.begin(), tileMax.end(), FLT_MAX);
+}
+
+void GfxOcclusionBuffer::addOccluder (const GfxOcclusionMatrix &m, const float *positions,
+                                      const uint32_t *indexes, unsigned num_indexes)
+{
+    if (num_indexes == 0) return;
+    unsigned num_vertexes = *std::max_element(indexes, indexes + num_indexes) + 1;
+    screen.resize(num_vertexes * 3);
+    inFront.resize(num_vertexes);
+    for (unsigned i = 0 ; i < num_vertexes ; ++i) {
+        const float *p = &positions[i * 3];
+        inFront[i] = project(m, p[0], p[1], p[2], width, height, &screen[i * 3]);
+    }
+    for (unsigned i = 0 ; i + 2 < num_indexes ; i += 3) {
+        uint32_t i0 = indexes[i], i1 = indexes[i + 1], i2 = indexes[i + 2];
+        if (!inFront[i0] || !inFront[i1] || !inFront[i2]) continue;
+        rasterise(&screen[i0 * 3], &screen[i1 * 3], &screen[i2 * 3]);
+    }
+}
+
+void GfxOcclusionBuffer::rasterise (const float *v0, const float *v1, const float *v2)
+{
+    float area = (v1[0] - v0[0]) * (v2[1] - v0[1]) - (v1[1] - v0[1]) * (v2[0] - v0[0]);
+    // Either winding will do.
+    if (area < 0) {
+        std::swap(v1, v2);
+        area = -area;
+    }
+    if (!(area > 1e-8f)) return;
+
+    float min_x = std::max(0.0f, std::min(v0[0], std::min(v1[0], v2[0])));
+    float max_x = std::min(float(width - 1), std::max(v0[0], std::max(v1[0], v2[0])));
+    float min_y = std::max(0.0f, std::min(v0[1], std::min(v1[1], v2[1])));
+    float max_y = std::min(float(height - 1), std::max(v0[1], std::max(v1[1], v2[1])));
+    if (min_x > max_x || min_y > max_y) return;
+    unsigned x0 = unsigned(min_x), x1 = unsigned(max_x);
+    unsigned y0 = unsigned(min_y), y1 = unsigned(max_y);
+
+    // Each is positive inside the triangle and is proportional to the barycentric co-ordinate of
+    // the opposite vertex.
+    Edge e0(v1, v2), e1(v2, v0), e2(v0, v1);
+
+    // The depth is also linear in screen space.
+    float inv_area = 1 / area;
+    float da = (e0.a * v0[2] + e1.a * v1[2] + e2.a * v2[2]) * inv_area;
+    float db = (e0.b * v0[2] + e1.b * v1[2] + e2.b * v2[2]) * inv_area;
+    float dc = (e0.c * v0[2] + e1.c * v1[2] + e2.c * v2[2]) * inv_area;
+
+#if defined(GFX_OCCLUSION_SSE)
+    // Rows are a multiple of 4 pixels wide, so spans start from an aligned column.
+    const __m128 lane = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 e0a = _mm_set1_ps(e0.a), e1a = _mm_set1_ps(e1.a), e2a = _mm_set1_ps(e2.a);
+    const __m128 vda = _mm_set1_ps(da);
+    for (unsigned y = y0 ; y <= y1 ; ++y) {
+        float py = y + 0.5f;
+        unsigned from, to;
+        if (!span(e0, e1, e2, py, x0, x1, from, to)) continue;
+        __m128 e0row = _mm_set1_ps(e0.b * py + e0.c);
+        __m128 e1row = _mm_set1_ps(e1.b * py + e1.c);
+        __m128 e2row = _mm_set1_ps(e2.b * py + e2.c);
+        __m128 drow = _mm_set1_ps(db * py + dc);
+        float *row = &depth[y * width];
+        for (unsigned x = from & ~3u ; x <= to ; x += 4) {
+            __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), lane);
+            __m128 inside = _mm_and_ps(
+                _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(e0a, px), e0row), zero),
+                _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(e1a, px), e1row), zero),
+                           _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(e2a, px), e2row), zero)));
+            if (_mm_movemask_ps(inside) == 0) continue;
+            __m128 d = _mm_add_ps(_mm_mul_ps(vda, px), drow);
+            __m128 old = _mm_loadu_ps(&row[x]);
+            __m128 nearest = _mm_min_ps(old, d);
+            _mm_storeu_ps(&row[x], _mm_or_ps(_mm_and_ps(inside, nearest),
+                                             _mm_andnot_ps(inside, old)));
+        }
+    }
+#else
+    for (unsigned y = y0 ; y <= y1 ; ++y) {
+        float py = y + 0.5f;
+        unsigned from, to;
+        if (!span(e0, e1, e2, py, x0, x1, from, to)) continue;
+        float *row = &depth[y * width];
+        for (unsigned x = from ; x <= to ; ++x) {
+            float px = x + 0.5f;
+            if (e0.a * px + (e0.b * py + e0.c) < 0) continue;
+            if (e1.a * px + (e1.b * py + e1.c) < 0) continue;
+            if (e2.a * px + (e2.b * py + e2.c) < 0) continue;
+            float d = da * px + (db * py + dc);
+            row[x] = std::min(row[x], d);
+        }
+    }
+#endif
+}
+
+void GfxOcclusionBuffer::finish (void)
+{
+    for (unsigned ty = 0 ; ty < tilesY ; ++ty) {
+        for (unsigned tx = 0 ; tx < tilesX ; ++tx) {
+            float farthest = -FLT_MAX;
+            for (unsigned y = ty * TILE_SIZE ; y < (ty + 1) * TILE_SIZE ; ++y) {
+                const float *row = &depth[y * width + tx * TILE_SIZE];
+                for (unsigned x = 0 ; x < TILE_SIZE ; ++x)
+                    farthest = std::max(farthest, row[x]);
+            }
+            tileMax[ty * tilesX + tx] = farthest;
+        }
+    }
+}
+
+bool GfxOcclusionBuffer::isOccluded (const GfxOcclusionMatrix &m, const Vector3 &min,
+                                     const Vector3 &max) const
+{
+    float min_x = FLT_MAX, max_x = -FLT_MAX;
+    float min_y = FLT_MAX, max_y = -FLT_MAX;
+    float nearest = FLT_MAX;
+    for (unsigned i = 0 ; i < 8 ; ++i) {
+        float p[3];
+        if (!project(m, i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z,
+                     width, height, p))
+            return false;
+        min_x = std::min(min_x, p[0]);
+        max_x = std::max(max_x, p[0]);
+        min_y = std::min(min_y, p[1]);
+        max_y = std::max(max_y, p[1]);
+        nearest = std::min(nearest, p[2]);
+    }
+
+    if (max_x < 0 || max_y < 0 || min_x >= width || min_y >= height) return false;
+    // Occluders only cover the pixels whose centres they contain, at the depth of the centre, so
+    // the box could show through the uncovered part of a pixel on an occluder's edge, or just
+    // behind the occluder within a pixel.  Growing the footprint by a pixel on each side keeps
+    // the test conservative: the pixel past the edge is empty, and the depths of the neighbours
+    // of a pixel are at least as far as the occluder anywhere within it.
+    unsigned x0 = unsigned(std::max(0.0f, min_x - 1));
+    unsigned x1 = unsigned(std::min(float(width - 1), max_x + 1));
+    unsigned y0 = unsigned(std::max(0.0f, min_y - 1));
+    unsigned y1 = unsigned(std::min(float(height - 1), max_y + 1));
+
+    for (unsigned ty = y0 / TILE_SIZE ; ty <= y1 / TILE_SIZE ; ++ty) {
+        for (unsigned tx = x0 / TILE_SIZE ; tx <= x1 / TILE_SIZE ; ++tx) {
+            // The whole tile is nearer than the box.
+            if (nearest > tileMax[ty * tilesX + tx]) continue;
+            unsigned from_y = std::max(y0, ty * TILE_SIZE);
+            unsigned to_y = std::min(y1, ty * TILE_SIZE + TILE_SIZE - 1);
+            unsigned from_x = std::max(x0, tx * TILE_SIZE);
+            unsigned to_x = std::min(x1, tx * TILE_SIZE + TILE_SIZE - 1);
+            for (unsigned y = from_y ; y <= to_y ; ++y) {
+                const float *row = &depth[y * width];
+                for (unsigned x = from_x ; x <= to_x ; ++x) {
+                    if (nearest <= row[x]) return false;
+                }
+            }
+        }
+    }
+    return true;
+}
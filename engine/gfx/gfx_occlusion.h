@@ -0,0 +1,93 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdint>
+#include <vector>
+
+#include <math_util.h>
+
+#ifndef GFX_OCCLUSION_H
+#define GFX_OCCLUSION_H
+
+/** A transform to clip space, with the layout of Ogre::Matrix4: clip = m * (x, y, z, 1). */
+struct GfxOcclusionMatrix {
+    float m[4][4];
+};
+
+/** A small depth buffer that occluders are rasterised into on the CPU, and that bounding boxes
+ * are then tested against to find objects that are completely hidden.
+ *
+ * Depth is z / w in clip space with the OpenGL convention, i.e. -1 at the near clip plane and 1
+ * at the far one, which is linear in screen space for both perspective and orthographic
+ * projections.  Triangles are rasterised 4 pixels at a time with SSE where available, covering
+ * the pixels whose centres they contain.  Triangles that cross the near clip plane are skipped,
+ * so they never hide anything.  The farthest depth of each 8x8 tile is kept, so most boxes are
+ * accepted or rejected without looking at individual pixels.
+ */
+class GfxOcclusionBuffer {
+    public:
+
+    static const unsigned TILE_SIZE = 8;
+
+    /** Both dimensions must be multiples of TILE_SIZE. */
+    GfxOcclusionBuffer (unsigned width, unsigned height);
+
+    unsigned getWidth (void) const { return width; }
+    unsigned getHeight (void) const { return height; }
+
+    /** Remove all occluders. */
+    void clear (void);
+
+    /** Rasterise triangles, given as vertex positions (3 floats each) and 3 indexes per triangle,
+     * in the space that m transforms to clip space.
+     */
+    void addOccluder (const GfxOcclusionMatrix &m, const float *positions,
+                      const uint32_t *indexes, unsigned num_indexes);
+
+    /** Must be called after adding occluders and before testing boxes. */
+    void finish (void);
+
+    /** Whether the box, in the space that m transforms to clip space, is hidden by the occluders
+     * everywhere it appears on screen.  Boxes that are off screen or that cross the near clip
+     * plane are not occluded.
+     */
+    bool isOccluded (const GfxOcclusionMatrix &m, const Vector3 &min, const Vector3 &max) const;
+
+    /** The depth at a pixel, counting rows down from the top of the screen.  Empty pixels have
+     * FLT_MAX.
+     */
+    float getDepth (unsigned x, unsigned y) const { return depth[y * width + x]; }
+
+    private:
+
+    unsigned width, height;
+    unsigned tilesX, tilesY;
+    std::vector<float> depth;
+    std::vector<float> tileMax;
+
+    // Screen position and depth of the vertexes of the occluder being added, and whether each one
+    // is in front of the near clip plane.
+    std::vector<float> screen;
+    std::vector<bool> inFront;
+
+    void rasterise (const float *v0, const float *v1, const float *v2);
+};
+
+#endif
@@ -55,6 +55,9 @@ GfxBoolOption gfx_bool_options[] = {
 
     GFX_RENDER_FIRST_PERSON,
     GFX_UPDATE_MATERIALS,
+    GFX_OCCLUSION_CULL,
+    GFX_STATE_SORT,
+    GFX_PARAM_BLOCKS,
 };  
 
 GfxIntOption gfx_int_options[] = {
@@ -63,6 +66,8 @@ GfxIntOption gfx_int_options[] = {
     GFX_SHADOW_RES,
     GFX_SHADOW_FILTER_TAPS,
     GFX_BLOOM_ITERATIONS,
+    GFX_PARTICLE_THREADS,
+    GFX_ANIMATION_THREADS,
     GFX_RAM,
     GFX_DEBUG_MODE,
 };      
@@ -156,6 +161,9 @@ std::string gfx_option_to_string (GfxBoolOption o)
 
         TO_STRING_MACRO(GFX_RENDER_FIRST_PERSON);
         TO_STRING_MACRO(GFX_UPDATE_MATERIALS);
+        TO_STRING_MACRO(GFX_OCCLUSION_CULL);
+        TO_STRING_MACRO(GFX_STATE_SORT);
+        TO_STRING_MACRO(GFX_PARAM_BLOCKS);
     }
     return "UNKNOWN_BOOL_OPTION";
 }
@@ -167,6 +175,8 @@ std::string gfx_option_to_string (GfxIntOption o)
         TO_STRING_MACRO(GFX_SHADOW_RES);
         TO_STRING_MACRO(GFX_SHADOW_FILTER_TAPS);
         TO_STRING_MACRO(GFX_BLOOM_ITERATIONS);
+        TO_STRING_MACRO(GFX_PARTICLE_THREADS);
+        TO_STRING_MACRO(GFX_ANIMATION_THREADS);
         TO_STRING_MACRO(GFX_RAM);
         TO_STRING_MACRO(GFX_DEBUG_MODE);
     }
@@ -255,6 +265,9 @@ void gfx_option_from_string (const std::string &s,
 
     FROM_STRING_BOOL_MACRO(GFX_RENDER_FIRST_PERSON)
     FROM_STRING_BOOL_MACRO(GFX_UPDATE_MATERIALS)
+    FROM_STRING_BOOL_MACRO(GFX_OCCLUSION_CULL)
+    FROM_STRING_BOOL_MACRO(GFX_STATE_SORT)
+    FROM_STRING_BOOL_MACRO(GFX_PARAM_BLOCKS)
 
 
     FROM_STRING_INT_MACRO(GFX_FULLSCREEN_WIDTH)
@@ -262,6 +275,8 @@ void gfx_option_from_string (const std::string &s,
     FROM_STRING_INT_MACRO(GFX_SHADOW_RES)
     FROM_STRING_INT_MACRO(GFX_SHADOW_FILTER_TAPS)
     FROM_STRING_INT_MACRO(GFX_BLOOM_ITERATIONS)
+    FROM_STRING_INT_MACRO(GFX_PARTICLE_THREADS)
+    FROM_STRING_INT_MACRO(GFX_ANIMATION_THREADS)
 
     FROM_STRING_INT_MACRO(GFX_RAM)
     FROM_STRING_INT_MACRO(GFX_DEBUG_MODE)
@@ -369,6 +384,9 @@ static void options_update (bool flush)
             case GFX_RENDER_HUD: break;
             case GFX_RENDER_FIRST_PERSON: break;
             case GFX_UPDATE_MATERIALS: break;
+            case GFX_OCCLUSION_CULL: break;
+            case GFX_STATE_SORT: break;
+            case GFX_PARAM_BLOCKS: break;
         }
     }
     for (unsigned i=0 ; i<sizeof(gfx_int_options)/sizeof(*gfx_int_options) ; ++i) {
@@ -395,6 +413,8 @@ static void options_update (bool flush)
             shader_scene_env.shadowFilterTaps = v_new;
             break;
             case GFX_BLOOM_ITERATIONS: break;
+            case GFX_PARTICLE_THREADS: break;
+            case GFX_ANIMATION_THREADS: break;
         }
     }
     for (unsigned i=0 ; i<sizeof(gfx_float_options)/sizeof(*gfx_float_options) ; ++i) {
@@ -583,6 +603,9 @@ void gfx_option_reset (void)
 
     gfx_option(GFX_RENDER_FIRST_PERSON, true);
     gfx_option(GFX_UPDATE_MATERIALS, true);
+    gfx_option(GFX_OCCLUSION_CULL, true);
+    gfx_option(GFX_STATE_SORT, true);
+    gfx_option(GFX_PARAM_BLOCKS, true);
 
 
     gfx_option(GFX_FULLSCREEN_WIDTH, 800);
@@ -590,6 +613,8 @@ void gfx_option_reset (void)
     gfx_option(GFX_SHADOW_RES, 1024);
     gfx_option(GFX_SHADOW_FILTER_TAPS, 4);
     gfx_option(GFX_BLOOM_ITERATIONS, 0);
+    gfx_option(GFX_PARTICLE_THREADS, 0);
+    gfx_option(GFX_ANIMATION_THREADS, 0);
     gfx_option(GFX_RAM, 128);
     gfx_option(GFX_DEBUG_MODE, 0);
 
@@ -647,6 +672,8 @@ void gfx_option_init (void)
     int filter_taps_list[] = {1,4,9,16,36};
     valid_option(GFX_SHADOW_FILTER_TAPS, new ValidOptionList<int,int[5]>(filter_taps_list));
     valid_option(GFX_BLOOM_ITERATIONS, new ValidOptionRange<int>(0,255));
+    valid_option(GFX_PARTICLE_THREADS, new ValidOptionRange<int>(0,64));
+    valid_option(GFX_ANIMATION_THREADS, new ValidOptionRange<int>(0,64));
     valid_option(GFX_RAM, new ValidOptionRange<int>(0,16384));
     valid_option(GFX_DEBUG_MODE, new ValidOptionRange<int>(0,8));
 
@@ -49,6 +49,9 @@ enum GfxBoolOption {
 
     GFX_RENDER_FIRST_PERSON,
     GFX_UPDATE_MATERIALS,
+    GFX_OCCLUSION_CULL,
+    GFX_STATE_SORT,
+    GFX_PARAM_BLOCKS,
 };
 
 enum GfxIntOption {
@@ -57,6 +60,8 @@ enum GfxIntOption {
     GFX_SHADOW_RES,
     GFX_SHADOW_FILTER_TAPS,
     GFX_BLOOM_ITERATIONS,
+    GFX_PARTICLE_THREADS, // 0 means one per hardware thread
+    GFX_ANIMATION_THREADS, // 0 means one per hardware thread
 
     GFX_RAM,
     GFX_DEBUG_MODE,
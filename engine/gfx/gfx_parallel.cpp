@@ -0,0 +1,141 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "gfx_parallel.h"
+
+namespace {
+
+    class WorkerPool {
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable finished;
+        std::vector<std::thread> workers;
+        bool quit;
+
+        // The current call.  Bumping generation tells the workers there is a new one.
+        unsigned long generation;
+        const std::function<void(size_t, size_t)> *fn;
+        size_t n;
+        size_t rangeSize;
+        size_t ranges;
+        std::atomic<size_t> nextRange;
+        size_t rangesDone;
+        // Workers that may still call runOne for the current call, the next call must not
+        // start until this is 0.
+        unsigned active;
+
+        // Returns false once there are no ranges left to start.
+        bool runOne (void)
+        {
+            size_t r = nextRange++;
+            if (r >= ranges) return false;
+            size_t from = r * rangeSize;
+            (*fn)(from, std::min(n, from + rangeSize));
+            std::lock_guard<std::mutex> lock(mutex);
+            if (++rangesDone == ranges) finished.notify_all();
+            return true;
+        }
+
+        void workerMain (void)
+        {
+            unsigned long seen = 0;
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [&] { return quit || generation != seen; });
+                    if (quit) return;
+                    seen = generation;
+                    active++;
+                }
+                while (runOne()) { }
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--active == 0) finished.notify_all();
+            }
+        }
+
+        public:
+
+        WorkerPool (void)
+          : quit(false), generation(0), fn(nullptr), n(0), rangeSize(0), ranges(0),
+            nextRange(0), rangesDone(0), active(0)
+        { }
+
+        ~WorkerPool (void)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                quit = true;
+            }
+            wake.notify_all();
+            for (auto &t : workers)
+                t.join();
+        }
+
+        void run (size_t n_, size_t ranges_, const std::function<void(size_t, size_t)> &fn_)
+        {
+            while (workers.size() < ranges_ - 1)
+                workers.emplace_back(&WorkerPool::workerMain, this);
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                finished.wait(lock, [&] { return active == 0; });
+                fn = &fn_;
+                n = n_;
+                ranges = ranges_;
+                rangeSize = (n + ranges - 1) / ranges;
+                nextRange = 0;
+                rangesDone = 0;
+                generation++;
+            }
+            wake.notify_all();
+
+            while (runOne()) { }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            finished.wait(lock, [&] { return rangesDone == ranges; });
+            fn = nullptr;
+        }
+    };
+
+}
+
+void gfx_parallel_for (size_t n, size_t grain, unsigned threads,
+                       const std::function<void(size_t from, size_t to)> &fn)
+{
+    if (n == 0) return;
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    if (grain == 0) grain = 1;
+    size_t ranges = std::min<size_t>(threads, (n + grain - 1) / grain);
+
+    if (ranges <= 1) {
+        fn(0, n);
+        return;
+    }
+
+    static WorkerPool pool;
+    pool.run(n, ranges, fn);
+}
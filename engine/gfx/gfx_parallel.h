@@ -0,0 +1,38 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstddef>
+#include <functional>
+
+#ifndef GFX_PARALLEL_H
+#define GFX_PARALLEL_H
+
+/** Call fn(from, to) over consecutive ranges that together cover 0 to n-1, across up to the
+ * given number of threads (0 means one per hardware thread).  The calling thread takes part,
+ * and the call returns once every range is done.
+ *
+ * Ranges are at least grain long, so small amounts of work stay on the calling thread.  The
+ * worker threads are started on first use and then wait for later calls, which makes this cheap
+ * enough to use every frame.  Only call it from the main thread, and fn must not throw.
+ */
+void gfx_parallel_for (size_t n, size_t grain, unsigned threads,
+                       const std::function<void(size_t from, size_t to)> &fn);
+
+#endif
@@ -0,0 +1,158 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "gfx_particle_behaviour.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define GFX_PARTICLE_SSE 1
+#include <xmmintrin.h>
+#endif
+
+const GfxParticleFrame *GfxParticleBehaviour::frame (float age, float life) const
+{
+    if (frames.size() == 0) return nullptr;
+    unsigned n = frames.size();
+    unsigned i;
+    if (frameRate > 0) {
+        i = unsigned(age * frameRate) % n;
+    } else {
+        i = unsigned(age / life * n);
+        if (i >= n) i = n - 1;
+    }
+    return &frames[i];
+}
+
+void GfxParticleStore::emit (const Vector3 &pos, const Vector3 &vel, float life_, float angle_)
+{
+    posX.push_back(pos.x);
+    posY.push_back(pos.y);
+    posZ.push_back(pos.z);
+    velX.push_back(vel.x);
+    velY.push_back(vel.y);
+    velZ.push_back(vel.z);
+    age.push_back(0);
+    life.push_back(life_);
+    angle.push_back(angle_);
+}
+
+namespace {
+
+    // Semi-implicit Euler: the new velocity moves the particle.  The acceleration is
+    // gravity + drag * (wind - vel), rearranged so the constant part is computed once.  Both
+    // versions do the same operations in the same order, without fused multiply-add.
+    void integrate_scalar (float *px, float *py, float *pz, float *vx, float *vy, float *vz,
+                           float *age, size_t from, size_t to,
+                           const Vector3 &accel, float drag, float dt)
+    {
+        for (size_t i = from ; i < to ; ++i) {
+            vx[i] = vx[i] + (accel.x - drag * vx[i]) * dt;
+            vy[i] = vy[i] + (accel.y - drag * vy[i]) * dt;
+            vz[i] = vz[i] + (accel.z - drag * vz[i]) * dt;
+            px[i] = px[i] + vx[i] * dt;
+            py[i] = py[i] + vy[i] * dt;
+            pz[i] = pz[i] + vz[i] * dt;
+            age[i] = age[i] + dt;
+        }
+    }
+
+    #ifdef GFX_PARTICLE_SSE
+    size_t integrate_sse (float *px, float *py, float *pz, float *vx, float *vy, float *vz,
+                          float *age, size_t n, const Vector3 &accel, float drag, float dt)
+    {
+        const __m128 ax = _mm_set1_ps(accel.x);
+        const __m128 ay = _mm_set1_ps(accel.y);
+        const __m128 az = _mm_set1_ps(accel.z);
+        const __m128 vdrag = _mm_set1_ps(drag);
+        const __m128 vdt = _mm_set1_ps(dt);
+        size_t i = 0;
+        for ( ; i + 4 <= n ; i += 4) {
+            __m128 x = _mm_loadu_ps(vx + i);
+            __m128 y = _mm_loadu_ps(vy + i);
+            __m128 z = _mm_loadu_ps(vz + i);
+            x = _mm_add_ps(x, _mm_mul_ps(_mm_sub_ps(ax, _mm_mul_ps(vdrag, x)), vdt));
+            y = _mm_add_ps(y, _mm_mul_ps(_mm_sub_ps(ay, _mm_mul_ps(vdrag, y)), vdt));
+            z = _mm_add_ps(z, _mm_mul_ps(_mm_sub_ps(az, _mm_mul_ps(vdrag, z)), vdt));
+            _mm_storeu_ps(vx + i, x);
+            _mm_storeu_ps(vy + i, y);
+            _mm_storeu_ps(vz + i, z);
+            _mm_storeu_ps(px + i, _mm_add_ps(_mm_loadu_ps(px + i), _mm_mul_ps(x, vdt)));
+            _mm_storeu_ps(py + i, _mm_add_ps(_mm_loadu_ps(py + i), _mm_mul_ps(y, vdt)));
+            _mm_storeu_ps(pz + i, _mm_add_ps(_mm_loadu_ps(pz + i), _mm_mul_ps(z, vdt)));
+            _mm_storeu_ps(age + i, _mm_add_ps(_mm_loadu_ps(age + i), vdt));
+        }
+        return i;
+    }
+    #endif
+
+}
+
+void GfxParticleStore::step (const GfxParticleBehaviour &b, float elapsed)
+{
+    size_t n = size();
+    if (n == 0) return;
+
+    Vector3 accel = b.gravity + b.drag * b.wind;
+    size_t done = 0;
+    #ifdef GFX_PARTICLE_SSE
+    done = integrate_sse(&posX[0], &posY[0], &posZ[0], &velX[0], &velY[0], &velZ[0], &age[0],
+                         n, accel, b.drag, elapsed);
+    #endif
+    integrate_scalar(&posX[0], &posY[0], &posZ[0], &velX[0], &velY[0], &velZ[0], &age[0],
+                     done, n, accel, b.drag, elapsed);
+
+    // Going backwards means the particle moved into a hole has already been considered.
+    for (size_t i = n ; i-- > 0 ; ) {
+        if (age[i] < life[i]) continue;
+        size_t last = --n;
+        posX[i] = posX[last];
+        posY[i] = posY[last];
+        posZ[i] = posZ[last];
+        velX[i] = velX[last];
+        velY[i] = velY[last];
+        velZ[i] = velZ[last];
+        age[i] = age[last];
+        life[i] = life[last];
+        angle[i] = angle[last];
+    }
+    if (n != size()) {
+        posX.resize(n);
+        posY.resize(n);
+        posZ.resize(n);
+        velX.resize(n);
+        velY.resize(n);
+        velZ.resize(n);
+        age.resize(n);
+        life.resize(n);
+        angle.resize(n);
+    }
+}
+
+void GfxParticleStore::clear (void)
+{
+    posX.clear();
+    posY.clear();
+    posZ.clear();
+    velX.clear();
+    velY.clear();
+    velZ.clear();
+    age.clear();
+    life.clear();
+    angle.clear();
+}
@@ -0,0 +1,114 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstddef>
+#include <vector>
+
+#include <math_util.h>
+
+#ifndef GFX_PARTICLE_BEHAVIOUR_H
+#define GFX_PARTICLE_BEHAVIOUR_H
+
+/** A rectangle of the particle texture, in texels. */
+struct GfxParticleFrame {
+    float u1, v1, u2, v2;
+};
+
+/** A value that changes over the life of a particle.  The keys are spread evenly from birth to
+ * death and linearly interpolated, so a single key gives a constant value.
+ */
+template<class T> struct GfxParticleCurve {
+    std::vector<T> keys;
+
+    GfxParticleCurve (const T &v) : keys(1, v) { }
+
+    // t is the proportion of the particle's life that has passed, from 0 to 1.
+    T operator() (float t) const
+    {
+        if (keys.size() == 1 || t <= 0) return keys.front();
+        float f = t * (keys.size() - 1);
+        unsigned i = unsigned(f);
+        if (i >= keys.size() - 1) return keys.back();
+        float frac = f - i;
+        return keys[i] + (keys[i + 1] - keys[i]) * frac;
+    }
+};
+
+/** How the particles of a natively simulated system move and change over their lives.
+ *
+ * The air moves at wind, and each second, drag is the proportion of the particle's velocity
+ * relative to the air that is lost.  Without drag, wind has no effect.
+ */
+struct GfxParticleBehaviour {
+    // Defaults for gfx_particle_emit.
+    float life;
+    Vector3 velocity;
+
+    Vector3 gravity;
+    Vector3 wind;
+    float drag;
+
+    // Multiplied by the size curve.
+    Vector3 dimensions;
+    GfxParticleCurve<float> size;
+    GfxParticleCurve<float> alpha;
+    GfxParticleCurve<Vector3> diffuse;
+    GfxParticleCurve<Vector3> emissive;
+
+    // Empty means the whole texture.
+    std::vector<GfxParticleFrame> frames;
+    // Frames per second, or 0 to play the frames once over the life of the particle.
+    float frameRate;
+
+    GfxParticleBehaviour (void)
+      : life(1), velocity(0, 0, 0), gravity(0, 0, 0), wind(0, 0, 0), drag(0),
+        dimensions(1, 1, 1), size(1), alpha(1), diffuse(Vector3(1, 1, 1)),
+        emissive(Vector3(0, 0, 0)), frameRate(0)
+    { }
+
+    // The frame to show at the given age, or null for the whole texture.
+    const GfxParticleFrame *frame (float age, float life) const;
+};
+
+/** The live particles of one natively simulated system, as a structure of arrays.
+ *
+ * The order of the particles is not stable, as expired ones are replaced by the last.
+ */
+class GfxParticleStore {
+    public:
+    std::vector<float> posX, posY, posZ;
+    std::vector<float> velX, velY, velZ;
+    std::vector<float> age, life, angle;
+
+    size_t size (void) const { return age.size(); }
+
+    void emit (const Vector3 &pos, const Vector3 &vel, float life, float angle);
+
+    /** Advance every particle by elapsed seconds, then remove those that have expired.
+     *
+     * The integration runs 4 particles at a time with SSE where available.  The results do not
+     * depend on whether it is.
+     */
+    void step (const GfxParticleBehaviour &b, float elapsed);
+
+    void clear (void);
+};
+
+#endif
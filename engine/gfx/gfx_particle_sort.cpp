@@ -0,0 +1,96 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cfloat>
+#include <cmath>
+
+#include "gfx_particle_sort.h"
+
+void GfxParticleDepthSort::sort (const float *dists, unsigned n)
+{
+    if (n == 0) return;
+    keys.resize(n);
+    keysTmp.resize(n);
+    order.resize(n);
+    orderTmp.resize(n);
+
+    // Only finite distances widen the range, in case the first one is NaN or infinite.
+    float nearest = FLT_MAX;
+    float furthest = -FLT_MAX;
+    for (unsigned i = 0 ; i < n ; ++i) {
+        if (!std::isfinite(dists[i])) continue;
+        if (dists[i] < nearest) nearest = dists[i];
+        if (dists[i] > furthest) furthest = dists[i];
+    }
+    float scale = furthest > nearest ? 65535 / (furthest - nearest) : 0;
+
+    // Both histograms are built while making the keys.  The key is inverted so that the
+    // furthest particle has the lowest.
+    unsigned counts[2][256] = { };
+    for (unsigned i = 0 ; i < n ; ++i) {
+        float q = (dists[i] - nearest) * scale;
+        // Also catches NaN.
+        if (!(q >= 0)) q = 0;
+        if (q > 65535) q = 65535;
+        uint16_t key = 65535 - uint16_t(q);
+        keys[i] = key;
+        counts[0][key & 0xff]++;
+        counts[1][key >> 8]++;
+    }
+
+    // Least significant byte first.  Each pass is stable, so the second keeps the order of the
+    // first among equal high bytes.  A pass where all keys share the same byte would not change
+    // the order, so it is skipped.
+    const uint16_t *keys_in = &keys[0];
+    uint16_t *keys_out = &keysTmp[0];
+    const unsigned *order_in = nullptr;
+    unsigned *order_out = &orderTmp[0];
+    for (unsigned pass = 0 ; pass < 2 ; ++pass) {
+        unsigned shift = pass * 8;
+        unsigned *c = counts[pass];
+        if (c[(keys_in[0] >> shift) & 0xff] == n) continue;
+
+        unsigned offset = 0;
+        for (unsigned b = 0 ; b < 256 ; ++b) {
+            unsigned count = c[b];
+            c[b] = offset;
+            offset += count;
+        }
+        for (unsigned i = 0 ; i < n ; ++i) {
+            uint16_t key = keys_in[i];
+            unsigned dst = c[(key >> shift) & 0xff]++;
+            keys_out[dst] = key;
+            order_out[dst] = order_in == nullptr ? i : order_in[i];
+        }
+
+        keys_in = keys_out;
+        order_in = order_out;
+        keys_out = keys_in == &keys[0] ? &keysTmp[0] : &keys[0];
+        order_out = order_in == &order[0] ? &orderTmp[0] : &order[0];
+    }
+
+    // Make sure the result ends up in order.
+    if (order_in == nullptr) {
+        for (unsigned i = 0 ; i < n ; ++i)
+            order[i] = i;
+    } else if (order_in != &order[0]) {
+        order.swap(orderTmp);
+    }
+}
@@ -0,0 +1,46 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdint>
+#include <vector>
+
+#ifndef GFX_PARTICLE_SORT_H
+#define GFX_PARTICLE_SORT_H
+
+/** Orders particles furthest first, for back to front blending.
+ *
+ * The distances are quantised to 16 bits across the range between the nearest and furthest
+ * particle, then sorted by a two pass radix sort, so particles closer together than 1/65535 of
+ * that range may be drawn in either order.  The buffers are kept between calls, so sorting does
+ * not allocate once they have grown to the largest system.
+ */
+class GfxParticleDepthSort {
+    std::vector<uint16_t> keys, keysTmp;
+    std::vector<unsigned> order, orderTmp;
+
+    public:
+
+    void sort (const float *dists, unsigned n);
+
+    // Indexes into the dists given to the last sort, furthest first.
+    const unsigned *getOrder (void) const { return &order[0]; }
+};
+
+#endif
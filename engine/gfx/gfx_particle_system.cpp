@@ -21,14 +21,19 @@
 
 #include <string>
 #include <algorithm>
+#include <cmath>
 #include <map>
 
 #include <math_util.h>
+#include <sleep.h>
 
 #include "../vect_util.h"
 
 #include "gfx.h"
 #include "gfx_internal.h"
+#include "gfx_option.h"
+#include "gfx_parallel.h"
+#include "gfx_particle_sort.h"
 #include "gfx_particle_system.h"
 #include "gfx_pipeline.h"
 #include "gfx_shader.h"
@@ -39,8 +44,13 @@ static Ogre::IndexData quadIndexData;
 
 #define QUAD(a,b,c,d) a, b, d, d, b, c
 
+// Smallest number of particles worth handing to another thread when filling the buffer.
+static const size_t PARTICLE_FILL_GRAIN = 4096;
+
 static GfxShader *shader;
 
+static GfxParticleRenderStats render_stats;
+
 void gfx_particle_init (void)
 {
     // set up the quad geometry
@@ -125,15 +135,12 @@ class ParticlesInstanceBuffer {
     Ogre::VertexData vertexData;
     unsigned instBufVertexSize;
 
-    float *instPtr, *instPtr0;
     unsigned maxInstances;
 
-    unsigned instancesAdded (void)
-    { return ((instPtr - instPtr0)*sizeof(float)) / instBufVertexSize; }
-
-
     public:
 
+    static const unsigned instanceFloats = 21;
+
     ParticlesInstanceBuffer (void)
     {
         auto d = vertexData.vertexDeclaration;
@@ -165,82 +172,96 @@ class ParticlesInstanceBuffer {
         instBufVertexSize += d->addElement(1, instBufVertexSize, Ogre::VET_FLOAT3, tc, 6).getSize();
         // uv1, uv2
         instBufVertexSize += d->addElement(1, instBufVertexSize, Ogre::VET_FLOAT4, tc, 7).getSize();
+        APP_ASSERT(instBufVertexSize == instanceFloats * sizeof(float));
 
         renderOp.vertexData = &vertexData;
         renderOp.indexData = &quadIndexData;
         renderOp.operationType = Ogre::RenderOperation::OT_TRIANGLE_LIST;
         renderOp.useIndexes = true;
-        instPtr = NULL;
-        instPtr0 = NULL;
         maxInstances = 0;
     }
 
-    void beginParticles (unsigned instances)
+    // Returns the buffer to write the instances into, instanceFloats each.  The buffer grows
+    // geometrically, and is discarded rather than reallocated each frame, so the driver can
+    // hand back memory the GPU is not using without a copy or a stall.
+    float *beginParticles (unsigned instances)
     {
-        
         if (instances > maxInstances) {
-            maxInstances = instances;
+            maxInstances = std::max(instances, maxInstances * 2);
             instBuf = Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
-                    instBufVertexSize, instances, Ogre::HardwareBuffer::HBU_DYNAMIC_WRITE_ONLY);
+                    instBufVertexSize, maxInstances,
+                    Ogre::HardwareBuffer::HBU_DYNAMIC_WRITE_ONLY_DISCARDABLE);
             instBuf->setIsInstanceData(true);
             instBuf->setInstanceDataStepRate(1);
             vertexData.vertexBufferBinding->setBinding(1, instBuf);
         }
 
-        instPtr0 = instPtr = static_cast<float*>(instBuf->lock(Ogre::HardwareBuffer::HBL_DISCARD));
+        return static_cast<float*>(instBuf->lock(0, instances * instBufVertexSize,
+                                                 Ogre::HardwareBuffer::HBL_DISCARD));
     }
 
-    void addParticle (const Vector3 &cam_up, GfxParticle *p)
+    static void writeParticle (float *instPtr, const Vector3 &cam_up, GfxParticle *p)
+    {
+        std::pair<unsigned, unsigned> tex_size = p->getTextureSize();
+        writeInstance(instPtr, cam_up, p->fromCamNorm, p->pos, p->dimensions, p->diffuse,
+                      p->alpha, p->emissive, p->angle,
+                      p->u1 / tex_size.first, p->v1 / tex_size.second,
+                      p->u2 / tex_size.first, p->v2 / tex_size.second);
+    }
+
+    // The uvs are normalised.
+    static void writeInstance (float *instPtr, const Vector3 &cam_up,
+                               const Vector3 &from_cam_norm, const Vector3 &pos,
+                               const Vector3 &dimensions, const Vector3 &diffuse, float alpha,
+                               const Vector3 &emissive, float angle_,
+                               float u1, float v1, float u2, float v2)
     {
         // right hand coordinate system -- +Z is towards the viewer
-        Vector3 basis_y = p->fromCamNorm;
+        Vector3 basis_y = from_cam_norm;
         Vector3 basis_z = cam_up; // not necessarily perpendicular to basis_z yet
         Vector3 basis_x = basis_y.cross(basis_z); // perp to z
 
-        basis_x *= p->dimensions.x / 2;
-        basis_z *= p->dimensions.y / 2;
+        basis_x *= dimensions.x / 2;
+        basis_z *= dimensions.y / 2;
 
         // rotate around y
-        Degree angle(p->angle);
+        Degree angle(angle_);
         float sin_angle = gritsin(angle);
         float cos_angle = gritcos(angle);
         Vector3 basis_x2 = cos_angle*basis_x + sin_angle*basis_z;
         Vector3 basis_z2 = cos_angle*basis_z - sin_angle*basis_x;
 
-        std::pair<unsigned, unsigned> tex_size = p->getTextureSize();
-
         *(instPtr++) = basis_x2.x;
         *(instPtr++) = basis_x2.y;
         *(instPtr++) = basis_x2.z;
-        *(instPtr++) = p->dimensions.z / 2;
+        *(instPtr++) = dimensions.z / 2;
         *(instPtr++) = basis_z2.x;
         *(instPtr++) = basis_z2.y;
         *(instPtr++) = basis_z2.z;
-        *(instPtr++) = p->pos.x;
-        *(instPtr++) = p->pos.y;
-        *(instPtr++) = p->pos.z;
-        *(instPtr++) = p->diffuse.x;
-        *(instPtr++) = p->diffuse.y;
-        *(instPtr++) = p->diffuse.z;
-        *(instPtr++) = p->alpha;
-        *(instPtr++) = p->emissive.x;
-        *(instPtr++) = p->emissive.y;
-        *(instPtr++) = p->emissive.z;
-        *(instPtr++) = p->u1 / tex_size.first;
-        *(instPtr++) = p->v1 / tex_size.second;
-        *(instPtr++) = p->u2 / tex_size.first;
-        *(instPtr++) = p->v2 / tex_size.second;
+        *(instPtr++) = pos.x;
+        *(instPtr++) = pos.y;
+        *(instPtr++) = pos.z;
+        *(instPtr++) = diffuse.x;
+        *(instPtr++) = diffuse.y;
+        *(instPtr++) = diffuse.z;
+        *(instPtr++) = alpha;
+        *(instPtr++) = emissive.x;
+        *(instPtr++) = emissive.y;
+        *(instPtr++) = emissive.z;
+        *(instPtr++) = u1;
+        *(instPtr++) = v1;
+        *(instPtr++) = u2;
+        *(instPtr++) = v2;
     }
 
-    void endParticles (void)
+    void endParticles (unsigned instances)
     {
         instBuf->unlock();
-        renderOp.numberOfInstances = instancesAdded();
+        renderOp.numberOfInstances = instances;
     }
 
     const Ogre::RenderOperation &getRenderOperation (void) { return renderOp; }
 
-    
 };
 
 
@@ -256,11 +277,20 @@ class GfxParticleSystem {
 
     ParticlesInstanceBuffer buffer;
 
+    // Kept between frames to avoid reallocating them.
+    std::vector<float> dists;
+    GfxParticleDepthSort sorter;
+
+    // Natively simulated particles, alongside any GfxParticle.
+    bool hasBehaviour;
+    GfxParticleBehaviour behaviour;
+    GfxParticleStore store;
+
     // every frame, must sort particles and compute new orientations
 
     public:
     GfxParticleSystem (const std::string &name, const DiskResourcePtr<GfxTextureDiskResource> &tex)
-         : name(name)
+         : name(name), hasBehaviour(false)
     {
         setTexture(tex);
     }
@@ -280,6 +310,43 @@ class GfxParticleSystem {
         texWidth = tex->getOgreTexturePtr()->getWidth();
     }
 
+    void setBehaviour (const GfxParticleBehaviour &v)
+    {
+        hasBehaviour = true;
+        behaviour = v;
+    }
+
+    void clearBehaviour (void)
+    {
+        hasBehaviour = false;
+        store.clear();
+    }
+
+    const GfxParticleBehaviour *getBehaviour (void) const
+    {
+        return hasBehaviour ? &behaviour : nullptr;
+    }
+
+    void emit (const Vector3 &pos, const Vector3 &vel, float life, float angle)
+    {
+        store.emit(pos, vel, life, angle);
+    }
+
+    void step (float elapsed)
+    {
+        if (hasBehaviour) store.step(behaviour, elapsed);
+    }
+
+    size_t nativeCount (void) const
+    {
+        return store.size();
+    }
+
+    void nativeReset (void)
+    {
+        store.clear();
+    }
+
     GfxParticle *emit (void)
     {
         GfxParticle *nu = new GfxParticle (this);
@@ -293,10 +360,27 @@ class GfxParticleSystem {
         delete p;
     }
 
-    static bool particleCompare (GfxParticle *a, GfxParticle *b)
+    void writeNative (float *instPtr, const Vector3 &cam_pos, const Vector3 &cam_up,
+                      unsigned i, float dist) const
     {
-        // furthest particle first
-        return a->fromCamDist > b->fromCamDist;
+        Vector3 pos(store.posX[i], store.posY[i], store.posZ[i]);
+        float age = store.age[i];
+        float life = store.life[i];
+        float t = age / life;
+
+        float u1 = 0, v1 = 0, u2 = 1, v2 = 1;
+        const GfxParticleFrame *frame = behaviour.frame(age, life);
+        if (frame != nullptr) {
+            u1 = frame->u1 / texWidth;
+            v1 = frame->v1 / texHeight;
+            u2 = frame->u2 / texWidth;
+            v2 = frame->v2 / texHeight;
+        }
+
+        ParticlesInstanceBuffer::writeInstance(
+            instPtr, cam_up, (pos - cam_pos) / dist, pos,
+            behaviour.dimensions * behaviour.size(t), behaviour.diffuse(t), behaviour.alpha(t),
+            behaviour.emissive(t), store.angle[i], u1, v1, u2, v2);
     }
 
     void render (GfxPipeline *pipe, const GfxShaderGlobals &globs)
@@ -307,29 +391,56 @@ class GfxParticleSystem {
 
         // PREPARE BUFFERS
 
-        // temporary list for sorting in
-        std::vector<GfxParticle*> tmp_list;
-        for (unsigned i=0 ; i<particles.size() ; ++i) {
-            GfxParticle *p = particles[i];
-            p->preProcess(cam_pos);
-            tmp_list.push_back(p);
-        }
+        // GfxParticle first, then natively simulated ones.
+        unsigned num_objects = particles.size();
+        unsigned num = num_objects + store.size();
 
         // early out for nothing to render
-        if (tmp_list.size() == 0) return;
-
-        std::sort(tmp_list.begin(), tmp_list.end(), particleCompare);
+        if (num == 0) return;
 
+        unsigned long long before = micros();
 
-        // use particles.size() to avoid frequent reallocation
-        buffer.beginParticles(particles.size());
-        for (unsigned i=0 ; i<tmp_list.size() ; ++i) {
-            GfxParticle *p = tmp_list[i];
-            buffer.addParticle(cam_up, p);
+        dists.resize(num);
+        for (unsigned i=0 ; i<num_objects ; ++i) {
+            GfxParticle *p = particles[i];
+            p->preProcess(cam_pos);
+            dists[i] = p->fromCamDist;
+        }
+        for (unsigned i=0 ; i<store.size() ; ++i) {
+            float dx = store.posX[i] - cam_pos.x;
+            float dy = store.posY[i] - cam_pos.y;
+            float dz = store.posZ[i] - cam_pos.z;
+            dists[num_objects + i] = std::sqrt(dx*dx + dy*dy + dz*dz);
         }
-        
-        buffer.endParticles();
 
+        sorter.sort(&dists[0], num);
+        const unsigned *order = sorter.getOrder();
+
+        unsigned long long after_sort = micros();
+
+        // Each instance is written straight into the locked buffer, in the sorted order, so
+        // ranges of it can be filled by different threads.
+        float *inst = buffer.beginParticles(num);
+        const unsigned floats = ParticlesInstanceBuffer::instanceFloats;
+        auto fill = [&] (size_t from, size_t to) {
+            for (size_t i=from ; i<to ; ++i) {
+                unsigned index = order[i];
+                if (index < num_objects) {
+                    ParticlesInstanceBuffer::writeParticle(&inst[i*floats], cam_up,
+                                                           particles[index]);
+                } else {
+                    writeNative(&inst[i*floats], cam_pos, cam_up, index - num_objects,
+                                dists[index]);
+                }
+            }
+        };
+        gfx_parallel_for(num, PARTICLE_FILL_GRAIN, gfx_option(GFX_PARTICLE_THREADS), fill);
+        buffer.endParticles(num);
+
+        unsigned long long after_fill = micros();
+        render_stats.particles += num;
+        render_stats.sortMicros += after_sort - before;
+        render_stats.fillMicros += after_fill - after_sort;
 
         // ISSUE RENDER COMMANDS
         try {
@@ -434,6 +545,15 @@ void gfx_particle_define (const std::string &pname,
     } else {
         psys = new GfxParticleSystem(pname, tex);
     }
+    psys->clearBehaviour();
+}
+
+void gfx_particle_define (const std::string &pname,
+                          const DiskResourcePtr<GfxTextureDiskResource> &tex,
+                          const GfxParticleBehaviour &behaviour)
+{
+    gfx_particle_define(pname, tex);
+    psystems[pname]->setBehaviour(behaviour);
 }
 
 GfxParticle *gfx_particle_emit (const std::string &pname)
@@ -443,6 +563,57 @@ GfxParticle *gfx_particle_emit (const std::string &pname)
     return psys->emit();
 }
 
+void gfx_particle_emit (const std::string &pname, const Vector3 &pos, const Vector3 &velocity,
+                        float life, float angle)
+{
+    PSysMap::iterator it = psystems.find(pname);
+    if (it == psystems.end()) EXCEPT << "No such particle: \"" << pname << "\"" << ENDL;
+    GfxParticleSystem *psys = it->second;
+    if (psys->getBehaviour() == nullptr)
+        EXCEPT << "Particle has no native behaviour: \"" << pname << "\"" << ENDL;
+    psys->emit(pos, velocity, life, angle);
+}
+
+const GfxParticleBehaviour *gfx_particle_behaviour (const std::string &pname)
+{
+    PSysMap::iterator it = psystems.find(pname);
+    if (it == psystems.end()) return nullptr;
+    return it->second->getBehaviour();
+}
+
+void gfx_particle_step (float elapsed)
+{
+    for (PSysMap::iterator i=psystems.begin(),i_=psystems.end() ; i!=i_ ; ++i) {
+        i->second->step(elapsed);
+    }
+}
+
+size_t gfx_particle_native_count (void)
+{
+    size_t r = 0;
+    for (PSysMap::iterator i=psystems.begin(),i_=psystems.end() ; i!=i_ ; ++i) {
+        r += i->second->nativeCount();
+    }
+    return r;
+}
+
+void gfx_particle_native_reset (void)
+{
+    for (PSysMap::iterator i=psystems.begin(),i_=psystems.end() ; i!=i_ ; ++i) {
+        i->second->nativeReset();
+    }
+}
+
+void gfx_particle_frame_started (void)
+{
+    render_stats = GfxParticleRenderStats();
+}
+
+const GfxParticleRenderStats &gfx_particle_last_frame_stats (void)
+{
+    return render_stats;
+}
+
 void gfx_particle_render (GfxPipeline *p)
 {
     GfxShaderGlobals g = gfx_shader_globals_cam(p);
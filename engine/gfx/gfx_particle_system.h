@@ -32,6 +32,8 @@ class GfxPipeline;
 #include "../vect_util.h"
 #include <math_util.h>
 
+#include "gfx_particle_behaviour.h"
+
 
 // Modify particle attributes whenever you want
 class GfxParticle : public fast_erase_index {
@@ -67,12 +69,48 @@ void gfx_particle_init (void);
 void gfx_particle_define (const std::string &pname,
                           const DiskResourcePtr<GfxTextureDiskResource> &tex);
 
+// set up a new particle system whose particles are simulated natively, or change the behaviour
+// of an existing one (its live particles carry on with the new behaviour)
+void gfx_particle_define (const std::string &pname,
+                          const DiskResourcePtr<GfxTextureDiskResource> &tex,
+                          const GfxParticleBehaviour &behaviour);
+
 // create a new particle in a given system (get rid of it by calling particle->release())
 GfxParticle *gfx_particle_emit (const std::string &pname);
 
+// create a natively simulated particle, it is removed when its life runs out
+void gfx_particle_emit (const std::string &pname, const Vector3 &pos, const Vector3 &velocity,
+                        float life, float angle);
+
+// the native behaviour of a system, or null if it has none or does not exist
+const GfxParticleBehaviour *gfx_particle_behaviour (const std::string &pname);
+
+// advance all natively simulated particles
+void gfx_particle_step (float elapsed);
+
+// number of natively simulated particles alive
+size_t gfx_particle_native_count (void);
+
+// remove all natively simulated particles
+void gfx_particle_native_reset (void);
+
 // A list of all particle systems
 std::vector<std::string> gfx_particle_all (void);
 
+/** CPU time spent preparing particles for rendering, summed over the passes of one frame. */
+struct GfxParticleRenderStats {
+    unsigned long particles;
+    float sortMicros;
+    float fillMicros;
+    GfxParticleRenderStats (void) : particles(0), sortMicros(0), fillMicros(0) { }
+};
+
+// called at the start of each frame, to reset the statistics
+void gfx_particle_frame_started (void);
+
+// between frames, the statistics of the frame that was just rendered
+const GfxParticleRenderStats &gfx_particle_last_frame_stats (void);
+
 // called every frame
 void gfx_particle_render (GfxPipeline *p);
 
@@ -24,8 +24,10 @@
 #include "gfx_body.h"
 #include "gfx_debug.h"
 #include "gfx_decal.h"
+#include "gfx_light.h"
 #include "gfx_particle_system.h"
 #include "gfx_pipeline.h"
+#include "gfx_scene_manager.h"
 #include "gfx_sky_body.h"
 #include "gfx_tracer_body.h"
 
@@ -226,57 +228,84 @@ void gfx_pipeline_init (void)
         true);
 
 
-    // TODO: Not clear if it's more efficient to compute ray at the vertexes.
     std::string identity_vertex_code =
         "out.position = vert.position.xyz;\n";
 
 
+    GfxGslRunParams lights_shader_params = gbuffer_shader_params;
+    lights_shader_params["lightClusters"] = GfxGslParam(GFX_GSL_FLOAT_TEXTURE2, 1, 1, 1, 1);
+    lights_shader_params["lightData"] = GfxGslParam(GFX_GSL_FLOAT_TEXTURE2, 1, 1, 1, 1);
+    lights_shader_params["lightIndexes"] = GfxGslParam(GFX_GSL_FLOAT_TEXTURE2, 1, 1, 1, 1);
+    // Tiles across, tiles down, slices, near clip distance.
+    lights_shader_params["clusterGrid"] = GfxGslParam::float4(1, 1, 1, 1);
+    lights_shader_params["clusterSliceScale"] = GfxGslParam::float1(1);
+    lights_shader_params["lightClustersHeight"] = GfxGslParam::float1(1);
+    lights_shader_params["lightDataHeight"] = GfxGslParam::float1(1);
+    lights_shader_params["lightIndexesSize"] = GfxGslParam::float2(1, 1);
+
+    // One full screen pass, each fragment looping over the lights of its cluster.  The textures
+    // are sampled at mip 0 since derivatives are undefined in the loop.
     std::string lights_colour_code =
-        "var uv = frag.screen / global.viewportSize;\n"
-        "uv.y = 1 - uv.y;\n"  // frag.screen is lower-left, textures upper-right.
-        "var ray = lerp(lerp(global.rayTopLeft, global.rayTopRight, uv.x),\n"
-        "               lerp(global.rayBottomLeft, global.rayBottomRight, uv.x),\n"
-        "               uv.y);\n"
-        // This code shouldn't be needed if frag.screen is working properly.
-        //+ std::string(gfx_d3d9() ? "uv = uv + Float2(0.5, 0.5) / global.viewportSize.xy;\n" : "")
-        + deferred_colour_code +
-        "var light_aim_ws = vert.normal;\n"
-        "var light_pos_ws = vert.coord2.xyz;\n"
-        "var inner = vert.coord3.x;\n"
-        "var outer = vert.coord3.y;\n"
-        "var range = vert.coord3.z;\n"
-        "var diff_colour = vert.coord0.xyz;\n"
-        "var spec_colour = vert.coord1.xyz;\n"
-
-        "var light_ray_ws = light_pos_ws - pos_ws;\n"
-        "var light_dist = length(light_ray_ws);\n"
-        "var surf_to_light = light_ray_ws / light_dist;\n"
-
-        "var dist = min(1.0, light_dist / range);\n"
+        deferred_colour_code +
+        "var grid = mat.clusterGrid;\n"
+        "var tile = min(floor(uv * grid.xy), grid.xy - Float2(1, 1));\n"
+        "var slice = floor(log(max(cam_dist, grid.w) / grid.w) * mat.clusterSliceScale);\n"
+        "slice = clamp(slice, 0.0, grid.z - 1);\n"
+        "var cluster_uv = Float2(tile.x + 0.5, slice * grid.y + tile.y + 0.5)\n"
+        "               / Float2(grid.x, mat.lightClustersHeight);\n"
+        "var cluster = sampleLod(mat.lightClusters, cluster_uv, 0.0);\n"
+        "var index_size = mat.lightIndexesSize;\n"
+
+        "out.colour = Float3(0, 0, 0);\n"
+        "for (var i = 0.0 ; i < cluster.y ; i = i + 1.0) {\n"
+        "    var entry = cluster.x + i;\n"
+        "    var entry_row = floor(entry / index_size.x);\n"
+        "    var entry_uv = Float2(entry - entry_row * index_size.x + 0.5, entry_row + 0.5)\n"
+        "                 / index_size;\n"
+        "    var light_index = sampleLod(mat.lightIndexes, entry_uv, 0.0).x;\n"
+        "    var light_v = (light_index + 0.5) / mat.lightDataHeight;\n"
+        "    var light_texel0 = sampleLod(mat.lightData, Float2(0.125, light_v), 0.0);\n"
+        "    var light_texel1 = sampleLod(mat.lightData, Float2(0.375, light_v), 0.0);\n"
+        "    var light_texel2 = sampleLod(mat.lightData, Float2(0.625, light_v), 0.0);\n"
+        "    var light_texel3 = sampleLod(mat.lightData, Float2(0.875, light_v), 0.0);\n"
+        "    var light_pos_ws = light_texel0.xyz;\n"
+        "    var range = light_texel0.w;\n"
+        "    var light_aim_ws = light_texel1.xyz;\n"
+        "    var inner = light_texel1.w;\n"
+        "    var diff_colour = light_texel2.xyz;\n"
+        "    var outer = light_texel2.w;\n"
+        "    var spec_colour = light_texel3.xyz;\n"
+
+        "    var light_ray_ws = light_pos_ws - pos_ws;\n"
+        "    var light_dist = length(light_ray_ws);\n"
+        "    var surf_to_light = light_ray_ws / light_dist;\n"
+
+        "    var dist = min(1.0, light_dist / range);\n"
         // This is the fadeoff equation that should probably be changed.
-        "var light_intensity = 2*dist*dist*dist - 3*dist*dist + 1;\n"
-
-        "var angle = -dot(light_aim_ws, surf_to_light);\n"
-        "if (outer != inner) {\n"
-        "    var occlusion = clamp((angle-inner)/(outer-inner), 0.0, 1.0);\n"
-        "    light_intensity = light_intensity * (1 - occlusion);\n"
+        "    var light_intensity = 2*dist*dist*dist - 3*dist*dist + 1;\n"
+
+        "    var angle = -dot(light_aim_ws, surf_to_light);\n"
+        "    if (outer != inner) {\n"
+        "        var occlusion = clamp((angle-inner)/(outer-inner), 0.0, 1.0);\n"
+        "        light_intensity = light_intensity * (1 - occlusion);\n"
+        "    }\n"
+
+        "    out.colour = out.colour + light_intensity * punctual_lighting(\n"
+        "        surf_to_light,\n"
+        "        v2c,\n"
+        "        d,\n"
+        "        normal_ws,\n"
+        "        g,\n"
+        "        s,\n"
+        "        diff_colour,\n"
+        "        spec_colour\n"
+        "    );\n"
         "}\n"
-
-        "out.colour = light_intensity * punctual_lighting(\n"
-        "    surf_to_light,\n"
-        "    v2c,\n"
-        "    d,\n"
-        "    normal_ws,\n"
-        "    g,\n"
-        "    s,\n"
-        "    diff_colour,\n"
-        "    spec_colour\n"
-        ");\n"
     ;
 
     deferred_lights = gfx_shader_make_or_reset("/system/DeferredLights",
-                                               identity_vertex_code, "", lights_colour_code,
-                                               gbuffer_shader_params, true);
+                                               das_vertex_code, "", lights_colour_code,
+                                               lights_shader_params, true);
 
 
     //////////////
@@ -410,221 +439,36 @@ void gfx_pipeline_init (void)
 }
 
 
-// {{{ (Deferred rendering) PointLightsGeometry
-
-// Buffers constructed every frame to render the point lights with deferred shading
-// (Cube and pyramid shaped bounding boxes for each light)
-class PointLightsGeometry {
-
-protected:
-
-    Ogre::RenderOperation mRenderOperation;
-    Ogre::VertexData mVertexData;
-    Ogre::IndexData mIndexData;
-
-    unsigned mDeclSize;
-    unsigned mMaxVertexesGPU;
-    unsigned mMaxIndexesGPU;
-
-    float *mVertexPtr0; // hold the base pointer
-    uint16_t *mIndexPtr0; // hold the base pointer
-    float *mVertexPtr; // hold the marching pointer
-    uint16_t *mIndexPtr; // hold the marching pointer
-
-public:
-
-    PointLightsGeometry (void)
-      :
-        mDeclSize(0),
-        mMaxVertexesGPU(0), // increase later
-        mMaxIndexesGPU(0), // increase later
-        mVertexPtr0(NULL),
-        mIndexPtr0(NULL)
-    {
-        mRenderOperation.vertexData = &mVertexData;
-        mRenderOperation.indexData = &mIndexData;
-        mRenderOperation.operationType = Ogre::RenderOperation::OT_TRIANGLE_LIST;
-        mRenderOperation.useIndexes = true;
-
-        // position on screen (just distinguishes the corners frome each other, -1 or 1)
-        mVertexData.vertexDeclaration->addElement(0, mDeclSize, Ogre::VET_FLOAT3,
-                                                                Ogre::VES_POSITION);
-        mDeclSize += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT3);
-        // direction the light is pointing (same for all 8 corners of the cube)
-        mVertexData.vertexDeclaration->addElement(0, mDeclSize, Ogre::VET_FLOAT3,
-                                                                Ogre::VES_NORMAL);
-        mDeclSize += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT3);
-        // diffuse colour (same for all 8 corners of the cube)
-        mVertexData.vertexDeclaration->addElement(0, mDeclSize, Ogre::VET_FLOAT3,
-                                                                Ogre::VES_TEXTURE_COORDINATES, 0);
-        mDeclSize += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT3);
-        // specular colour (same for all 8 corners of the cube)
-        mVertexData.vertexDeclaration->addElement(0, mDeclSize, Ogre::VET_FLOAT3,
-                                                                Ogre::VES_TEXTURE_COORDINATES, 1);
-        mDeclSize += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT3);
-        // light centre (same for all 8 corners of the cube)
-        mVertexData.vertexDeclaration->addElement(0, mDeclSize, Ogre::VET_FLOAT3,
-                                                                Ogre::VES_TEXTURE_COORDINATES, 2);
-        mDeclSize += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT3);
-        // inner/outer cone dot product and range (same for all 8 corners of the cube)
-        mVertexData.vertexDeclaration->addElement(0, mDeclSize, Ogre::VET_FLOAT3,
-                                                                Ogre::VES_TEXTURE_COORDINATES, 3);
-        mDeclSize += Ogre::VertexElement::getTypeSize(Ogre::VET_FLOAT3);
-
-    }
-
-    const Ogre::RenderOperation &getRenderOperation (void) { return mRenderOperation; }
-
-    unsigned indexesUsed (void) { return mIndexPtr - mIndexPtr0; }
-    unsigned vertexesUsed (void) { return ((mVertexPtr-mVertexPtr0)*sizeof(float)) / mDeclSize; }
-
-    void beginLights (unsigned lights)
-    {
-        unsigned vertexes = lights * 8; // assume worst case -- all cubes
-        if (vertexes > mMaxVertexesGPU) {
-            mMaxVertexesGPU = vertexes;
-            Ogre::HardwareVertexBufferSharedPtr vbuf =
-                Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(mDeclSize, vertexes, Ogre::HardwareBuffer::HBU_DYNAMIC_WRITE_ONLY);
-            mVertexData.vertexBufferBinding->setBinding(0, vbuf);
-        }
-
-        unsigned indexes = lights * 36; // assume worst case -- all cubes
-        if (indexes > mMaxIndexesGPU) {
-            mMaxIndexesGPU = indexes;
-            mIndexData.indexBuffer = Ogre::HardwareBufferManager::getSingleton().
-                createIndexBuffer(Ogre::HardwareIndexBuffer::IT_16BIT, indexes, Ogre::HardwareBuffer::HBU_DYNAMIC_WRITE_ONLY);
-        }
-
-        mVertexPtr0 = mVertexPtr = static_cast<float*>(mVertexData.vertexBufferBinding->getBuffer(0)->lock(Ogre::HardwareBuffer::HBL_DISCARD));
-        mIndexPtr0 = mIndexPtr = static_cast<uint16_t*>(mIndexData.indexBuffer->lock(Ogre::HardwareBuffer::HBL_DISCARD));
-    }
-
-    #define quad_vertexes(a,b,c,d) a, b, d, a, d, c
-
-    void pyramidLight (const Ogre::Vector3 &wpos,
-                       const Ogre::Vector3 *cuboid_planes, const Ogre::Vector3 &dir_ws,
-                       const Ogre::ColourValue &diff, const Ogre::ColourValue &spec,
-                       float inner, float outer, float range)
-    {
-
-        Ogre::Vector3 vertexes[] = {
-            wpos + cuboid_planes[0] + cuboid_planes[2] + cuboid_planes[5],
-            wpos + cuboid_planes[0] + cuboid_planes[3] + cuboid_planes[5],
-            wpos + cuboid_planes[1] + cuboid_planes[2] + cuboid_planes[5],
-            wpos + cuboid_planes[1] + cuboid_planes[3] + cuboid_planes[5],
-            wpos,
-        };
-
-        static unsigned indexes[] = {
-            quad_vertexes(3,1,2,0),
-            3, 4, 1,
-            1, 4, 0,
-            0, 4, 2,
-            2, 4, 3,
-        };
-
-
-        unsigned offset = vertexesUsed();
-        for (int j=0 ; j<5 ; ++j) {
-            // position
-            *(mVertexPtr++) = vertexes[j].x;
-            *(mVertexPtr++) = vertexes[j].y;
-            *(mVertexPtr++) = vertexes[j].z;
-            // direction
-            *(mVertexPtr++) = dir_ws.x;
-            *(mVertexPtr++) = dir_ws.y;
-            *(mVertexPtr++) = dir_ws.z;
-            // diffuse colour
-            *(mVertexPtr++) = diff.r;
-            *(mVertexPtr++) = diff.g;
-            *(mVertexPtr++) = diff.b;
-            // specular colour
-            *(mVertexPtr++) = spec.r;
-            *(mVertexPtr++) = spec.g;
-            *(mVertexPtr++) = spec.b;
-            // centre position
-            *(mVertexPtr++) = wpos.x;
-            *(mVertexPtr++) = wpos.y;
-            *(mVertexPtr++) = wpos.z;
-            // inner/outer cone dot product, range
-            *(mVertexPtr++) = inner;
-            *(mVertexPtr++) = outer;
-            *(mVertexPtr++) = range;
-        }
-        for (int j=0 ; j<18 ; ++j) {
-            *(mIndexPtr++) = offset+indexes[j];
-        }
-    }
+// {{{ (Deferred rendering) Light cluster textures
 
-    void cubeLight (const Ogre::Vector3 &wpos,
-                    const Ogre::Vector3 *cuboid_planes, const Ogre::Vector3 &dir_ws,
-                    const Ogre::ColourValue &diff, const Ogre::ColourValue &spec,
-                    float inner, float outer, float range)
-    {
-        Ogre::Vector3 vertexes[] = {
-            wpos + cuboid_planes[0] + cuboid_planes[2] + cuboid_planes[4],
-            wpos + cuboid_planes[0] + cuboid_planes[2] + cuboid_planes[5],
-            wpos + cuboid_planes[0] + cuboid_planes[3] + cuboid_planes[4],
-            wpos + cuboid_planes[0] + cuboid_planes[3] + cuboid_planes[5],
-            wpos + cuboid_planes[1] + cuboid_planes[2] + cuboid_planes[4],
-            wpos + cuboid_planes[1] + cuboid_planes[2] + cuboid_planes[5],
-            wpos + cuboid_planes[1] + cuboid_planes[3] + cuboid_planes[4],
-            wpos + cuboid_planes[1] + cuboid_planes[3] + cuboid_planes[5],
-        };
-
-        static unsigned indexes[] = {
-            quad_vertexes(2,6,0,4),
-            quad_vertexes(7,3,5,1),
-            quad_vertexes(3,2,1,0),
-            quad_vertexes(6,7,4,5),
-            quad_vertexes(0,4,1,5),
-            quad_vertexes(3,7,2,6)
-        };
+// Width of the texture holding the per-cluster light lists, which wraps onto further rows.
+static const unsigned LIGHT_INDEXES_WIDTH = 1024;
 
-        unsigned offset = vertexesUsed();
-        for (int j=0 ; j<8 ; ++j) {
-            // position
-            *(mVertexPtr++) = vertexes[j].x;
-            *(mVertexPtr++) = vertexes[j].y;
-            *(mVertexPtr++) = vertexes[j].z;
-            // direction
-            *(mVertexPtr++) = dir_ws.x;
-            *(mVertexPtr++) = dir_ws.y;
-            *(mVertexPtr++) = dir_ws.z;
-            // diffuse colour
-            *(mVertexPtr++) = diff.r;
-            *(mVertexPtr++) = diff.g;
-            *(mVertexPtr++) = diff.b;
-            // specular colour
-            *(mVertexPtr++) = spec.r;
-            *(mVertexPtr++) = spec.g;
-            *(mVertexPtr++) = spec.b;
-            // centre position
-            *(mVertexPtr++) = wpos.x;
-            *(mVertexPtr++) = wpos.y;
-            *(mVertexPtr++) = wpos.z;
-            // inner/outer cone dot product, range
-            *(mVertexPtr++) = inner;
-            *(mVertexPtr++) = outer;
-            *(mVertexPtr++) = range;
-        }
-        for (int j=0 ; j<36 ; ++j) {
-            *(mIndexPtr++) = offset+indexes[j];
-        }
-    }
-
-
-    void endLights ()
-    {
-        mVertexData.vertexBufferBinding->getBuffer(0)->unlock();
-        mIndexData.indexBuffer->unlock();
-
-        mVertexData.vertexCount = vertexesUsed();
-        mIndexData.indexCount = indexesUsed();
+// Write the rows of texels to the top of a texture used to stream data to the deferred shader,
+// first replacing the texture if it is too small.
+static void stream_texture (Ogre::TexturePtr &tex, unsigned width, unsigned height,
+                            Ogre::PixelFormat format, const float *data)
+{
+    if (tex.isNull() || tex->getWidth() != width || tex->getHeight() < height) {
+        unsigned h = tex.isNull() ? 1 : tex->getHeight();
+        while (h < height) h *= 2;
+        if (!tex.isNull()) Ogre::TextureManager::getSingleton().remove(tex);
+        static unsigned counter = 0;
+        std::stringstream ss;
+        ss << "LightClusters:" << counter++;
+        tex = Ogre::TextureManager::getSingleton().createManual(
+            ss.str(), RESGRP, Ogre::TEX_TYPE_2D, width, h, 1, 0, format,
+            Ogre::TU_DYNAMIC_WRITE_ONLY_DISCARDABLE);
     }
+    Ogre::PixelBox src(width, height, 1, format, const_cast<float*>(data));
+    tex->getBuffer()->blitFromMemory(src, Ogre::Box(0, 0, width, height));
+}
 
-
-};
+static void bind_point_texture (unsigned unit, const Ogre::TexturePtr &tex)
+{
+    ogre_rs->_setTexture(unit, true, tex);
+    ogre_rs->_setTextureUnitFiltering(unit, Ogre::FO_POINT, Ogre::FO_POINT, Ogre::FO_NONE);
+}
 
 // }}}
 
@@ -634,8 +478,14 @@ public:
 class DeferredLightingPasses : public Ogre::RenderQueueInvocation {
     GfxPipeline *pipe;
 
-    PointLightsGeometry mdl;
-    PointLightsGeometry mdlInside;
+    GfxLightClusters clusters;
+    std::vector<float> lightData;
+    std::vector<float> clusterTexels;
+    std::vector<float> indexTexels;
+
+    Ogre::TexturePtr lightDataTex;
+    Ogre::TexturePtr clustersTex;
+    Ogre::TexturePtr indexesTex;
 
     public:
     DeferredLightingPasses (GfxPipeline *pipe)
@@ -645,10 +495,16 @@ class DeferredLightingPasses : public Ogre::RenderQueueInvocation {
         setSuppressShadows(true);
     }
 
+    ~DeferredLightingPasses (void)
+    {
+        if (!lightDataTex.isNull()) Ogre::TextureManager::getSingleton().remove(lightDataTex);
+        if (!clustersTex.isNull()) Ogre::TextureManager::getSingleton().remove(clustersTex);
+        if (!indexesTex.isNull()) Ogre::TextureManager::getSingleton().remove(indexesTex);
+    }
+
     void invoke (Ogre::RenderQueueGroup *, Ogre::SceneManager *)
     {
         Ogre::Camera *cam = pipe->getCamera();
-        Ogre::Vector3 cam_pos = cam->getPosition();
 
         GfxTextureStateMap texs;
         // fill these in later as they are are Ogre internal textures
@@ -713,106 +569,73 @@ class DeferredLightingPasses : public Ogre::RenderQueueInvocation {
 
             const Ogre::LightList &ll = ogre_sm->_getLightsAffectingFrustum();
 
-            mdl.beginLights(ll.size());
-            mdlInside.beginLights(ll.size());
-
-            int light_counter = 0;
-            for (Ogre::LightList::const_iterator i=ll.begin(),i_=ll.end(); i!=i_ ; ++i) {
-                Ogre::Light *l = *i;
-                if (l == ogre_sun) continue;
-                light_counter++;
-                const Ogre::Vector3 &dir_ws = l->getDerivedDirection();
-                const Ogre::ColourValue &diff = l->getDiffuseColour();
-                const Ogre::ColourValue &spec = l->getSpecularColour();
-                float inner = Ogre::Math::Cos(l->getSpotlightInnerAngle());
-                float outer = Ogre::Math::Cos(l->getSpotlightOuterAngle());
-                float range = l->getAttenuationRange();
-                Ogre::Vector3 wpos = l->getDerivedPosition();
-                // define cone space in terms of world space
-                Ogre::Vector3 dir_z = dir_ws;
-                Ogre::Vector3 dir_x = dir_z.perpendicular();
-                Ogre::Vector3 dir_y = dir_z.crossProduct(dir_x);
-                bool use_pyramid = outer >= 0.4;
-                // define a bounding cuboid in cone space
-                float outer2 = std::max(0.0f, outer); // stop it at the 90 degree point
-                float cs_x_max = range * sqrtf(1 - outer2*outer2);
-                if (use_pyramid) {
-                        cs_x_max /= outer;
-                };
-                float cs_x_min = -cs_x_max;
-                float cs_y_max = cs_x_max;
-                float cs_y_min = cs_x_min;
-                float cs_z_max = range;
-                float cs_z_min = range * std::min(0.0f, outer);
-                Ogre::Vector3 light_to_cam = cam_pos - wpos;
-
-                // the 'inside' method always works but is less efficient as it
-                // does not allow us to avoid lighting when there is an object
-                // between the lit surface and the camera occluding the fragments
-                // to be shaded.
-
-                // on the other hand, the 'inside' method does have an optimisation
-                // in the case where the light is between the camera and a fragment
-                // but the fragment is out of range of the light
-
-                // I am choosing to prefer the occlusion optimisation as lights that are
-                // too far from surfaces should be avoided by good level design.
-
-                // however 'inside' is the only method that can be used if the
-                // camera is inside the light volume.
-
-                bool inside = between<float>(light_to_cam.dotProduct(dir_x), cs_x_min-1, cs_x_max+1)
-                           && between<float>(light_to_cam.dotProduct(dir_y), cs_y_min-1, cs_y_max+1)
-                           && between<float>(light_to_cam.dotProduct(dir_z), cs_z_min-1, cs_z_max+1);
-
-                //inside = true;
-
-                Ogre::Vector3 cuboid_planes[] = {
-                    cs_x_min * dir_x, cs_x_max * dir_x,
-                    cs_y_min * dir_y, cs_y_max * dir_y,
-                    cs_z_min * dir_z, cs_z_max * dir_z,
-                };
-
-                PointLightsGeometry &mdl_ = inside ? mdlInside : mdl;
-
-                if (use_pyramid) {
-                    mdl_.pyramidLight(wpos, cuboid_planes, dir_ws,diff,spec,inner,outer,range);
-                } else {
-                    mdl_.cubeLight(wpos, cuboid_planes, dir_ws,diff,spec,inner,outer,range);
-                }
-            }
-            mdl.endLights();
-            mdlInside.endLights();
-            //CVERB << "Total lights: " << light_counter << std::endl;
+            gfx_light_cluster_gather(ll, cam->getViewMatrix(), clusters, lightData);
+            GfxLightClusterGrid grid = gfx_light_cluster_grid(*cam);
+            clusters.assign(grid);
 
-            if (light_counter > 0) {
+            if (clusters.indexes.size() > 0) {
+
+                clusterTexels.resize(grid.size() * 4);
+                for (unsigned i=0 ; i<grid.size() ; ++i) {
+                    clusterTexels[i*4 + 0] = clusters.offsets[i];
+                    clusterTexels[i*4 + 1] = clusters.counts[i];
+                    clusterTexels[i*4 + 2] = 0;
+                    clusterTexels[i*4 + 3] = 0;
+                }
+                unsigned index_rows =
+                    (clusters.indexes.size() + LIGHT_INDEXES_WIDTH - 1) / LIGHT_INDEXES_WIDTH;
+                indexTexels.assign(index_rows * LIGHT_INDEXES_WIDTH, 0);
+                for (unsigned i=0 ; i<clusters.indexes.size() ; ++i)
+                    indexTexels[i] = clusters.indexes[i];
+
+                stream_texture(lightDataTex, 4, clusters.size(), Ogre::PF_FLOAT32_RGBA,
+                               &lightData[0]);
+                stream_texture(clustersTex, grid.tilesX, grid.tilesY * grid.slices,
+                               Ogre::PF_FLOAT32_RGBA, &clusterTexels[0]);
+                stream_texture(indexesTex, LIGHT_INDEXES_WIDTH, index_rows,
+                               Ogre::PF_FLOAT32_R, &indexTexels[0]);
+
+                binds["clusterGrid"] = GfxGslParam::float4(grid.tilesX, grid.tilesY,
+                                                           grid.slices, grid.nearClip);
+                binds["clusterSliceScale"] = GfxGslParam::float1(grid.sliceScale());
+                binds["lightClustersHeight"] = GfxGslParam::float1(clustersTex->getHeight());
+                binds["lightDataHeight"] = GfxGslParam::float1(lightDataTex->getHeight());
+                binds["lightIndexesSize"] = GfxGslParam::float2(LIGHT_INDEXES_WIDTH,
+                                                                indexesTex->getHeight());
+                binds["lightClusters"] = GfxGslParam(GFX_GSL_FLOAT_TEXTURE2, 1,1,1,1);
+                binds["lightData"] = GfxGslParam(GFX_GSL_FLOAT_TEXTURE2, 1,1,1,1);
+                binds["lightIndexes"] = GfxGslParam(GFX_GSL_FLOAT_TEXTURE2, 1,1,1,1);
+                texs["lightClusters"] = gfx_texture_state_point(nullptr);
+                texs["lightData"] = gfx_texture_state_point(nullptr);
+                texs["lightIndexes"] = gfx_texture_state_point(nullptr);
 
                 GfxShaderGlobals globs = gfx_shader_globals_cam(pipe);
 
-                deferred_lights->bindShader(GFX_GSL_PURPOSE_HUD, false, false, 0,
+                deferred_lights->bindShader(GFX_GSL_PURPOSE_DEFERRED_AMBIENT_SUN, false, false, 0,
                                             globs, I, nullptr, 0, 1, texs, binds);
 
+                // Bound in the order of the shader's texture params, which is alphabetical.
+                unsigned unit = NUM_GLOBAL_TEXTURES_LIGHTING;
                 for (unsigned i=0 ; i<3 ; ++i)
-                    ogre_rs->_setTexture(NUM_GLOBAL_TEXTURES_NO_LIGHTING + i, true, pipe->getGBufferTexture(i));
+                    ogre_rs->_setTexture(unit++, true, pipe->getGBufferTexture(i));
+                bind_point_texture(unit++, clustersTex);
+                bind_point_texture(unit++, lightDataTex);
+                bind_point_texture(unit++, indexesTex);
 
+                ogre_rs->_setCullingMode(Ogre::CULL_NONE);
+                ogre_rs->_setDepthBufferParams(false, false, Ogre::CMPF_LESS_EQUAL);
                 ogre_rs->_setSceneBlending(Ogre::SBF_ONE, Ogre::SBF_ONE);
                 ogre_rs->_setPolygonMode(Ogre::PM_SOLID);
                 ogre_rs->setStencilCheckEnabled(false);
                 ogre_rs->_setDepthBias(0, 0);
 
-                if (mdl.indexesUsed() > 0) {
-                    ogre_rs->_setCullingMode(Ogre::CULL_CLOCKWISE);
-                    ogre_rs->_setDepthBufferParams(true, false, Ogre::CMPF_LESS_EQUAL);
-                    ogre_rs->_render(mdl.getRenderOperation());
-                }
-
-                if (mdlInside.indexesUsed() > 0) {
-                    ogre_rs->_setCullingMode(Ogre::CULL_ANTICLOCKWISE);
-                    ogre_rs->_setDepthBufferParams(true, false, Ogre::CMPF_GREATER_EQUAL);
-                    ogre_rs->_render(mdlInside.getRenderOperation());
-                }
+                Ogre::RenderOperation op;
+                op.useIndexes = false;
+                op.vertexData = screen_quad_vdata;
+                op.operationType = Ogre::RenderOperation::OT_TRIANGLE_LIST;
+                ogre_rs->_render(op);
 
-                for (unsigned i=0 ; i<NUM_GLOBAL_TEXTURES_NO_LIGHTING + 3 ; ++i) {
+                for (unsigned i=0 ; i<unit ; ++i) {
                     ogre_rs->_disableTextureUnit(i);
                 }
             }
@@ -1016,7 +839,7 @@ class FirstPersonPasses : public Ogre::RenderQueueInvocation {
 
 
 GfxPipeline::GfxPipeline (const std::string &name, Ogre::Viewport *target_viewport)
-  : targetViewport(target_viewport)
+  : materialsRebuilt(0), targetViewport(target_viewport)
 {
 
     unsigned width = targetViewport->getActualWidth();
@@ -1242,14 +1065,9 @@ void GfxPipeline::render (const CameraOpts &cam_opts, bool additive)
     // populate gbuffer
     vp = gBuffer->addViewport(cam);
 
+    materialsRebuilt = 0;
     if (gfx_option(GFX_UPDATE_MATERIALS)) {
-        GfxShaderGlobals globs = gfx_shader_globals_cam(this);
-        for (const auto &pair : material_db) {
-            GfxMaterial *m = dynamic_cast<GfxMaterial*>(pair.second);
-            if (m == nullptr) continue;
-            // CVERB << "Rebuilding: " << m->name << std::endl;
-            m->updateOgreMaterials(globs);
-        }
+        materialsRebuilt = gfx_material_update(gfx_shader_globals_cam(this));
     }
 
     vp->setShadowsEnabled(true);
@@ -1263,6 +1081,7 @@ void GfxPipeline::render (const CameraOpts &cam_opts, bool additive)
     gBufferStats.batches = ogre_rs->_getBatchCount();
     gBufferStats.triangles = ogre_rs->_getFaceCount();;
     gBufferStats.micros = micros_after_gbuffer - micros_before;
+    gfx_scene_manager_cull_stats(cam, gBufferStats);
 
     if (!opts.bloomAndToneMap || opts.debugMode > 0) {
 
@@ -1281,6 +1100,7 @@ void GfxPipeline::render (const CameraOpts &cam_opts, bool additive)
         deferredStats.batches = ogre_rs->_getBatchCount();
         deferredStats.triangles = ogre_rs->_getFaceCount();
         deferredStats.micros = micros_after_deferred - micros_after_gbuffer;
+        gfx_scene_manager_cull_stats(cam, deferredStats);
         return;
 
     }
@@ -1297,6 +1117,7 @@ void GfxPipeline::render (const CameraOpts &cam_opts, bool additive)
     deferredStats.batches = ogre_rs->_getBatchCount();
     deferredStats.triangles = ogre_rs->_getFaceCount();
     deferredStats.micros = micros_after_deferred - micros_after_gbuffer;
+    gfx_scene_manager_cull_stats(cam, deferredStats);
     hdrFb[0]->getBuffer()->getRenderTarget()->removeViewport(vp->getZOrder());
     hdrFb[0]->getBuffer()->getRenderTarget()->detachDepthBuffer();
 
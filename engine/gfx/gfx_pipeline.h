@@ -71,6 +71,8 @@ class GfxPipeline {
     Ogre::Camera *cam;
     GfxLastRenderStats gBufferStats;
     GfxLastRenderStats deferredStats;
+    // Materials whose Ogre materials were rebuilt (rather than just updated) in the last render.
+    unsigned materialsRebuilt;
 
     // gbuffer target
     Ogre::TexturePtr gBufferElements[3];
@@ -95,6 +97,7 @@ class GfxPipeline {
 
     const GfxLastRenderStats &getGBufferStats (void) { return gBufferStats; }
     const GfxLastRenderStats &getDeferredStats (void) { return deferredStats; }
+    unsigned getMaterialsRebuilt (void) { return materialsRebuilt; }
 
     const CameraOpts &getCameraOpts (void) const { return opts; }
     Ogre::Camera *getCamera (void) const { return cam; }
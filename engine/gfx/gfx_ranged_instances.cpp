@@ -40,9 +40,10 @@ GfxRangedInstancesPtr GfxRangedInstances::make (const std::string &mesh_name, co
 GfxRangedInstances::GfxRangedInstances (const DiskResourcePtr<GfxMeshDiskResource> &gdr,
                                         const GfxNodePtr &par_)
   : GfxInstances(gdr, par_),
+    // Cells of about half the rendering distance keep the fade band to a few cells.
+    mGrid(20),
     mItemRenderingDistance(40),
-    mVisibility(1),
-    mStepSize(100000)
+    mVisibility(1)
 {   
     registerMe();
 }   
@@ -62,85 +63,37 @@ void GfxRangedInstances::unregisterMe (void)
     streamer_callback_unregister(this);
 }
 
-void GfxRangedInstances::update (const Vector3 &new_pos)
-{
-    const float vis2 = mVisibility * mVisibility;
-    typedef Cargo::iterator I;
-
-    // iterate through all activated guys to see who is too far to stay activated
-    Cargo victims = activated;
-    for (I i=victims.begin(), i_=victims.end() ; i!=i_ ; ++i) {
-        Item *o = *i;
-         //note we use vis2 not visibility
-        float range2 = o->range2(new_pos) / vis2;
-
-        if (range2 > 1) {
-            // now out of range
-            del(o->ticket);
-            o->activated = false;
-            Item *filler = activated[activated.size()-1];
-            activated[o->activatedIndex] = filler;
-            filler->activatedIndex = o->activatedIndex;
-            activated.pop_back();
-        } else {
-            // still in range, update visibility
-            float fade = o->calcFade(range2);
-            if (fade!=o->lastFade) {
-                update(o->ticket, o->pos, o->quat, fade);
-                o->lastFade = fade;
-            }
-        }
+struct GfxRangedInstances::CellCallbacks {
+    GfxRangedInstances *self;
+    bool activate (unsigned index, float fade)
+    {
+        Item &o = self->items[index];
+        o.ticket = self->add(o.pos, o.quat, fade);
+        return true;
     }
-
-    Cargo cargo;
-    mSpace.getPresent(new_pos.x, new_pos.y, new_pos.z, mStepSize, mVisibility, cargo);
-    // iterate through the cargo to see who needs to become activated
-    for (Cargo::iterator i=cargo.begin(),i_=cargo.end() ; i!=i_ ; ++i) {
-        Item *o = *i;
-
-        if (o->activated) continue;
-
-        float range2 = o->range2(new_pos) / vis2;
-
-        // not in range yet
-        if (range2 > 1) continue;
-
-        float fade = o->calcFade(range2);
-        o->lastFade = fade;
-
-        //activate o
-        o->ticket = add(o->pos, o->quat, fade);
-        o->activatedIndex = activated.size();
-        activated.push_back(o);
-        o->activated = true;
+    void deactivate (unsigned index)
+    {
+        self->del(self->items[index].ticket);
     }
-}
+    void fade (unsigned index, float fade)
+    {
+        Item &o = self->items[index];
+        self->update(o.ticket, o.pos, o.quat, fade);
+    }
+};
 
-void GfxRangedInstances::push_back (const SimpleTransform &t)
+void GfxRangedInstances::update (const Vector3 &new_pos)
 {
-    // it is very important that the number of samples does not increase over time, or
-    // the vector will resize and these pointers will become invalid
-    items.push_back(Item());
-    Item &item = items[items.size()-1];
-    item.parent = this;
-    item.activated = false;
-    item.quat = t.quat;
-    item.lastFade = 0;
-    mSpace.add(&item);
-    item.updateSphere(t.pos, mItemRenderingDistance);
+    CellCallbacks callbacks = { this };
+    mGrid.update(new_pos.x, new_pos.y, new_pos.z, mVisibility, streamer_fade_out_factor, callbacks);
 }
 
-float GfxRangedInstances::Item::calcFade (float range2)
+void GfxRangedInstances::push_back (const SimpleTransform &t)
 {
-    const float out = streamer_fade_out_factor;
-    float range = ::sqrtf(range2);
-
-    float fade = 1.0;
-
-    if (range > out) {
-            fade = (1-range) / (1-out);
-    }
-
-    return fade;
+    Item item;
+    item.pos = t.pos;
+    item.quat = t.quat;
+    item.ticket = 0;
+    items.push_back(item);
+    mGrid.add(t.pos.x, t.pos.y, t.pos.z, mItemRenderingDistance);
 }
-
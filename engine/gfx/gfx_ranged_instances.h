@@ -28,8 +28,8 @@ typedef SharedPtr<GfxRangedInstances> GfxRangedInstancesPtr;
 #ifndef GFX_RANGED_INSTANCES_H
 #define GFX_RANGED_INSTANCES_H
 
+#include "../ranged_cell_grid.h"
 #include "../streamer.h"
-#include "../cache_friendly_range_space_simd.h"
 
 #include "gfx_instances.h"
 
@@ -42,41 +42,23 @@ class GfxRangedInstances : public GfxInstances, public StreamerCallback {
     GfxRangedInstances (const DiskResourcePtr<GfxMeshDiskResource> &mesh, const GfxNodePtr &par_);
     ~GfxRangedInstances ();
 
+    // Indexed the same way as the items in mGrid.
     struct Item {
-        GfxRangedInstances *parent;
-        int index; // maintained by the RangeSpace class
         Vector3 pos;
         Quaternion quat;
-        bool activated;
-        int activatedIndex;
         unsigned ticket;
-        float renderingDistance;
-        float lastFade;
-        void updateSphere (const Vector3 &pos_, float r_)
-        {
-            renderingDistance = r_;
-            pos = pos_;
-            parent->mSpace.updateSphere(index, pos.x, pos.y, pos.z, r_);
-        }
-        void updateIndex (int index_) { index = index_; }
-        float range2 (const Vector3 &new_pos) const
-        {
-            return (new_pos-pos).length2() / renderingDistance / renderingDistance;
-        }
-        float calcFade (float range2);
     };
     typedef std::vector<Item> Items;
 
-    typedef CacheFriendlyRangeSpace<Item*> RS;
-    typedef RS::Cargo Cargo;
-    RS mSpace;
+    // Passed to mGrid.update() to (de)activate items and update their fade.
+    struct CellCallbacks;
+
+    RangedCellGrid mGrid;
     Items items;
-    Cargo activated;
 
 
     float mItemRenderingDistance;
     float mVisibility;
-    float mStepSize;
 
 
     public:
@@ -85,7 +67,7 @@ class GfxRangedInstances : public GfxInstances, public StreamerCallback {
     void push_back (const SimpleTransform &t);
     void reserve (size_t s) {
         items.reserve(s);
-        mSpace.reserve(s);
+        mGrid.reserve(s);
     };  
     size_t size (void) { return items.size(); }
 
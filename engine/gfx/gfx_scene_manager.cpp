@@ -0,0 +1,420 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+
+#include <sleep.h>
+
+#include "gfx_body.h"
+#include "gfx_occlusion.h"
+#include "gfx_scene_manager.h"
+#include "gfx_sort_keys.h"
+
+static const std::string TYPE_NAME = "GfxSceneManager";
+
+// Resolution of the occlusion buffers, 16:9 in whole tiles.
+static const unsigned OCCLUSION_WIDTH = 256;
+static const unsigned OCCLUSION_HEIGHT = 144;
+
+namespace {
+
+    struct Occluder {
+        const GfxMeshTriangles *mesh;
+        bool castShadows;
+    };
+
+    // The occlusion buffer of each camera, as of the last frame it was used in.
+    struct CameraOcclusion {
+        unsigned long frame;
+        Ogre::Matrix4 viewProj;
+        GfxOcclusionBuffer buffer;
+        CameraOcclusion (void) : frame(0), buffer(OCCLUSION_WIDTH, OCCLUSION_HEIGHT) { }
+    };
+    std::map<const Ogre::Camera*, CameraOcclusion> camera_occlusion;
+
+    unsigned long frame = 1;
+
+    GfxCullSpheres spheres;
+    std::vector<Ogre::MovableObject*> objects;
+    // For each object, its triangles if it is an occluder.
+    std::vector<Occluder> occluders;
+    unsigned num_occluders = 0;
+    std::vector<unsigned> visible;
+
+    struct CullStats {
+        unsigned visible;
+        unsigned culled;
+        unsigned occluded;
+        unsigned long long micros;
+    };
+    std::map<const Ogre::Camera*, CullStats> cull_stats;
+
+    GfxOcclusionMatrix to_occlusion (const Ogre::Matrix4 &m)
+    {
+        GfxOcclusionMatrix r;
+        for (unsigned i = 0 ; i < 4 ; ++i) {
+            for (unsigned j = 0 ; j < 4 ; ++j) {
+                r.m[i][j] = m[i][j];
+            }
+        }
+        return r;
+    }
+
+    /* Rasterise the visible occluders, or only those that cast shadows when rendering a shadow
+     * map.  Each camera's buffer is reused if it is asked for again in the same frame with the
+     * same view, e.g. by the deferred pass after the gbuffer pass.
+     */
+    const GfxOcclusionBuffer &occlusion_buffer (const Ogre::Camera *cam,
+                                                const Ogre::Matrix4 &view_proj,
+                                                bool only_shadow_casters)
+    {
+        CameraOcclusion &o = camera_occlusion[cam];
+        if (o.frame == frame && o.viewProj == view_proj) return o.buffer;
+        o.frame = frame;
+        o.viewProj = view_proj;
+        o.buffer.clear();
+        for (unsigned i : visible) {
+            const Occluder &occluder = occluders[i];
+            if (occluder.mesh == nullptr) continue;
+            if (only_shadow_casters && !occluder.castShadows) continue;
+            const GfxMeshTriangles &mesh = *occluder.mesh;
+            if (mesh.indexes.empty()) continue;
+            Ogre::Matrix4 m = view_proj * objects[i]->_getParentNodeFullTransform();
+            o.buffer.addOccluder(to_occlusion(m), &mesh.positions[0], &mesh.indexes[0],
+                                 mesh.indexes.size());
+        }
+        o.buffer.finish();
+        return o.buffer;
+    }
+
+    bool is_occluded (const GfxOcclusionBuffer &buffer, const Ogre::Matrix4 &view_proj,
+                      const Ogre::MovableObject *obj)
+    {
+        const Ogre::AxisAlignedBox &box = obj->getBoundingBox();
+        if (!box.isFinite()) return false;
+        Ogre::Matrix4 m = view_proj * obj->_getParentNodeFullTransform();
+        return buffer.isOccluded(to_occlusion(m), from_ogre(box.getMinimum()),
+                                 from_ogre(box.getMaximum()));
+    }
+
+    // One draw of a queued collection, and the state it needs bound.
+    struct Draw {
+        const Ogre::Pass *pass;
+        Ogre::Renderable *renderable;
+        const Ogre::VertexData *vertexData;
+    };
+    std::vector<Draw> draws;
+
+    // Ogre visits solids a pass at a time, and transparents one draw at a time.
+    class DrawCollector : public Ogre::QueuedRenderableVisitor {
+        const Ogre::Pass *pass;
+
+        void add (const Ogre::Pass *p, Ogre::Renderable *r)
+        {
+            Ogre::RenderOperation op;
+            r->getRenderOperation(op);
+            Draw d = { p, r, op.vertexData };
+            draws.push_back(d);
+        }
+
+        public:
+
+        DrawCollector (void) : pass(nullptr) { }
+
+        void visit (Ogre::RenderablePass *rp) { add(rp->pass, rp->renderable); }
+        bool visit (const Ogre::Pass *p) { pass = p; return true; }
+        void visit (Ogre::Renderable *r) { add(pass, r); }
+    } draw_collector;
+
+    GfxSortKeys draw_keys;
+    std::unordered_map<const Ogre::Pass*, uint64_t> pass_ids;
+    std::map<std::pair<const void*, const void*>, uint64_t> program_ids;
+    std::unordered_map<const Ogre::VertexData*, uint64_t> buffer_ids;
+
+    GfxDrawStateStats draw_stats;
+
+    std::pair<const void*, const void*> pass_programs (const Ogre::Pass *pass)
+    {
+        const void *vp = pass->hasVertexProgram() ? pass->getVertexProgram().get() : nullptr;
+        const void *fp = pass->hasFragmentProgram() ? pass->getFragmentProgram().get() : nullptr;
+        return std::make_pair(vp, fp);
+    }
+
+    // Ids are given in order of first use, and the last one is shared if there are too many.
+    template<class K, class M> uint64_t dense_id (M &ids, const K &k)
+    {
+        auto it = ids.find(k);
+        if (it != ids.end()) return it->second;
+        uint64_t id = std::min<uint64_t>(ids.size(), 0xffff);
+        ids[k] = id;
+        return id;
+    }
+
+    /* Keys of opaque draws, most expensive state change first: GPU programs, then the pass
+     * (i.e. material textures and params), then vertex data, then nearest first so the depth test
+     * rejects as much as possible.  The depth bucket is the top 16 bits of the squared distance as
+     * a float, which are ordered like the float itself since it is never negative.
+     */
+    void make_draw_keys (const Ogre::Camera *cam)
+    {
+        pass_ids.clear();
+        program_ids.clear();
+        buffer_ids.clear();
+        draw_keys.clear();
+        const Ogre::Pass *last_pass = nullptr;
+        uint64_t pass_key = 0;
+        for (const Draw &d : draws) {
+            if (d.pass != last_pass) {
+                last_pass = d.pass;
+                uint64_t program = dense_id(program_ids, pass_programs(d.pass));
+                pass_key = program << 48 | dense_id(pass_ids, d.pass) << 32;
+            }
+            float depth = d.renderable->getSquaredViewDepth(cam);
+            uint32_t depth_bits;
+            memcpy(&depth_bits, &depth, sizeof depth_bits);
+            draw_keys.add(pass_key | dense_id(buffer_ids, d.vertexData) << 16 | depth_bits >> 16);
+        }
+    }
+
+    class GfxSceneManager : public Ogre::OctreeSceneManager {
+
+        public:
+
+        GfxSceneManager (const std::string &name)
+          : Ogre::OctreeSceneManager(name)
+        { }
+
+        const std::string &getTypeName (void) const
+        {
+            return TYPE_NAME;
+        }
+
+        void _findVisibleObjects (Ogre::Camera *cam, Ogre::VisibleObjectsBoundsInfo *visible_bounds,
+                                  bool only_shadow_casters)
+        {
+            unsigned long long before = micros();
+
+            Ogre::RenderQueue *queue = getRenderQueue();
+            queue->clear();
+
+            visible.clear();
+            spheres.cull(gfx_cull_planes(cam), visible);
+            unsigned in_frustum = visible.size();
+
+            // Occluders are never tested, they would hide themselves.
+            if (num_occluders > 0 && gfx_option(GFX_OCCLUSION_CULL)) {
+                Ogre::Matrix4 view_proj = cam->getProjectionMatrix() * cam->getViewMatrix();
+                const GfxOcclusionBuffer &buffer =
+                    occlusion_buffer(cam, view_proj, only_shadow_casters);
+                unsigned kept = 0;
+                for (unsigned i : visible) {
+                    if (occluders[i].mesh == nullptr && is_occluded(buffer, view_proj, objects[i]))
+                        continue;
+                    visible[kept++] = i;
+                }
+                visible.resize(kept);
+            }
+
+            for (unsigned i : visible)
+                queue->processVisibleObject(objects[i], cam, only_shadow_casters, visible_bounds);
+
+            CullStats &s = cull_stats[cam];
+            s.visible = visible.size();
+            s.culled = objects.size() - in_frustum;
+            s.occluded = in_frustum - visible.size();
+            s.micros = micros() - before;
+        }
+
+        /* Ogre sets the pass of each transparent draw even when it is the same as the last one,
+         * and leaves solids of the same pass in the order they were queued.  Instead, collect the
+         * draws, sort the solids by their state, and only set the pass when it changes.
+         * Transparents must stay in the depth order Ogre gave them, for blending.
+         */
+        void renderObjects (const Ogre::QueuedRenderableCollection &objs,
+                            Ogre::QueuedRenderableCollection::OrganisationMode om,
+                            bool light_scissoring, bool do_light_iteration,
+                            const Ogre::LightList *manual_lights)
+        {
+            draws.clear();
+            objs.acceptVisitor(&draw_collector, om);
+            if (draws.empty()) return;
+
+            const unsigned *order = nullptr;
+            if (om == Ogre::QueuedRenderableCollection::OM_PASS_GROUP
+                && gfx_option(GFX_STATE_SORT)) {
+                unsigned long long before = micros();
+                make_draw_keys(mCameraInProgress);
+                draw_keys.sort();
+                order = draw_keys.getOrder();
+                draw_stats.sortMicros += micros() - before;
+            }
+
+            const Ogre::Pass *pass = nullptr;
+            const Ogre::Pass *used_pass = nullptr;
+            std::pair<const void*, const void*> programs(nullptr, nullptr);
+            const Ogre::VertexData *vertex_data = nullptr;
+            for (unsigned i = 0 ; i < draws.size() ; ++i) {
+                const Draw &d = draws[order == nullptr ? i : order[i]];
+                if (d.pass != pass) {
+                    pass = d.pass;
+                    used_pass = validatePassForRendering(pass) ? _setPass(pass) : nullptr;
+                    if (used_pass != nullptr) {
+                        draw_stats.passChanges++;
+                        auto used_programs = pass_programs(used_pass);
+                        if (used_programs != programs) {
+                            programs = used_programs;
+                            draw_stats.programChanges++;
+                        }
+                    }
+                }
+                if (used_pass == nullptr) continue;
+                if (!validateRenderableForRendering(used_pass, d.renderable)) continue;
+                if (d.vertexData != vertex_data) {
+                    vertex_data = d.vertexData;
+                    draw_stats.bufferChanges++;
+                }
+                draw_stats.draws++;
+                renderSingleObject(d.renderable, used_pass, light_scissoring, do_light_iteration,
+                                   manual_lights);
+            }
+        }
+    };
+
+    class GfxSceneManagerFactory : public Ogre::SceneManagerFactory {
+
+        protected:
+
+        void initMetaData (void) const
+        {
+            mMetaData.typeName = TYPE_NAME;
+            mMetaData.description = "Octree scene manager with bulk sphere culling";
+            mMetaData.sceneTypeMask = Ogre::ST_GENERIC;
+            mMetaData.worldGeometrySupported = false;
+        }
+
+        public:
+
+        Ogre::SceneManager *createInstance (const std::string &name)
+        {
+            return OGRE_NEW GfxSceneManager(name);
+        }
+
+        void destroyInstance (Ogre::SceneManager *sm)
+        {
+            OGRE_DELETE sm;
+        }
+    } factory;
+
+}
+
+Ogre::OctreeSceneManager *gfx_scene_manager_make (void)
+{
+    ogre_root->addSceneManagerFactory(&factory);
+    return static_cast<Ogre::OctreeSceneManager*>(ogre_root->createSceneManager(TYPE_NAME));
+}
+
+void gfx_scene_manager_shutdown (void)
+{
+    ogre_root->removeSceneManagerFactory(&factory);
+    spheres.clear();
+    objects.clear();
+    occluders.clear();
+    num_occluders = 0;
+    cull_stats.clear();
+    camera_occlusion.clear();
+    draws.clear();
+    pass_ids.clear();
+    program_ids.clear();
+    buffer_ids.clear();
+}
+
+void gfx_scene_manager_frame_started (void)
+{
+    frame++;
+    draw_stats = GfxDrawStateStats();
+    spheres.clear();
+    objects.clear();
+    occluders.clear();
+    num_occluders = 0;
+}
+
+void gfx_scene_manager_add (Ogre::MovableObject *obj)
+{
+    const Ogre::Matrix4 &world = obj->getParentNode()->_getFullTransform();
+
+    // The bounding radius is about the origin of the object, in its own space.
+    float scale = std::max((world * Ogre::Vector4(1, 0, 0, 0)).xyz().length(),
+                  std::max((world * Ogre::Vector4(0, 1, 0, 0)).xyz().length(),
+                           (world * Ogre::Vector4(0, 0, 1, 0)).xyz().length()));
+    float radius = obj->getBoundingRadius();
+    // Infinite bounds stay infinite, whatever the scale.
+    if (radius < FLT_MAX) radius *= scale;
+
+    spheres.add(from_ogre(world.getTrans()), radius);
+    objects.push_back(obj);
+
+    // Bodies that are fading are dithered, so cannot hide anything.
+    Occluder occluder = { nullptr, false };
+    auto *body = dynamic_cast<GfxBody*>(obj);
+    if (body != nullptr && body->getOccluder() && body->isEnabled() && body->getFade() >= 1) {
+        occluder.mesh = &body->getMeshTriangles();
+        occluder.castShadows = body->getCastShadows();
+        num_occluders++;
+    }
+    occluders.push_back(occluder);
+}
+
+GfxCullPlanes gfx_cull_planes (const Ogre::Camera *cam)
+{
+    GfxCullPlanes r;
+    const Ogre::Plane *planes = cam->getFrustumPlanes();
+    for (unsigned j = 0 ; j < 6 ; ++j) {
+        r.p[j][0] = planes[j].normal.x;
+        r.p[j][1] = planes[j].normal.y;
+        r.p[j][2] = planes[j].normal.z;
+        r.p[j][3] = planes[j].d;
+    }
+    if (cam->getFarClipDistance() == 0) {
+        // An infinite far clip distance, so nothing is beyond the far plane.
+        float *far_plane = r.p[Ogre::FRUSTUM_PLANE_FAR];
+        far_plane[0] = far_plane[1] = far_plane[2] = 0;
+        far_plane[3] = 1;
+    }
+    return r;
+}
+
+void gfx_scene_manager_cull_stats (const Ogre::Camera *cam, GfxLastRenderStats &stats)
+{
+    auto it = cull_stats.find(cam);
+    if (it == cull_stats.end()) return;
+    stats.visible = it->second.visible;
+    stats.culled = it->second.culled;
+    stats.occluded = it->second.occluded;
+    stats.cullMicros = it->second.micros;
+}
+
+const GfxDrawStateStats &gfx_scene_manager_last_frame_draw_stats (void)
+{
+    return draw_stats;
+}
@@ -0,0 +1,73 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "gfx_cull.h"
+#include "gfx_internal.h"
+
+#ifndef GFX_SCENE_MANAGER_H
+#define GFX_SCENE_MANAGER_H
+
+/* Ogre finds the objects to render by walking its octree and asking each object for its bounds,
+ * once for the camera and again for each shadow cascade.  Our scene manager instead keeps the
+ * world bounding spheres of all GfxNodes that are Ogre::MovableObjects (bodies, text bodies, and
+ * instances), and culls them in bulk with GfxCullSpheres.  If any bodies are occluders, the
+ * visible ones are then rasterised into a GfxOcclusionBuffer for each camera, and objects whose
+ * boxes are hidden by them are dropped too.  Only the remaining objects reach the render queue.
+ *
+ * When the queue is rendered, solid draws are sorted by the state they need (GPU programs, pass,
+ * vertex data, depth) so that consecutive draws share as much as possible, and each pass is only
+ * set when it differs from the one before.
+ */
+
+/** Register our scene manager with Ogre and create it. */
+Ogre::OctreeSceneManager *gfx_scene_manager_make (void);
+
+/** After the scene manager has been destroyed. */
+void gfx_scene_manager_shutdown (void);
+
+/** Forget the objects of the last frame. */
+void gfx_scene_manager_frame_started (void);
+
+/** Make the object a candidate for rendering this frame.  Its node's world transform must be up
+ * to date.
+ */
+void gfx_scene_manager_add (Ogre::MovableObject *obj);
+
+/** The planes that Ogre::Camera::isVisible tests against. */
+GfxCullPlanes gfx_cull_planes (const Ogre::Camera *cam);
+
+/** How much state changed between consecutive draws, summed over all the renders of a frame. */
+struct GfxDrawStateStats {
+    unsigned long draws;
+    unsigned long programChanges;
+    unsigned long passChanges;
+    unsigned long bufferChanges;
+    float sortMicros;
+    GfxDrawStateStats (void)
+      : draws(0), programChanges(0), passChanges(0), bufferChanges(0), sortMicros(0) { }
+};
+
+/** Between frames, the draw state stats of the frame that was just rendered. */
+const GfxDrawStateStats &gfx_scene_manager_last_frame_draw_stats (void);
+
+/** Fill in the culling stats of the last time objects were found for the camera. */
+void gfx_scene_manager_cull_stats (const Ogre::Camera *cam, GfxLastRenderStats &stats);
+
+#endif
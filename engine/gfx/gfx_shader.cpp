@@ -19,13 +19,21 @@
  * THE SOFTWARE.
  */
 
+#include <algorithm>
+#include <iterator>
+#include <thread>
+#include <unordered_set>
+
 #include <centralised_log.h>
+#include <sleep.h>
 
 #include "gfx.h"
 #include "gfx_gasoline.h"
+#include "gfx_gasoline_parallel.h"
 #include "gfx_gl3_plus.h"
 #include "gfx_internal.h"
 #include "gfx_shader.h"
+#include "gfx_shader_cache.h"
 
 GfxGslBackend backend = gfx_d3d9() ? GFX_GSL_BACKEND_CG : GFX_GSL_BACKEND_GLSL33;
 
@@ -39,6 +47,9 @@ std::ostream &operator << (std::ostream &o, const GfxShader::Split &s)
     return o;
 }
 
+// Shared by all shaders, so a block packed against one shader never matches another's version.
+static unsigned next_params_version = 1;
+
 static std::string fresh_name (void)
 {
     static int counter = 0;
@@ -191,6 +202,7 @@ void GfxShader::reset (const GfxGslRunParams &p,
                        bool internal_)
 {
     params = p;
+    paramsVersion = next_params_version++;
     srcVertex = src_vertex;
     srcDangs = src_dangs;
     srcAdditional = src_additional;
@@ -237,6 +249,33 @@ void GfxShader::populateMatEnv (bool fade_dither,
     }
 }
 
+void GfxShader::packParams (const GfxShaderBindings &bindings, GfxShaderParamBlock &block) const
+{
+    block.values.clear();
+    block.values.reserve(params.size());
+    for (const auto &pair : params) {
+        const std::string &name = pair.first;
+        const GfxGslParam &param = pair.second;
+        if (param.t == GFX_GSL_INT2 || param.t == GFX_GSL_INT3 || param.t == GFX_GSL_INT4) {
+            EXCEPTEX << "Ogre does not support int2 / int3 / int4." << ENDL;
+        }
+        auto bind = bindings.find(name);
+        if (bind == bindings.end()) {
+            block.values.push_back(param);
+            continue;
+        }
+        // Solid textures are checked at bind time, since they only matter if the texture is
+        // unbound.
+        if (!gfx_gasoline_param_is_texture(param) && bind->second.t != param.t) {
+            EXCEPTEX << "Binding \"" << name << "\" had wrong type in shader "
+                     << "\"" << this->name << "\": got " << bind->second.t << " but expected "
+                     << param.t << ENDL;
+        }
+        block.values.push_back(bind->second);
+    }
+    block.paramsVersion = paramsVersion;
+}
+
 void GfxShader::populateMeshEnv (bool instanced, unsigned bone_weights,
                                  GfxGslMeshEnvironment &mesh_env)
 {
@@ -244,9 +283,115 @@ void GfxShader::populateMeshEnv (bool instanced, unsigned bone_weights,
     mesh_env.boneWeights = bone_weights;
 }
 
-GfxShader::NativePair GfxShader::getNativePair (GfxGslPurpose purpose,
-                                                const GfxGslMaterialEnvironment &mat_env,
-                                                const GfxGslMeshEnvironment &mesh_env)
+GfxGslMetadata GfxShader::getMetadata (GfxGslPurpose purpose,
+                                       const GfxGslMaterialEnvironment &mat_env,
+                                       const GfxGslMeshEnvironment &mesh_env) const
+{
+    GfxGslMetadata md;
+    md.params = params;
+    md.cfgEnv = shader_scene_env;
+    md.matEnv = mat_env;
+    md.meshEnv = mesh_env;
+    md.d3d9 = gfx_d3d9();
+    md.internal = internal;
+    md.lightingTextures = gfx_gasoline_does_lighting(purpose);
+    return md;
+}
+
+GfxGasolineResult GfxShader::compile (GfxGslPurpose purpose,
+                                      const GfxGslMaterialEnvironment &mat_env,
+                                      const GfxGslMeshEnvironment &mesh_env)
+{
+    GfxGslMetadata md = getMetadata(purpose, mat_env, mesh_env);
+
+    GfxGasolineResult output;
+    try {
+        output = gfx_shader_cache_compile(purpose, backend, srcVertex, srcDangs, srcAdditional, md);
+    } catch (const Exception &e) {
+        EXCEPT << name << ": " << e.msg << ENDL;
+    }
+    return output;
+}
+
+bool GfxShader::hasNativePair (GfxGslPurpose purpose,
+                               const GfxGslMaterialEnvironment &mat_env,
+                               const GfxGslMeshEnvironment &mesh_env) const
+{
+    auto cfg_it = shaderCache.find(shader_scene_env);
+    if (cfg_it == shaderCache.end()) return false;
+    auto mat_it = cfg_it->second.find(mat_env);
+    if (mat_it == cfg_it->second.end()) return false;
+    Split split;
+    split.purpose = purpose;
+    split.meshEnv = mesh_env;
+    return mat_it->second.find(split) != mat_it->second.end();
+}
+
+void GfxShader::addNativePair (GfxGslPurpose purpose,
+                               const GfxGslMaterialEnvironment &mat_env,
+                               const GfxGslMeshEnvironment &mesh_env,
+                               const GfxGasolineResult &output)
+{
+    Split split;
+    split.purpose = purpose;
+    split.meshEnv = mesh_env;
+
+    Ogre::HighLevelGpuProgramPtr vp;
+    Ogre::HighLevelGpuProgramPtr fp;
+
+    std::string oname = fresh_name();
+    if (backend == GFX_GSL_BACKEND_CG) {
+        vp = Ogre::HighLevelGpuProgramManager::getSingleton().createProgram(
+            oname+"_v", RESGRP, "cg", Ogre::GPT_VERTEX_PROGRAM);
+        fp = Ogre::HighLevelGpuProgramManager::getSingleton().createProgram(
+            oname+"_f", RESGRP, "cg", Ogre::GPT_FRAGMENT_PROGRAM);
+        Ogre::StringVector vp_profs, fp_profs;
+        if (gfx_d3d9()) {
+            vp_profs.push_back("vs_3_0");
+            fp_profs.push_back("ps_3_0");
+        } else {
+            vp_profs.push_back("gpu_vp");
+            fp_profs.push_back("gp4fp");
+        }
+
+        Ogre::CgProgram *tmp_vp = static_cast<Ogre::CgProgram*>(&*vp);
+        tmp_vp->setEntryPoint("main");
+        tmp_vp->setProfiles(vp_profs);
+        tmp_vp->setCompileArguments("-I. -O3");
+
+        Ogre::CgProgram *tmp_fp = static_cast<Ogre::CgProgram*>(&*fp);
+        tmp_fp->setEntryPoint("main");
+        tmp_fp->setProfiles(fp_profs);
+        tmp_fp->setCompileArguments("-I. -O3");
+    } else {
+        vp = Ogre::HighLevelGpuProgramManager::getSingleton().createProgram(
+            oname+"_v", RESGRP, "glsl", Ogre::GPT_VERTEX_PROGRAM);
+        fp = Ogre::HighLevelGpuProgramManager::getSingleton().createProgram(
+            oname+"_f", RESGRP, "glsl", Ogre::GPT_FRAGMENT_PROGRAM);
+    }
+
+    if (dump_shader == "*" || dump_shader == name) {
+        CVERB << "=== Compiling: " << name << " " << split << std::endl;
+        CVERB << "--- Vertex ---\n" << output.vertexShader << std::endl;
+        CVERB << "--- Fragment ---\n" << output.fragmentShader << std::endl;
+    }
+    vp->setSource(output.vertexShader);
+    fp->setSource(output.fragmentShader);
+    vp->load();
+    fp->load();
+
+    if (backend == GFX_GSL_BACKEND_GLSL33) {
+        gfx_gl3_plus_force_shader_compilation(vp, fp);
+    }
+    NativePair &np = shaderCache[shader_scene_env][mat_env][split];
+    np.vp = vp;
+    np.fp = fp;
+    resolveUniforms(mat_env, np);
+}
+
+const GfxShader::NativePair &GfxShader::getNativePair (GfxGslPurpose purpose,
+                                                       const GfxGslMaterialEnvironment &mat_env,
+                                                       const GfxGslMeshEnvironment &mesh_env)
 {
     // Need to choose / maybe compile a shader for this combination of textures and bindings.
     //
@@ -259,83 +404,138 @@ GfxShader::NativePair GfxShader::getNativePair (GfxGslPurpose purpose,
 
     if (it == cache.end()) {
         // Need to build it.
-        Ogre::HighLevelGpuProgramPtr vp;
-        Ogre::HighLevelGpuProgramPtr fp;
-
-
-        std::string oname = fresh_name();
-        if (backend == GFX_GSL_BACKEND_CG) {
-            vp = Ogre::HighLevelGpuProgramManager::getSingleton().createProgram(
-                oname+"_v", RESGRP, "cg", Ogre::GPT_VERTEX_PROGRAM);
-            fp = Ogre::HighLevelGpuProgramManager::getSingleton().createProgram(
-                oname+"_f", RESGRP, "cg", Ogre::GPT_FRAGMENT_PROGRAM);
-            Ogre::StringVector vp_profs, fp_profs;
-            if (gfx_d3d9()) {
-                vp_profs.push_back("vs_3_0");
-                fp_profs.push_back("ps_3_0");
+        addNativePair(purpose, mat_env, mesh_env, compile(purpose, mat_env, mesh_env));
+        return cache[split];
+        
+    } else {
+
+        return it->second;
+
+    }
+}
+
+
+// Sets count to 0 if the program does not use the constant.
+static void find_constant (const Ogre::GpuProgramParametersSharedPtr &p, const std::string &name,
+                           size_t &index, unsigned &count)
+{
+    const Ogre::GpuConstantDefinition *def = p->_findNamedConstantDefinition(name, false);
+    if (def == nullptr) {
+        index = 0;
+        count = 0;
+        return;
+    }
+    index = def->physicalIndex;
+    // Mirror setNamedConstant, which never writes past the declared size.
+    count = std::min(count, unsigned(def->elementSize * def->arraySize));
+}
+
+void GfxShader::resolveUniforms (const GfxGslMaterialEnvironment &mat_env, NativePair &np)
+{
+    const Ogre::GpuProgramParametersSharedPtr &vparams = np.vp->getDefaultParameters();
+    const Ogre::GpuProgramParametersSharedPtr &fparams = np.fp->getDefaultParameters();
+
+    np.uniforms.clear();
+    int sampler = 0;
+    unsigned index = 0;
+    for (const auto &pair : params) {
+        const std::string &name = pair.first;
+        const GfxGslParam &param = pair.second;
+        UniformBinding u;
+        u.param = index++;
+        u.isInt = false;
+        u.solidTexture = false;
+        u.sampler = -1;
+        unsigned count = 0;
+        if (gfx_gasoline_param_is_texture(param)) {
+            auto it = mat_env.ubt.find(name);
+            if (it == mat_env.ubt.end()) {
+                // Bound texture, only GLSL needs to be told the texture unit.
+                u.sampler = sampler++;
+                if (backend != GFX_GSL_BACKEND_GLSL33) continue;
+                u.isInt = true;
+                count = 1;
+            } else if (it->second) {
+                u.solidTexture = true;
+                count = 4;
             } else {
-                vp_profs.push_back("gpu_vp");
-                fp_profs.push_back("gp4fp");
+                // Completely unbound texture, compiled out of the shader.
+                continue;
             }
+        } else {
+            switch (param.t) {
+                case GFX_GSL_FLOAT1: count = 1; break;
+                case GFX_GSL_FLOAT2: count = 2; break;
+                case GFX_GSL_FLOAT3: count = 3; break;
+                case GFX_GSL_FLOAT4: count = 4; break;
+                case GFX_GSL_INT1: u.isInt = true; count = 1; break;
+
+                // Rejected by packParams.
+                case GFX_GSL_INT2:
+                case GFX_GSL_INT3:
+                case GFX_GSL_INT4:
+                continue;
 
-            Ogre::CgProgram *tmp_vp = static_cast<Ogre::CgProgram*>(&*vp);
-            tmp_vp->setEntryPoint("main");
-            tmp_vp->setProfiles(vp_profs);
-            tmp_vp->setCompileArguments("-I. -O3");
+                case GFX_GSL_STATIC_FLOAT1:
+                case GFX_GSL_STATIC_FLOAT2:
+                case GFX_GSL_STATIC_FLOAT3:
+                case GFX_GSL_STATIC_FLOAT4:
+                case GFX_GSL_STATIC_INT1:
+                case GFX_GSL_STATIC_INT2:
+                case GFX_GSL_STATIC_INT3:
+                case GFX_GSL_STATIC_INT4:
+                // Do nothing -- these are baked into the shader already.
+                continue;
 
-            Ogre::CgProgram *tmp_fp = static_cast<Ogre::CgProgram*>(&*fp);
-            tmp_fp->setEntryPoint("main");
-            tmp_fp->setProfiles(fp_profs);
-            tmp_fp->setCompileArguments("-I. -O3");
-        } else {
-            vp = Ogre::HighLevelGpuProgramManager::getSingleton().createProgram(
-                oname+"_v", RESGRP, "glsl", Ogre::GPT_VERTEX_PROGRAM);
-            fp = Ogre::HighLevelGpuProgramManager::getSingleton().createProgram(
-                oname+"_f", RESGRP, "glsl", Ogre::GPT_FRAGMENT_PROGRAM);
+                default: EXCEPTEX << "Internal error." << ENDL;
+            }
         }
+        u.v.count = count;
+        u.f.count = count;
+        find_constant(vparams, "mat_" + name, u.v.index, u.v.count);
+        find_constant(fparams, "mat_" + name, u.f.index, u.f.count);
+        if (u.v.count == 0 && u.f.count == 0) continue;
+        np.uniforms.push_back(u);
+    }
+}
 
+template<class T> static void write_constant (const Ogre::GpuProgramParametersSharedPtr &p,
+                                              size_t index, unsigned count, const T *v)
+{
+    if (count > 0) p->_writeRawConstants(index, v, count);
+}
 
-        GfxGslMetadata md;
-        md.params = params;
-        md.cfgEnv = shader_scene_env;
-        md.matEnv = mat_env;
-        md.meshEnv = mesh_env;
-        md.d3d9 = gfx_d3d9();
-        md.internal = internal;
-        md.lightingTextures = gfx_gasoline_does_lighting(purpose);
-
-        GfxGasolineResult output;
-        try {
-            output = gfx_gasoline_compile(purpose, backend, srcVertex, srcDangs, srcAdditional, md);
-        } catch (const Exception &e) {
-            EXCEPT << name << ": " << e.msg << ENDL;
+void GfxShader::bindShaderParams (int counter, const NativePair &np,
+                                  const Ogre::GpuProgramParametersSharedPtr &vparams,
+                                  const Ogre::GpuProgramParametersSharedPtr &fparams,
+                                  const GfxShaderParamBlock &block)
+{
+    if (block.paramsVersion != paramsVersion) {
+        EXCEPTEX << "Param block is out of date for shader \"" << name << "\"." << ENDL;
+    }
+    for (const UniformBinding &u : np.uniforms) {
+        if (u.sampler >= 0) {
+            int unit = counter + u.sampler;
+            write_constant(vparams, u.v.index, u.v.count, &unit);
+            write_constant(fparams, u.f.index, u.f.count, &unit);
+            continue;
         }
-        if (dump_shader == "*" || dump_shader == name) {
-            CVERB << "=== Compiling: " << name << " " << split << std::endl;
-            CVERB << "--- Vertex ---\n" << output.vertexShader << std::endl;
-            CVERB << "--- Fragment ---\n" << output.fragmentShader << std::endl;
+        const GfxGslParam &v = block.values[u.param];
+        if (u.solidTexture && v.t != GFX_GSL_FLOAT4) {
+            EXCEPTEX << "Solid texture \"" << std::next(params.begin(), u.param)->first
+                     << "\" had wrong type in shader \"" << this->name << "\": got " << v.t
+                     << " but expected " << GFX_GSL_FLOAT4 << ENDL;
         }
-        vp->setSource(output.vertexShader);
-        fp->setSource(output.fragmentShader);
-        vp->load();
-        fp->load();
-
-        if (backend == GFX_GSL_BACKEND_GLSL33) {
-            gfx_gl3_plus_force_shader_compilation(vp, fp);
+        if (u.isInt) {
+            write_constant(vparams, u.v.index, u.v.count, &v.is.r);
+            write_constant(fparams, u.f.index, u.f.count, &v.is.r);
+        } else {
+            write_constant(vparams, u.v.index, u.v.count, &v.fs.r);
+            write_constant(fparams, u.f.index, u.f.count, &v.fs.r);
         }
-        NativePair np = {vp, fp};
-        cache[split] = np;
-
-        return np;
-        
-    } else {
-
-        return it->second;
-
     }
 }
 
-
 void GfxShader::bindShaderParams (int counter,
                                   const Ogre::GpuProgramParametersSharedPtr &vparams,
                                   const Ogre::GpuProgramParametersSharedPtr &fparams,
@@ -593,6 +793,28 @@ void GfxShader::bindShader (GfxGslPurpose purpose,
                num_bone_world_matrixes, fade, paint_colours, textures, bindings);
 }
 
+void GfxShader::bindShader (GfxGslPurpose purpose,
+                            const GfxGslMaterialEnvironment &mat_env,
+                            const GfxGslMeshEnvironment &mesh_env,
+                            const GfxShaderGlobals &globs,
+                            const Ogre::Matrix4 &world,
+                            const Ogre::Matrix4 *bone_world_matrixes,
+                            unsigned num_bone_world_matrixes,
+                            float fade,
+                            const GfxTextureStateMap &textures,
+                            const GfxShaderParamBlock &block)
+{
+    GfxPaintColour white[] = {
+        { Vector3(1, 1, 1), 1, 1, 1, },
+        { Vector3(1, 1, 1), 1, 1, 1, },
+        { Vector3(1, 1, 1), 1, 1, 1, },
+        { Vector3(1, 1, 1), 1, 1, 1, },
+    };
+    bindShader(purpose, mat_env, mesh_env, globs, world,
+               bone_world_matrixes, num_bone_world_matrixes, fade, white,
+               textures, block);
+}
+
 void GfxShader::bindShader (GfxGslPurpose purpose,
                             const GfxGslMaterialEnvironment &mat_env,
                             const GfxGslMeshEnvironment &mesh_env,
@@ -605,7 +827,48 @@ void GfxShader::bindShader (GfxGslPurpose purpose,
                             const GfxTextureStateMap &textures,
                             const GfxShaderBindings &bindings)
 {
-    auto np = getNativePair(purpose, mat_env, mesh_env);
+    if (!gfx_option(GFX_PARAM_BLOCKS)) {
+        bindShaderImpl(purpose, mat_env, mesh_env, globs, world, bone_world_matrixes,
+                       num_bone_world_matrixes, fade, paint_colours, textures, nullptr, &bindings);
+        return;
+    }
+    // Only the render thread binds shaders, so the scratch block can be reused.
+    static GfxShaderParamBlock block;
+    packParams(bindings, block);
+    bindShaderImpl(purpose, mat_env, mesh_env, globs, world, bone_world_matrixes,
+                   num_bone_world_matrixes, fade, paint_colours, textures, &block, nullptr);
+}
+
+void GfxShader::bindShader (GfxGslPurpose purpose,
+                            const GfxGslMaterialEnvironment &mat_env,
+                            const GfxGslMeshEnvironment &mesh_env,
+                            const GfxShaderGlobals &globs,
+                            const Ogre::Matrix4 &world,
+                            const Ogre::Matrix4 *bone_world_matrixes,
+                            unsigned num_bone_world_matrixes,
+                            float fade,
+                            const GfxPaintColour *paint_colours,  // Array of 4
+                            const GfxTextureStateMap &textures,
+                            const GfxShaderParamBlock &block)
+{
+    bindShaderImpl(purpose, mat_env, mesh_env, globs, world, bone_world_matrixes,
+                   num_bone_world_matrixes, fade, paint_colours, textures, &block, nullptr);
+}
+
+void GfxShader::bindShaderImpl (GfxGslPurpose purpose,
+                                const GfxGslMaterialEnvironment &mat_env,
+                                const GfxGslMeshEnvironment &mesh_env,
+                                const GfxShaderGlobals &globs,
+                                const Ogre::Matrix4 &world,
+                                const Ogre::Matrix4 *bone_world_matrixes,
+                                unsigned num_bone_world_matrixes,
+                                float fade,
+                                const GfxPaintColour *paint_colours,  // Array of 4
+                                const GfxTextureStateMap &textures,
+                                const GfxShaderParamBlock *block,
+                                const GfxShaderBindings *bindings)
+{
+    const NativePair &np = getNativePair(purpose, mat_env, mesh_env);
 
     // both programs must be bound before we bind the params, otherwise some params are 'lost' in gl
     ogre_rs->bindGpuProgram(np.vp->_getBindingDelegate());
@@ -618,7 +881,11 @@ void GfxShader::bindShader (GfxGslPurpose purpose,
 
     bindGlobals(vparams, fparams, globs, purpose);
     int counter = bindGlobalTexturesRs(globs, purpose);
-    bindShaderParams(counter, vparams, fparams, textures, bindings);
+    if (block != nullptr) {
+        bindShaderParams(counter, np, vparams, fparams, *block);
+    } else {
+        bindShaderParams(counter, vparams, fparams, textures, *bindings);
+    }
     bindShaderParamsRs(counter, textures);
     bindBodyParamsRS(vparams, fparams, globs, world, bone_world_matrixes, num_bone_world_matrixes,
                      fade, paint_colours, purpose);
@@ -644,7 +911,7 @@ void GfxShader::initPass (Ogre::Pass *p,
                           const GfxTextureStateMap &textures,
                           const GfxShaderBindings &bindings)
 {
-    auto np = getNativePair(purpose, mat_env, mesh_env);
+    const NativePair &np = getNativePair(purpose, mat_env, mesh_env);
 
     p->setFragmentProgram(np.fp->getName());
     p->setVertexProgram(np.vp->getName());
@@ -709,24 +976,8 @@ void GfxShader::initPass (Ogre::Pass *p,
 
 }
 
-void GfxShader::updatePass (Ogre::Pass *p,
-                            const GfxShaderGlobals &globs,
-                            GfxGslPurpose purpose,
-                            const GfxGslMaterialEnvironment &mat_env,
-                            const GfxGslMeshEnvironment &mesh_env,
-                            const GfxTextureStateMap &textures,
-                            const GfxShaderBindings &bindings)
+void GfxShader::updatePass (Ogre::Pass *p, const GfxShaderGlobals &globs, GfxGslPurpose purpose)
 {
-    auto np = getNativePair(purpose, mat_env, mesh_env);
-
-    // TODO(dcunnin): Not 100% sure why this is being done, but if it is so that materials
-    // are updated when their shaders change, this should be done at the time of shader update, not
-    // checked every material every frame as the getNativePair call is too slow for that.
-    if (p->getFragmentProgram() != np.fp || p->getVertexProgram() != np.vp) {
-        // Need a whole new shader, so do the slow path.
-        p->removeAllTextureUnitStates();
-        initPass(p, purpose, mat_env, mesh_env, textures, bindings);
-    }
     const Ogre::GpuProgramParametersSharedPtr &vp = p->getVertexProgramParameters();
     const Ogre::GpuProgramParametersSharedPtr &fp = p->getFragmentProgramParameters();
 
@@ -1307,6 +1558,100 @@ GfxShader *gfx_shader_make_or_reset (const std::string &name,
     return shader;
 }
 
+namespace {
+    // Identifies a permutation of a shader, so each is only built once.
+    struct PrecompileKey {
+        const GfxShader *shader;
+        GfxGslPurpose purpose;
+        GfxGslMaterialEnvironment matEnv;
+        GfxGslMeshEnvironment meshEnv;
+        bool operator== (const PrecompileKey &other) const
+        {
+            return other.shader == shader
+                && other.purpose == purpose
+                && other.matEnv == matEnv
+                && other.meshEnv == meshEnv;
+        }
+    };
+
+    struct PrecompileKeyHash {
+        size_t operator()(const PrecompileKey &k) const
+        {
+            size_t r = std::hash<const GfxShader*>()(k.shader);
+            r = r * 31 + my_hash(unsigned(k.purpose));
+            r = r * 31 + my_hash(k.matEnv);
+            r = r * 31 + my_hash(k.meshEnv);
+            return r;
+        }
+    };
+
+    // Creating the native programs can fail too, e.g. if the driver rejects the code.
+    bool precompile_add (const GfxShaderPrecompileJob &job, const GfxGasolineResult &output)
+    {
+        try {
+            job.shader->addNativePair(job.perm.purpose, job.perm.matEnv, job.perm.meshEnv, output);
+            return true;
+        } catch (const Exception &e) {
+            CERR << job.shader->name << ": " << e.msg << std::endl;
+            return false;
+        }
+    }
+}
+
+GfxShaderPrecompileStats gfx_shader_precompile (const std::vector<GfxShaderPrecompileJob> &jobs,
+                                                unsigned threads)
+{
+    unsigned long long before = micros();
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    GfxShaderPrecompileStats stats = { 0, 0, 0, 0, threads, 0.0 };
+
+    // Cache hits are built straight away, the rest are queued for the workers.
+    std::unordered_set<PrecompileKey, PrecompileKeyHash> seen;
+    std::vector<GfxGslCompileJob> compile_jobs;
+    std::vector<const GfxShaderPrecompileJob*> compile_owners;
+    for (const GfxShaderPrecompileJob &job : jobs) {
+        GfxShader *shader = job.shader;
+        const GfxShaderPermutation &perm = job.perm;
+        if (shader->hasNativePair(perm.purpose, perm.matEnv, perm.meshEnv)) continue;
+        if (!seen.insert({shader, perm.purpose, perm.matEnv, perm.meshEnv}).second) continue;
+        stats.permutations++;
+
+        GfxGslCompileJob cj;
+        cj.purpose = perm.purpose;
+        cj.backend = backend;
+        cj.vertProg = &shader->getSrcVertex();
+        cj.dangsProg = &shader->getSrcDangs();
+        cj.additionalProg = &shader->getSrcAdditional();
+        cj.md = shader->getMetadata(perm.purpose, perm.matEnv, perm.meshEnv);
+
+        GfxGasolineResult cached;
+        if (gfx_shader_cache_lookup(cj.purpose, cj.backend, *cj.vertProg, *cj.dangsProg,
+                                    *cj.additionalProg, cj.md, cached)) {
+            stats.cached++;
+            if (!precompile_add(job, cached)) stats.failed++;
+            continue;
+        }
+        compile_jobs.push_back(cj);
+        compile_owners.push_back(&job);
+    }
+
+    gfx_gasoline_compile_parallel(compile_jobs, threads, [&] (GfxGslCompileJob &cj) {
+        const GfxShaderPrecompileJob &job = *compile_owners[&cj - &compile_jobs[0]];
+        if (!cj.error.empty()) {
+            CERR << job.shader->name << ": " << cj.error << std::endl;
+            stats.failed++;
+            return;
+        }
+        stats.compiled++;
+        gfx_shader_cache_store(cj.purpose, cj.backend, *cj.vertProg, *cj.dangsProg,
+                               *cj.additionalProg, cj.md, cj.result, cj.seconds);
+        if (!precompile_add(job, cj.result)) stats.failed++;
+    });
+
+    stats.seconds = (micros() - before) / 1E6;
+    return stats;
+}
+
 GfxShader *gfx_shader_get (const std::string &name)
 {
     if (!gfx_shader_has(name)) GRIT_EXCEPT("Shader does not exist: \"" + name + "\"");
@@ -1342,6 +1687,7 @@ void gfx_shader_check (const std::string &name,
 
 void gfx_shader_init (void)
 {
+    gfx_shader_cache_init();
 }
 
 void gfx_shader_shutdown (void)
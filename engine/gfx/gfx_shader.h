@@ -27,6 +27,7 @@
 #include <functional>
 #include <unordered_map>
 #include <string>
+#include <vector>
 
 #include <math_util.h>
 
@@ -45,6 +46,23 @@ typedef std::map<std::string, GfxGslParam> GfxShaderBindings;
 #ifndef GFX_SHADER_H
 #define GFX_SHADER_H
 
+/** One combination of purpose and environments that a material needs a native program for. */
+struct GfxShaderPermutation {
+    GfxGslPurpose purpose;
+    GfxGslMaterialEnvironment matEnv;
+    GfxGslMeshEnvironment meshEnv;
+};
+
+/** The value of every param of a shader, in the order of GfxShader::getParams(), i.e. the
+ * bindings of a material with the param defaults filling the gaps.  Built once when the material
+ * changes, it is consumed by index at draw time instead of looking bindings up by name. */
+struct GfxShaderParamBlock {
+    std::vector<GfxGslParam> values;
+    // The GfxShader::getParamsVersion() it was packed against, 0 if it was never packed.
+    unsigned paramsVersion;
+    GfxShaderParamBlock (void) : paramsVersion(0) { }
+};
+
 struct GfxPaintColour {
     Vector3 diff;
     float met; // metallic paint (0 -> 1)
@@ -100,6 +118,8 @@ class GfxShader {
     std::string srcVertex, srcDangs, srcAdditional;
     GfxGslRunParams params;
     bool internal;
+    // Changes whenever params does, so param blocks packed against the old ones can be detected.
+    unsigned paramsVersion;
 
 
     struct Split {
@@ -121,8 +141,28 @@ class GfxShader {
         }
     };
 
+    // Where a uniform lives in one native program's constant buffer.
+    struct ConstantSlot {
+        size_t index;  // Physical index into the float or int buffer.
+        unsigned count;  // Number of floats / ints to write, 0 if the program does not use it.
+    };
+
+    // One entry per param that becomes a uniform for a given material environment.
+    struct UniformBinding {
+        unsigned param;  // Index into params and GfxShaderParamBlock::values.
+        bool isInt;
+        // Unbound texture that takes a solid colour from the bindings instead.
+        bool solidTexture;
+        // GLSL sampler uniform, bound to the texture unit at this offset past the global
+        // textures.  -1 otherwise.
+        int sampler;
+        ConstantSlot v, f;
+    };
+
     struct NativePair {
         Ogre::HighLevelGpuProgramPtr vp, fp;
+        // Resolved when the programs are built so draws do not look up uniforms by name.
+        std::vector<UniformBinding> uniforms;
     };
 
     typedef std::unordered_map<Split, NativePair, SplitHash> ShaderCacheBySplit;
@@ -170,6 +210,11 @@ class GfxShader {
 
     const GfxGslRunParams &getParams(void) const { return params; }
 
+    unsigned getParamsVersion (void) const { return paramsVersion; }
+
+    /** Resolve the given bindings against the params, checking their types. */
+    void packParams (const GfxShaderBindings &bindings, GfxShaderParamBlock &block) const;
+
 
     // New API, may throw compilation errors if not checked previously.
     void bindShader (GfxGslPurpose purpose,
@@ -194,7 +239,7 @@ class GfxShader {
                      float fade,
                      const GfxPaintColour *paint_colours,  // Array of 4
                      const GfxTextureStateMap &textures,
-                     const GfxShaderBindings &bindings);
+                     const GfxShaderBindings &bindings);  // By name if !GFX_PARAM_BLOCKS.
 
     // Defaults the paint_colours for the many cases that don't use them.
     void bindShader (GfxGslPurpose purpose,
@@ -208,6 +253,31 @@ class GfxShader {
                      const GfxTextureStateMap &textures,
                      const GfxShaderBindings &bindings);
 
+    // As above, with the bindings already packed (e.g. by the material).
+    void bindShader (GfxGslPurpose purpose,
+                     const GfxGslMaterialEnvironment &mat_env,
+                     const GfxGslMeshEnvironment &mesh_env,
+                     const GfxShaderGlobals &globs,
+                     const Ogre::Matrix4 &world,
+                     const Ogre::Matrix4 *bone_world_matrixes,
+                     unsigned num_bone_world_matrixes,
+                     float fade,
+                     const GfxPaintColour *paint_colours,  // Array of 4
+                     const GfxTextureStateMap &textures,
+                     const GfxShaderParamBlock &block);
+
+    // As above, with the bindings already packed (e.g. by the material).
+    void bindShader (GfxGslPurpose purpose,
+                     const GfxGslMaterialEnvironment &mat_env,
+                     const GfxGslMeshEnvironment &mesh_env,
+                     const GfxShaderGlobals &globs,
+                     const Ogre::Matrix4 &world,
+                     const Ogre::Matrix4 *bone_world_matrixes,
+                     unsigned num_bone_world_matrixes,
+                     float fade,
+                     const GfxTextureStateMap &textures,
+                     const GfxShaderParamBlock &block);
+
     // Defaults the paint_colours for the many cases that don't use them. (DEPRECATED)
     void bindShader (GfxGslPurpose purpose,
                      bool fade_dither, bool instanced, unsigned bone_weights,
@@ -226,14 +296,9 @@ class GfxShader {
                    const GfxTextureStateMap &textures,
                    const GfxShaderBindings &bindings);
 
-    // Every frame
-    void updatePass (Ogre::Pass *p,
-                     const GfxShaderGlobals &globs,
-                     GfxGslPurpose purpose,
-                     const GfxGslMaterialEnvironment &mat_env,
-                     const GfxGslMeshEnvironment &mesh_env,
-                     const GfxTextureStateMap &textures,
-                     const GfxShaderBindings &bindings);
+    // Every frame, only refreshes the globals.  Passes whose programs are stale (e.g. after a
+    // reset) must be rebuilt with initPass instead, see GfxMaterial::isDirty.
+    void updatePass (Ogre::Pass *p, const GfxShaderGlobals &globs, GfxGslPurpose purpose);
 
     void populateMatEnv (bool fade_dither,
                          const GfxTextureStateMap &textures,
@@ -243,11 +308,40 @@ class GfxShader {
     void populateMeshEnv (bool instanced, unsigned bone_weights,
                           GfxGslMeshEnvironment &mesh_env);
 
+    /** Generate code for the given permutation, without creating the native programs.  Goes
+     * through the shader cache, so this is also how the cache is prewarmed. */
+    GfxGasolineResult compile (GfxGslPurpose purpose,
+                               const GfxGslMaterialEnvironment &mat_env,
+                               const GfxGslMeshEnvironment &mesh_env);
+
+    /** Everything besides the source that compile() passes to the Gasoline compiler. */
+    GfxGslMetadata getMetadata (GfxGslPurpose purpose,
+                                const GfxGslMaterialEnvironment &mat_env,
+                                const GfxGslMeshEnvironment &mesh_env) const;
+
+    const std::string &getSrcVertex (void) const { return srcVertex; }
+    const std::string &getSrcDangs (void) const { return srcDangs; }
+    const std::string &getSrcAdditional (void) const { return srcAdditional; }
+
+    /** Whether the native programs for this permutation have been built already. */
+    bool hasNativePair (GfxGslPurpose purpose,
+                        const GfxGslMaterialEnvironment &mat_env,
+                        const GfxGslMeshEnvironment &mesh_env) const;
+
+    /** Build the native programs for this permutation from code generated elsewhere (e.g. by
+     * gfx_shader_precompile).  They must not have been built already. */
+    void addNativePair (GfxGslPurpose purpose,
+                        const GfxGslMaterialEnvironment &mat_env,
+                        const GfxGslMeshEnvironment &mesh_env,
+                        const GfxGasolineResult &output);
+
     protected:
 
-    NativePair getNativePair (GfxGslPurpose purpose,
-                              const GfxGslMaterialEnvironment &mat_env,
-                              const GfxGslMeshEnvironment &mesh_env);
+    const NativePair &getNativePair (GfxGslPurpose purpose,
+                                     const GfxGslMaterialEnvironment &mat_env,
+                                     const GfxGslMeshEnvironment &mesh_env);
+
+    void resolveUniforms (const GfxGslMaterialEnvironment &mat_env, NativePair &np);
 
     // Generic: binds uniforms (not textures, but texture indexes) for both RS and passes
     void bindGlobals (const Ogre::GpuProgramParametersSharedPtr &vparams,
@@ -258,6 +352,25 @@ class GfxShader {
                            const Ogre::GpuProgramParametersSharedPtr &fparams,
                            const GfxTextureStateMap &textures,
                            const GfxShaderBindings &bindings);
+    void bindShaderParams (int counter, const NativePair &np,
+                           const Ogre::GpuProgramParametersSharedPtr &vparams,
+                           const Ogre::GpuProgramParametersSharedPtr &fparams,
+                           const GfxShaderParamBlock &block);
+
+    // The material params come from block if it is not null, otherwise they are looked up by
+    // name in bindings.
+    void bindShaderImpl (GfxGslPurpose purpose,
+                         const GfxGslMaterialEnvironment &mat_env,
+                         const GfxGslMeshEnvironment &mesh_env,
+                         const GfxShaderGlobals &globs,
+                         const Ogre::Matrix4 &world,
+                         const Ogre::Matrix4 *bone_world_matrixes,
+                         unsigned num_bone_world_matrixes,
+                         float fade,
+                         const GfxPaintColour *paint_colours,  // Array of 4
+                         const GfxTextureStateMap &textures,
+                         const GfxShaderParamBlock *block,
+                         const GfxShaderBindings *bindings);
 
     // RenderSystem bindings
     // gloal textures
@@ -307,6 +420,34 @@ GfxShader *gfx_shader_make_or_reset (const std::string &name,
                                      const GfxGslRunParams &params,
                                      bool internal);
 
+/** Something to precompile: one permutation of one shader. */
+struct GfxShaderPrecompileJob {
+    GfxShader *shader;
+    GfxShaderPermutation perm;
+};
+
+struct GfxShaderPrecompileStats {
+    /** Permutations that needed building, after removing duplicates and those already built. */
+    unsigned permutations;
+    /** Of those, how many were found in the shader cache. */
+    unsigned cached;
+    /** How many were generated by the worker threads. */
+    unsigned compiled;
+    /** How many did not compile (the errors are logged). */
+    unsigned failed;
+    unsigned threads;
+    /** Wall clock time, including building the native programs. */
+    double seconds;
+};
+
+/** Build the native programs for the given permutations ahead of time, so they are not compiled
+ * on demand in the middle of a frame.  Code generation runs across the given number of threads
+ * (0 means one per hardware thread), and the calling thread hands each result to the driver as
+ * soon as it is ready.  Does not throw for compilation errors, the first draw that needs a failed
+ * permutation will report it as usual. */
+GfxShaderPrecompileStats gfx_shader_precompile (const std::vector<GfxShaderPrecompileJob> &jobs,
+                                                unsigned threads);
+
 GfxShader *gfx_shader_get (const std::string &name);
 bool gfx_shader_has (const std::string &name);
 
@@ -0,0 +1,320 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <unordered_map>
+
+#include <sleep.h>
+
+#include <centralised_log.h>
+
+#include "gfx_shader_cache.h"
+
+namespace {
+
+    // Bump this whenever the layout of the file changes, or the Gasoline compiler generates
+    // different code for the same input.
+    const uint32_t CACHE_VERSION = 3;
+    const char CACHE_MAGIC[4] = { 'G', 'S', 'L', 'C' };
+
+    struct FileHeader {
+        char magic[4];
+        uint32_t version;
+    };
+
+    struct EntryHeader {
+        uint32_t keySize;
+        uint32_t vertexSize;
+        uint32_t fragmentSize;
+    };
+
+    GfxShaderCacheStats stats = { 0, 0, 0, 0.0 };
+
+    std::unordered_map<std::string, GfxGasolineResult> entries;
+
+    std::string init_file (void)
+    {
+        const char *env = getenv("GRIT_SHADER_CACHE");
+        return env == nullptr ? "gasoline_cache.bin" : env;
+    }
+
+    const std::string &file (void)
+    {
+        static const std::string f = init_file();
+        return f;
+    }
+
+    bool enabled = true;
+
+    // FNV-1a, this only has to detect edits, not resist collisions constructed on purpose.
+    uint64_t hash_bytes (uint64_t h, const std::string &s)
+    {
+        for (size_t i = 0 ; i < s.length() ; ++i) {
+            h ^= (unsigned char)s[i];
+            h *= 1099511628211ULL;
+        }
+        // Separate consecutive strings, so moving code between them changes the hash.
+        h ^= 0xff;
+        h *= 1099511628211ULL;
+        return h;
+    }
+
+    void write_params (std::ostream &o, const GfxGslRunParams &params)
+    {
+        o << "{";
+        for (const auto &pair : params) {
+            const GfxGslParam &p = pair.second;
+            o << pair.first << ":" << unsigned(p.t) << ":"
+              << p.fs.r << "," << p.fs.g << "," << p.fs.b << "," << p.fs.a << ":"
+              << p.is.r << "," << p.is.g << "," << p.is.b << "," << p.is.a << ";";
+        }
+        o << "}";
+    }
+
+    // The sources are hashed to keep keys short, everything else is written out in full.
+    std::string make_key (GfxGslPurpose purpose, GfxGslBackend backend,
+                          const std::string &vert_prog, const std::string &dangs_prog,
+                          const std::string &additional_prog, const GfxGslMetadata &md)
+    {
+        uint64_t h = 14695981039346656037ULL;
+        h = hash_bytes(h, vert_prog);
+        h = hash_bytes(h, dangs_prog);
+        h = hash_bytes(h, additional_prog);
+
+        std::stringstream ss;
+        // Enough digits that distinct floats never print the same.
+        ss << std::setprecision(9);
+        ss << std::hex << std::setw(16) << std::setfill('0') << h << std::dec;
+        ss << "|" << unsigned(purpose) << "|" << unsigned(backend);
+        ss << "|" << md.d3d9 << md.internal << md.lightingTextures << "|";
+        write_params(ss, md.params);
+        ss << "|" << md.cfgEnv;
+        ss << "|" << md.matEnv.fadeDither << md.matEnv.ubt;
+        write_params(ss, md.matEnv.staticValues);
+        ss << "|" << md.meshEnv;
+        return ss.str();
+    }
+
+    bool write_header (std::ostream &out)
+    {
+        FileHeader h;
+        memcpy(h.magic, CACHE_MAGIC, sizeof CACHE_MAGIC);
+        h.version = CACHE_VERSION;
+        out.write(reinterpret_cast<const char*>(&h), sizeof h);
+        return out.good();
+    }
+
+    // The entry is written with a single call so a concurrent instance appending to the same
+    // file does not interleave with it.
+    bool write_entry (std::ostream &out, const std::string &key, const GfxGasolineResult &r)
+    {
+        EntryHeader h;
+        h.keySize = key.length();
+        h.vertexSize = r.vertexShader.length();
+        h.fragmentSize = r.fragmentShader.length();
+        std::string buf(reinterpret_cast<const char*>(&h), sizeof h);
+        buf += key;
+        buf += r.vertexShader;
+        buf += r.fragmentShader;
+        out.write(buf.data(), buf.length());
+        out.flush();
+        return out.good();
+    }
+
+    // Reads as many entries as possible, returns false if the file had to be abandoned part way
+    // through (truncated by a crash, or from a different version).
+    bool read_file (std::istream &in)
+    {
+        FileHeader fh;
+        in.read(reinterpret_cast<char*>(&fh), sizeof fh);
+        if (!in.good()) return false;
+        if (memcmp(fh.magic, CACHE_MAGIC, sizeof CACHE_MAGIC) != 0) return false;
+        if (fh.version != CACHE_VERSION) return false;
+
+        while (true) {
+            EntryHeader h;
+            in.read(reinterpret_cast<char*>(&h), sizeof h);
+            if (in.gcount() == 0 && in.eof()) return true;
+            if (!in.good()) return false;
+            std::string key(h.keySize, '\0');
+            GfxGasolineResult r;
+            r.vertexShader.resize(h.vertexSize);
+            r.fragmentShader.resize(h.fragmentSize);
+            in.read(&key[0], h.keySize);
+            in.read(&r.vertexShader[0], h.vertexSize);
+            in.read(&r.fragmentShader[0], h.fragmentSize);
+            if (!in.good()) return false;
+            entries[key] = r;
+        }
+    }
+
+    // Replace the file with one holding exactly the entries in memory.
+    void rewrite_file (void)
+    {
+        std::stringstream tmp_ss;
+        tmp_ss << file() << "." << micros() << ".tmp";
+        std::string tmp = tmp_ss.str();
+        {
+            std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+            bool ok = write_header(out);
+            for (const auto &pair : entries) {
+                if (!ok) break;
+                ok = write_entry(out, pair.first, pair.second);
+            }
+            if (!ok) {
+                out.close();
+                remove(tmp.c_str());
+                stats.writeFailures++;
+                return;
+            }
+        }
+        #ifdef WIN32
+        // rename does not replace an existing file on Windows.
+        remove(file().c_str());
+        #endif
+        if (rename(tmp.c_str(), file().c_str()) != 0) {
+            remove(tmp.c_str());
+            stats.writeFailures++;
+        }
+    }
+
+    void append_entry (const std::string &key, const GfxGasolineResult &r)
+    {
+        std::ofstream out(file().c_str(), std::ios::binary | std::ios::app);
+        if (!out.good() || !write_entry(out, key, r)) stats.writeFailures++;
+    }
+
+}
+
+void gfx_shader_cache_init (void)
+{
+    entries.clear();
+    if (file().empty()) return;
+
+    std::ifstream in(file().c_str(), std::ios::binary);
+    if (!in.good()) {
+        // No cache yet, start one.
+        std::ofstream out(file().c_str(), std::ios::binary | std::ios::trunc);
+        if (!write_header(out)) stats.writeFailures++;
+        return;
+    }
+    bool ok = read_file(in);
+    in.close();
+    if (!ok) {
+        CVERB << "Rebuilding shader cache \"" << file() << "\" (" << entries.size()
+              << " entries recovered)." << std::endl;
+        rewrite_file();
+    }
+}
+
+GfxGasolineResult gfx_shader_cache_compile (GfxGslPurpose purpose,
+                                            GfxGslBackend backend,
+                                            const std::string &vert_prog,
+                                            const std::string &dangs_prog,
+                                            const std::string &additional_prog,
+                                            const GfxGslMetadata &md)
+{
+    GfxGasolineResult r;
+    if (gfx_shader_cache_lookup(purpose, backend, vert_prog, dangs_prog, additional_prog, md, r))
+        return r;
+
+    unsigned long long before = micros();
+    // Compilation errors are not cached, they are reported every time until fixed.
+    r = gfx_gasoline_compile(purpose, backend, vert_prog, dangs_prog, additional_prog, md);
+    gfx_shader_cache_store(purpose, backend, vert_prog, dangs_prog, additional_prog, md, r,
+                           (micros() - before) / 1E6);
+    return r;
+}
+
+bool gfx_shader_cache_lookup (GfxGslPurpose purpose,
+                              GfxGslBackend backend,
+                              const std::string &vert_prog,
+                              const std::string &dangs_prog,
+                              const std::string &additional_prog,
+                              const GfxGslMetadata &md,
+                              GfxGasolineResult &result)
+{
+    if (!gfx_shader_cache_enabled()) return false;
+
+    std::string key = make_key(purpose, backend, vert_prog, dangs_prog, additional_prog, md);
+    auto it = entries.find(key);
+    if (it == entries.end()) return false;
+    stats.hits++;
+    result = it->second;
+    return true;
+}
+
+void gfx_shader_cache_store (GfxGslPurpose purpose,
+                             GfxGslBackend backend,
+                             const std::string &vert_prog,
+                             const std::string &dangs_prog,
+                             const std::string &additional_prog,
+                             const GfxGslMetadata &md,
+                             const GfxGasolineResult &result,
+                             double seconds)
+{
+    if (!gfx_shader_cache_enabled()) return;
+
+    stats.misses++;
+    stats.compileSeconds += seconds;
+    std::string key = make_key(purpose, backend, vert_prog, dangs_prog, additional_prog, md);
+    entries[key] = result;
+    append_entry(key, result);
+}
+
+void gfx_shader_cache_enabled (bool v)
+{
+    enabled = v;
+}
+
+bool gfx_shader_cache_enabled (void)
+{
+    return enabled && !file().empty();
+}
+
+const std::string &gfx_shader_cache_file (void)
+{
+    return file();
+}
+
+size_t gfx_shader_cache_size (void)
+{
+    return entries.size();
+}
+
+const GfxShaderCacheStats &gfx_shader_cache_stats (void)
+{
+    return stats;
+}
+
+void gfx_shader_cache_reset_stats (void)
+{
+    stats.hits = 0;
+    stats.misses = 0;
+    stats.writeFailures = 0;
+    stats.compileSeconds = 0;
+}
@@ -0,0 +1,104 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef GFX_SHADER_CACHE_H
+#define GFX_SHADER_CACHE_H
+
+#include <string>
+
+#include "gfx_gasoline.h"
+
+/** A persistent cache of the code generated by gfx_gasoline_compile.
+ *
+ * Entries are addressed by a hash of the Gasoline source of the shader together with everything
+ * else that affects code generation: the purpose, the backend and the GfxGslMetadata (params,
+ * config, material and mesh environments).  The whole cache lives in a single file that is read
+ * once at startup (gfx_shader_cache_init) and appended to whenever a new permutation is compiled,
+ * so a permutation seen in one run costs only a hash table lookup in the next.
+ *
+ * The file defaults to "gasoline_cache.bin" in the working directory, and can be overridden with
+ * the GRIT_SHADER_CACHE environment variable.  Setting that to the empty string disables the
+ * cache.  As with the Lua chunk cache, failing to read or write the file is never fatal.
+ *
+ * Only the generated source is cached.  The driver still compiles it when the native programs are
+ * created.
+ */
+
+struct GfxShaderCacheStats {
+    /** Permutations satisfied from the cache. */
+    unsigned long hits;
+    /** Permutations that had to be compiled. */
+    unsigned long misses;
+    /** Entries that could not be appended to the file. */
+    unsigned long writeFailures;
+    /** Time spent in gfx_gasoline_compile for misses, in seconds. */
+    double compileSeconds;
+};
+
+/** Read the cache file, called once at startup. */
+void gfx_shader_cache_init (void);
+
+/** Same contract as gfx_gasoline_compile (throws on errors), but returns the cached result if
+ * there is one, and records the result otherwise. */
+GfxGasolineResult gfx_shader_cache_compile (GfxGslPurpose purpose,
+                                            GfxGslBackend backend,
+                                            const std::string &vert_prog,
+                                            const std::string &dangs_prog,
+                                            const std::string &additional_prog,
+                                            const GfxGslMetadata &md);
+
+/** The first half of gfx_shader_cache_compile, for callers that compile misses themselves (e.g.
+ * on other threads).  Returns true and fills in result if the permutation is cached. */
+bool gfx_shader_cache_lookup (GfxGslPurpose purpose,
+                              GfxGslBackend backend,
+                              const std::string &vert_prog,
+                              const std::string &dangs_prog,
+                              const std::string &additional_prog,
+                              const GfxGslMetadata &md,
+                              GfxGasolineResult &result);
+
+/** The second half, records a result that took the given time to compile after a failed
+ * lookup. */
+void gfx_shader_cache_store (GfxGslPurpose purpose,
+                             GfxGslBackend backend,
+                             const std::string &vert_prog,
+                             const std::string &dangs_prog,
+                             const std::string &additional_prog,
+                             const GfxGslMetadata &md,
+                             const GfxGasolineResult &result,
+                             double seconds);
+
+/** Enable or disable use of the cache (initially enabled unless GRIT_SHADER_CACHE is empty). */
+void gfx_shader_cache_enabled (bool v);
+
+bool gfx_shader_cache_enabled (void);
+
+/** The cache file, or the empty string if there is none. */
+const std::string &gfx_shader_cache_file (void);
+
+/** Number of permutations currently held. */
+size_t gfx_shader_cache_size (void);
+
+const GfxShaderCacheStats &gfx_shader_cache_stats (void);
+
+void gfx_shader_cache_reset_stats (void);
+
+#endif
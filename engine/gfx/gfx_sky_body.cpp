@@ -176,8 +176,13 @@ void GfxSkyBody::render (const GfxShaderGlobals &g)
         // render sm using mat
  
         const GfxTextureStateMap &mat_texs = mat->getTextures();
-        mat->getShader()->bindShader(GFX_GSL_PURPOSE_SKY, false, false, 0,
-                                     g, world, nullptr, 0, 1, mat_texs, mat->getBindings());
+        GfxShader *shader = mat->getShader();
+        GfxGslMaterialEnvironment mat_env;
+        shader->populateMatEnv(false, mat_texs, mat->getBindings(), mat_env);
+        GfxGslMeshEnvironment mesh_env;
+        shader->populateMeshEnv(false, 0, mesh_env);
+        shader->bindShader(GFX_GSL_PURPOSE_SKY, mat_env, mesh_env, g, world, nullptr, 0, 1,
+                           mat_texs, mat->getParamBlock());
 
         ogre_rs->_setCullingMode(Ogre::CULL_NONE);
         // read but don't write depth buffer
@@ -0,0 +1,54 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdint>
+#include <vector>
+
+#ifndef GFX_SORT_KEYS_H
+#define GFX_SORT_KEYS_H
+
+/** Orders draws by 64 bit keys, smallest first.
+ *
+ * The keys are sorted by a stable radix sort, a byte at a time from the least significant.  A
+ * byte that is the same in every key does not change the order, so its pass is skipped.  Keys
+ * built from small ids and coarse buckets therefore only pay for the bytes they actually use.
+ * The buffers are kept between calls, so sorting does not allocate once they have grown to the
+ * largest batch.
+ */
+class GfxSortKeys {
+    std::vector<uint64_t> keys, keysTmp;
+    std::vector<unsigned> order, orderTmp;
+
+    public:
+
+    void clear (void) { keys.clear(); }
+
+    /** The index of the draw is the number of keys added before it. */
+    void add (uint64_t key) { keys.push_back(key); }
+
+    unsigned size (void) const { return keys.size(); }
+
+    void sort (void);
+
+    // Indexes of the draws given since the last clear, in order of their keys.
+    const unsigned *getOrder (void) const { return &order[0]; }
+};
+
+#endif
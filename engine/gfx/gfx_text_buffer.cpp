@@ -19,6 +19,8 @@
  * THE SOFTWARE.
  */
 
+#include <algorithm>
+
 #include <unicode_util.h>
 
 #include "gfx_text_buffer.h"
@@ -43,7 +45,9 @@ static bool is_whitespace (GfxFont::codepoint_t cp)
 
 GfxTextBuffer::GfxTextBuffer (GfxFont *font)
   : font(font), currentDrawnDimensions(0,0), currentLeft(0), currentTop(0),
-    lastTop(0), lastBottom(0), wrap(0), dirty(false)
+    lastTop(0), lastBottom(0), wrap(0), dirty(false),
+    lastFirstLine(0), lastStopLine(0), lastZero(0), firstDirtyLine(0),
+    gpuDirty(false), gpuValidVertexes(0), gpuValidIndexes(0)
 {   
     APP_ASSERT(font != NULL);
 
@@ -72,76 +76,15 @@ GfxTextBuffer::GfxTextBuffer (GfxFont *font)
     APP_ASSERT(vdecl_sz == VERT_BYTE_SZ);
 }
 
-// searching for the i such that cT[i-1].top < top && cT[i].top >= top, or 0 if cT[0] >= top
-unsigned long GfxTextBuffer::binaryChopTop (unsigned long begin, unsigned long end, unsigned long top)
-{
-    unsigned long middle = (end + begin + 1) / 2;
-    if (middle == 0) return middle;
-    if (middle == colouredText.size() - 1) return middle+1;
-    const ColouredChar &c = colouredText[middle];
-    const ColouredChar &b = colouredText[middle-1];
-    if (c.top < top) {
-        // too close to the beginning of the text, look right
-        APP_ASSERT(begin != middle); // this leads to infinite recursion
-        return binaryChopTop(middle, end, top);
-    } else if (b.top < top) {
-        // found it
-        return middle;
-    } else {
-        // too close to the end of the text, look left
-        return binaryChopTop(begin, middle-1, top);
-    }
-}
-
-// searching for the i such that cT[i].top <= top && cT[i+1].top > top, or sz-1 if cT[sz-1] < top
-unsigned long GfxTextBuffer::binaryChopBottom (unsigned long begin, unsigned long end, unsigned long bottom_top)
-{   
-    unsigned long middle = (end + begin) / 2;
-    if (middle == colouredText.size() - 1) return middle;
-    const ColouredChar &c = colouredText[middle];
-    const ColouredChar &d = colouredText[middle+1];
-    if (c.top > bottom_top) {
-        // too close to the end of the text, look left
-        APP_ASSERT(middle != end); // this leads to infinite recursion
-        return binaryChopBottom(begin, middle, bottom_top);
-    } else if (d.top > bottom_top) {
-        // found it
-        return middle;
-    } else {
-        // too close to the beginning of the text, look right
-        return binaryChopBottom(middle+1, end, bottom_top);
-    }
-}
-
-void GfxTextBuffer::updateGPU (bool no_scroll, long top, long bottom)
+void GfxTextBuffer::buildLine (unsigned long line, float zero, std::vector<float> &out)
 {
-    if (lastTop != top || lastBottom != bottom) dirty = true;
-    if (!dirty) return;
+    Line &l = lines[line];
+    unsigned long stop = line + 1 < lines.size() ? lines[line + 1].firstChar : colouredText.size();
+    Vector2 tex_dim = font->getTextureDimensions();
 
-    currentDrawnDimensions = Vector2(0,0);
-    rawVBuf.clear();
-    rawIBuf.clear();
-
-    unsigned long start_index = 0;
-    unsigned long stop_index = colouredText.size();
-    float zero = 0;
+    l.right = 0;
 
-    if (!no_scroll && colouredText.size() > 0) {
-        long bottom_top = bottom - long(font->getHeight());
-        /* find start and stop */
-        if (bottom_top < 0) {
-            start_index = 0;
-            stop_index = 0;
-        } else {
-            start_index = binaryChopTop(0, colouredText.size() - 1, std::max(0l, top));
-            stop_index = 1+binaryChopBottom(0, colouredText.size() - 1, std::max(0l, bottom_top));
-            zero = top;
-        }
-    }
-
-    unsigned long current_size = 0;
-
-    for (unsigned long i=start_index ; i<stop_index ; ++i) {
+    for (unsigned long i=l.firstChar ; i<stop ; ++i) {
         const ColouredChar &c = colouredText[i];
         if (is_whitespace(c.cp)) {
             continue;
@@ -151,7 +94,6 @@ void GfxTextBuffer::updateGPU (bool no_scroll, long top, long bottom)
         GfxFont::codepoint_t cp = override_cp(font, c.cp);
         bool r = font->getCodePointOrFail(cp, uvs);
         if (!r) continue;
-        Vector2 tex_dim = font->getTextureDimensions();
         float width = uvs.u2 - uvs.u1;
         float height = uvs.v2 - uvs.v1;
 
@@ -167,68 +109,164 @@ void GfxTextBuffer::updateGPU (bool no_scroll, long top, long bottom)
            |/  |
            2---3   indexes: 0 2 1  1 2 3
          */
-        {
-            // 4 because there are 4 vertexes per letter
-            rawVBuf.resize(rawVBuf.size() + VERT_FLOAT_SZ*4);
-            float *base = &rawVBuf[current_size * VERT_FLOAT_SZ*4];
-
-            (*base++) = c.left;
-            (*base++) = -(c.top - zero);
-            (*base++) = uvs.u1 / tex_dim.x;
-            (*base++) = uvs.v1 / tex_dim.y;
-            (*base++) = c.topColour.x;
-            (*base++) = c.topColour.y;
-            (*base++) = c.topColour.z;
-            (*base++) = c.topAlpha;
-
-            (*base++) = c.left + width;
-            (*base++) = -(c.top - zero);
-            (*base++) = uvs.u2 / tex_dim.x;
-            (*base++) = uvs.v1 / tex_dim.y;
-            (*base++) = c.topColour.x;
-            (*base++) = c.topColour.y;
-            (*base++) = c.topColour.z;
-            (*base++) = c.topAlpha;
-
-            (*base++) = c.left;
-            (*base++) = -(c.top - zero + height);
-            (*base++) = uvs.u1 / tex_dim.x;
-            (*base++) = uvs.v2 / tex_dim.y;
-            (*base++) = c.bottomColour.x;
-            (*base++) = c.bottomColour.y;
-            (*base++) = c.bottomColour.z;
-            (*base++) = c.bottomAlpha;
-
-            (*base++) = c.left + width;
-            (*base++) = -(c.top - zero + height);
-            (*base++) = uvs.u2 / tex_dim.x;
-            (*base++) = uvs.v2 / tex_dim.y;
-            (*base++) = c.bottomColour.x;
-            (*base++) = c.bottomColour.y;
-            (*base++) = c.bottomColour.z;
-            (*base++) = c.bottomAlpha;
+        // 4 because there are 4 vertexes per letter
+        out.resize(out.size() + VERT_FLOAT_SZ*4);
+        float *base = &out[out.size() - VERT_FLOAT_SZ*4];
+
+        (*base++) = c.left;
+        (*base++) = -(c.top - zero);
+        (*base++) = uvs.u1 / tex_dim.x;
+        (*base++) = uvs.v1 / tex_dim.y;
+        (*base++) = c.topColour.x;
+        (*base++) = c.topColour.y;
+        (*base++) = c.topColour.z;
+        (*base++) = c.topAlpha;
+
+        (*base++) = c.left + width;
+        (*base++) = -(c.top - zero);
+        (*base++) = uvs.u2 / tex_dim.x;
+        (*base++) = uvs.v1 / tex_dim.y;
+        (*base++) = c.topColour.x;
+        (*base++) = c.topColour.y;
+        (*base++) = c.topColour.z;
+        (*base++) = c.topAlpha;
+
+        (*base++) = c.left;
+        (*base++) = -(c.top - zero + height);
+        (*base++) = uvs.u1 / tex_dim.x;
+        (*base++) = uvs.v2 / tex_dim.y;
+        (*base++) = c.bottomColour.x;
+        (*base++) = c.bottomColour.y;
+        (*base++) = c.bottomColour.z;
+        (*base++) = c.bottomAlpha;
+
+        (*base++) = c.left + width;
+        (*base++) = -(c.top - zero + height);
+        (*base++) = uvs.u2 / tex_dim.x;
+        (*base++) = uvs.v2 / tex_dim.y;
+        (*base++) = c.bottomColour.x;
+        (*base++) = c.bottomColour.y;
+        (*base++) = c.bottomColour.z;
+        (*base++) = c.bottomAlpha;
+
+        l.right = std::max(l.right, float(c.left + width));
+    }
+}
+
+void GfxTextBuffer::updateVertexes (bool no_scroll, long top, long bottom)
+{
+    if (lastTop != top || lastBottom != bottom) dirty = true;
+    if (!dirty) return;
+
+    const unsigned long line_height = font->getHeight();
+
+    // Every line is line_height tall, so the visible window of lines is found directly.
+    unsigned long first_line = 0;
+    unsigned long stop_line = lines.size();
+    float zero = 0;
+
+    if (!no_scroll && colouredText.size() > 0) {
+        long bottom_top = bottom - long(line_height);
+        if (bottom_top < 0) {
+            stop_line = 0;
+        } else {
+            // Lines whose top is in [top, bottom_top].
+            first_line = (std::max(0l, top) + line_height - 1) / line_height;
+            stop_line = std::min(stop_line, (unsigned long)(bottom_top) / line_height + 1);
+            first_line = std::min(first_line, stop_line);
+            zero = top;
         }
+    }
 
-        {
-            // 6 because there are 2 triangles per letter
-            rawIBuf.resize(rawIBuf.size() + 6);
-            uint16_t *base = &rawIBuf[current_size * 6];
-            (*base++) = current_size*4 + 0;
-            (*base++) = current_size*4 + 2;
-            (*base++) = current_size*4 + 1;
-            (*base++) = current_size*4 + 1;
-            (*base++) = current_size*4 + 2;
-            (*base++) = current_size*4 + 3;
+    // The quads of lines that were visible last time, and have not been laid out again since, are
+    // still in rawVBuf.  Keep them, so appending only builds the new lines and scrolling only builds
+    // the lines that came into view.
+    unsigned long reuse_first = std::max(first_line, lastFirstLine);
+    unsigned long reuse_stop = std::min(std::min(stop_line, lastStopLine), firstDirtyLine);
+    if (reuse_first >= reuse_stop) {
+        reuse_first = reuse_stop = first_line;
+        rawVBuf.clear();
+    } else {
+        unsigned long from = windowFloats[reuse_first - lastFirstLine];
+        unsigned long to = windowFloats[reuse_stop - lastFirstLine];
+        rawVBuf.resize(to);
+        rawVBuf.erase(rawVBuf.begin(), rawVBuf.begin() + from);
+        if (zero != lastZero) {
+            for (size_t j=1 ; j<rawVBuf.size() ; j+=VERT_FLOAT_SZ) {
+                rawVBuf[j] += zero - lastZero;
+            }
         }
+    }
+
+    // Unless the start of rawVBuf is in the same place, it all needs uploading again.
+    unsigned long unchanged_floats = 0;
+    if (reuse_first == first_line && first_line == lastFirstLine && zero == lastZero)
+        unchanged_floats = rawVBuf.size();
 
-        current_size++;
+    std::vector<unsigned long> offsets(1, 0);
 
-        // calculate text bounds
-        currentDrawnDimensions.x = std::max(currentDrawnDimensions.x, float(c.left + width));
-        currentDrawnDimensions.y = std::max(currentDrawnDimensions.y, float(c.top + font->getHeight()));
+    // Lines that scrolled into view at the top.
+    if (first_line < reuse_first) {
+        std::vector<float> head;
+        for (unsigned long i=first_line ; i<reuse_first ; ++i) {
+            buildLine(i, zero, head);
+            offsets.push_back(head.size());
+        }
+        rawVBuf.insert(rawVBuf.begin(), head.begin(), head.end());
+    }
+
+    for (unsigned long i=reuse_first ; i<reuse_stop ; ++i) {
+        unsigned long sz = windowFloats[i + 1 - lastFirstLine] - windowFloats[i - lastFirstLine];
+        offsets.push_back(offsets.back() + sz);
+    }
+
+    // Lines that were appended, laid out again, or scrolled into view at the bottom.
+    for (unsigned long i=reuse_stop ; i<stop_line ; ++i) {
+        buildLine(i, zero, rawVBuf);
+        offsets.push_back(rawVBuf.size());
+    }
+
+    windowFloats.swap(offsets);
+
+    // The indexes only depend on the number of quads, so are only ever extended or truncated.
+    unsigned long quads = rawVBuf.size() / (VERT_FLOAT_SZ*4);
+    for (unsigned long q=rawIBuf.size()/6 ; q<quads ; ++q) {
+        rawIBuf.push_back(q*4 + 0);
+        rawIBuf.push_back(q*4 + 2);
+        rawIBuf.push_back(q*4 + 1);
+        rawIBuf.push_back(q*4 + 1);
+        rawIBuf.push_back(q*4 + 2);
+        rawIBuf.push_back(q*4 + 3);
+    }
+    rawIBuf.resize(quads * 6);
 
+    // calculate text bounds
+    currentDrawnDimensions = Vector2(0,0);
+    for (unsigned long i=first_line ; i<stop_line ; ++i) {
+        const Line &l = lines[i];
+        if (l.right == 0) continue;
+        currentDrawnDimensions.x = std::max(currentDrawnDimensions.x, l.right);
+        currentDrawnDimensions.y = float((i + 1) * line_height);
     }
 
+    gpuValidVertexes = std::min(gpuValidVertexes, unchanged_floats / VERT_FLOAT_SZ);
+
+    dirty = false;
+    gpuDirty = true;
+    lastFirstLine = first_line;
+    lastStopLine = stop_line;
+    lastZero = zero;
+    firstDirtyLine = lines.size();
+    lastTop = top;
+    lastBottom = bottom;
+}
+
+void GfxTextBuffer::updateGPU (bool no_scroll, long top, long bottom)
+{
+    updateVertexes(no_scroll, top, bottom);
+    if (!gpuDirty) return;
+
+    unsigned long current_size = rawIBuf.size() / 6;
 
     // do the actual copy to GPU (resize if necessary)
 
@@ -236,39 +274,50 @@ void GfxTextBuffer::updateGPU (bool no_scroll, long top, long bottom)
     unsigned index_size = current_size * 6; // 2 triangles per quad
 
     if (currentGPUCapacity < current_size) {
-        // resize needed
+        // resize needed, grow geometrically so that appending text does not resize every time
+        unsigned capacity = std::max(unsigned(current_size), 2 * currentGPUCapacity);
 
         vBuf.setNull();
         iBuf.setNull();
 
         vBuf = Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
                         VERT_BYTE_SZ,
-                        vertex_size,
+                        capacity * 4,
                         Ogre::HardwareBuffer::HBU_DYNAMIC_WRITE_ONLY);
 
         iBuf = Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(
                         Ogre::HardwareIndexBuffer::IT_16BIT,
-                        index_size,
+                        capacity * 6,
                         Ogre::HardwareBuffer::HBU_DYNAMIC_WRITE_ONLY);
 
         vData.vertexBufferBinding->setBinding(0, vBuf);
         iData.indexBuffer = iBuf;
 
-        currentGPUCapacity = current_size;
+        currentGPUCapacity = capacity;
+        gpuValidVertexes = 0;
+        gpuValidIndexes = 0;
     }
 
     if (current_size > 0) {
-        // copy the whole thing every time (could optimise this if needed)
-        vBuf->writeData(0, vertex_size*VERT_BYTE_SZ, &rawVBuf[0], true);
-        iBuf->writeData(0, index_size*sizeof(uint16_t), &rawIBuf[0], true);
+        // Only copy the vertexes that changed, e.g. the lines appended since the last upload.
+        unsigned long first = std::min(gpuValidVertexes, (unsigned long)vertex_size);
+        if (first < vertex_size) {
+            vBuf->writeData(first*VERT_BYTE_SZ, (vertex_size - first)*VERT_BYTE_SZ,
+                            &rawVBuf[first*VERT_FLOAT_SZ], first == 0);
+        }
+        if (gpuValidIndexes < index_size) {
+            iBuf->writeData(gpuValidIndexes*sizeof(uint16_t),
+                            (index_size - gpuValidIndexes)*sizeof(uint16_t),
+                            &rawIBuf[gpuValidIndexes], gpuValidIndexes == 0);
+            gpuValidIndexes = index_size;
+        }
     }
     
     vData.vertexCount = vertex_size;
     iData.indexCount = index_size;
 
-    dirty = false;
-    lastTop = top;
-    lastBottom = bottom;
+    gpuValidVertexes = vertex_size;
+    gpuDirty = false;
 }
 
 void GfxTextBuffer::recalculatePositions (unsigned long start)
@@ -276,7 +325,14 @@ void GfxTextBuffer::recalculatePositions (unsigned long start)
     if (start == 0) {
         currentLeft = 0;
         currentTop = 0;
+        lines.clear();
+    } else {
+        // Lines from start onwards are laid out again, the line containing start will get new
+        // characters.
+        while (lines.size() > 0 && lines.back().firstChar >= start) lines.pop_back();
     }
+    firstDirtyLine = std::min(firstDirtyLine, (unsigned long)(lines.size() == 0 ? 0 : lines.size() - 1));
+
     unsigned word_first_letter = 0;
     bool in_word = false;
     bool word_first_on_line = true;
@@ -293,6 +349,7 @@ void GfxTextBuffer::recalculatePositions (unsigned long start)
 
         c.left = currentLeft;
         c.top = currentTop;
+        while (lines.size() <= currentTop / font->getHeight()) lines.push_back(Line(i));
 
         switch (c.cp) {
             case '\n':
@@ -51,6 +51,15 @@ class GfxTextBuffer {
     };
     std::vector<ColouredChar> colouredText;
 
+    /** A line of laid out text, i.e. the characters between two line breaks or wraps. */
+    struct Line {
+        unsigned long firstChar;
+        // The rightmost edge of the glyphs (0 if none), set when the line's quads are built.
+        float right;
+        Line (unsigned long first_char) : firstChar(first_char), right(0) { }
+    };
+    std::vector<Line> lines;
+
     GfxFont *font;
 
     Ogre::VertexData vData;
@@ -72,12 +81,27 @@ class GfxTextBuffer {
 
     bool dirty;
 
-    /** Fill in the ColouredChar::pos fields. */
-    void recalculatePositions (unsigned long offset = 0);
+    // The visible lines [lastFirstLine, lastStopLine) are in rawVBuf, offset by lastZero.
+    unsigned long lastFirstLine, lastStopLine;
+    float lastZero;
+    // Where each of those lines starts in rawVBuf, plus the end.
+    std::vector<unsigned long> windowFloats;
 
-    unsigned long binaryChopTop (unsigned long begin, unsigned long end, unsigned long top);
+    // Lines from here on have been laid out again since rawVBuf was built.
+    unsigned long firstDirtyLine;
 
-    unsigned long binaryChopBottom (unsigned long begin, unsigned long end, unsigned long bottom_top);
+    // The raw buffers have changed since they were last uploaded.
+    bool gpuDirty;
+
+    // How much of the start of rawVBuf / rawIBuf is unchanged on the GPU.
+    unsigned long gpuValidVertexes;
+    unsigned long gpuValidIndexes;
+
+    /** Fill in the ColouredChar::pos fields and the lines, from the given character onwards. */
+    void recalculatePositions (unsigned long offset = 0);
+
+    /** Append the glyph quads of the given line to out. */
+    void buildLine (unsigned long line, float zero, std::vector<float> &out);
 
     public:
 
@@ -95,6 +119,13 @@ class GfxTextBuffer {
      */
     void addFormattedString (const std::string &text, const Vector3 &top_colour, float top_alpha, const Vector3 &bot_colour, float bot_alpha);
 
+    /** Put the triangles in the raw vertex/index buffers, without uploading them.
+     * \param no_scroll Do not use top/bottom to clip the buffer vertically, render the whole buffer.
+     * \param top The top of the visible area, in pixels from the top of the buffer.  Can be negative to add extra space at top.
+     * \param bottom The bottom of the visible area, in pixels from the top of the buffer.  Can be negative.
+     */
+    void updateVertexes (bool no_scroll, long top, long bottom);
+
     /** Put the triangles in the vertex/index buffers and upload them.
      * \param no_scroll Do not use top/bottom to clip the buffer vertically, render the whole buffer.
      * \param top The top of the visible area, in pixels from the top of the buffer.  Can be negative to add extra space at top.
@@ -122,18 +153,30 @@ class GfxTextBuffer {
     /** Returns the font. */
     GfxFont *getFont (void) const { return font; }
 
-    /** Returns the size of the text rectangle in pixels.  Drawn part only, updated by updateGPU. */
+    /** Returns the size of the text rectangle in pixels.  Drawn part only, updated by updateVertexes. */
     const Vector2 &getDrawnDimensions (void) const { return currentDrawnDimensions; }
 
     /** Returns the size of the text rectangle in pixels.  Entire buffer. */
     unsigned long getBufferHeight (void) const { return font->getHeight() + currentTop; }
 
     /** Set the max size.  This is used to wrap text during addFormattedString. */
-    void setWrap (float v) { wrap = v; recalculatePositions(); }
+    void setWrap (float v)
+    {
+        unsigned long w = v;
+        if (w == wrap) return;
+        wrap = w;
+        recalculatePositions();
+    }
 
     /** Returns the max size. \see setWrap */
     float getWrap (void) const { return wrap; }
 
+    /** The vertexes built by updateVertexes: 2 position, 2 uv, 4 colour floats each. */
+    const std::vector<float> &getRawVertexes (void) const { return rawVBuf; }
+
+    /** The triangle list indexes built by updateVertexes, into getRawVertexes. */
+    const std::vector<uint16_t> &getRawIndexes (void) const { return rawIBuf; }
+
     /** Get an operation that can be used to render this text buffer. */
     const Ogre::RenderOperation &getRenderOperation (void) const { return op; }
 
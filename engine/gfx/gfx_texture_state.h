@@ -88,6 +88,19 @@ static inline GfxTextureState gfx_texture_state_point(GfxBaseTextureDiskResource
     };
 }
 
+static inline bool operator== (const GfxTextureState &a, const GfxTextureState &b)
+{
+    return a.texture == b.texture
+        && a.modeU == b.modeU && a.modeV == b.modeV && a.modeW == b.modeW
+        && a.filterMin == b.filterMin && a.filterMax == b.filterMax && a.filterMip == b.filterMip
+        && a.anisotropy == b.anisotropy;
+}
+
+static inline bool operator!= (const GfxTextureState &a, const GfxTextureState &b)
+{
+    return !(a == b);
+}
+
 typedef std::map<std::string, GfxTextureState> GfxTextureStateMap;
         
 #endif // GFX_TEXTURE_STATE_H
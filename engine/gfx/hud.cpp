@@ -19,16 +19,21 @@
  * THE SOFTWARE.
  */
 
+#include <algorithm>
+
 #include <centralised_log.h>
+#include <sleep.h>
+
 #include "../path_util.h"
+#include "../lua_profiler.h"
 
 #include "lua_wrappers_gfx.h"
 #include "hud.h"
 #include "gfx_internal.h"
 #include "gfx_shader.h"
 
-static GfxShader *shader_text, *shader_rect, *shader_stencil;
-static GfxShaderBindings shader_text_binds, empty_binds;
+static GfxShader *shader_rect, *shader_stencil;
+static GfxShaderBindings empty_binds;
 
 static Vector2 win_size(0,0);
 
@@ -110,6 +115,21 @@ static std::vector<HudObject *> get_all_hud_objects (const fast_erase_vector<Hud
     return r;
 }
 
+/** Like get_all_hud_objects, but only those that want parentResizedCallbacks.
+ */
+static std::vector<HudObject *> get_hud_objects_needing_parent_resized (const fast_erase_vector<HudBase*> &bases)
+{
+    std::vector<HudObject*> r;
+    for (unsigned i=0 ; i<bases.size() ; ++i) {
+        HudObject *o = dynamic_cast<HudObject*>(bases[i]);
+        if (o == NULL) continue;
+        if (!o->getNeedsParentResizedCallbacks()) continue;
+        r.push_back(o);
+        o->incRefCount();
+    }
+    return r;
+}
+
 /** The companion to get_all_hud_objects.  This simply decs the reference count
  * for all the objects.
  */
@@ -221,12 +241,18 @@ HudObject::HudObject (HudClass *hud_class)
     uv1(0,0), uv2(1,1), cornered(false), size(32,32), sizeSet(false), colour(1,1,1), alpha(1),
     stencil(false),
     needsResizedCallbacks(false), needsParentResizedCallbacks(false), needsInputCallbacks(false),
-    needsFrameCallbacks(false), refCount(0)
+    needsFrameCallbacks(false), frameCallbacksIndex(0), refCount(0)
 {
-    shader_rect->populateMatEnv(false, texs, shaderBinds, matEnvRect);
+    shader_rect->populateMatEnv(false, texs, empty_binds, matEnvRect);
     shader_stencil->populateMatEnv(false, stencilTexs, empty_binds, matEnvStencil);
 }
 
+HudObject::~HudObject (void)
+{
+    // Otherwise objs_needing_frame_callbacks would keep a dangling pointer.
+    if (aliveness != DEAD) destroy();
+}
+
 void HudObject::incRefCount (void)
 {
     refCount++;
@@ -255,19 +281,46 @@ void HudObject::setColour (const Vector3 &v)
 {
     assertAlive();
     colour = v;
-    shaderBinds["colour"] = v;
 }
 
 void HudObject::setAlpha (float v)
 {
     assertAlive();
     alpha = v;
-    shaderBinds["alpha"] = GfxGslParam::float1(v);
+}
+
+// Dense, so that objects that do not want frame callbacks cost nothing per frame.
+static std::vector<HudObject*> objs_needing_frame_callbacks;
+
+void HudObject::setNeedsFrameCallbacks (bool v)
+{
+    assertAlive();
+    if (v == needsFrameCallbacks) return;
+    needsFrameCallbacks = v;
+
+    if (v) {
+        frameCallbacksIndex = objs_needing_frame_callbacks.size();
+        objs_needing_frame_callbacks.push_back(this);
+    } else {
+        HudObject *last = objs_needing_frame_callbacks.back();
+        objs_needing_frame_callbacks[frameCallbacksIndex] = last;
+        last->frameCallbacksIndex = frameCallbacksIndex;
+        objs_needing_frame_callbacks.pop_back();
+    }
+}
+
+bool HudObject::isDerivedEnabled (void)
+{
+    for (HudObject *o = this ; o != NULL ; o = o->getParent()) {
+        if (!o->isEnabled()) return false;
+    }
+    return true;
 }
 
 void HudObject::destroy (void)
 {
     if (aliveness != DEAD) {
+        setNeedsFrameCallbacks(false);
         texture = nullptr;
         HudBase::destroy();
     }
@@ -321,6 +374,7 @@ void HudObject::triggerInit (lua_State *L)
     STACK_CHECK_N(3);
 
     // call (1 arg), pops function too
+    LuaProfilerScope profiler_scope("hud init", hudClass->name);
     int status = lua_pcall(L,1,0,error_handler);
     if (status) {
         STACK_CHECK_N(2);
@@ -385,6 +439,7 @@ void HudObject::triggerResized (lua_State *L)
     STACK_CHECK_N(4);
 
     // call (1 arg), pops function too
+    LuaProfilerScope profiler_scope("hud resizedCallback", hudClass->name);
     int status = lua_pcall(L,2,0,error_handler);
     if (status) {
         STACK_CHECK_N(2);
@@ -453,6 +508,7 @@ void HudObject::triggerParentResized (lua_State *L)
     STACK_CHECK_N(4);
 
     // call (1 arg), pops function too
+    LuaProfilerScope profiler_scope("hud parentResizedCallback", hudClass->name);
     int status = lua_pcall(L,2,0,error_handler);
     if (status) {
         STACK_CHECK_N(2);
@@ -486,7 +542,7 @@ void HudObject::setSize (lua_State *L, const Vector2 &v)
     size = v;
 
     // use local_children copy since callbacks can alter hierarchy
-    std::vector<HudObject*> local_children = get_all_hud_objects(children);
+    std::vector<HudObject*> local_children = get_hud_objects_needing_parent_resized(children);
     for (unsigned j=0 ; j<local_children.size() ; ++j) {
         HudObject *obj = local_children[j];
         if (!obj->destroyed()) obj->triggerParentResized(L);
@@ -618,6 +674,7 @@ void HudObject::triggerMouseMove (lua_State *L, const Vector2 &screen_pos)
         STACK_CHECK_N(7);
 
         // call (1 arg), pops function too
+        LuaProfilerScope profiler_scope("hud mouseMoveCallback", hudClass->name);
         int status = lua_pcall(L,5,0,error_handler);
         if (status) {
             STACK_CHECK_N(2);
@@ -696,6 +753,7 @@ void HudObject::triggerButton (lua_State *L, const std::string &name)
         STACK_CHECK_N(4);
 
         // call (2 args), pops function too
+        LuaProfilerScope profiler_scope("hud buttonCallback", hudClass->name);
         int status = lua_pcall(L,2,0,error_handler);
         if (status) {
             STACK_CHECK_N(2);
@@ -736,78 +794,65 @@ void HudObject::triggerFrame (lua_State *L, float elapsed)
 {
     assertAlive();
 
-    if (!isEnabled()) return;
-
-    do {
-        if (!needsFrameCallbacks) continue;
-
-        STACK_BASE;
-        //stack is empty
+    if (!needsFrameCallbacks) return;
 
-        // error handler in case there is a problem during 
-        // the callback
-        push_cfunction(L, my_lua_error_handler);
-        int error_handler = lua_gettop(L);
+    STACK_BASE;
+    //stack is empty
 
-        //stack: err
+    // error handler in case there is a problem during 
+    // the callback
+    push_cfunction(L, my_lua_error_handler);
+    int error_handler = lua_gettop(L);
 
-        // get the function
-        hudClass->get(L,"frameCallback");
-        //stack: err,callback
-        if (lua_isnil(L,-1)) {
-            // no parentResized callback -- our work is done
-            lua_pop(L,2);
-            STACK_CHECK;
-            CERR << "Hud object of class: \"" << hudClass->name << "\" has no frameCallback function, disabling frame callbacks." << std::endl;
-            needsFrameCallbacks = false;
-            continue; // to children
-        }
+    //stack: err
 
+    // get the function
+    hudClass->get(L,"frameCallback");
+    //stack: err,callback
+    if (lua_isnil(L,-1)) {
+        // no frame callback -- our work is done
+        lua_pop(L,2);
+        STACK_CHECK;
+        CERR << "Hud object of class: \"" << hudClass->name << "\" has no frameCallback function, disabling frame callbacks." << std::endl;
+        setNeedsFrameCallbacks(false);
+        return;
+    }
 
-        //stack: err,callback
-        STACK_CHECK_N(2);
 
-        push_hudobj(L, this);
-        lua_pushnumber(L, elapsed);
-        //stack: err,callback,object,size
+    //stack: err,callback
+    STACK_CHECK_N(2);
 
-        STACK_CHECK_N(4);
+    push_hudobj(L, this);
+    lua_pushnumber(L, elapsed);
+    //stack: err,callback,object,size
 
-        // call (1 arg), pops function too
-        int status = lua_pcall(L,2,0,error_handler);
-        if (status) {
-            STACK_CHECK_N(2);
-            //stack: err,error
-            // pop the error message since the error handler will
-            // have already printed it out
-            lua_pop(L,1);
-            CERR << "Hud object of class: \"" << hudClass->name << "\" raised an error on frameCallback, disabling frame callbacks." << std::endl;
-            needsFrameCallbacks = false;
-            //stack: err
-            STACK_CHECK_N(1);
-        } else {
-            //stack: err
-            STACK_CHECK_N(1);
-        }
+    STACK_CHECK_N(4);
 
+    // call (1 arg), pops function too
+    LuaProfilerScope profiler_scope("hud frameCallback", hudClass->name);
+    int status = lua_pcall(L,2,0,error_handler);
+    if (status) {
+        STACK_CHECK_N(2);
+        //stack: err,error
+        // pop the error message since the error handler will
+        // have already printed it out
+        lua_pop(L,1);
+        CERR << "Hud object of class: \"" << hudClass->name << "\" raised an error on frameCallback, disabling frame callbacks." << std::endl;
+        // the callback may have destroyed us, which already unsubscribed us
+        if (!destroyed()) setNeedsFrameCallbacks(false);
         //stack: err
         STACK_CHECK_N(1);
-        lua_pop(L,1);
-
-        //stack is empty
-        STACK_CHECK;
-
-    } while (0);
+    } else {
+        //stack: err
+        STACK_CHECK_N(1);
+    }
 
-    // note if we destroyed ourselves due to an error in the callback, children should be empty
+    //stack: err
+    STACK_CHECK_N(1);
+    lua_pop(L,1);
 
-    // use local_children copy since callbacks can alter hierarchy
-    std::vector<HudObject*> local_children = get_all_hud_objects(children);
-    for (unsigned j=0 ; j<local_children.size() ; ++j) {
-        HudObject *obj = local_children[j];
-        if (!obj->destroyed()) obj->triggerFrame(L, elapsed);
-    }
-    dec_all_hud_objects(L, local_children);
+    //stack is empty
+    STACK_CHECK;
 }
 
 void HudObject::notifyChildAdd (HudBase *child)
@@ -854,6 +899,7 @@ void HudObject::triggerDestroy (lua_State *L)
     STACK_CHECK_N(3);
 
     // call (1 arg), pops function too
+    LuaProfilerScope profiler_scope("hud destroy", hudClass->name);
     int status = lua_pcall(L,1,0,error_handler);
     if (status) {
         STACK_CHECK_N(2);
@@ -886,7 +932,7 @@ void HudObject::setTexture (const DiskResourcePtr<GfxTextureDiskResource> &v)
     texs.clear();
     if (v != nullptr)
         texs["tex"] = gfx_texture_state_anisotropic(&*v);
-    shader_rect->populateMatEnv(false, texs, shaderBinds, matEnvRect);
+    shader_rect->populateMatEnv(false, texs, empty_binds, matEnvRect);
 }
 
 void HudObject::setStencilTexture (const DiskResourcePtr<GfxTextureDiskResource> &v)
@@ -916,45 +962,34 @@ HudText::HudText (GfxFont *font)
     shadow(0,0), shadowColour(0,0,0), shadowAlpha(1),
     refCount(0)
 {
-    shaderBinds["colour"] = colour;
-    shaderBinds["alpha"] = GfxGslParam::float1(alpha);
-
-    shaderBindsShadow["colour"] = shadowColour;
-    shaderBindsShadow["alpha"] = GfxGslParam::float1(shadowAlpha);
-
     GfxTextureDiskResource *tex = font->getTexture();
     texs["tex"] = gfx_texture_state_anisotropic(tex);
 
-    shader_text->populateMatEnv(false, texs, shaderBinds, matEnv);
-    shader_text->populateMatEnv(false, texs, shaderBindsShadow, matEnvShadow);
+    shader_rect->populateMatEnv(false, texs, empty_binds, matEnv);
 }
 
 void HudText::setAlpha (float v)
 {
     assertAlive();
     alpha = v;
-    shaderBinds["alpha"] = GfxGslParam::float1(alpha);
 }
 
 void HudText::setColour (const Vector3 &v)
 {
     assertAlive();
     colour = v;
-    shaderBinds["colour"] = colour;
 }
 
 void HudText::setShadowColour (const Vector3 &v)
 {
     assertAlive();
     shadowColour = v;
-    shaderBindsShadow["colour"] = shadowColour;
 }
 
 void HudText::setShadowAlpha (float v)
 {
     assertAlive();
     shadowAlpha = v;
-    shaderBindsShadow["alpha"] = GfxGslParam::float1(shadowAlpha);
 }
 
 void HudText::incRefCount (void)
@@ -1008,132 +1043,114 @@ std::string HudText::getText (void) const
 
 GfxGslMeshEnvironment simple_mesh_env;
 
-// vdata/idata be allocated later because constructor requires ogre to be initialised
-static Ogre::VertexData *quad_vdata;
-static Ogre::HardwareVertexBufferSharedPtr quad_vbuf;
-static unsigned quad_vdecl_size;
+/* The HUD is flattened once per frame into a single stream of vertexes.  Each vertex is already
+ * in clip space and carries its own colour, so consecutive elements that share a texture, shader,
+ * and stencil state are merged into one draw call.  Batches are never reordered, so the painter's
+ * order of the tree is preserved.
+ */
+
+// strict alignment required here, matches the vertex declaration in hud_init
+struct HudVertex {
+    float x, y;
+    float u, v;
+    float r, g, b, a;
+};
+
+enum HudStencilMode {
+    HUD_STENCIL_TEST,       // Draw colour where the stencil equals the ref.
+    HUD_STENCIL_PUSH,       // Increment the stencil where it equals the ref, no colour.
+    HUD_STENCIL_POP         // Reset the stencil to the ref where it is at least the ref, no colour.
+};
+
+struct HudBatch {
+    GfxShader *shader;
+    const GfxGslMaterialEnvironment *matEnv;
+    const GfxTextureStateMap *texs;
+    GfxTextureDiskResource *tex;
+    HudStencilMode stencilMode;
+    int stencilRef;
+    unsigned indexStart;
+    unsigned indexCount;
+};
+
+// Reused from frame to frame to avoid allocations.
+static std::vector<HudVertex> batch_vertexes;
+static std::vector<uint32_t> batch_indexes;
+static std::vector<HudBatch> batches;
+static std::vector<HudBase*> zorder_scratch;
 
 // vdata/idata be allocated later because constructor requires ogre to be initialised
-static Ogre::VertexData *cornered_quad_vdata;
-static Ogre::IndexData *cornered_quad_idata;
-static Ogre::HardwareVertexBufferSharedPtr cornered_quad_vbuf;
-static Ogre::HardwareIndexBufferSharedPtr cornered_quad_ibuf;
-static unsigned cornered_quad_vdecl_size;
+static Ogre::VertexData *batch_vdata;
+static Ogre::IndexData *batch_idata;
+static Ogre::HardwareVertexBufferSharedPtr batch_vbuf;
+static Ogre::HardwareIndexBufferSharedPtr batch_ibuf;
+static unsigned batch_vbuf_capacity;
+static unsigned batch_ibuf_capacity;
+
+static GfxLastRenderStats last_render_stats;
 
 void hud_init (void)
 {
     win_size = Vector2(ogre_win->getWidth(), ogre_win->getHeight());
 
-    // Prepare vertex buffers
-    quad_vdata = OGRE_NEW Ogre::VertexData();
-    quad_vdata->vertexStart = 0;
-    quad_vdata->vertexCount = 6;
-    quad_vdecl_size = 0;
-    quad_vdecl_size += quad_vdata->vertexDeclaration->addElement(0, quad_vdecl_size, Ogre::VET_FLOAT2, Ogre::VES_POSITION).getSize();
-    quad_vdecl_size += quad_vdata->vertexDeclaration->addElement(0, quad_vdecl_size, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES,0).getSize();
-    quad_vbuf =
-        Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
-            quad_vdecl_size, 6, Ogre::HardwareBuffer::HBU_DYNAMIC_WRITE_ONLY_DISCARDABLE);
-    quad_vdata->vertexBufferBinding->setBinding(0, quad_vbuf);
-
-    cornered_quad_vdata = OGRE_NEW Ogre::VertexData();
-    cornered_quad_vdata->vertexStart = 0;
-    cornered_quad_vdata->vertexCount = 16;
-    cornered_quad_vdecl_size = 0;
-    cornered_quad_vdecl_size += cornered_quad_vdata->vertexDeclaration->addElement(0, cornered_quad_vdecl_size, Ogre::VET_FLOAT2, Ogre::VES_POSITION).getSize();
-    cornered_quad_vdecl_size += cornered_quad_vdata->vertexDeclaration->addElement(0, cornered_quad_vdecl_size, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES,0).getSize();
-    cornered_quad_vbuf =
-        Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
-            cornered_quad_vdecl_size, 16, Ogre::HardwareBuffer::HBU_DYNAMIC_WRITE_ONLY_DISCARDABLE);
-    cornered_quad_vdata->vertexBufferBinding->setBinding(0, cornered_quad_vbuf);
-
-    unsigned cornered_quad_indexes = 6*9;
-    cornered_quad_ibuf =
-        Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(
-            Ogre::HardwareIndexBuffer::IT_16BIT,
-            cornered_quad_indexes,
-            Ogre::HardwareBuffer::HBU_DYNAMIC_WRITE_ONLY);
-
-    cornered_quad_idata = OGRE_NEW Ogre::IndexData();
-    cornered_quad_idata->indexStart = 0;
-    cornered_quad_idata->indexCount = cornered_quad_indexes;
-    cornered_quad_idata->indexBuffer = cornered_quad_ibuf;
-
-    /* c d e f
-     * 8 9 a b
-     * 4 5 6 7    d c
-     * 0 1 2 3    a b
-     */
-    #define QUAD(a,b,c,d) a, b, d,  c, d, b
-    uint16_t cornered_quad_idata_raw[] = {
-        QUAD( 0, 1, 5, 4), QUAD( 1, 2, 6, 5), QUAD( 2, 3, 7, 6),
-        QUAD( 4, 5, 9, 8), QUAD( 5, 6,10, 9), QUAD( 6, 7,11,10),
-        QUAD( 8, 9,13,12), QUAD( 9,10,14,13), QUAD(10,11,15,14),
-    };
-    #undef QUAD
-
-    cornered_quad_ibuf->writeData(
-        0, cornered_quad_indexes*sizeof(uint16_t), &cornered_quad_idata_raw[0], true);
+    // Prepare vertex buffers, the actual buffers are created on demand in hud_render.
+    batch_vdata = OGRE_NEW Ogre::VertexData();
+    batch_vdata->vertexStart = 0;
+    batch_vdata->vertexCount = 0;
+    unsigned vdecl_size = 0;
+    vdecl_size += batch_vdata->vertexDeclaration->addElement(0, vdecl_size, Ogre::VET_FLOAT2, Ogre::VES_POSITION).getSize();
+    vdecl_size += batch_vdata->vertexDeclaration->addElement(0, vdecl_size, Ogre::VET_FLOAT2, Ogre::VES_TEXTURE_COORDINATES,0).getSize();
+    vdecl_size += batch_vdata->vertexDeclaration->addElement(0, vdecl_size, Ogre::VET_FLOAT4, Ogre::VES_TEXTURE_COORDINATES,1).getSize();
+    APP_ASSERT(vdecl_size == sizeof(HudVertex));
+    batch_vbuf_capacity = 0;
+
+    batch_idata = OGRE_NEW Ogre::IndexData();
+    batch_idata->indexStart = 0;
+    batch_idata->indexCount = 0;
+    batch_ibuf_capacity = 0;
 
     GfxGslRunParams shader_rect_params = {
-        {"colour", GfxGslParam::float3(1, 1, 1)},
-        {"alpha", GfxGslParam::float1(1.0f)},
         {"tex", GfxGslParam(GFX_GSL_FLOAT_TEXTURE2, 1, 1, 1, 1)}
     };
     GfxGslRunParams shader_stencil_params = {
         {"tex", GfxGslParam(GFX_GSL_FLOAT_TEXTURE2, 1, 1, 1, 1)}
     };
-    GfxGslRunParams shader_text_params = {
-        {"colour", GfxGslParam::float3(1, 1, 1)},
-        {"alpha", GfxGslParam::float1(1.0f)},
-        {"tex", GfxGslParam(GFX_GSL_FLOAT_TEXTURE2, 1, 1, 1, 1)}
-    };
 
+    // Vertexes are transformed on the CPU, the world matrix is the identity.
     std::string vertex_code =
         "out.position = transform_to_world(Float3(vert.position.xy, 0));\n";
 
-    // Note this never discards, even if alpha == 0.  This is important because we use it
-    // to populate the stencil buffer to mask children at the bounds of the object.
+    // Used for both rects and text, the colour and alpha of the element are in the vertex.
+    // Note this never discards, even if alpha == 0.
     std::string rect_colour_code =
         "var texel = sample(mat.tex, vert.coord0.xy);\n"
-        "out.colour = texel.rgb * mat.colour;\n"
-        "out.alpha = texel.a * mat.alpha;\n"
+        "out.colour = texel.rgb * vert.coord1.rgb;\n"
+        "out.alpha = texel.a * vert.coord1.a;\n"
         "out.colour = out.colour * out.alpha;\n";
 
     std::string stencil_colour_code =
         "var texel = sample(mat.tex, vert.coord0.xy);\n"
         "if (texel.a < 0.5) discard;\n";
 
-    std::string text_colour_code =
-        "var texel = sample(mat.tex, vert.coord0.xy);\n"
-        "out.colour = texel.rgb * vert.coord1.rgb * mat.colour;\n"
-        "out.alpha = texel.a * vert.coord1.a * mat.alpha;\n"
-        "out.colour = out.colour * out.alpha;\n";
-
     gfx_shader_check(
         "/system/HudRect", vertex_code, "", rect_colour_code, shader_rect_params, false);
     gfx_shader_check(
         "/system/HudStencil", vertex_code, "", stencil_colour_code, shader_stencil_params, false);
-    gfx_shader_check(
-        "/system/HudText", vertex_code, "", text_colour_code, shader_text_params, false);
 
     shader_rect = gfx_shader_make_or_reset(
         "/system/HudRect", vertex_code, "", rect_colour_code, shader_rect_params, false);
 
     shader_stencil = gfx_shader_make_or_reset(
         "/system/HudStencil", vertex_code, "", stencil_colour_code, shader_stencil_params, false);
-    
-    shader_text = gfx_shader_make_or_reset(
-        "/system/HudText", vertex_code, "", text_colour_code, shader_text_params, false);
 
 }
 
 void hud_shutdown (lua_State *L)
 {
-    quad_vbuf.setNull();
-    OGRE_DELETE quad_vdata;
-    cornered_quad_vbuf.setNull();
-    OGRE_DELETE cornered_quad_vdata;
+    batch_vbuf.setNull();
+    OGRE_DELETE batch_vdata;
+    batch_ibuf.setNull();
+    OGRE_DELETE batch_idata;
 
     // Not all destroy callbacks actually destroy their children.  Orphaned
     // children end up being adopted by grandparents, and ultimately the root.  If
@@ -1177,116 +1194,30 @@ static inline Vector2 maybe_snap (bool snap, Vector2 pos)
     return pos;
 }
 
-static void set_vertex_data (const Vector2 &size,
-                             const Vector2 &uv1, const Vector2 &uv2)
-{
-    // strict alignment required here
-    struct Vertex { Vector2 position; Vector2 uv; };
-
-    float left   = -size.x / 2;
-    float right  =  size.x / 2;
-    float bottom = -size.y / 2;
-    float top    =  size.y / 2;
-
-    Vertex bottom_left = { Vector2(left, bottom), Vector2(uv1.x,uv2.y) };
-    Vertex bottom_right = { Vector2(right, bottom), uv2 };
-    Vertex top_left = { Vector2(left, top), uv1 };
-    Vertex top_right = { Vector2(right, top), Vector2(uv2.x,uv1.y) };
-
-    Vertex vdata_raw[] = {
-        bottom_left, bottom_right, top_left,
-        top_left, bottom_right, top_right
-    };
-
-    quad_vbuf->writeData(quad_vdata->vertexStart, quad_vdata->vertexCount*quad_vdecl_size,
-                         vdata_raw, true);
-}
-
-static void set_cornered_vertex_data (GfxTextureDiskResource *tex,
-                                      const Vector2 &size,
-                                      const Vector2 &uv1, const Vector2 &uv2)
-{
-    // strict alignment required here
-    struct Vertex { Vector2 position; Vector2 uv; };
-
-    const Ogre::TexturePtr &texptr = tex->getOgreTexturePtr();
-    texptr->load();
-    const Vector2 whole_tex_size(texptr->getWidth(), texptr->getHeight());
-    
-    const Vector2 tex_size = whole_tex_size * Vector2(::fabsf(uv2.x-uv1.x), ::fabsf(uv2.y-uv1.y));
-    const Vector2 uvm = (uv2+uv1)/2;
-
-    const Vector2 diag0 = -size/2;
-    const Vector2 diag3 = size/2;
-    const Vector2 diag1 = diag0 + tex_size/2;
-    const Vector2 diag2 = diag3 - tex_size/2;
-
-    /* c d e f
-     * 8 9 a b
-     * 4 5 6 7
-     * 0 1 2 3
-     */
-
-    Vertex vdata_raw[] = {
-        { Vector2(diag0.x, diag0.y), Vector2(uv1.x, uv2.y) },
-        { Vector2(diag1.x, diag0.y), Vector2(uvm.x, uv2.y) },
-        { Vector2(diag2.x, diag0.y), Vector2(uvm.x, uv2.y) },
-        { Vector2(diag3.x, diag0.y), Vector2(uv2.x, uv2.y) },
-
-        { Vector2(diag0.x, diag1.y), Vector2(uv1.x, uvm.y) },
-        { Vector2(diag1.x, diag1.y), Vector2(uvm.x, uvm.y) },
-        { Vector2(diag2.x, diag1.y), Vector2(uvm.x, uvm.y) },
-        { Vector2(diag3.x, diag1.y), Vector2(uv2.x, uvm.y) },
-
-        { Vector2(diag0.x, diag2.y), Vector2(uv1.x, uvm.y) },
-        { Vector2(diag1.x, diag2.y), Vector2(uvm.x, uvm.y) },
-        { Vector2(diag2.x, diag2.y), Vector2(uvm.x, uvm.y) },
-        { Vector2(diag3.x, diag2.y), Vector2(uv2.x, uvm.y) },
-
-        { Vector2(diag0.x, diag3.y), Vector2(uv1.x, uv1.y) },
-        { Vector2(diag1.x, diag3.y), Vector2(uvm.x, uv1.y) },
-        { Vector2(diag2.x, diag3.y), Vector2(uvm.x, uv1.y) },
-        { Vector2(diag3.x, diag3.y), Vector2(uv2.x, uv1.y) },
-    };
-
-    cornered_quad_vbuf->writeData(cornered_quad_vdata->vertexStart,
-                                  cornered_quad_vdata->vertexCount*cornered_quad_vdecl_size,
-                                  vdata_raw, true);
-}
-
-void gfx_render_hud_text (HudText *text, bool shadow, const Vector2 &offset,
-                          int parent_stencil_ref)
+/** Round the position to the pixel grid, keeping odd sized elements centred on a pixel. */
+static Vector2 pixel_position (HudBase *base)
 {
-    GfxFont *font = text->getFont();
-    GfxTextureDiskResource *tex = font->getTexture();
-
-    // In case the font has changed texture.
-    // Note that we do not have to rebuild the GfxGasolineMaterialEnvironments because
-    // they only care about whether a texture was bound, not which one.
-    text->texs["tex"] = gfx_texture_state_anisotropic(tex);
-
-    Vector2 pos = text->getDerivedPosition();
-    if (text->snapPixels) {
-        if (int(text->getDerivedBounds().x + 0.5) % 2 == 1)
+    Vector2 pos = base->getDerivedPosition();
+    if (base->snapPixels) {
+        if (int(base->getDerivedBounds().x + 0.5) % 2 == 1)
             pos.x += 0.5f;
-        if (int(text->getDerivedBounds().y + 0.5) % 2 == 1)
+        if (int(base->getDerivedBounds().y + 0.5) % 2 == 1)
             pos.y += 0.5f;
         pos.x = ::floorf(pos.x);
         pos.y = ::floorf(pos.y);
-        if (int(text->getDerivedBounds().x + 0.5) % 2 == 1)
+        if (int(base->getDerivedBounds().x + 0.5) % 2 == 1)
             pos.x -= 0.5f;
-        if (int(text->getDerivedBounds().y + 0.5) % 2 == 1)
+        if (int(base->getDerivedBounds().y + 0.5) % 2 == 1)
             pos.y -= 0.5f;
     }
-    pos += offset;
+    return pos;
+}
 
+/** The transform from element space (centred at the origin) to clip space. */
+static Ogre::Matrix4 element_matrix (const Vector2 &pos, const Degree &orientation)
+{
     const Ogre::Matrix4 &I = Ogre::Matrix4::IDENTITY;
 
-    Ogre::Matrix4 matrix_centre = I;
-    // move origin to center (for rotation)
-    matrix_centre.setTrans(Ogre::Vector3(-text->getSize().x/2, text->getSize().y/2, 0));
-
-    const Degree &orientation = text->getDerivedOrientation();
     Ogre::Matrix4 matrix_spin(Ogre::Quaternion(to_ogre(orientation), Ogre::Vector3(0,0,-1)));
 
     Ogre::Matrix4 matrix_trans = I;
@@ -1301,38 +1232,144 @@ void gfx_render_hud_text (HudText *text, bool shadow, const Vector2 &offset,
     }
 
     Ogre::Matrix4 matrix_scale = I;
-    matrix_scale.setScale(Ogre::Vector3(2/win_size.x, 2/win_size.y ,1));
+    matrix_scale.setScale(Ogre::Vector3(2/win_size.x, 2/win_size.y, 1));
 
-    // TODO: render target flipping (see comment in text rendering, above)
-    bool render_target_flipping = false;
-    Ogre::Matrix4 matrix = matrix_scale * matrix_d3d_offset * matrix_trans * matrix_spin * matrix_centre;
+    return matrix_scale * matrix_d3d_offset * matrix_trans * matrix_spin;
+}
 
-    Vector3 zv(0,0,0);
-    GfxShaderGlobals globs = {
-        zv, I, I, I, zv, zv, zv, zv, win_size, render_target_flipping, nullptr
+static inline void add_vertex (const Ogre::Matrix4 &m, float x, float y, float u, float v,
+                               float r, float g, float b, float a)
+{
+    HudVertex vert = {
+        float(m[0][0]*x + m[0][1]*y + m[0][3]),
+        float(m[1][0]*x + m[1][1]*y + m[1][3]),
+        u, v, r, g, b, a
     };
+    batch_vertexes.push_back(vert);
+}
 
-    if (shadow) {
-        shader_text->bindShader(GFX_GSL_PURPOSE_HUD, text->matEnvShadow, simple_mesh_env,
-                                globs, matrix, nullptr, 0, 1, text->texs, text->shaderBindsShadow);
-    } else {
-        shader_text->bindShader(GFX_GSL_PURPOSE_HUD, text->matEnv, simple_mesh_env,
-                                globs, matrix, nullptr, 0, 1, text->texs, text->shaderBinds);
+/** Continue the last batch if it has the same state, otherwise start a new one.  The batch is
+ * drawn with the material environment and textures of its first element, so everything they
+ * bind, including the samplers' addressing and filtering, has to match.
+ */
+static void begin_batch (GfxShader *shader, const GfxGslMaterialEnvironment &mat_env,
+                         const GfxTextureStateMap &texs, GfxTextureDiskResource *tex,
+                         HudStencilMode stencil_mode, int stencil_ref)
+{
+    if (batches.size() > 0) {
+        const HudBatch &last = batches.back();
+        if (last.shader == shader && last.tex == tex && last.stencilMode == stencil_mode
+            && last.stencilRef == stencil_ref && *last.texs == texs)
+            return;
+    }
+    HudBatch b = {
+        shader, &mat_env, &texs, tex, stencil_mode, stencil_ref, unsigned(batch_indexes.size()), 0
+    };
+    batches.push_back(b);
+}
+
+static void end_batch (void)
+{
+    HudBatch &b = batches.back();
+    b.indexCount = batch_indexes.size() - b.indexStart;
+}
+
+static void add_rect (const Ogre::Matrix4 &m, GfxTextureDiskResource *tex, bool cornered,
+                      const Vector2 &size, const Vector2 &uv1, const Vector2 &uv2,
+                      const Vector3 &colour, float alpha)
+{
+    const float r = colour.x, g = colour.y, b = colour.z;
+    const uint32_t base = batch_vertexes.size();
+
+    if (!cornered || tex == nullptr) {
+        float left   = -size.x / 2;
+        float right  =  size.x / 2;
+        float bottom = -size.y / 2;
+        float top    =  size.y / 2;
+
+        add_vertex(m, left, bottom, uv1.x, uv2.y, r, g, b, alpha);
+        add_vertex(m, right, bottom, uv2.x, uv2.y, r, g, b, alpha);
+        add_vertex(m, left, top, uv1.x, uv1.y, r, g, b, alpha);
+        add_vertex(m, right, top, uv2.x, uv1.y, r, g, b, alpha);
+
+        const uint32_t idxs[] = { 0, 1, 2,  2, 1, 3 };
+        for (uint32_t i : idxs)
+            batch_indexes.push_back(base + i);
+        return;
+    }
+
+    const Ogre::TexturePtr &texptr = tex->getOgreTexturePtr();
+    texptr->load();
+    const Vector2 whole_tex_size(texptr->getWidth(), texptr->getHeight());
+
+    const Vector2 tex_size = whole_tex_size * Vector2(::fabsf(uv2.x-uv1.x), ::fabsf(uv2.y-uv1.y));
+    const Vector2 uvm = (uv2+uv1)/2;
+
+    const float xs[] = { -size.x/2, -size.x/2 + tex_size.x/2, size.x/2 - tex_size.x/2, size.x/2 };
+    const float ys[] = { -size.y/2, -size.y/2 + tex_size.y/2, size.y/2 - tex_size.y/2, size.y/2 };
+    const float us[] = { uv1.x, uvm.x, uvm.x, uv2.x };
+    const float vs[] = { uv2.y, uvm.y, uvm.y, uv1.y };
+
+    /* c d e f
+     * 8 9 a b
+     * 4 5 6 7
+     * 0 1 2 3
+     */
+    for (unsigned j=0 ; j<4 ; ++j) {
+        for (unsigned i=0 ; i<4 ; ++i) {
+            add_vertex(m, xs[i], ys[j], us[i], vs[j], r, g, b, alpha);
+        }
     }
 
+    /*  d c
+     *  a b
+     */
+    #define QUAD(a,b,c,d) a, b, d,  c, d, b
+    const uint32_t idxs[] = {
+        QUAD( 0, 1, 5, 4), QUAD( 1, 2, 6, 5), QUAD( 2, 3, 7, 6),
+        QUAD( 4, 5, 9, 8), QUAD( 5, 6,10, 9), QUAD( 6, 7,11,10),
+        QUAD( 8, 9,13,12), QUAD( 9,10,14,13), QUAD(10,11,15,14),
+    };
+    #undef QUAD
+    for (uint32_t i : idxs)
+        batch_indexes.push_back(base + i);
+}
+
+void hud_flatten_text (HudText *text, const Vector2 &offset, const Vector3 &colour, float alpha,
+                       int parent_stencil_ref)
+{
+    const std::vector<float> &raw_vertexes = text->buf.getRawVertexes();
+    if (raw_vertexes.size() == 0) return;
+
+    Ogre::Matrix4 matrix_centre = Ogre::Matrix4::IDENTITY;
+    // move origin to center (for rotation)
+    matrix_centre.setTrans(Ogre::Vector3(-text->getSize().x/2, text->getSize().y/2, 0));
 
-    ogre_rs->setStencilBufferParams(Ogre::CMPF_EQUAL, parent_stencil_ref);
+    Ogre::Matrix4 matrix = element_matrix(pixel_position(text) + offset,
+                                          text->getDerivedOrientation()) * matrix_centre;
 
+    begin_batch(shader_rect, text->matEnv, text->texs, text->getFont()->getTexture(),
+                HUD_STENCIL_TEST, parent_stencil_ref);
 
-    if (text->buf.getRenderOperation().indexData->indexCount > 0) {
-        ogre_rs->_render(text->buf.getRenderOperation());
+    const uint32_t base = batch_vertexes.size();
+    for (size_t i=0 ; i<raw_vertexes.size() ; i+=8) {
+        const float *v = &raw_vertexes[i];
+        add_vertex(matrix, v[0], v[1], v[2], v[3],
+                   v[4] * colour.x, v[5] * colour.y, v[6] * colour.z, v[7] * alpha);
+    }
+    // Every glyph is a quad, as in GfxTextBuffer::getRawIndexes, but not limited to 16 bits.
+    const uint32_t quad_idxs[] = { 0, 2, 1,  1, 2, 3 };
+    for (uint32_t q=0 ; q<(raw_vertexes.size()/8)/4 ; ++q) {
+        for (uint32_t i : quad_idxs)
+            batch_indexes.push_back(base + q*4 + i);
     }
 
-    ogre_rs->_disableTextureUnit(0);
+    end_batch();
 }
 
+static void flatten_children (const fast_erase_vector<HudBase*> &elements, int parent_stencil_ref);
 
-void gfx_render_hud_one (HudBase *base, int parent_stencil_ref)
+void hud_flatten_one (HudBase *base, int parent_stencil_ref)
 {
     if (!base->isEnabled()) return;
     if (base->destroyed()) return;
@@ -1341,150 +1378,200 @@ void gfx_render_hud_one (HudBase *base, int parent_stencil_ref)
     if (obj != nullptr) {
 
         bool is_cornered = obj->isCornered();
-
+        Vector2 size = obj->getSize();
         Vector2 uv1 = obj->getUV1();
         Vector2 uv2 = obj->getUV2();
 
-        Vector2 pos = obj->getDerivedPosition();
-        if (obj->snapPixels) {
-            if (int(obj->getDerivedBounds().x + 0.5) % 2 == 1)
-                pos.x += 0.5f;
-            if (int(obj->getDerivedBounds().y + 0.5) % 2 == 1)
-                pos.y += 0.5f;
-            pos.x = ::floorf(pos.x);
-            pos.y = ::floorf(pos.y);
-            if (int(obj->getDerivedBounds().x + 0.5) % 2 == 1)
-                pos.x -= 0.5f;
-            if (int(obj->getDerivedBounds().y + 0.5) % 2 == 1)
-                pos.y -= 0.5f;
-        }
+        Ogre::Matrix4 matrix = element_matrix(pixel_position(obj), obj->getDerivedOrientation());
 
+        // First only draw our colour if we fit inside our parent.
         GfxTextureDiskResource *tex = obj->getTexture();
-        if (is_cornered && tex != nullptr) {
-            set_cornered_vertex_data(tex, obj->getSize(), uv1, uv2);
-        } else {
-            set_vertex_data(obj->getSize(), uv1, uv2);
-        }
+        begin_batch(shader_rect, obj->matEnvRect, obj->texs, tex,
+                    HUD_STENCIL_TEST, parent_stencil_ref);
+        add_rect(matrix, tex, is_cornered, size, uv1, uv2, obj->getColour(), obj->getAlpha());
+        end_batch();
 
-        const Degree &orientation = obj->getDerivedOrientation();
-        Ogre::Matrix4 matrix_spin(Ogre::Quaternion(to_ogre(orientation), Ogre::Vector3(0,0,-1)));
-
-        const Ogre::Matrix4 &I = Ogre::Matrix4::IDENTITY;
+        int child_stencil_ref = parent_stencil_ref;
+        GfxTextureDiskResource *stencil_tex = obj->getStencilTexture();
+        if (obj->isStencil()) {
+            // Paint a rectangle in the stencil buffer to mask our children, but we
+            // ourselves are still masked by our parent.
+            child_stencil_ref += 1;
+            begin_batch(shader_stencil, obj->matEnvStencil, obj->stencilTexs, stencil_tex,
+                        HUD_STENCIL_PUSH, parent_stencil_ref);
+            add_rect(matrix, stencil_tex, is_cornered, size, uv1, uv2, Vector3(1, 1, 1), 1);
+            end_batch();
+        }
 
-        Ogre::Matrix4 matrix_trans = I;
-        matrix_trans.setTrans(Ogre::Vector3(pos.x, pos.y, 0));
+        flatten_children(obj->children, child_stencil_ref);
 
-        Ogre::Matrix4 matrix_d3d_offset = I;
-        if (d3d9) {
-            // offsets for D3D rasterisation quirks, see http://msdn.microsoft.com/en-us/library/windows/desktop/bb219690(v=vs.85).aspx
-            matrix_d3d_offset.setTrans(Ogre::Vector3(-0.5-win_size.x/2, 0.5-win_size.y/2, 0));
-        } else {
-            matrix_d3d_offset.setTrans(Ogre::Vector3(-win_size.x/2, -win_size.y/2, 0));
+        if (obj->isStencil()) {
+            begin_batch(shader_stencil, obj->matEnvStencil, obj->stencilTexs, stencil_tex,
+                        HUD_STENCIL_POP, parent_stencil_ref);
+            add_rect(matrix, stencil_tex, is_cornered, size, uv1, uv2, Vector3(1, 1, 1), 1);
+            end_batch();
         }
+    }
 
-        Ogre::Matrix4 matrix_scale = I;
-        matrix_scale.setScale(Ogre::Vector3(2/win_size.x, 2/win_size.y, 1));
+    HudText *text = dynamic_cast<HudText*>(base);
+    if (text != nullptr) {
 
-        // TODO: Is there no render target flipping?
-        // I guess we never rendered HUD to a texture on GL?
-        bool render_target_flipping = false;
-        Ogre::Matrix4 matrix = matrix_scale * matrix_d3d_offset * matrix_trans * matrix_spin;
+        text->buf.updateVertexes(text->wrap == Vector2(0, 0), text->scroll,
+                                 text->scroll+text->wrap.y);
 
-        Vector3 zv(0,0,0);
-        GfxShaderGlobals globs = { zv, I, I, I, zv, zv, zv, zv, win_size, render_target_flipping,
-                                   nullptr };
+        // In case the font has changed texture.
+        // Note that we do not have to rebuild the GfxGasolineMaterialEnvironment because
+        // it only cares about whether a texture was bound, not which one.
+        text->texs["tex"] = gfx_texture_state_anisotropic(text->getFont()->getTexture());
 
-        Ogre::RenderOperation op;
-        if (is_cornered && tex != nullptr) {
-            op.useIndexes = true;
-            op.vertexData = cornered_quad_vdata;
-            op.indexData = cornered_quad_idata;
-        } else {
-            op.useIndexes = false;
-            op.vertexData = quad_vdata;
+        if (text->getShadow() != Vector2(0, 0)) {
+            hud_flatten_text(text, text->getShadow(), text->getShadowColour(),
+                             text->getShadowAlpha(), parent_stencil_ref);
         }
-        op.operationType = Ogre::RenderOperation::OT_TRIANGLE_LIST;
+        hud_flatten_text(text, Vector2(0, 0), text->getColour(), text->getAlpha(),
+                         parent_stencil_ref);
+    }
+}
 
-        shader_rect->bindShader(GFX_GSL_PURPOSE_HUD, obj->matEnvRect, simple_mesh_env,
-                                globs, matrix, nullptr, 0, 1, obj->texs, obj->shaderBinds);
+/** Append the elements to zorder_scratch, bucketed by z order in a single pass.
+ *
+ * Within a bucket, the elements are in reverse order, for consistency with ray priority.  Returns
+ * the index in zorder_scratch of the first element.
+ */
+static size_t bucket_by_zorder (const fast_erase_vector<HudBase*> &elements)
+{
+    unsigned offsets[GFX_HUD_ZORDER_MAX + 2] = { 0 };
+    for (unsigned j=0 ; j<elements.size() ; ++j) {
+        unsigned z = elements[j]->getZOrder();
+        if (z <= GFX_HUD_ZORDER_MAX) offsets[z + 1]++;
+    }
+    for (unsigned i=1 ; i<=GFX_HUD_ZORDER_MAX+1 ; ++i)
+        offsets[i] += offsets[i - 1];
+
+    size_t start = zorder_scratch.size();
+    zorder_scratch.resize(start + offsets[GFX_HUD_ZORDER_MAX + 1]);
+    for (unsigned j=0 ; j<elements.size() ; ++j) {
+        HudBase *el = elements[elements.size() - j - 1];
+        unsigned z = el->getZOrder();
+        if (z > GFX_HUD_ZORDER_MAX) continue;
+        zorder_scratch[start + offsets[z]++] = el;
+    }
+    return start;
+}
 
-        // First only draw our colour if we fit inside our parent.
-        ogre_rs->setStencilBufferParams(
-            Ogre::CMPF_EQUAL, parent_stencil_ref, 0xffffffff, 0xffffffff,
-            Ogre::SOP_KEEP, Ogre::SOP_KEEP, Ogre::SOP_KEEP);
+static void flatten_children (const fast_erase_vector<HudBase*> &elements, int parent_stencil_ref)
+{
+    // Recursive calls push (and then pop) their own elements onto the end of zorder_scratch, so
+    // it may be reallocated during the loop.
+    size_t start = bucket_by_zorder(elements);
+    size_t end = zorder_scratch.size();
+    for (size_t i=start ; i<end ; ++i) {
+        hud_flatten_one(zorder_scratch[i], parent_stencil_ref);
+    }
+    zorder_scratch.resize(start);
+}
 
-        ogre_rs->_render(op);
+static void upload_batches (void)
+{
+    unsigned vertexes = batch_vertexes.size();
+    unsigned indexes = batch_indexes.size();
 
-        int child_stencil_ref = parent_stencil_ref;
-        if (obj->isStencil()) {
+    if (batch_vbuf_capacity < vertexes) {
+        // Grow geometrically so that a slowly growing HUD does not reallocate every frame.
+        batch_vbuf_capacity = std::max(vertexes, 2 * batch_vbuf_capacity);
+        batch_vbuf.setNull();
+        batch_vbuf = Ogre::HardwareBufferManager::getSingleton().createVertexBuffer(
+            sizeof(HudVertex), batch_vbuf_capacity,
+            Ogre::HardwareBuffer::HBU_DYNAMIC_WRITE_ONLY_DISCARDABLE);
+        batch_vdata->vertexBufferBinding->setBinding(0, batch_vbuf);
+    }
 
-            GfxTextureDiskResource *stencil_tex = obj->getStencilTexture();
-            if (is_cornered && stencil_tex != nullptr) {
-                set_cornered_vertex_data(stencil_tex, obj->getSize(), uv1, uv2);
-            } else {
-                set_vertex_data(obj->getSize(), uv1, uv2);
-            }
+    if (batch_ibuf_capacity < indexes) {
+        batch_ibuf_capacity = std::max(indexes, 2 * batch_ibuf_capacity);
+        batch_ibuf.setNull();
+        batch_ibuf = Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(
+            Ogre::HardwareIndexBuffer::IT_32BIT, batch_ibuf_capacity,
+            Ogre::HardwareBuffer::HBU_DYNAMIC_WRITE_ONLY_DISCARDABLE);
+        batch_idata->indexBuffer = batch_ibuf;
+    }
 
+    batch_vbuf->writeData(0, vertexes * sizeof(HudVertex), &batch_vertexes[0], true);
+    batch_ibuf->writeData(0, indexes * sizeof(uint32_t), &batch_indexes[0], true);
+    batch_vdata->vertexCount = vertexes;
+}
 
-            // Paint a rectangle in the stencil buffer to mask our children, but we
-            // ourselves are still masked by our parent.
-            child_stencil_ref += 1;
+static void draw_batches (void)
+{
+    if (batch_indexes.size() == 0) return;
 
-            ogre_rs->setStencilBufferParams(
-                Ogre::CMPF_EQUAL, parent_stencil_ref, 0xffffffff, 0xffffffff,
-                Ogre::SOP_KEEP, Ogre::SOP_KEEP, Ogre::SOP_INCREMENT);
+    upload_batches();
 
-            ogre_rs->_setColourBufferWriteEnabled(false, false, false, false);
-            shader_stencil->bindShader(GFX_GSL_PURPOSE_HUD, obj->matEnvStencil, simple_mesh_env,
-                                       globs, matrix, nullptr, 0, 1, obj->stencilTexs,
-                                       empty_binds);
+    const Ogre::Matrix4 &I = Ogre::Matrix4::IDENTITY;
 
-            ogre_rs->_render(op);
-            ogre_rs->_setColourBufferWriteEnabled(true, true, true, true);
-        }
+    // TODO: Is there no render target flipping?
+    // I guess we never rendered HUD to a texture on GL?
+    bool render_target_flipping = false;
+    Vector3 zv(0,0,0);
+    GfxShaderGlobals globs = { zv, I, I, I, zv, zv, zv, zv, win_size, render_target_flipping,
+                               nullptr };
 
-        if (tex != NULL) {
-            ogre_rs->_disableTextureUnit(0);
-        }
+    Ogre::RenderOperation op;
+    op.useIndexes = true;
+    op.vertexData = batch_vdata;
+    op.indexData = batch_idata;
+    op.operationType = Ogre::RenderOperation::OT_TRIANGLE_LIST;
 
-        for (unsigned i=0 ; i<=GFX_HUD_ZORDER_MAX ; ++i) {
-            for (unsigned j=0 ; j<obj->children.size() ; ++j) {
-                // Draw in reverse order, for consistency with ray priority
-                HudBase *child = obj->children[obj->children.size() - j - 1];
-                if (child->getZOrder() != i) continue;
-                gfx_render_hud_one(child, child_stencil_ref);
-            }
-        }
+    for (const HudBatch &b : batches) {
+        if (b.indexCount == 0) continue;
 
-        if (obj->isStencil()) {
+        b.shader->bindShader(GFX_GSL_PURPOSE_HUD, *b.matEnv, simple_mesh_env,
+                             globs, I, nullptr, 0, 1, *b.texs, empty_binds);
+
+        switch (b.stencilMode) {
+            case HUD_STENCIL_TEST:
             ogre_rs->setStencilBufferParams(
-                Ogre::CMPF_LESS_EQUAL, parent_stencil_ref, 0xffffffff, 0xffffffff,
-                Ogre::SOP_KEEP, Ogre::SOP_KEEP, Ogre::SOP_REPLACE);
+                Ogre::CMPF_EQUAL, b.stencilRef, 0xffffffff, 0xffffffff,
+                Ogre::SOP_KEEP, Ogre::SOP_KEEP, Ogre::SOP_KEEP);
+            break;
 
-            ogre_rs->_setColourBufferWriteEnabled(false, false, false, false);
-            shader_stencil->bindShader(GFX_GSL_PURPOSE_HUD, obj->matEnvStencil, simple_mesh_env,
-                                       globs, matrix, nullptr, 0, 1, obj->stencilTexs,
-                                       empty_binds);
+            case HUD_STENCIL_PUSH:
+            ogre_rs->setStencilBufferParams(
+                Ogre::CMPF_EQUAL, b.stencilRef, 0xffffffff, 0xffffffff,
+                Ogre::SOP_KEEP, Ogre::SOP_KEEP, Ogre::SOP_INCREMENT);
+            break;
 
-            ogre_rs->_render(op);
-            ogre_rs->_setColourBufferWriteEnabled(true, true, true, true);
+            case HUD_STENCIL_POP:
+            ogre_rs->setStencilBufferParams(
+                Ogre::CMPF_LESS_EQUAL, b.stencilRef, 0xffffffff, 0xffffffff,
+                Ogre::SOP_KEEP, Ogre::SOP_KEEP, Ogre::SOP_REPLACE);
+            break;
         }
-    }
 
-    HudText *text = dynamic_cast<HudText*>(base);
-    if (text != nullptr) {
+        bool colour_write = b.stencilMode == HUD_STENCIL_TEST;
+        if (!colour_write)
+            ogre_rs->_setColourBufferWriteEnabled(false, false, false, false);
 
-        text->buf.updateGPU(text->wrap == Vector2(0, 0), text->scroll, text->scroll+text->wrap.y);
+        batch_idata->indexStart = b.indexStart;
+        batch_idata->indexCount = b.indexCount;
+        ogre_rs->_render(op);
 
-        if (text->getShadow() != Vector2(0, 0)) {
-            gfx_render_hud_text(text, true, text->getShadow(), parent_stencil_ref);
+        if (!colour_write)
+            ogre_rs->_setColourBufferWriteEnabled(true, true, true, true);
+
+        if (b.texs->size() > 0) {
+            ogre_rs->_disableTextureUnit(0);
         }
-        gfx_render_hud_text(text, false, Vector2(0, 0), parent_stencil_ref);
+
+        last_render_stats.batches += 1;
+        last_render_stats.triangles += b.indexCount / 3;
     }
 }
 
 void hud_render (Ogre::Viewport *vp)
 {
+    unsigned long long before = micros();
+    last_render_stats = GfxLastRenderStats();
+
     ogre_rs->_setViewport(vp);
 
     ogre_rs->_beginFrame();
@@ -1501,17 +1588,19 @@ void hud_render (Ogre::Viewport *vp)
 
     try {
 
-        for (unsigned i=0 ; i<=GFX_HUD_ZORDER_MAX ; ++i) {
-            for (unsigned j=0 ; j<root_elements.size() ; ++j) {
-                HudBase *el = root_elements[root_elements.size() - j - 1];
-                if (el->getZOrder() != i) continue;
-                gfx_render_hud_one(el, 0);
-            }
-        }
+        batch_vertexes.clear();
+        batch_indexes.clear();
+        batches.clear();
+
+        flatten_children(root_elements, 0);
+
+        draw_batches();
 
     } catch (const Exception &e) {
+        zorder_scratch.clear();
         CERR << "Rendering HUD, got: " << e << std::endl;
     } catch (const Ogre::Exception &e) {
+        zorder_scratch.clear();
         CERR << "Rendering HUD, got: " << e.getDescription() << std::endl;
     }
 
@@ -1519,6 +1608,12 @@ void hud_render (Ogre::Viewport *vp)
 
     ogre_rs->_endFrame();
 
+    last_render_stats.micros = micros() - before;
+}
+
+GfxLastRenderStats hud_last_render_stats (void)
+{
+    return last_render_stats;
 }
 
 // }}}
@@ -1539,25 +1634,33 @@ void hud_signal_window_resized (unsigned w, unsigned h)
 
 void hud_call_per_frame_callbacks (lua_State *L, float elapsed)
 {
-
-    std::vector<HudObject*> local_root_objects = get_all_hud_objects(root_elements);
-
     if (window_size_dirty) {
         window_size_dirty = false;
+        std::vector<HudObject*> local_root_objects =
+            get_hud_objects_needing_parent_resized(root_elements);
         for (unsigned j=0 ; j<local_root_objects.size() ; ++j) {
             HudObject *obj = local_root_objects[j];
             if (obj->destroyed()) continue;
             obj->triggerParentResized(L);
         }
+        dec_all_hud_objects(L, local_root_objects);
     }
 
-    for (unsigned j=0 ; j<local_root_objects.size() ; ++j) {
-        HudObject *obj = local_root_objects[j];
+    // Make local copy because callbacks can destroy elements or change who needs callbacks.
+    std::vector<HudObject*> local_objects = objs_needing_frame_callbacks;
+    for (unsigned j=0 ; j<local_objects.size() ; ++j) {
+        local_objects[j]->incRefCount();
+    }
+
+    for (unsigned j=0 ; j<local_objects.size() ; ++j) {
+        HudObject *obj = local_objects[j];
         if (obj->destroyed()) continue;
+        // Disabled objects, and everything inside them, do not get frame callbacks.
+        if (!obj->isDerivedEnabled()) continue;
         obj->triggerFrame(L, elapsed);
     }
 
-    dec_all_hud_objects(L, local_root_objects);
+    dec_all_hud_objects(L, local_objects);
 }
 
 // }}}
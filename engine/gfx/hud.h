@@ -210,7 +210,6 @@ class HudObject : public HudBase {
     fast_erase_vector<HudBase*> children;
 
     DiskResourcePtr<GfxTextureDiskResource> texture;
-    GfxShaderBindings shaderBinds;
     GfxTextureStateMap texs;
     GfxTextureStateMap stencilTexs;
 
@@ -231,10 +230,16 @@ class HudObject : public HudBase {
     bool needsInputCallbacks;
     bool needsFrameCallbacks;
 
+    // Position in the list of objects needing frame callbacks, if needsFrameCallbacks.
+    size_t frameCallbacksIndex;
+
     public:
 
     HudObject (HudClass *hud_class);
 
+    // HudBase::~HudBase cannot reach HudObject::destroy, so this has to.
+    ~HudObject (void);
+
     void incRefCount (void);
     void decRefCount (lua_State *L);
     // do as much as we can without using L
@@ -296,7 +301,10 @@ class HudObject : public HudBase {
     void setNeedsInputCallbacks (bool v) { assertAlive(); needsInputCallbacks = v; }
 
     bool getNeedsFrameCallbacks (void) const { assertAlive(); return needsFrameCallbacks; }
-    void setNeedsFrameCallbacks (bool v) { assertAlive(); needsFrameCallbacks = v; }
+    void setNeedsFrameCallbacks (bool v);
+
+    /** Whether this object and all of its ancestors are enabled. */
+    bool isDerivedEnabled (void);
 
     // Transform screen co-ordinates (e.g. from the mouse) to co-ordinates local to the HudObject.
     Vector2 screenToLocal (const Vector2 &screen_pos);
@@ -309,8 +317,7 @@ class HudObject : public HudBase {
     unsigned refCount;
 
     // internal function
-    friend void gfx_render_hud_one (HudBase *, int);
-    friend void gfx_render_hud_text (HudText *, const Vector3 &, const Vector2 &, int);
+    friend void hud_flatten_one (HudBase *, int);
     
 };
 
@@ -331,9 +338,8 @@ class HudText : public HudBase {
     Vector2 shadow;
     Vector3 shadowColour;
     float shadowAlpha;
-    GfxShaderBindings shaderBinds, shaderBindsShadow;
     GfxTextureStateMap texs;
-    GfxGslMaterialEnvironment matEnv, matEnvShadow;
+    GfxGslMaterialEnvironment matEnv;
 
 
     unsigned refCount;
@@ -384,7 +390,7 @@ class HudText : public HudBase {
     {
         assertAlive();
         if (wrap == Vector2(0,0)) {
-            buf.updateGPU(true, scroll, scroll+wrap.y);
+            buf.updateVertexes(true, scroll, scroll+wrap.y);
             return buf.getDrawnDimensions();
         }
         return wrap;
@@ -422,13 +428,16 @@ class HudText : public HudBase {
     
 
     // internal function
-    friend void gfx_render_hud_one (HudBase *, int);
-    friend void gfx_render_hud_text (HudText *, bool, const Vector2 &, int);
+    friend void hud_flatten_one (HudBase *, int);
+    friend void hud_flatten_text (HudText *, const Vector2 &, const Vector3 &, float, int);
 };
 
 /** Called in the frame loop by the graphics code to render the HUD on top of the 3d graphics. */
 void hud_render (Ogre::Viewport *vp);
 
+/** Draw calls, triangles, and CPU time (flattening, upload, and submission) of the last hud_render. */
+GfxLastRenderStats hud_last_render_stats (void);
+
 /** Set up internal state. */
 void hud_init (void);
 
@@ -34,6 +34,8 @@
 #include "gfx_debug.h"
 #include "gfx_font.h"
 #include "gfx_option.h"
+#include "gfx_scene_manager.h"
+#include "gfx_shader_cache.h"
 #include "hud.h"
 #include "lua_wrappers_gfx.h"
 
@@ -677,6 +679,8 @@ TRY_START
         lua_pushboolean(L, self->getWireframe());
     } else if (!::strcmp(key,"firstPerson")) {
         lua_pushboolean(L, self->getFirstPerson());
+    } else if (!::strcmp(key,"occluder")) {
+        lua_pushboolean(L, self->getOccluder());
     } else if (!::strcmp(key,"enabled")) {
         lua_pushboolean(L, self->isEnabled());
 
@@ -809,6 +813,9 @@ TRY_START
     } else if (!::strcmp(key,"firstPerson")) {
         bool v = check_bool(L,3);
         self->setFirstPerson(v);
+    } else if (!::strcmp(key,"occluder")) {
+        bool v = check_bool(L,3);
+        self->setOccluder(v);
     } else {
        my_lua_error(L,"Not a writeable GfxBody member: "+std::string(key));
     }
@@ -1320,6 +1327,18 @@ TRY_START
 TRY_END
 }
 
+static int gfxrangedinstances_add_item (lua_State *L)
+{
+TRY_START
+    check_args(L,3);
+    GET_UD_MACRO(GfxRangedInstancesPtr,self,1,GFXRANGEDINSTANCES_TAG);
+    Vector3 v = check_v3(L,2);
+    Quaternion q = check_quat(L,3);
+    self->push_back(SimpleTransform(v, q));
+    return 0;
+TRY_END
+}
+
 static int gfxrangedinstances_del (lua_State *L)
 {
 TRY_START
@@ -1356,6 +1375,10 @@ TRY_START
         push_cfunction(L,gfxrangedinstances_update);
     } else if (!::strcmp(key,"del")) {
         push_cfunction(L,gfxrangedinstances_del);
+    } else if (!::strcmp(key,"addItem")) {
+        push_cfunction(L,gfxrangedinstances_add_item);
+    } else if (!::strcmp(key,"items")) {
+        lua_pushnumber(L, self->size());
     } else if (!::strcmp(key,"enabled")) {
         lua_pushboolean(L, self->isEnabled());
     } else if (!::strcmp(key,"castShadows")) {
@@ -2943,6 +2966,19 @@ TRY_END
 }
 
 
+// The fields of a hud class that initialise each new object, interned once.
+static const ExternalTable::Key key_orientation("orientation");
+static const ExternalTable::Key key_position("position");
+static const ExternalTable::Key key_size("size");
+static const ExternalTable::Key key_colour("colour");
+static const ExternalTable::Key key_alpha("alpha");
+static const ExternalTable::Key key_texture("texture");
+static const ExternalTable::Key key_z_order("zOrder");
+static const ExternalTable::Key key_cornered("cornered");
+static const ExternalTable::Key key_enabled("enabled");
+static const ExternalTable::Key key_stencil("stencil");
+static const ExternalTable::Key key_stencil_texture("stencilTexture");
+
 static int global_hud_object_add (lua_State *L)
 {
 TRY_START
@@ -3103,54 +3139,54 @@ TRY_START
     ExternalTable &class_tab = hud_class->getTable();
     std::string msg = "Wrong type for %s field in hud class \"" + hud_class->name + "\".";
     if (!have_orientation) {
-        if (class_tab.has("orientation")) {
+        if (class_tab.has(key_orientation)) {
             lua_Number v;
-            class_tab.getOrExcf("orientation", v, msg, "orientation");
+            class_tab.getOrExcf(key_orientation, v, msg, "orientation");
             self->setOrientation(Degree(v));
         }
     }
     if (!have_position) {
-        if (class_tab.has("position")) {
+        if (class_tab.has(key_position)) {
             Vector2 v;
-            class_tab.getOrExcf("position", v, msg, "position");
+            class_tab.getOrExcf(key_position, v, msg, "position");
             self->setPosition(v);
         }
     }
     if (!have_size) {
-        if (class_tab.has("size")) {
+        if (class_tab.has(key_size)) {
             Vector2 v;
-            class_tab.getOrExcf("size", v, msg, "size");
+            class_tab.getOrExcf(key_size, v, msg, "size");
             self->setSize(L, v);
             have_size = true;
         }
     }
     if (!have_colour) {
-        if (class_tab.has("colour")) {
+        if (class_tab.has(key_colour)) {
             Vector3 v;
-            class_tab.getOrExcf("colour", v, msg, "colour");
+            class_tab.getOrExcf(key_colour, v, msg, "colour");
             self->setColour(v);
         }
     }
     if (!have_alpha) {
-        if (class_tab.has("alpha")) {
+        if (class_tab.has(key_alpha)) {
             lua_Number v;
-            class_tab.getOrExcf("alpha", v, msg, "alpha");
+            class_tab.getOrExcf(key_alpha, v, msg, "alpha");
             self->setAlpha(v);
         }
     }
     if (!have_texture) {
-        if (class_tab.has("texture")) {
+        if (class_tab.has(key_texture)) {
             std::string v;
-            class_tab.getOrExcf("texture", v, msg, "texture");
+            class_tab.getOrExcf(key_texture, v, msg, "texture");
             auto d = disk_resource_use<GfxTextureDiskResource>(v);
             if (d == nullptr) my_lua_error(L, "Resource not a texture: \""+std::string(v)+"\"");
             self->setTexture(d);
         }
     }
     if (!have_zorder) {
-        if (class_tab.has("zOrder")) {
+        if (class_tab.has(key_z_order)) {
             lua_Number v;
-            class_tab.getOrExcf("zOrder", v, msg, "zOrder");
+            class_tab.getOrExcf(key_z_order, v, msg, "zOrder");
             if ((unsigned char)(v) != v)
                 EXCEPT << "zOrder must be an integer in range 0 to 255 in class \""
                        << hud_class->name << "\"." << ENDL;
@@ -3158,30 +3194,30 @@ TRY_START
         }
     }
     if (!have_cornered) {
-        if (class_tab.has("cornered")) {
+        if (class_tab.has(key_cornered)) {
             bool v;
-            class_tab.getOrExcf("cornered", v, msg, "cornered");
+            class_tab.getOrExcf(key_cornered, v, msg, "cornered");
             self->setCornered(v);
         }
     }
     if (!have_enabled) {
-        if (class_tab.has("enabled")) {
+        if (class_tab.has(key_enabled)) {
             bool v;
-            class_tab.getOrExcf("enabled", v, msg, "enabled");
+            class_tab.getOrExcf(key_enabled, v, msg, "enabled");
             self->setEnabled(v);
         }
     }
     if (!have_stencil) {
-        if (class_tab.has("stencil")) {
+        if (class_tab.has(key_stencil)) {
             bool v;
-            class_tab.getOrExcf("stencil", v, msg, "stencil");
+            class_tab.getOrExcf(key_stencil, v, msg, "stencil");
             self->setStencil(v);
         }
     }
     if (!have_stencil_texture) {
-        if (class_tab.has("stencilTexture")) {
+        if (class_tab.has(key_stencil_texture)) {
             std::string v;
-            class_tab.getOrExcf("stencilTexture", v, msg, "stencilTexture");
+            class_tab.getOrExcf(key_stencil_texture, v, msg, "stencilTexture");
             auto d = disk_resource_use<GfxTextureDiskResource>(v);
             if (d == nullptr) EXCEPT << "Resource not a texture: \"" << v << "\"" << ENDL;
             self->setStencilTexture(d);
@@ -3306,6 +3342,20 @@ TRY_START
 TRY_END
 }
 
+static int global_gfx_light_cluster_assign (lua_State *L)
+{
+TRY_START
+    check_args(L, 2);
+    Vector3 cp = check_v3(L, 1);
+    Quaternion cq = check_quat(L, 2);
+    unsigned entries;
+    unsigned lights = gfx_light_cluster_assign(cp, cq, entries);
+    lua_pushnumber(L, lights);
+    lua_pushnumber(L, entries);
+    return 2;
+TRY_END
+}
+
 static int global_gfx_sunlight_diffuse (lua_State *L)
 {
 TRY_START
@@ -3955,6 +4005,13 @@ static void push_stat (lua_State *L, GfxLastRenderStats &s)
     lua_pushnumber(L, s.micros);
 }
 
+static void push_cull_stat (lua_State *L, GfxLastRenderStats &s)
+{
+    lua_pushnumber(L, s.visible);
+    lua_pushnumber(L, s.culled);
+    lua_pushnumber(L, s.cullMicros);
+}
+
 static int global_gfx_last_frame_stats (lua_State *L)
 {
 TRY_START
@@ -3968,10 +4025,109 @@ TRY_START
     push_stat(L, s.left_deferred);
     push_stat(L, s.right_gbuffer);
     push_stat(L, s.right_deferred);
+    lua_pushnumber(L, s.materialsRebuilt);
+    return 3*7 + 1;
+TRY_END
+}
+
+// The same renders as gfx_last_frame_stats, in the same order.
+static int global_gfx_cull_stats (lua_State *L)
+{
+TRY_START
+    check_args(L,0);
+    GfxLastFrameStats s = gfx_last_frame_stats();
+    lua_checkstack(L,30);
+    push_cull_stat(L, s.shadow[0]);
+    push_cull_stat(L, s.shadow[1]);
+    push_cull_stat(L, s.shadow[2]);
+    push_cull_stat(L, s.left_gbuffer);
+    push_cull_stat(L, s.left_deferred);
+    push_cull_stat(L, s.right_gbuffer);
+    push_cull_stat(L, s.right_deferred);
     return 3*7;
 TRY_END
 }
 
+// Objects hidden behind occluders, for the same renders as gfx_last_frame_stats.
+static int global_gfx_occlusion_stats (lua_State *L)
+{
+TRY_START
+    check_args(L,0);
+    GfxLastFrameStats s = gfx_last_frame_stats();
+    lua_pushnumber(L, s.shadow[0].occluded);
+    lua_pushnumber(L, s.shadow[1].occluded);
+    lua_pushnumber(L, s.shadow[2].occluded);
+    lua_pushnumber(L, s.left_gbuffer.occluded);
+    lua_pushnumber(L, s.left_deferred.occluded);
+    lua_pushnumber(L, s.right_gbuffer.occluded);
+    lua_pushnumber(L, s.right_deferred.occluded);
+    return 7;
+TRY_END
+}
+
+static int global_gfx_hud_render_stats (lua_State *L)
+{
+TRY_START
+    check_args(L,0);
+    GfxLastFrameStats s = gfx_last_frame_stats();
+    lua_pushnumber(L, s.hud.batches);
+    lua_pushnumber(L, s.hud.triangles);
+    lua_pushnumber(L, s.hud.micros);
+    return 3;
+TRY_END
+}
+
+static int global_gfx_instances_upload_stats (lua_State *L)
+{
+TRY_START
+    check_args(L,0);
+    const GfxInstancesUploadStats &s = GfxInstances::getLastFrameUploadStats();
+    lua_pushnumber(L, s.bytes);
+    lua_pushnumber(L, s.writes);
+    lua_pushnumber(L, s.fullUploads);
+    return 3;
+TRY_END
+}
+
+static int global_gfx_bone_update_stats (lua_State *L)
+{
+TRY_START
+    check_args(L,0);
+    const GfxBoneUpdateStats &s = GfxBody::getLastFrameBoneStats();
+    lua_pushnumber(L, s.skeletons);
+    lua_pushnumber(L, s.bones);
+    lua_pushnumber(L, s.poseMicros);
+    lua_pushnumber(L, s.paletteMicros);
+    return 4;
+TRY_END
+}
+
+static int global_gfx_particle_render_stats (lua_State *L)
+{
+TRY_START
+    check_args(L,0);
+    const GfxParticleRenderStats &s = gfx_particle_last_frame_stats();
+    lua_pushnumber(L, s.particles);
+    lua_pushnumber(L, s.sortMicros);
+    lua_pushnumber(L, s.fillMicros);
+    return 3;
+TRY_END
+}
+
+static int global_gfx_draw_state_stats (lua_State *L)
+{
+TRY_START
+    check_args(L,0);
+    const GfxDrawStateStats &s = gfx_scene_manager_last_frame_draw_stats();
+    lua_pushnumber(L, s.draws);
+    lua_pushnumber(L, s.programChanges);
+    lua_pushnumber(L, s.passChanges);
+    lua_pushnumber(L, s.bufferChanges);
+    lua_pushnumber(L, s.sortMicros);
+    return 5;
+TRY_END
+}
+
 static int global_gfx_colour_grade_look_up (lua_State *L)
 {
     check_args(L,1);
@@ -4152,11 +4308,11 @@ static int global_hsv_to_rgb (lua_State *L)
 // {{{ Particles
 
 namespace {
-    struct UVRect { float u1,v1, u2,v2; };
     struct ParticleDefinition;
 
     struct ParticleDefinition {
-        ParticleDefinition (const std::string &m, const std::vector<UVRect> fs, lua_State *L, int t)
+        ParticleDefinition (const std::string &m, const std::vector<GfxParticleFrame> fs,
+                            lua_State *L, int t)
           : material(m), frames(fs)
         {
             table.takeTableFromLuaStack(L, t);
@@ -4164,7 +4320,7 @@ namespace {
         void destroy (lua_State *L);
 
         std::string material;
-        std::vector<UVRect> frames;
+        std::vector<GfxParticleFrame> frames;
         ExternalTable table;
     };
 
@@ -4294,7 +4450,7 @@ namespace {
                     has_frame = true;
                     float frame_ = lua_tonumber(L,-1);
                     unsigned frame = unsigned(frame_);
-                    UVRect &uvr = pd->frames[frame % pd->frames.size()];
+                    GfxParticleFrame &uvr = pd->frames[frame % pd->frames.size()];
                     p->u1 = uvr.u1;
                     p->v1 = uvr.v1;
                     p->u2 = uvr.u2;
@@ -4387,6 +4543,94 @@ namespace {
         }
         particles.clear();
     }
+
+    float particle_field_float (lua_State *L, int t, const char *field, float def)
+    {
+        lua_getfield(L, t, field);
+        float r = def;
+        if (!lua_isnil(L,-1)) {
+            if (!lua_isnumber(L,-1))
+                my_lua_error(L, std::string("Particle ") + field + " must be a number.");
+            r = lua_tonumber(L,-1);
+        }
+        lua_pop(L,1);
+        return r;
+    }
+
+    Vector3 particle_field_v3 (lua_State *L, int t, const char *field, const Vector3 &def)
+    {
+        lua_getfield(L, t, field);
+        Vector3 r = def;
+        if (!lua_isnil(L,-1)) {
+            if (!lua_isvector3(L,-1))
+                my_lua_error(L, std::string("Particle ") + field + " must be a vector3.");
+            r = check_v3(L,-1);
+        }
+        lua_pop(L,1);
+        return r;
+    }
+
+    // A number, or an array of them spread evenly over the particle's life.
+    void particle_field_curve (lua_State *L, int t, const char *field, GfxParticleCurve<float> &c)
+    {
+        lua_getfield(L, t, field);
+        if (lua_isnumber(L,-1)) {
+            c = GfxParticleCurve<float>(lua_tonumber(L,-1));
+        } else if (lua_istable(L,-1) && lua_objlen(L,-1) > 0) {
+            c.keys.resize(lua_objlen(L,-1));
+            for (unsigned i=0 ; i<c.keys.size() ; ++i) {
+                lua_rawgeti(L, -1, i+1);
+                if (!lua_isnumber(L,-1))
+                    my_lua_error(L, std::string("Particle ") + field + " must contain numbers.");
+                c.keys[i] = lua_tonumber(L,-1);
+                lua_pop(L,1);
+            }
+        } else if (!lua_isnil(L,-1)) {
+            my_lua_error(L, std::string("Particle ") + field
+                            + " must be a number or a non-empty array of numbers.");
+        }
+        lua_pop(L,1);
+    }
+
+    // A vector3, or an array of them spread evenly over the particle's life.
+    void particle_field_curve (lua_State *L, int t, const char *field, GfxParticleCurve<Vector3> &c)
+    {
+        lua_getfield(L, t, field);
+        if (lua_isvector3(L,-1)) {
+            c = GfxParticleCurve<Vector3>(check_v3(L,-1));
+        } else if (lua_istable(L,-1) && lua_objlen(L,-1) > 0) {
+            c.keys.resize(lua_objlen(L,-1));
+            for (unsigned i=0 ; i<c.keys.size() ; ++i) {
+                lua_rawgeti(L, -1, i+1);
+                if (!lua_isvector3(L,-1))
+                    my_lua_error(L, std::string("Particle ") + field + " must contain vector3s.");
+                c.keys[i] = check_v3(L,-1);
+                lua_pop(L,1);
+            }
+        } else if (!lua_isnil(L,-1)) {
+            my_lua_error(L, std::string("Particle ") + field
+                            + " must be a vector3 or a non-empty array of vector3s.");
+        }
+        lua_pop(L,1);
+    }
+
+    void particle_behaviour_from_table (lua_State *L, int t, GfxParticleBehaviour &b)
+    {
+        b.life = particle_field_float(L, t, "life", b.life);
+        if (b.life <= 0) my_lua_error(L, "Particle life must be greater than 0.");
+        b.velocity = particle_field_v3(L, t, "velocity", b.velocity);
+        b.gravity = particle_field_v3(L, t, "gravity", b.gravity);
+        b.wind = particle_field_v3(L, t, "wind", b.wind);
+        b.drag = particle_field_float(L, t, "drag", b.drag);
+        if (b.drag < 0) my_lua_error(L, "Particle drag must not be negative.");
+        b.dimensions = particle_field_v3(L, t, "dimensions", b.dimensions);
+        particle_field_curve(L, t, "size", b.size);
+        particle_field_curve(L, t, "alpha", b.alpha);
+        particle_field_curve(L, t, "diffuse", b.diffuse);
+        particle_field_curve(L, t, "emissive", b.emissive);
+        b.frameRate = particle_field_float(L, t, "frameRate", b.frameRate);
+        if (b.frameRate < 0) my_lua_error(L, "Particle frameRate must not be negative.");
+    }
 }
 
 static int global_gfx_particle_define (lua_State *L)
@@ -4405,7 +4649,7 @@ TRY_START
     lua_setfield(L, 2, "map");
 
     lua_getfield(L, 2, "frames");
-    std::vector<UVRect> frames;
+    std::vector<GfxParticleFrame> frames;
     if (lua_isnil(L,-1)) {
     } else if (!lua_istable(L,-1)) {
         my_lua_error(L,"Particle frames must be an array.");
@@ -4414,7 +4658,7 @@ TRY_START
         if (nums%4 != 0) my_lua_error(L,"Number of texcoords should be a multiple of 4.");
         frames.resize(nums/4);
         for (unsigned i=0 ; i<nums/4 ; ++i) {
-            UVRect &uvrect = frames[i];
+            GfxParticleFrame &uvrect = frames[i];
 
             lua_rawgeti(L,-1,4*i+1);
             if (!lua_isnumber(L,-1)) my_lua_error(L, "Texcoord must be a number");
@@ -4446,12 +4690,26 @@ TRY_START
     lua_setfield(L, 2, "frames");
 
     lua_getfield(L, 2, "behaviour");
-    if (!lua_isfunction(L,-1)) my_lua_error(L,"Particle behaviour must be a function.");
+    bool native = lua_isnil(L,-1);
+    if (!native && !lua_isfunction(L,-1))
+        my_lua_error(L,"Particle behaviour must be a function, or nil for native behaviour.");
+    lua_pop(L,1);
 
     ParticleDefinition *&pd = particle_defs[name];
     if (pd != NULL) {
         pd->destroy(L);
         delete pd;
+        pd = NULL;
+    }
+
+    if (native) {
+        // Simulated natively, the rest of the table gives its parameters.
+        GfxParticleBehaviour behaviour;
+        behaviour.frames = frames;
+        particle_behaviour_from_table(L, 2, behaviour);
+        particle_defs.erase(name);
+        gfx_particle_define(name, dr, behaviour);
+        return 0;
     }
 
     ParticleDefinition *newpd = new ParticleDefinition(name, frames, L, 2);
@@ -4482,6 +4740,7 @@ static int global_gfx_particle_reset (lua_State *L)
 TRY_START
     check_args(L, 0);
     reset_particles(L);
+    gfx_particle_native_reset();
     return 0;
 TRY_END
 }
@@ -4495,11 +4754,20 @@ TRY_START
     Vector3 pos = check_v3(L,2);
     if (!lua_istable(L,3)) my_lua_error(L,"Parameter 3 must be a table.");
 
-    ParticleDefinition *pd = particle_defs[name];
-
-    if (pd==NULL) {
-        my_lua_error(L, "No such particle \""+name+"\"");
+    auto it = particle_defs.find(name);
+
+    if (it == particle_defs.end()) {
+        const GfxParticleBehaviour *behaviour = gfx_particle_behaviour(name);
+        if (behaviour == nullptr) my_lua_error(L, "No such particle \""+name+"\"");
+        // Natively simulated, the table can only override these.
+        Vector3 velocity = particle_field_v3(L, 3, "velocity", behaviour->velocity);
+        float life = particle_field_float(L, 3, "life", behaviour->life);
+        if (life <= 0) my_lua_error(L, "Particle life must be greater than 0.");
+        float angle = particle_field_float(L, 3, "angle", 0);
+        gfx_particle_emit(name, pos, velocity, life, angle);
+        return 0;
     }
+    ParticleDefinition *pd = it->second;
 
     pd->table.dump(L);
     // stack: particle
@@ -4583,6 +4851,7 @@ TRY_START
 
     while (elapsed > particle_step_size) {
         elapsed -= particle_step_size;
+        gfx_particle_step(particle_step_size);
         for (size_t i=0 ; i<particles.size() ; ++i) {
             LuaParticle *lp = particles[i];
             bool destroy = lp->updateGraphics(L, particle_step_size, error_handler);
@@ -4610,7 +4879,7 @@ TRY_END
 static int global_gfx_particle_count (lua_State *L)
 {
     check_args(L,0);
-        lua_pushnumber(L, particles.size());
+        lua_pushnumber(L, particles.size() + gfx_particle_native_count());
         return 1;
 }
 
@@ -5104,6 +5373,101 @@ TRY_START
 TRY_END
 }
 
+static int global_gfx_shader_cache_enabled (lua_State *L)
+{
+TRY_START
+    if (lua_gettop(L) == 1) {
+        gfx_shader_cache_enabled(check_bool(L, 1));
+        return 0;
+    }
+    check_args(L, 0);
+    lua_pushboolean(L, gfx_shader_cache_enabled());
+    return 1;
+TRY_END
+}
+
+static int global_gfx_shader_cache_stats (lua_State *L)
+{
+TRY_START
+    check_args(L, 0);
+    const GfxShaderCacheStats &stats = gfx_shader_cache_stats();
+    lua_createtable(L, 0, 6);
+    push_string(L, gfx_shader_cache_file());
+    lua_setfield(L, -2, "file");
+    lua_pushnumber(L, gfx_shader_cache_size());
+    lua_setfield(L, -2, "entries");
+    lua_pushnumber(L, stats.hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushnumber(L, stats.misses);
+    lua_setfield(L, -2, "misses");
+    lua_pushnumber(L, stats.writeFailures);
+    lua_setfield(L, -2, "writeFailures");
+    lua_pushnumber(L, stats.compileSeconds);
+    lua_setfield(L, -2, "compileSeconds");
+    return 1;
+TRY_END
+}
+
+static int global_gfx_shader_cache_reset_stats (lua_State *L)
+{
+TRY_START
+    check_args(L, 0);
+    gfx_shader_cache_reset_stats();
+    return 0;
+TRY_END
+}
+
+// Compile (through the cache) every permutation of the given materials, without creating native
+// programs.  Returns the number of permutations.
+static int global_gfx_shader_cache_prewarm (lua_State *L)
+{
+TRY_START
+    check_args(L, 1);
+    if (!lua_istable(L, 1))
+        my_lua_error(L, "Expected a list of material names.");
+    GFX_MAT_SYNC;
+    unsigned counter = 0;
+    for (lua_pushnil(L) ; lua_next(L, 1) != 0 ; lua_pop(L, 1)) {
+        GfxMaterial *mat = gfx_material_get(check_path(L, -1));
+        std::vector<GfxShaderPermutation> perms;
+        mat->getPermutations(perms);
+        for (const auto &perm : perms)
+            mat->getShader()->compile(perm.purpose, perm.matEnv, perm.meshEnv);
+        counter += perms.size();
+    }
+    lua_pushnumber(L, counter);
+    return 1;
+TRY_END
+}
+
+static int global_gfx_material_precompile (lua_State *L)
+{
+TRY_START
+    // Defaults to one thread per hardware thread.
+    unsigned threads = 0;
+    if (lua_gettop(L) == 1) {
+        threads = check_t<unsigned>(L, 1);
+    } else {
+        check_args(L, 0);
+    }
+    GfxShaderPrecompileStats stats = gfx_material_precompile(threads);
+    lua_createtable(L, 0, 6);
+    lua_pushnumber(L, stats.permutations);
+    lua_setfield(L, -2, "permutations");
+    lua_pushnumber(L, stats.cached);
+    lua_setfield(L, -2, "cached");
+    lua_pushnumber(L, stats.compiled);
+    lua_setfield(L, -2, "compiled");
+    lua_pushnumber(L, stats.failed);
+    lua_setfield(L, -2, "failed");
+    lua_pushnumber(L, stats.threads);
+    lua_setfield(L, -2, "threads");
+    lua_pushnumber(L, stats.seconds);
+    lua_setfield(L, -2, "seconds");
+    return 1;
+TRY_END
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 static int global_resource_exists (lua_State *L)
@@ -5206,6 +5570,7 @@ static const luaL_reg global[] = {
     {"gfx_ranged_instances_make", global_gfx_ranged_instances_make},
     {"gfx_sky_body_make", global_gfx_sky_body_make},
     {"gfx_light_make", global_gfx_light_make},
+    {"gfx_light_cluster_assign", global_gfx_light_cluster_assign},
     {"gfx_sprite_body_make", global_gfx_sprite_body_make},
     {"gfx_decal_make", global_gfx_decal_make},
     {"gfx_tracer_body_make", global_gfx_tracer_body_make},
@@ -5221,6 +5586,11 @@ static const luaL_reg global[] = {
     {"gfx_register_sky_material", global_gfx_register_sky_material},
     {"gfx_register_material", global_gfx_register_material},
     {"gfx_register_shader", global_gfx_register_shader},
+    {"gfx_shader_cache_enabled", global_gfx_shader_cache_enabled},
+    {"gfx_shader_cache_prewarm", global_gfx_shader_cache_prewarm},
+    {"gfx_shader_cache_reset_stats", global_gfx_shader_cache_reset_stats},
+    {"gfx_shader_cache_stats", global_gfx_shader_cache_stats},
+    {"gfx_material_precompile", global_gfx_material_precompile},
 
     {"gfx_font_define", global_gfx_font_define},
     {"gfx_font_line_height", global_gfx_font_line_height},
@@ -5291,6 +5661,13 @@ static const luaL_reg global[] = {
     {"gfx_particle_reset", global_gfx_particle_reset},
 
     {"gfx_last_frame_stats", global_gfx_last_frame_stats},
+    {"gfx_hud_render_stats", global_gfx_hud_render_stats},
+    {"gfx_cull_stats", global_gfx_cull_stats},
+    {"gfx_occlusion_stats", global_gfx_occlusion_stats},
+    {"gfx_instances_upload_stats", global_gfx_instances_upload_stats},
+    {"gfx_bone_update_stats", global_gfx_bone_update_stats},
+    {"gfx_particle_render_stats", global_gfx_particle_render_stats},
+    {"gfx_draw_state_stats", global_gfx_draw_state_stats},
 
     {"gfx_colour_grade_look_up", global_gfx_colour_grade_look_up},
 
@@ -8,6 +8,8 @@ GSL_CPP_SRCS= \
 	gfx/gfx_gasoline_backend_gsl.cpp \
 	gfx/gfx_gasoline_backend_cg.cpp \
 	gfx/gfx_gasoline_backend_glsl.cpp \
+	gfx/gfx_gasoline_optimiser.cpp \
+	gfx/gfx_gasoline_parallel.cpp \
 
 
 GSL_STANDALONE_CPP_SRCS= \
@@ -39,12 +41,15 @@ ENGINE_CPP_SRCS=\
 	grit_object.cpp \
 	input_filter.cpp \
 	ldbglue.cpp \
+	lua_chunk_cache.cpp \
+	lua_profiler.cpp \
 	lua_wrappers_core.cpp \
 	lua_wrappers_disk_resource.cpp \
 	lua_wrappers_gritobj.cpp \
 	lua_wrappers_primitives.cpp \
 	main.cpp \
 	path_util.cpp \
+	range_space_kernel.cpp \
 	streamer.cpp \
 	 \
 	audio/audio.cpp \
@@ -54,6 +59,7 @@ ENGINE_CPP_SRCS=\
 	 \
 	gfx/gfx_body.cpp \
 	gfx/gfx.cpp \
+	gfx/gfx_cull.cpp \
 	gfx/gfx_debug.cpp \
 	gfx/gfx_decal.cpp \
 	gfx/gfx_disk_resource.cpp \
@@ -62,13 +68,21 @@ ENGINE_CPP_SRCS=\
 	gfx/gfx_gl3_plus.cpp \
 	gfx/gfx_instances.cpp \
 	gfx/gfx_light.cpp \
+	gfx/gfx_light_cluster.cpp \
 	gfx/gfx_material.cpp \
 	gfx/gfx_node.cpp \
+	gfx/gfx_occlusion.cpp \
 	gfx/gfx_option.cpp \
+	gfx/gfx_parallel.cpp \
+	gfx/gfx_particle_behaviour.cpp \
+	gfx/gfx_particle_sort.cpp \
 	gfx/gfx_particle_system.cpp \
 	gfx/gfx_pipeline.cpp \
 	gfx/gfx_ranged_instances.cpp \
+	gfx/gfx_scene_manager.cpp \
 	gfx/gfx_shader.cpp \
+	gfx/gfx_shader_cache.cpp \
+	gfx/gfx_sort_keys.cpp \
 	gfx/gfx_sky_body.cpp \
 	gfx/gfx_sky_material.cpp \
 	gfx/gfx_sprite_body.cpp \
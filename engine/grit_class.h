@@ -85,6 +85,19 @@ class GritClass {
     /** Look up the given key, pushing the value on the stack, or nil if it
      * is unbound. */
     void get (lua_State *L, const std::string &key)
+    {
+        get(L, ExternalTable::Key::find(key), key);
+    }
+
+    /** As get, but with a key that has already been interned. */
+    void get (lua_State *L, const ExternalTable::Key &key)
+    {
+        get(L, key, key.str());
+    }
+
+    /** As get, but with the key already found.  The parent is a Lua table, so it is searched
+     * by name, which is needed as the key may never have been interned. */
+    void get (lua_State *L, const ExternalTable::Key &key, const std::string &name)
     {
         const char *err = table.luaGet(L, key);
         if (err) my_lua_error(L, err);
@@ -92,7 +105,7 @@ class GritClass {
         if (lua_isnil(L, -1)) {
             lua_pop(L, 1);
             pushParent(L);
-            lua_getfield(L, -1, key.c_str());
+            lua_getfield(L, -1, name.c_str());
             lua_replace(L, -2); // pop the parent
         }
     }
@@ -26,6 +26,7 @@
 #include "grit_class.h"
 
 #include "grit_lua_util.h"
+#include "lua_profiler.h"
 #include "lua_wrappers_gritobj.h"
 
 
@@ -35,6 +36,14 @@ static GObjSet objs_needing_step_callbacks;
 static GObjPtrs loaded;
 static unsigned long long name_generation_counter;
 
+// Callbacks looked up on every object, interned once.
+static const ExternalTable::Key key_set_fade("setFade");
+static const ExternalTable::Key key_activate("activate");
+static const ExternalTable::Key key_deactivate("deactivate");
+static const ExternalTable::Key key_init("init");
+static const ExternalTable::Key key_frame_callback("frameCallback");
+static const ExternalTable::Key key_step_callback("stepCallback");
+
 GritObject::GritObject (const std::string &name_,
                         GritClass *gritClass_)
   : name(name_), 
@@ -89,7 +98,7 @@ void GritObject::notifyFade (lua_State *L,
 
     // call into lua...
     //stack: err
-    getField(L, "setFade");
+    getField(L, key_set_fade);
     //stack: err, class, callback
     if (lua_isnil(L, -1)) {
         // TODO(dcunnin): We should add needsFadeCallbacks.
@@ -108,6 +117,7 @@ void GritObject::notifyFade (lua_State *L,
     push_gritobj(L, self); // persistent grit obj
     lua_pushnumber(L, fade); // fade
     //stack: err, callback, persistent, fade
+    LuaProfilerScope profiler_scope("setFade", gritClass->name);
     int status = lua_pcall(L, 2, 0, error_handler);
     if (status) {
         //stack: err, msg
@@ -161,7 +171,7 @@ void GritObject::activate (lua_State *L,
     //stack: err
 
     //stack: err
-    getField(L, "activate");
+    getField(L, key_activate);
     //stack: err, callback
     if (lua_isnil(L, -1)) {
         // don't activate it as class does not have activate function
@@ -195,6 +205,7 @@ void GritObject::activate (lua_State *L,
     STACK_CHECK_N(4);
 
     // call (2 args), pops function too
+    LuaProfilerScope profiler_scope("activate", gritClass->name);
     int status = lua_pcall(L, 2, 0, error_handler);
     if (status) {
         STACK_CHECK_N(2);
@@ -283,7 +294,7 @@ bool GritObject::deactivate (lua_State *L, const GritObjectPtr &self)
     //stack: err
 
     //stack: err
-    getField(L, "deactivate");
+    getField(L, key_deactivate);
     //stack: err, callback
     if (lua_isnil(L, -1)) {
         lua_pop(L, 2);
@@ -305,6 +316,7 @@ bool GritObject::deactivate (lua_State *L, const GritObjectPtr &self)
 
     push_gritobj(L, self); // persistent grit obj
     //stack: err, callback, self
+    LuaProfilerScope profiler_scope("deactivate", gritClass->name);
     int status = lua_pcall(L, 1, 1, error_handler);
     if (status) {
         //stack: err, msg
@@ -345,7 +357,7 @@ void GritObject::init (lua_State *L, const GritObjectPtr &self)
     //stack: err
 
     //stack: err
-    getField(L, "init");
+    getField(L, key_init);
     //stack: err, callback
     if (lua_isnil(L, -1)) {
         lua_pop(L, 2);
@@ -363,6 +375,7 @@ void GritObject::init (lua_State *L, const GritObjectPtr &self)
     lua_checkstack(L, 2);
     push_gritobj(L, self); // persistent grit obj
     //stack: err, callback, persistent
+    LuaProfilerScope profiler_scope("init", gritClass->name);
     int status = lua_pcall(L, 1, 0, error_handler);
     if (status) {
         //stack: err, msg
@@ -394,7 +407,7 @@ bool GritObject::frameCallback (lua_State *L, const GritObjectPtr &self, float e
     int error_handler = lua_gettop(L);
 
     //stack: err
-    getField(L, "frameCallback");
+    getField(L, key_frame_callback);
     //stack: err, callback
     if (lua_isnil(L, -1)) {
         lua_pop(L, 2);
@@ -409,6 +422,7 @@ bool GritObject::frameCallback (lua_State *L, const GritObjectPtr &self, float e
     push_gritobj(L, self); // persistent grit obj
     lua_pushnumber(L, elapsed); // time since last frame
     //stack: err, callback, instance, elapsed
+    LuaProfilerScope profiler_scope("frameCallback", gritClass->name);
     int status = lua_pcall(L, 2, 0, error_handler);
     if (status) {
         //stack: err, msg
@@ -438,7 +452,7 @@ bool GritObject::stepCallback (lua_State *L, const GritObjectPtr &self, float el
 
     //stack: err
 
-    getField(L, "stepCallback");
+    getField(L, key_step_callback);
     //stack: err, callback
     if (lua_isnil(L, -1)) {
         lua_pop(L, 2);
@@ -453,6 +467,7 @@ bool GritObject::stepCallback (lua_State *L, const GritObjectPtr &self, float el
     push_gritobj(L, self); // persistent grit obj
     lua_pushnumber(L, elapsed); // time since last frame
     //stack: err, callback, instance, elapsed
+    LuaProfilerScope profiler_scope("stepCallback", gritClass->name);
     int status = lua_pcall(L, 2, 0, error_handler);
     if (status) {
         //stack: err, msg
@@ -515,6 +530,18 @@ void GritObject::setNeedsStepCallbacks (const GritObjectPtr &self, bool v)
 }
 
 void GritObject::getField (lua_State *L, const std::string &f) const
+{
+    // Hash the name once, for both the object and the class.
+    getField(L, ExternalTable::Key::find(f), f);
+}
+
+void GritObject::getField (lua_State *L, const ExternalTable::Key &f) const
+{
+    getField(L, f, f.str());
+}
+
+void GritObject::getField (lua_State *L, const ExternalTable::Key &f,
+                           const std::string &name) const
 {
     if (gritClass==NULL) GRIT_EXCEPT("Object destroyed");
 
@@ -523,7 +550,7 @@ void GritObject::getField (lua_State *L, const std::string &f) const
     if (!lua_isnil(L, -1)) return;
     lua_pop(L, 1);
     // try class instead
-    gritClass->get(L, f);
+    gritClass->get(L, f, name);
 }
 
 
@@ -327,6 +327,9 @@ class GritObject {
     bool anonymous;
 
     void getField (lua_State *L, const std::string &f) const;
+    void getField (lua_State *L, const ExternalTable::Key &f) const;
+    // With the key already found, and its name for the class's Lua parent.
+    void getField (lua_State *L, const ExternalTable::Key &f, const std::string &name) const;
 
     protected:
 
@@ -0,0 +1,275 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#ifdef WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+#include <sleep.h>
+
+#include <centralised_log.h>
+
+#include "lua_chunk_cache.h"
+
+namespace {
+
+    // Bump this whenever the layout of cache files changes.
+    const uint32_t CACHE_VERSION = 1;
+    const char CACHE_MAGIC[4] = { 'G', 'L', 'C', 'C' };
+
+    // The Lua bytecode header records the VM version and number formats, so bytecode from a
+    // different build is rejected by lua_load itself, at which point we recompile.
+    struct CacheHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t sourceHash;
+        uint64_t sourceSize;
+        uint32_t pathSize;
+        uint32_t bytecodeSize;
+    };
+
+    LuaChunkCacheStats stats = { 0, 0, 0, 0.0 };
+
+    std::string init_dir (void)
+    {
+        const char *env = getenv("GRIT_LUA_CACHE");
+        return env == nullptr ? "lua_chunk_cache" : env;
+    }
+
+    const std::string &dir (void)
+    {
+        static const std::string d = init_dir();
+        return d;
+    }
+
+    bool enabled = true;
+    bool dir_created = false;
+
+    // FNV-1a, this only has to detect edits, not resist collisions constructed on purpose.
+    uint64_t hash_bytes (const char *data, size_t sz)
+    {
+        uint64_t h = 14695981039346656037ULL;
+        for (size_t i = 0 ; i < sz ; ++i) {
+            h ^= (unsigned char)data[i];
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    std::string cache_filename (const std::string &path)
+    {
+        char buf[17];
+        snprintf(buf, sizeof buf, "%016llx",
+                 (unsigned long long)hash_bytes(path.data(), path.length()));
+        return dir() + "/" + buf + ".luac";
+    }
+
+    void ensure_dir (void)
+    {
+        if (dir_created) return;
+        #ifdef WIN32
+        _mkdir(dir().c_str());
+        #else
+        mkdir(dir().c_str(), 0777);
+        #endif
+        // If that failed for any reason other than the directory already existing, writing the
+        // cache file will fail too, and be counted.
+        dir_created = true;
+    }
+
+    int dump_writer (lua_State *L, const void *p, size_t sz, void *ud)
+    {
+        (void) L;
+        static_cast<std::string*>(ud)->append(static_cast<const char*>(p), sz);
+        return 0;
+    }
+
+    struct StringReaderState {
+        const char *data;
+        size_t size;
+    };
+
+    const char *string_reader (lua_State *L, void *ud, size_t *size)
+    {
+        (void) L;
+        StringReaderState &s = *static_cast<StringReaderState*>(ud);
+        *size = s.size;
+        s.size = 0;
+        return s.data;
+    }
+
+    int load_buffer (lua_State *L, const char *data, size_t sz, const std::string &chunkname,
+                     const char *mode)
+    {
+        StringReaderState s = { data, sz };
+        return lua_load(L, string_reader, &s, chunkname.c_str(), mode);
+    }
+
+    // Returns the bytecode stored for the given path, if the entry is present and matches the
+    // given source.
+    bool read_entry (const std::string &path, uint64_t source_hash, uint64_t source_size,
+                     std::string &bytecode)
+    {
+        std::ifstream in(cache_filename(path).c_str(), std::ios::binary);
+        if (!in.good()) return false;
+
+        CacheHeader h;
+        in.read(reinterpret_cast<char*>(&h), sizeof h);
+        if (!in.good()) return false;
+        if (memcmp(h.magic, CACHE_MAGIC, sizeof CACHE_MAGIC) != 0) return false;
+        if (h.version != CACHE_VERSION) return false;
+        if (h.sourceHash != source_hash || h.sourceSize != source_size) return false;
+        if (h.pathSize != path.length()) return false;
+
+        // Guards against two paths whose hashes (and so cache filenames) collide.
+        std::string stored_path(h.pathSize, '\0');
+        in.read(&stored_path[0], h.pathSize);
+        if (!in.good() || stored_path != path) return false;
+
+        bytecode.resize(h.bytecodeSize);
+        in.read(&bytecode[0], h.bytecodeSize);
+        return in.good();
+    }
+
+    void write_entry (const std::string &path, uint64_t source_hash, uint64_t source_size,
+                      const std::string &bytecode)
+    {
+        ensure_dir();
+        std::string filename = cache_filename(path);
+        // Write to a temporary file and rename it into place, so a crash or a concurrent
+        // instance of the engine never sees a partially written entry.
+        std::stringstream tmp_ss;
+        tmp_ss << filename << "." << micros() << ".tmp";
+        std::string tmp = tmp_ss.str();
+
+        CacheHeader h;
+        memcpy(h.magic, CACHE_MAGIC, sizeof CACHE_MAGIC);
+        h.version = CACHE_VERSION;
+        h.sourceHash = source_hash;
+        h.sourceSize = source_size;
+        h.pathSize = path.length();
+        h.bytecodeSize = bytecode.length();
+
+        {
+            std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char*>(&h), sizeof h);
+            out.write(path.data(), path.length());
+            out.write(bytecode.data(), bytecode.length());
+            if (!out.good()) {
+                out.close();
+                remove(tmp.c_str());
+                stats.writeFailures++;
+                return;
+            }
+        }
+
+        #ifdef WIN32
+        // rename does not replace an existing file on Windows.
+        remove(filename.c_str());
+        #endif
+        if (rename(tmp.c_str(), filename.c_str()) != 0) {
+            remove(tmp.c_str());
+            stats.writeFailures++;
+        }
+    }
+
+    int load (lua_State *L, const std::string &path, const std::string &source,
+              const std::string &chunkname)
+    {
+        if (!enabled || dir().empty())
+            return load_buffer(L, source.data(), source.length(), chunkname, "bt");
+
+        // Files that are already bytecode gain nothing from the cache.
+        if (!source.empty() && source[0] == LUA_SIGNATURE[0])
+            return load_buffer(L, source.data(), source.length(), chunkname, "b");
+
+        uint64_t source_hash = hash_bytes(source.data(), source.length());
+        uint64_t source_size = source.length();
+
+        std::string bytecode;
+        if (read_entry(path, source_hash, source_size, bytecode)) {
+            if (load_buffer(L, bytecode.data(), bytecode.length(), chunkname, "b") == 0) {
+                stats.hits++;
+                return 0;
+            }
+            // Probably bytecode from a different build of Lua, fall through and replace it.
+            lua_pop(L, 1);
+        }
+
+        stats.misses++;
+        int status = load_buffer(L, source.data(), source.length(), chunkname, "t");
+        // Syntax errors are not cached, they are reported every time until fixed.
+        if (status != 0) return status;
+
+        bytecode.clear();
+        if (lua_dump(L, dump_writer, &bytecode) == 0 && !bytecode.empty())
+            write_entry(path, source_hash, source_size, bytecode);
+        return 0;
+    }
+
+}
+
+int lua_chunk_cache_load (lua_State *L, const std::string &path, const std::string &source,
+                          const std::string &chunkname)
+{
+    unsigned long long before = micros();
+    int status = load(L, path, source, chunkname);
+    stats.loadSeconds += (micros() - before) / 1E6;
+    return status;
+}
+
+void lua_chunk_cache_enabled (bool v)
+{
+    enabled = v;
+}
+
+bool lua_chunk_cache_enabled (void)
+{
+    return enabled && !dir().empty();
+}
+
+const std::string &lua_chunk_cache_dir (void)
+{
+    return dir();
+}
+
+const LuaChunkCacheStats &lua_chunk_cache_stats (void)
+{
+    return stats;
+}
+
+void lua_chunk_cache_reset_stats (void)
+{
+    stats.hits = 0;
+    stats.misses = 0;
+    stats.writeFailures = 0;
+    stats.loadSeconds = 0;
+}
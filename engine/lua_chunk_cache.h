@@ -0,0 +1,77 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef LUA_CHUNK_CACHE_H
+#define LUA_CHUNK_CACHE_H
+
+#include <string>
+
+extern "C" {
+    #include <lua.h>
+}
+
+/** A disk cache of precompiled Lua chunks, used by include() and safe_include().
+ *
+ * Each source file maps to one cache file (named by a hash of its path) holding the bytecode
+ * produced by lua_dump, along with the path, size and a 64 bit hash of the source it was
+ * compiled from.  A cache entry is only used if the source still has the same size and hash, so
+ * editing a file invalidates its entry and the next include recompiles and rewrites it.  The
+ * source still has to be read to compute the hash, but the parser and code generator are
+ * skipped.
+ *
+ * The cache directory defaults to "lua_chunk_cache" in the working directory, and can be
+ * overridden with the GRIT_LUA_CACHE environment variable.  Setting that to the empty string
+ * disables the cache.  Failures to read or write the cache are never fatal, the source is
+ * simply compiled as normal.
+ */
+
+struct LuaChunkCacheStats {
+    /** Includes satisfied from the cache. */
+    unsigned long hits;
+    /** Includes that had to compile the source (no entry, or a stale one). */
+    unsigned long misses;
+    /** Cache files that could not be written. */
+    unsigned long writeFailures;
+    /** Total time spent in lua_load for included files, in seconds. */
+    double loadSeconds;
+};
+
+/** Compile the given source (or load its cached bytecode) and push the resulting function.
+ *
+ * Has the same contract as lua_load: on failure, returns nonzero and pushes an error message.
+ * The chunkname is used for error messages and debug info, as in lua_load.
+ */
+int lua_chunk_cache_load (lua_State *L, const std::string &path, const std::string &source,
+                          const std::string &chunkname);
+
+/** Enable or disable use of the cache (initially enabled unless GRIT_LUA_CACHE is empty). */
+void lua_chunk_cache_enabled (bool v);
+
+bool lua_chunk_cache_enabled (void);
+
+/** The directory holding cache files, or the empty string if there is none. */
+const std::string &lua_chunk_cache_dir (void);
+
+const LuaChunkCacheStats &lua_chunk_cache_stats (void);
+
+void lua_chunk_cache_reset_stats (void);
+
+#endif
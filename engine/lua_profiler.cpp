@@ -0,0 +1,297 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include <sleep.h>
+
+#include <centralised_log.h>
+
+#include "lua_profiler.h"
+
+namespace {
+
+    // Frames deeper than this are truncated (the outermost frames are kept).
+    const unsigned MAX_DEPTH = 64;
+    const unsigned RING_SIZE = 4096;
+    // VM instructions between checks of the clock.
+    const int HOOK_COUNT = 500;
+
+    struct RawSample {
+        unsigned long long micros;
+        unsigned depth;
+        unsigned frames[MAX_DEPTH];
+    };
+
+    // Only the hook writes and only drain() reads, so this needs no lock even if the two
+    // end up on different threads.
+    RawSample ring[RING_SIZE];
+    std::atomic<unsigned> ring_head(0);
+    std::atomic<unsigned> ring_tail(0);
+
+    // Identifies a Lua function by the (Lua interned) source string and line it was defined at.
+    struct FrameKey {
+        const void *source;
+        int line;
+        bool operator== (const FrameKey &o) const { return source == o.source && line == o.line; }
+    };
+    struct FrameKeyHash {
+        size_t operator() (const FrameKey &k) const
+        { return std::hash<const void*>()(k.source) ^ (std::hash<int>()(k.line) << 1); }
+    };
+
+    std::unordered_map<FrameKey, unsigned, FrameKeyHash> frame_ids;
+    std::unordered_map<std::string, unsigned> marker_ids;
+    std::vector<std::string> frame_names;
+    std::vector<unsigned> markers;
+
+    // Aggregated samples, for LUA_PROFILER_FOLDED.
+    std::map<std::vector<unsigned>, unsigned long> folded;
+    // Every sample in order, for LUA_PROFILER_CHROME_TRACE.
+    struct TimedSample {
+        unsigned long long micros;
+        std::vector<unsigned> frames;
+    };
+    std::vector<TimedSample> timeline;
+
+    bool running = false;
+    std::string output_filename;
+    LuaProfilerFormat output_format;
+    unsigned long long period;
+    unsigned long long start_time;
+    unsigned long long last_sample;
+    unsigned long samples;
+    lua_Hook old_hook;
+    int old_mask;
+    int old_count;
+
+    unsigned intern_name (const std::string &name)
+    {
+        frame_names.push_back(name);
+        return frame_names.size() - 1;
+    }
+
+    unsigned frame_id (lua_State *L, lua_Debug &ar)
+    {
+        FrameKey key = { ar.source, ar.linedefined };
+        if (ar.what != nullptr && ar.what[0] == 'C') {
+            // All C functions share a source, tell them apart by address instead.
+            lua_getinfo(L, "f", &ar);
+            key.source = reinterpret_cast<const void*>(lua_tocfunction(L, -1));
+            lua_pop(L, 1);
+        }
+        auto it = frame_ids.find(key);
+        if (it != frame_ids.end()) return it->second;
+        lua_getinfo(L, "n", &ar);
+        std::string name;
+        if (ar.what != nullptr && ar.what[0] == 'C') {
+            name = std::string("[C] ") + (ar.name ? ar.name : "?");
+        } else {
+            name = std::string(ar.short_src) + ":" + std::to_string(ar.linedefined);
+            if (ar.name != nullptr) name = name + " " + ar.name;
+        }
+        unsigned id = intern_name(name);
+        frame_ids[key] = id;
+        return id;
+    }
+
+    void drain (void)
+    {
+        unsigned tail = ring_tail.load(std::memory_order_relaxed);
+        unsigned head = ring_head.load(std::memory_order_acquire);
+        while (tail != head) {
+            const RawSample &s = ring[tail % RING_SIZE];
+            std::vector<unsigned> frames(s.frames, s.frames + s.depth);
+            if (output_format == LUA_PROFILER_FOLDED) {
+                folded[frames]++;
+            } else {
+                TimedSample ts = { s.micros - start_time, frames };
+                timeline.push_back(ts);
+            }
+            tail++;
+        }
+        ring_tail.store(tail, std::memory_order_release);
+    }
+
+    void hook (lua_State *L, lua_Debug *)
+    {
+        unsigned long long now = micros();
+        if (now - last_sample < period) return;
+        last_sample = now;
+
+        unsigned head = ring_head.load(std::memory_order_relaxed);
+        if (head - ring_tail.load(std::memory_order_acquire) >= RING_SIZE) {
+            drain();
+        }
+        RawSample &s = ring[head % RING_SIZE];
+        s.micros = now;
+        s.depth = 0;
+
+        // Outermost first: native markers, then the Lua stack from the bottom up.
+        for (unsigned m : markers) {
+            if (s.depth == MAX_DEPTH) break;
+            s.frames[s.depth++] = m;
+        }
+        lua_Debug ar;
+        int levels = 0;
+        while (lua_getstack(L, levels, &ar)) levels++;
+        for (int level = levels - 1 ; level >= 0 && s.depth < MAX_DEPTH ; --level) {
+            lua_getstack(L, level, &ar);
+            lua_getinfo(L, "S", &ar);
+            s.frames[s.depth++] = frame_id(L, ar);
+        }
+
+        ring_head.store(head + 1, std::memory_order_release);
+        samples++;
+    }
+
+    void write_folded (std::ostream &out)
+    {
+        for (const auto &pair : folded) {
+            const std::vector<unsigned> &frames = pair.first;
+            for (unsigned i = 0 ; i < frames.size() ; ++i) {
+                if (i > 0) out << ";";
+                out << frame_names[frames[i]];
+            }
+            out << " " << pair.second << "\n";
+        }
+    }
+
+    std::string json_escape (const std::string &s)
+    {
+        std::string r;
+        for (char c : s) {
+            if (c == '"' || c == '\\') r += '\\';
+            if (static_cast<unsigned char>(c) < 0x20) continue;
+            r += c;
+        }
+        return r;
+    }
+
+    // Each frame becomes a slice spanning the consecutive samples it appears in, found by
+    // diffing each stack against the one before.
+    void write_chrome_trace (std::ostream &out)
+    {
+        out << "{\"traceEvents\":[\n";
+        bool first = true;
+        auto event = [&] (const char *ph, unsigned frame, unsigned long long ts) {
+            if (!first) out << ",\n";
+            first = false;
+            out << "{\"name\":\"" << json_escape(frame_names[frame]) << "\",\"ph\":\"" << ph
+                << "\",\"ts\":" << ts << ",\"pid\":1,\"tid\":1}";
+        };
+        std::vector<unsigned> open;
+        for (const TimedSample &s : timeline) {
+            unsigned common = 0;
+            while (common < open.size() && common < s.frames.size()
+                   && open[common] == s.frames[common])
+                common++;
+            for (unsigned i = open.size() ; i > common ; --i) event("E", open[i - 1], s.micros);
+            open.resize(common);
+            for (unsigned i = common ; i < s.frames.size() ; ++i) {
+                event("B", s.frames[i], s.micros);
+                open.push_back(s.frames[i]);
+            }
+        }
+        unsigned long long end = timeline.empty() ? 0 : timeline.back().micros + period;
+        for (unsigned i = open.size() ; i > 0 ; --i) event("E", open[i - 1], end);
+        out << "\n]}\n";
+    }
+
+}
+
+void lua_profiler_start (lua_State *L, const std::string &filename, LuaProfilerFormat format,
+                         unsigned long period_us)
+{
+    if (running) EXCEPT << "Lua profiler already running." << ENDL;
+
+    output_filename = filename;
+    output_format = format;
+    period = period_us;
+    start_time = micros();
+    last_sample = start_time;
+    samples = 0;
+    ring_head.store(0);
+    ring_tail.store(0);
+
+    old_hook = lua_gethook(L);
+    old_mask = lua_gethookmask(L);
+    old_count = lua_gethookcount(L);
+    lua_sethook(L, hook, LUA_MASKCOUNT, HOOK_COUNT);
+    running = true;
+}
+
+unsigned long lua_profiler_stop (lua_State *L)
+{
+    if (!running) EXCEPT << "Lua profiler not running." << ENDL;
+    lua_sethook(L, old_hook, old_mask, old_count);
+    running = false;
+
+    drain();
+
+    std::ofstream out(output_filename.c_str());
+    if (!out.good()) {
+        CERR << "Could not open profile output: \"" << output_filename << "\"" << std::endl;
+    } else if (output_format == LUA_PROFILER_FOLDED) {
+        write_folded(out);
+    } else {
+        write_chrome_trace(out);
+    }
+
+    unsigned long r = samples;
+    folded.clear();
+    timeline.clear();
+    frame_ids.clear();
+    marker_ids.clear();
+    frame_names.clear();
+    markers.clear();
+    return r;
+}
+
+bool lua_profiler_running (void)
+{
+    return running;
+}
+
+void lua_profiler_push_marker (const char *what, const std::string &detail)
+{
+    std::string name = std::string("[native] ") + what;
+    if (!detail.empty()) name += " " + detail;
+    auto it = marker_ids.find(name);
+    unsigned id;
+    if (it == marker_ids.end()) {
+        id = intern_name(name);
+        marker_ids[name] = id;
+    } else {
+        id = it->second;
+    }
+    markers.push_back(id);
+}
+
+void lua_profiler_pop_marker (void)
+{
+    // The profiler may have been stopped (and the markers cleared) inside the scope.
+    if (!markers.empty()) markers.pop_back();
+}
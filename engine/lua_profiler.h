@@ -0,0 +1,90 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef LUA_PROFILER_H
+#define LUA_PROFILER_H
+
+#include <string>
+
+extern "C" {
+    #include <lua.h>
+}
+
+/** A sampling profiler for Lua code.
+ *
+ * A count hook fires every few hundred VM instructions and, once the sampling period has
+ * elapsed, records the current Lua stack.  Engine entry points into Lua (object and HUD
+ * callbacks, etc.) push native markers with LuaProfilerScope, so samples show which callback
+ * the Lua code was running under.
+ *
+ * Samples go through a fixed size single-producer single-consumer ring and are aggregated when
+ * it fills up, and when the profiler is stopped, at which point the output file is written.
+ */
+
+enum LuaProfilerFormat {
+    /** One line per unique stack, frames separated by ';', then the sample count.  The input
+     * format of flamegraph.pl and speedscope. */
+    LUA_PROFILER_FOLDED,
+    /** Chrome trace event JSON (chrome://tracing, Perfetto), one slice per run of samples. */
+    LUA_PROFILER_CHROME_TRACE
+};
+
+/** Start sampling the given Lua state (and threads subsequently created from it).
+ *
+ * The period is in microseconds.  An exception is thrown if the profiler is already running.
+ */
+void lua_profiler_start (lua_State *L, const std::string &filename, LuaProfilerFormat format,
+                         unsigned long period_us);
+
+/** Stop sampling and write the output file.  Returns the number of samples taken. */
+unsigned long lua_profiler_stop (lua_State *L);
+
+/** Whether lua_profiler_start has been called without a corresponding stop. */
+bool lua_profiler_running (void);
+
+void lua_profiler_push_marker (const char *what, const std::string &detail);
+
+void lua_profiler_pop_marker (void);
+
+/** Mark a call from the engine into Lua, for as long as the scope lives.
+ *
+ * Costs a single branch when the profiler is not running.
+ */
+class LuaProfilerScope {
+    bool active;
+    public:
+    LuaProfilerScope (const char *what, const std::string &detail)
+      : active(lua_profiler_running())
+    {
+        if (active) lua_profiler_push_marker(what, detail);
+    }
+    explicit LuaProfilerScope (const char *what)
+      : active(lua_profiler_running())
+    {
+        if (active) lua_profiler_push_marker(what, std::string());
+    }
+    ~LuaProfilerScope (void)
+    {
+        if (active) lua_profiler_pop_marker();
+    }
+};
+
+#endif
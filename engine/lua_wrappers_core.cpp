@@ -19,6 +19,7 @@
  * THE SOFTWARE.
  */
 
+#include <cmath>
 #include <limits.h>
 
 #ifdef USE_GOOGLE_PERF_TOOLS
@@ -48,6 +49,8 @@
 #include "keyboard.h"
 #include "lua_wrappers_disk_resource.h"
 #include "lua_wrappers_gritobj.h"
+#include "lua_chunk_cache.h"
+#include "lua_profiler.h"
 #include "lua_wrappers_primitives.h"
 #include "main.h"
 #include "mouse.h"
@@ -55,6 +58,7 @@
 #include "net/lua_wrappers_net.h"
 #include "path_util.h"
 #include "physics/lua_wrappers_physics.h"
+#include "timer_wheel.h"
 
 #define IFILTER_TAG "Grit/InputFilter"
 
@@ -825,6 +829,48 @@ TRY_START
 TRY_END
 }
 
+static int global_lua_profiler_start (lua_State *L)
+{
+TRY_START
+    if (lua_gettop(L) == 1) lua_pushstring(L, "folded");
+    if (lua_gettop(L) == 2) lua_pushnumber(L, 1000);
+    check_args(L, 3);
+    std::string filename = check_string(L, 1);
+    std::string format_name = check_string(L, 2);
+    lua_Number period = luaL_checknumber(L, 3);
+    LuaProfilerFormat format = LUA_PROFILER_FOLDED;
+    if (format_name == "folded") {
+        format = LUA_PROFILER_FOLDED;
+    } else if (format_name == "chrome") {
+        format = LUA_PROFILER_CHROME_TRACE;
+    } else {
+        my_lua_error(L, "Unrecognised profile format: \"" + format_name + "\" "
+                        "(expected \"folded\" or \"chrome\")");
+    }
+    if (period < 1) my_lua_error(L, "Sampling period must be at least 1 microsecond.");
+    lua_profiler_start(L, filename, format, (unsigned long)period);
+    return 0;
+TRY_END
+}
+
+static int global_lua_profiler_stop (lua_State *L)
+{
+TRY_START
+    check_args(L, 0);
+    lua_pushnumber(L, lua_profiler_stop(L));
+    return 1;
+TRY_END
+}
+
+static int global_lua_profiler_running (lua_State *L)
+{
+TRY_START
+    check_args(L, 0);
+    lua_pushboolean(L, lua_profiler_running());
+    return 1;
+TRY_END
+}
+
 
 static int global_mlockall (lua_State *L)
 {
@@ -856,20 +902,6 @@ TRY_END
 }
 
 
-struct LuaIncludeState {
-    Ogre::DataStreamPtr ds;
-    char buf[16384];
-};
-
-static const char *aux_aux_include (lua_State *L, void *ud, size_t *size)
-{
-    (void) L;
-    LuaIncludeState &lis = *static_cast<LuaIncludeState*>(ud);
-    *size = lis.ds->read(lis.buf, sizeof(lis.buf));
-    return lis.buf;
-}
-
-
 static int aux_include (lua_State *L, const std::string &filename)
 {
     std::string fname(filename, 1); // strip leading /
@@ -877,13 +909,56 @@ static int aux_include (lua_State *L, const std::string &filename)
         lua_pushfstring(L, "File not found: \"%s\"", filename.c_str());
         return LUA_ERRFILE;
     }
-    LuaIncludeState lis;
-    lis.ds = Ogre::ResourceGroupManager::getSingleton().openResource(fname, "GRIT");
-    // Last argument means it will accept either binary or text files.
-    return lua_load(L, aux_aux_include, &lis, ("@" + filename).c_str(), "bt");
+    Ogre::DataStreamPtr ds
+        = Ogre::ResourceGroupManager::getSingleton().openResource(fname, "GRIT");
+    // The whole file is needed anyway, to check it against the cached bytecode.
+    // Accepts either binary or text files.
+    return lua_chunk_cache_load(L, filename, ds->getAsString(), "@" + filename);
 }
 
 
+static int global_lua_chunk_cache_enabled (lua_State *L)
+{
+TRY_START
+    if (lua_gettop(L) == 1) {
+        lua_chunk_cache_enabled(check_bool(L, 1));
+        return 0;
+    }
+    check_args(L, 0);
+    lua_pushboolean(L, lua_chunk_cache_enabled());
+    return 1;
+TRY_END
+}
+
+static int global_lua_chunk_cache_stats (lua_State *L)
+{
+TRY_START
+    check_args(L, 0);
+    const LuaChunkCacheStats &stats = lua_chunk_cache_stats();
+    lua_createtable(L, 0, 5);
+    push_string(L, lua_chunk_cache_dir());
+    lua_setfield(L, -2, "dir");
+    lua_pushnumber(L, stats.hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushnumber(L, stats.misses);
+    lua_setfield(L, -2, "misses");
+    lua_pushnumber(L, stats.writeFailures);
+    lua_setfield(L, -2, "writeFailures");
+    lua_pushnumber(L, stats.loadSeconds);
+    lua_setfield(L, -2, "loadSeconds");
+    return 1;
+TRY_END
+}
+
+static int global_lua_chunk_cache_reset_stats (lua_State *L)
+{
+TRY_START
+    check_args(L, 0);
+    lua_chunk_cache_reset_stats();
+    return 0;
+TRY_END
+}
+
 static int global_import_str (lua_State *L)
 {
 TRY_START
@@ -1023,14 +1098,30 @@ TRY_END
 
 
 static lua_Number game_time = 0;
-typedef std::map<lua_Number, std::vector<LuaPtr*> > EventMap;
-static EventMap event_map;
 
-static void add_event (lua_State *L, lua_Number countdown)
+// Events are kept at millisecond granularity, rounding up so they never fire early.  The payload
+// is a registry reference to the event function, reused when the event reschedules itself.
+static const lua_Number EVENT_TICKS_PER_SECOND = 1000;
+typedef TimerWheel<int> EventWheel;
+static EventWheel event_wheel;
+
+static uint64_t event_tick_ceil (lua_Number t)
+{
+    if (t <= 0) return 0;
+    return uint64_t(std::ceil(t * EVENT_TICKS_PER_SECOND));
+}
+
+static uint64_t event_tick_floor (lua_Number t)
+{
+    if (t <= 0) return 0;
+    return uint64_t(std::floor(t * EVENT_TICKS_PER_SECOND));
+}
+
+// Schedule the function at the top of the stack, popping it.
+static EventWheel::Handle add_event (lua_State *L, lua_Number countdown)
 {
-    LuaPtr *lp = new LuaPtr();
-    lp->setNoPop(L);
-    event_map[countdown + game_time].push_back(lp);
+    int ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    return event_wheel.add(event_tick_ceil(countdown + game_time), ref);
 }
 
 static int global_future_event (lua_State *L)
@@ -1039,22 +1130,81 @@ TRY_START
     check_args(L, 2);
     lua_Number countdown = luaL_checknumber(L, 1);
     if (!lua_isfunction(L, 2)) my_lua_error(L, "Argument 2 must be a function.");
-    add_event(L, countdown);
-    return 0;
+    EventWheel::Handle h = add_event(L, countdown);
+    lua_pushnumber(L, lua_Number(h));
+    return 1;
 TRY_END
 }
 
+static int global_cancel_event (lua_State *L)
+{
+TRY_START
+    check_args(L, 1);
+    lua_Number h = luaL_checknumber(L, 1);
+    int ref;
+    bool cancelled = h > 0 && event_wheel.cancel(EventWheel::Handle(h), ref);
+    if (cancelled) luaL_unref(L, LUA_REGISTRYINDEX, ref);
+    lua_pushboolean(L, cancelled);
+    return 1;
+TRY_END
+}
+
+namespace {
+    struct EventUnref {
+        lua_State *L;
+        void operator() (int ref) { luaL_unref(L, LUA_REGISTRYINDEX, ref); }
+    };
+
+    struct EventDump {
+        lua_State *L;
+        int counter;
+        void operator() (uint64_t tick, int ref)
+        {
+            lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+            lua_rawseti(L, -2, counter++);
+            lua_pushnumber(L, tick / EVENT_TICKS_PER_SECOND);
+            lua_rawseti(L, -2, counter++);
+        }
+    };
+
+    struct EventFire {
+        lua_State *L;
+        int errorHandler;
+        bool operator() (int ref, uint64_t &again)
+        {
+            // stack: eh
+            lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+            // stack: eh, func
+            int status = lua_pcall(L, 0, 1, errorHandler);
+            bool reschedule = false;
+            if (status) {
+                lua_pop(L, 1); // error msg
+            } else {
+                // stack: eh, r
+                if (!lua_isnil(L, -1)) {
+                    if (!lua_isnumber(L, -1)) {
+                        CERR << "Return type of event must be number or nil." << std::endl;
+                    } else {
+                        again = event_tick_ceil(lua_tonumber(L, -1) + game_time);
+                        reschedule = true;
+                    }
+                }
+                lua_pop(L, 1);
+            }
+            // stack: eh
+            // The wheel releases the reference (via EventUnref) unless the event is rescheduled
+            // or was cancelled while it ran, in which case the canceller has released it.
+            return reschedule;
+        }
+    };
+}
+
 static int global_clear_events (lua_State *L)
 {
 TRY_START
     check_args(L, 0);
-    for (EventMap::iterator i=event_map.begin(), i_=event_map.end() ; i != i_ ; ++i) {
-        for (unsigned j=0 ; j<i->second.size() ; ++j) {
-            i->second[j]->setNil(L);
-            delete i->second[j];
-        }
-    }
-    event_map.clear();
+    EventUnref unref = { L };
+    event_wheel.clear(unref);
     return 0;
 TRY_END
 }
@@ -1064,15 +1214,8 @@ static int global_dump_events (lua_State *L)
 TRY_START
     check_args(L, 0);
     lua_newtable(L);
-    int counter = 1;
-    for (EventMap::iterator i=event_map.begin(), i_=event_map.end() ; i != i_ ; ++i) {
-        for (unsigned j=0 ; j<i->second.size() ; ++j) {
-            i->second[j]->push(L);
-            lua_rawseti(L, -2, counter++);
-            lua_pushnumber(L, i->first);
-            lua_rawseti(L, -2, counter++);
-        }
-    }
+    EventDump dump = { L, 1 };
+    event_wheel.forEach(dump);
     return 1;
 TRY_END
 }
@@ -1087,43 +1230,10 @@ TRY_START
     int error_handler = lua_gettop(L);
 
     game_time += elapsed;
-    do {
-        // stack: eh
-        EventMap::iterator i = event_map.begin();
-        if (i == event_map.end()) break;
-        lua_Number time = i->first;
-        std::vector<LuaPtr*> &events = i->second;
-        if (time > game_time) break;
-        for (unsigned j=0 ; j<events.size() ; ++j) {
-            // stack: eh
-            LuaPtr *func = events[j];
-            func->push(L);
-            // stack: eh, func
-            int status = lua_pcall(L, 0, 1, error_handler);
-            if (status) {
-                lua_pop(L, 1); // error msg
-            } else {
-                // stack: eh, r
-                if (!lua_isnil(L, -1)) {
-                    if (!lua_isnumber(L, -1)) {
-                        CERR << "Return type of event must be number or nil." << std::endl;
-                    } else {
-                        lua_Number r = lua_tonumber(L, -1);
-                        func->push(L);
-                        add_event(L, r);
-                        lua_pop(L, 1);
-                    }
-                    // stack: eh, r;
-                }
-                lua_pop(L, 1);
-                // stack: eh
-            }
-            func->setNil(L);
-            delete func;
-            // stack: eh
-        }
-        event_map.erase(i);
-    } while (true);
+    EventFire fire = { L, error_handler };
+    EventUnref unref = { L };
+    event_wheel.advance(event_tick_floor(game_time), fire, unref);
+    lua_pop(L, 1); // eh
     return 0;
 TRY_END
 }
@@ -1179,6 +1289,12 @@ static const luaL_reg global[] = {
 
     {"profiler_start", global_profiler_start},
     {"profiler_stop", global_profiler_stop},
+    {"lua_profiler_start", global_lua_profiler_start},
+    {"lua_profiler_stop", global_lua_profiler_stop},
+    {"lua_profiler_running", global_lua_profiler_running},
+    {"lua_chunk_cache_enabled", global_lua_chunk_cache_enabled},
+    {"lua_chunk_cache_stats", global_lua_chunk_cache_stats},
+    {"lua_chunk_cache_reset_stats", global_lua_chunk_cache_reset_stats},
 
     {"input_filter_trickle_button", global_input_filter_trickle_button},
     {"input_filter_trickle_mouse_move", global_input_filter_trickle_mouse_move},
@@ -1194,6 +1310,7 @@ static const luaL_reg global[] = {
     {"StringDB", stringdb_make},
 
     {"future_event", global_future_event},
+    {"cancel_event", global_cancel_event},
     {"clear_events", global_clear_events},
     {"dump_events", global_dump_events},
     {"do_events", global_do_events},
@@ -26,6 +26,7 @@
 #include "lua_wrappers_primitives.h"
 #include "main.h"
 #include "path_util.h"
+#include "range_space_kernel.h"
 
 
 // GRIT CLASS ============================================================= {{{
@@ -354,6 +355,21 @@ TRY_START
 TRY_END
 }
 
+static int global_range_space_kernel (lua_State *L)
+{
+TRY_START
+    if (lua_gettop(L) == 1) {
+        std::string name = luaL_checkstring(L, 1);
+        if (!range_space_kernel_select(name))
+            my_lua_error(L, "Range space kernel not supported on this CPU: \"" + name + "\"");
+        return 0;
+    }
+    check_args(L, 0);
+    push_string(L, range_space_kernel_name());
+    return 1;
+TRY_END
+}
+
 static int global_class_add (lua_State *L)
 {
 TRY_START
@@ -706,6 +722,7 @@ TRY_END
 static const luaL_reg global[] = {
     {"streamer_centre", global_streamer_centre},
     {"streamer_centre_full", global_streamer_centre_full},
+    {"range_space_kernel", global_range_space_kernel},
     {"class_add", global_class_add},
     {"class_del", global_class_del},
     {"class_all_del", global_class_all_del},
@@ -44,6 +44,13 @@
 
 #ifdef WIN32
 #    define snprintf _snprintf
+#    define WIN32_LEAN_AND_MEAN
+#    include <windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
 #endif
 
 #include"navigation_system.h"
@@ -681,6 +688,7 @@ NavigationManager::NavigationManager() :
     m_talloc = new LinearAllocator(32000);
     m_tcomp = new FastLZCompressor;
     m_tmproc = new MeshProcess;
+    m_mappedFile = new MappedNavmeshFile;
 
     m_crowdTool = new CrowdTool();
 }
@@ -693,6 +701,9 @@ NavigationManager::~NavigationManager()
 
     m_navMesh = 0;
     dtFreeTileCache(m_tileCache);
+
+    // Tiles loaded from the mapping point into it, so unmap only once the tile cache is gone.
+    delete m_mappedFile;
 }
 
 void NavigationManager::updateMaxTiles()
@@ -960,6 +971,8 @@ void NavigationManager::changeMesh(class InputGeom* geom)
     
     dtFreeNavMesh(m_navMesh);
     m_navMesh = 0;
+
+    m_mappedFile->close();
 }
 
 void NavigationManager::addTempObstacle(const float* pos)
@@ -1182,7 +1195,16 @@ void NavigationManager::getTilePos(const float* pos, int& tx, int& ty)
 }
 
 static const int TILECACHESET_MAGIC = 'T'<<24 | 'S'<<16 | 'E'<<8 | 'T'; //'TSET';
-static const int TILECACHESET_VERSION = 1;
+// Version 1: headers and tile data streamed back to back, read with fread.
+// Version 2: tile directory up front, tile data starts on a page boundary, each tile aligned to
+// TILECACHESET_TILE_ALIGNMENT.  Loaded via mmap, the tile cache points straight into the mapping.
+static const int TILECACHESET_VERSION_STREAMED = 1;
+static const int TILECACHESET_VERSION = 2;
+
+// Conservative page size, valid on every platform we ship on.  Keeping the data section aligned
+// to this means the mapping can be shared with the page cache without any fix-ups.
+static const long TILECACHESET_PAGE_SIZE = 4096;
+static const long TILECACHESET_TILE_ALIGNMENT = 16;
 
 struct TileCacheSetHeader
 {
@@ -1199,6 +1221,105 @@ struct TileCacheTileHeader
     int dataSize;
 };
 
+// Directory entry of a version 2 file, offset is from the start of the file.
+struct TileCacheMappedTileHeader
+{
+    dtCompressedTileRef tileRef;
+    int dataSize;
+    long long dataOffset;
+};
+
+static long long align_up (long long v, long long alignment)
+{
+    return (v + alignment - 1) / alignment * alignment;
+}
+
+/** Read-only mapping of a whole navmesh file.
+ *
+ * Tiles added to the tile cache from this mapping do not own their data, so the mapping must
+ * outlive the tile cache.
+ */
+struct MappedNavmeshFile
+{
+    const unsigned char *data;
+    size_t size;
+    #ifdef WIN32
+    HANDLE file;
+    HANDLE mapping;
+    #endif
+
+    MappedNavmeshFile (void)
+      : data(nullptr), size(0)
+    {
+        #ifdef WIN32
+        file = INVALID_HANDLE_VALUE;
+        mapping = NULL;
+        #endif
+    }
+
+    ~MappedNavmeshFile (void)
+    {
+        close();
+    }
+
+    bool open (const char *path)
+    {
+        close();
+        #ifdef WIN32
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+            close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL) {
+            close();
+            return false;
+        }
+        void *ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (ptr == NULL) {
+            close();
+            return false;
+        }
+        data = static_cast<const unsigned char*>(ptr);
+        size = size_t(file_size.QuadPart);
+        #else
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void *ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // The mapping keeps its own reference to the file.
+        ::close(fd);
+        if (ptr == MAP_FAILED) return false;
+        data = static_cast<const unsigned char*>(ptr);
+        size = size_t(st.st_size);
+        #endif
+        return true;
+    }
+
+    void close (void)
+    {
+        #ifdef WIN32
+        if (data != nullptr) UnmapViewOfFile(data);
+        if (mapping != NULL) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+        #else
+        if (data != nullptr) munmap(const_cast<unsigned char*>(data), size);
+        #endif
+        data = nullptr;
+        size = 0;
+    }
+};
+
 bool NavigationManager::saveAll(const char* path)
 {
     if (!m_tileCache) return false;
@@ -1222,65 +1343,158 @@ bool NavigationManager::saveAll(const char* path)
     memcpy(&header.meshParams, m_navMesh->getParams(), sizeof(dtNavMeshParams));
     fwrite(&header, sizeof(TileCacheSetHeader), 1, fp);
 
-    // Store tiles.
+    // Store tile directory, with data offsets laid out ahead of time.
+    long long directory_end = sizeof(TileCacheSetHeader)
+                            + header.numTiles * (long long)sizeof(TileCacheMappedTileHeader);
+    long long offset = align_up(directory_end, TILECACHESET_PAGE_SIZE);
     for (int i = 0; i < m_tileCache->getTileCount(); ++i)
     {
         const dtCompressedTile* tile = m_tileCache->getTile(i);
         if (!tile || !tile->header || !tile->dataSize) continue;
 
-        TileCacheTileHeader tileHeader;
+        TileCacheMappedTileHeader tileHeader;
+        memset(&tileHeader, 0, sizeof(tileHeader));
         tileHeader.tileRef = m_tileCache->getTileRef(tile);
         tileHeader.dataSize = tile->dataSize;
+        tileHeader.dataOffset = offset;
         fwrite(&tileHeader, sizeof(tileHeader), 1, fp);
 
+        offset = align_up(offset + tile->dataSize, TILECACHESET_TILE_ALIGNMENT);
+    }
+
+    // Store tiles, padding each one out to its directory offset.
+    static const unsigned char padding[TILECACHESET_PAGE_SIZE] = { 0 };
+    long long written = directory_end;
+    offset = align_up(directory_end, TILECACHESET_PAGE_SIZE);
+    for (int i = 0; i < m_tileCache->getTileCount(); ++i)
+    {
+        const dtCompressedTile* tile = m_tileCache->getTile(i);
+        if (!tile || !tile->header || !tile->dataSize) continue;
+
+        fwrite(padding, size_t(offset - written), 1, fp);
         fwrite(tile->data, tile->dataSize, 1, fp);
+        written = offset + tile->dataSize;
+        offset = align_up(written, TILECACHESET_TILE_ALIGNMENT);
     }
 
     fclose(fp);
     return true;
 }
 
+bool NavigationManager::initFromHeader(const void* headerPtr)
+{
+    const TileCacheSetHeader &header = *static_cast<const TileCacheSetHeader*>(headerPtr);
+
+    m_navMesh = dtAllocNavMesh();
+    if (!m_navMesh)
+        return false;
+    dtStatus status = m_navMesh->init(&header.meshParams);
+    if (dtStatusFailed(status))
+        return false;
+
+    m_tileCache = dtAllocTileCache();
+    if (!m_tileCache)
+        return false;
+    status = m_tileCache->init(&header.cacheParams, m_talloc, m_tcomp, m_tmproc);
+    if (dtStatusFailed(status))
+        return false;
+
+    return true;
+}
+
 bool NavigationManager::loadAll(const char* path)
 {
-    FILE* fp = fopen(path, "rb");
-    if (!fp) return false;
+    if (!m_mappedFile->open(path))
+        return false;
 
-    // Read header.
+    const unsigned char *base = m_mappedFile->data;
+    const size_t size = m_mappedFile->size;
+
+    if (size < sizeof(TileCacheSetHeader))
+    {
+        m_mappedFile->close();
+        return false;
+    }
     TileCacheSetHeader header;
-    size_t bytes = fread(&header, sizeof(TileCacheSetHeader), 1, fp);
-    APP_ASSERT(bytes != sizeof(TileCacheSetHeader));
+    memcpy(&header, base, sizeof(header));
     if (header.magic != TILECACHESET_MAGIC)
     {
-        fclose(fp);
+        m_mappedFile->close();
         return false;
     }
+    if (header.version == TILECACHESET_VERSION_STREAMED)
+    {
+        m_mappedFile->close();
+        return loadAllStreamed(path);
+    }
     if (header.version != TILECACHESET_VERSION)
     {
-        fclose(fp);
+        m_mappedFile->close();
         return false;
     }
 
-    m_navMesh = dtAllocNavMesh();
-    if (!m_navMesh)
+    if (!initFromHeader(&header))
     {
-        fclose(fp);
+        m_mappedFile->close();
         return false;
     }
-    dtStatus status = m_navMesh->init(&header.meshParams);
-    if (dtStatusFailed(status))
+
+    // Add tiles without copying.  The tile cache does not own the data (no
+    // DT_COMPRESSEDTILE_FREE_DATA), the compressed layers are only decompressed on demand when
+    // the navmesh tile is built from them.
+    const size_t directory_end = sizeof(TileCacheSetHeader)
+                               + size_t(header.numTiles) * sizeof(TileCacheMappedTileHeader);
+    if (header.numTiles < 0 || directory_end > size)
     {
-        fclose(fp);
+        m_mappedFile->close();
         return false;
     }
+    for (int i = 0; i < header.numTiles; ++i)
+    {
+        TileCacheMappedTileHeader tileHeader;
+        memcpy(&tileHeader,
+               base + sizeof(TileCacheSetHeader) + i * sizeof(TileCacheMappedTileHeader),
+               sizeof(tileHeader));
+        if (!tileHeader.tileRef || !tileHeader.dataSize)
+            break;
+        if (tileHeader.dataOffset < (long long)directory_end
+            || tileHeader.dataOffset + tileHeader.dataSize > (long long)size)
+            break;
 
-    m_tileCache = dtAllocTileCache();
-    if (!m_tileCache)
+        // Detour takes a non-const pointer but never writes to compressed tile data.
+        unsigned char* data = const_cast<unsigned char*>(base + tileHeader.dataOffset);
+
+        dtCompressedTileRef tile = 0;
+        m_tileCache->addTile(data, tileHeader.dataSize, 0, &tile);
+
+        if (tile)
+            m_tileCache->buildNavMeshTile(tile, m_navMesh);
+    }
+
+    return true;
+}
+
+bool NavigationManager::loadAllStreamed(const char* path)
+{
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return false;
+
+    // Read header.
+    TileCacheSetHeader header;
+    size_t bytes = fread(&header, sizeof(TileCacheSetHeader), 1, fp);
+    APP_ASSERT(bytes != sizeof(TileCacheSetHeader));
+    if (header.magic != TILECACHESET_MAGIC)
     {
         fclose(fp);
         return false;
     }
-    status = m_tileCache->init(&header.cacheParams, m_talloc, m_tcomp, m_tmproc);
-    if (dtStatusFailed(status))
+    if (header.version != TILECACHESET_VERSION_STREAMED)
+    {
+        fclose(fp);
+        return false;
+    }
+
+    if (!initFromHeader(&header))
     {
         fclose(fp);
         return false;
@@ -1352,6 +1566,9 @@ bool NavigationManager::load(const char* path)
     updateMaxTiles();
     dtFreeNavMesh(m_navMesh);
     dtFreeTileCache(m_tileCache);
+    m_navMesh = 0;
+    m_tileCache = 0;
+    m_mappedFile->close();
     bool result = loadAll(path);
     m_navQuery->init(m_navMesh, 2048);
 
@@ -1366,6 +1583,9 @@ void NavigationManager::freeNavmesh()
 
     dtFreeNavMesh(m_navMesh);
     m_navMesh = 0;
+
+    // The tile cache pointed into the mapping, so it can only go now.
+    m_mappedFile->close();
 }
 
 // CONVEX VOLUMES: (from Convex Volume Tool)
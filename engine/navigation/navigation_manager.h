@@ -83,6 +83,7 @@ protected:
     struct LinearAllocator* m_talloc;
     struct FastLZCompressor* m_tcomp;
     struct MeshProcess* m_tmproc;
+    struct MappedNavmeshFile* m_mappedFile;
 
     class dtTileCache* m_tileCache;
 
@@ -121,6 +122,8 @@ protected:
     int m_npts;
     int m_hull[MAX_PTS];
     int m_nhull;
+
+    bool initFromHeader(const void* header);
 public:
     NavigationManager();
     ~NavigationManager();
@@ -200,6 +203,7 @@ public:
 
     bool saveAll(const char* path);
     bool loadAll(const char* path);
+    bool loadAllStreamed(const char* path);
 
     void setContext(BuildContext* ctx) { m_ctx = ctx; }
 
@@ -45,7 +45,5 @@ void net_set_callbacks(ExternalTable& table, lua_State* L)
 {
     APP_ASSERT(netManager != NULL);
 
-    netManager->setCBTable(table);
-    
-    table.clear(L); //ensure setNil() is called so we don't get LuaPtr shutdown error
+    netManager->setCBTable(L, table);
 }
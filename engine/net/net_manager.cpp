@@ -89,6 +89,8 @@ NetManager::~NetManager()
 #endif
 }
 
+static const ExternalTable::Key key_process_packet("process_packet");
+
 void NetManager::processPacket(lua_State* L, NetAddress& from, std::string& data)
 {
     STACK_BASE;
@@ -96,7 +98,7 @@ void NetManager::processPacket(lua_State* L, NetAddress& from, std::string& data
     push_cfunction(L, my_lua_error_handler);
     int error_handler = lua_gettop(L);
 
-    const char* err = netCBTable.luaGet(L, "process_packet");
+    const char* err = netCBTable.luaGet(L, key_process_packet);
 
     if (err) {
         my_lua_error(L, err);
@@ -249,9 +251,9 @@ bool NetManager::getLoopbackPacket(NetChannel channel, std::string& packet)
     return false;
 }
 
-void NetManager::setCBTable(ExternalTable& table)
+void NetManager::setCBTable(lua_State* L, ExternalTable& table)
 {
-    this->netCBTable = table;
+    this->netCBTable.moveFrom(L, table);
 }
 
 ExternalTable& NetManager::getCBTable()
@@ -47,7 +47,7 @@ public:
 
     void sendPacket(NetChannel channel, NetAddress& address, std::string& data);
 
-    void setCBTable(ExternalTable& table);
+    void setCBTable(lua_State* L, ExternalTable& table);
     ExternalTable& getCBTable();
 
     bool getLoopbackPacket(NetChannel channel, std::string& packet);
@@ -27,6 +27,7 @@
 #include <centralised_log.h>
 #include "../option.h"
 #include "../grit_lua_util.h"
+#include "../lua_profiler.h"
 
 #include "physics_world.h"
 #include "lua_wrappers_physics.h"
@@ -1366,6 +1367,7 @@ void RigidBody::updateGraphicsCallback (lua_State *L, float extrapolate)
     push_quat(L,from_bullet(quat)); // arg 1
 
     // call callback (7 args, no return values)
+    LuaProfilerScope profiler_scope("updateGraphicsCallback");
     int status = lua_pcall(L,2,0,error_handler);
     if (status) {
         // pop the error message since the error handler will
@@ -1401,6 +1403,7 @@ void RigidBody::stepCallback (lua_State *L, float step_size)
     lua_pushnumber(L, step_size);
 
     // call callback (no args, no return values)
+    LuaProfilerScope profiler_scope("physics stepCallback");
     int status = lua_pcall(L,1,0,error_handler);
     if (status) {
         lua_pop(L,1);
@@ -1437,6 +1440,7 @@ void RigidBody::collisionCallback (lua_State *L, int lifetime, float impulse,
     push_v3(L,pos);
     push_v3(L,pos2);
     push_v3(L,wnormal);
+    LuaProfilerScope profiler_scope("collisionCallback");
     int status = lua_pcall(L,9,0,error_handler);
     if (status) {
         lua_pop(L,1);
@@ -1464,6 +1468,7 @@ void RigidBody::stabiliseCallback (lua_State *L, float elapsed)
     lua_pushnumber(L, elapsed);
 
     // call callback (no args, no return values)
+    LuaProfilerScope profiler_scope("stabiliseCallback");
     int status = lua_pcall(L,1,0,error_handler);
     if (status) {
         lua_pop(L,1);
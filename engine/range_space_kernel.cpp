@@ -0,0 +1,301 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include <cstdint>
+
+#include "range_space_kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define RANGE_SPACE_KERNEL_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and clang only allow the intrinsics of instruction sets enabled for the function, which
+// lets the wider kernels be compiled without enabling those instruction sets for the whole
+// engine.  MSVC allows any intrinsic anywhere.
+#if defined(RANGE_SPACE_KERNEL_X86) && !defined(_MSC_VER)
+#define KERNEL_TARGET(x) __attribute__((target(x)))
+#else
+#define KERNEL_TARGET(x)
+#endif
+
+namespace {
+
+    typedef size_t Kernel (const float *xs, const float *ys, const float *zs, const float *ds,
+                           size_t from, size_t to, float x, float y, float z, float factor2,
+                           unsigned *out);
+
+    // The dot product is summed in the same order by all kernels, and none of them use fused
+    // multiply-add, so they agree on spheres that just touch the point.
+    size_t kernel_scalar (const float *xs, const float *ys, const float *zs, const float *ds,
+                          size_t from, size_t to, float x, float y, float z, float factor2,
+                          unsigned *out)
+    {
+        size_t n = 0;
+        for (size_t i = from ; i < to ; ++i) {
+            float dx = xs[i] - x;
+            float dy = ys[i] - y;
+            float dz = zs[i] - z;
+            float dx2 = dx * dx;
+            float dy2 = dy * dy;
+            float dz2 = dz * dz;
+            float d2 = ds[i] * ds[i];
+            if (dx2 + dy2 + dz2 < d2 * factor2) out[n++] = unsigned(i);
+        }
+        return n;
+    }
+
+    #ifdef RANGE_SPACE_KERNEL_X86
+
+    inline unsigned count_trailing_zeros (unsigned v)
+    {
+        #ifdef _MSC_VER
+        unsigned long r;
+        _BitScanForward(&r, v);
+        return r;
+        #else
+        return __builtin_ctz(v);
+        #endif
+    }
+
+    inline unsigned population_count (unsigned v)
+    {
+        #ifdef _MSC_VER
+        return __popcnt(v);
+        #else
+        return __builtin_popcount(v);
+        #endif
+    }
+
+    // SSE2 is part of x86-64, so this needs no target attribute there.
+    KERNEL_TARGET("sse2")
+    size_t kernel_sse2 (const float *xs, const float *ys, const float *zs, const float *ds,
+                        size_t from, size_t to, float x, float y, float z, float factor2,
+                        unsigned *out)
+    {
+        const __m128 vx = _mm_set1_ps(x);
+        const __m128 vy = _mm_set1_ps(y);
+        const __m128 vz = _mm_set1_ps(z);
+        const __m128 vf = _mm_set1_ps(factor2);
+        size_t n = 0;
+        size_t i = from;
+        for ( ; i + 4 <= to ; i += 4) {
+            __m128 dx = _mm_sub_ps(_mm_loadu_ps(xs + i), vx);
+            __m128 dy = _mm_sub_ps(_mm_loadu_ps(ys + i), vy);
+            __m128 dz = _mm_sub_ps(_mm_loadu_ps(zs + i), vz);
+            __m128 d = _mm_loadu_ps(ds + i);
+            __m128 lhs = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                                    _mm_mul_ps(dz, dz));
+            __m128 rhs = _mm_mul_ps(_mm_mul_ps(d, d), vf);
+            unsigned mask = _mm_movemask_ps(_mm_cmplt_ps(lhs, rhs));
+            while (mask != 0) {
+                out[n++] = unsigned(i + count_trailing_zeros(mask));
+                mask &= mask - 1;
+            }
+        }
+        return n + kernel_scalar(xs, ys, zs, ds, i, to, x, y, z, factor2, out + n);
+    }
+
+    // For each 8 bit mask, the positions of its set bits, packed to the front.
+    uint8_t left_pack[256][8];
+
+    void init_left_pack (void)
+    {
+        for (unsigned mask = 0 ; mask < 256 ; ++mask) {
+            unsigned n = 0;
+            for (unsigned bit = 0 ; bit < 8 ; ++bit) {
+                if (mask & (1 << bit)) left_pack[mask][n++] = bit;
+            }
+            while (n < 8) left_pack[mask][n++] = 0;
+        }
+    }
+
+    // AVX2 has no compress-store, so the indexes of the hits are moved to the front of the
+    // vector with a permutation from a lookup table, and the whole vector is stored.
+    KERNEL_TARGET("avx2")
+    size_t kernel_avx2 (const float *xs, const float *ys, const float *zs, const float *ds,
+                        size_t from, size_t to, float x, float y, float z, float factor2,
+                        unsigned *out)
+    {
+        const __m256 vx = _mm256_set1_ps(x);
+        const __m256 vy = _mm256_set1_ps(y);
+        const __m256 vz = _mm256_set1_ps(z);
+        const __m256 vf = _mm256_set1_ps(factor2);
+        const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        size_t n = 0;
+        size_t i = from;
+        for ( ; i + 8 <= to ; i += 8) {
+            __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(xs + i), vx);
+            __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(ys + i), vy);
+            __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(zs + i), vz);
+            __m256 d = _mm256_loadu_ps(ds + i);
+            __m256 lhs = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                                       _mm256_mul_ps(dz, dz));
+            __m256 rhs = _mm256_mul_ps(_mm256_mul_ps(d, d), vf);
+            unsigned mask = _mm256_movemask_ps(_mm256_cmp_ps(lhs, rhs, _CMP_LT_OQ));
+            if (mask == 0) continue;
+            __m256i indexes = _mm256_add_epi32(_mm256_set1_epi32(int(i)), lanes);
+            __m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(left_pack[mask]));
+            __m256i perm = _mm256_cvtepu8_epi32(packed);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + n),
+                                _mm256_permutevar8x32_epi32(indexes, perm));
+            n += population_count(mask);
+        }
+        return n + kernel_sse2(xs, ys, zs, ds, i, to, x, y, z, factor2, out + n);
+    }
+
+    KERNEL_TARGET("avx512f")
+    size_t kernel_avx512 (const float *xs, const float *ys, const float *zs, const float *ds,
+                          size_t from, size_t to, float x, float y, float z, float factor2,
+                          unsigned *out)
+    {
+        const __m512 vx = _mm512_set1_ps(x);
+        const __m512 vy = _mm512_set1_ps(y);
+        const __m512 vz = _mm512_set1_ps(z);
+        const __m512 vf = _mm512_set1_ps(factor2);
+        const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+                                                8, 9, 10, 11, 12, 13, 14, 15);
+        size_t n = 0;
+        size_t i = from;
+        for ( ; i + 16 <= to ; i += 16) {
+            __m512 dx = _mm512_sub_ps(_mm512_loadu_ps(xs + i), vx);
+            __m512 dy = _mm512_sub_ps(_mm512_loadu_ps(ys + i), vy);
+            __m512 dz = _mm512_sub_ps(_mm512_loadu_ps(zs + i), vz);
+            __m512 d = _mm512_loadu_ps(ds + i);
+            __m512 lhs = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy)),
+                                       _mm512_mul_ps(dz, dz));
+            __m512 rhs = _mm512_mul_ps(_mm512_mul_ps(d, d), vf);
+            __mmask16 mask = _mm512_cmp_ps_mask(lhs, rhs, _CMP_LT_OQ);
+            if (mask == 0) continue;
+            __m512i indexes = _mm512_add_epi32(_mm512_set1_epi32(int(i)), lanes);
+            _mm512_mask_compressstoreu_epi32(out + n, mask, indexes);
+            n += population_count(mask);
+        }
+        return n + kernel_sse2(xs, ys, zs, ds, i, to, x, y, z, factor2, out + n);
+    }
+
+    bool cpu_has_avx2 (void)
+    {
+        #ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return false;
+        __cpuid(info, 1);
+        // OSXSAVE and AVX, then check the OS saves the YMM registers.
+        if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0) return false;
+        if ((_xgetbv(0) & 0x6) != 0x6) return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+        #else
+        return __builtin_cpu_supports("avx2");
+        #endif
+    }
+
+    bool cpu_has_avx512 (void)
+    {
+        if (!cpu_has_avx2()) return false;
+        #ifdef _MSC_VER
+        int info[4];
+        // And the OS saves the opmask and ZMM registers.
+        if ((_xgetbv(0) & 0xe6) != 0xe6) return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 16)) != 0;
+        #else
+        return __builtin_cpu_supports("avx512f");
+        #endif
+    }
+
+    #endif
+
+    struct Implementation {
+        const char *name;
+        Kernel *kernel;
+        bool (*supported) (void);
+    };
+
+    bool always (void) { return true; }
+
+    // Best first.
+    const Implementation implementations[] = {
+        #ifdef RANGE_SPACE_KERNEL_X86
+        { "avx512", kernel_avx512, cpu_has_avx512 },
+        { "avx2", kernel_avx2, cpu_has_avx2 },
+        { "sse2", kernel_sse2, always },
+        #endif
+        { "scalar", kernel_scalar, always },
+    };
+
+    const Implementation *selected = nullptr;
+
+    const Implementation *best (void)
+    {
+        for (const Implementation &impl : implementations) {
+            if (impl.supported()) return &impl;
+        }
+        return nullptr;  // Not reached, scalar is always supported.
+    }
+
+    const Implementation &current (void)
+    {
+        if (selected == nullptr) {
+            #ifdef RANGE_SPACE_KERNEL_X86
+            #ifndef _MSC_VER
+            __builtin_cpu_init();
+            #endif
+            init_left_pack();
+            #endif
+            selected = best();
+        }
+        return *selected;
+    }
+
+}
+
+size_t range_space_kernel (const float *xs, const float *ys, const float *zs, const float *ds,
+                           size_t from, size_t to, float x, float y, float z, float factor2,
+                           unsigned *out)
+{
+    return current().kernel(xs, ys, zs, ds, from, to, x, y, z, factor2, out);
+}
+
+std::string range_space_kernel_name (void)
+{
+    return current().name;
+}
+
+bool range_space_kernel_select (const std::string &name)
+{
+    current();
+    if (name.empty()) {
+        selected = best();
+        return true;
+    }
+    for (const Implementation &impl : implementations) {
+        if (name != impl.name) continue;
+        if (!impl.supported()) return false;
+        selected = &impl;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,53 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef RANGE_SPACE_KERNEL_H
+#define RANGE_SPACE_KERNEL_H
+
+#include <cstddef>
+#include <string>
+
+/** The inner loop of CacheFriendlyRangeSpace::getPresent.
+ *
+ * Considers the spheres from..to-1, given in structure of arrays form (centre xs, ys, zs and
+ * radius ds), and writes the index of each one that contains the point (x, y, z) once its
+ * radius is multiplied by sqrt(factor2) to out.  Returns the number of indexes written.  The
+ * out buffer must have room for to - from + RANGE_SPACE_KERNEL_SLACK entries, as the wider
+ * kernels store whole vectors of indexes at a time.
+ *
+ * The implementation is chosen on first use according to the instruction sets the CPU
+ * supports (AVX-512, AVX2, SSE2, or plain C++).  All of them give exactly the same results.
+ */
+size_t range_space_kernel (const float *xs, const float *ys, const float *zs, const float *ds,
+                           size_t from, size_t to, float x, float y, float z, float factor2,
+                           unsigned *out);
+
+static const size_t RANGE_SPACE_KERNEL_SLACK = 16;
+
+/** Name of the implementation in use: "avx512", "avx2", "sse2", or "scalar". */
+std::string range_space_kernel_name (void);
+
+/** Use a specific implementation (by name, as above), for benchmarking.  The empty string
+ * returns to automatic selection.  Returns false if the CPU does not support it.
+ */
+bool range_space_kernel_select (const std::string &name);
+
+#endif
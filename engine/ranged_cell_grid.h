@@ -0,0 +1,333 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef RANGED_CELL_GRID_H
+#define RANGED_CELL_GRID_H
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/** Decides which of a large static set of items are within their rendering distance of the
+ * camera, and with what fade, for GfxRangedInstances and RangedClutter.
+ *
+ * Items are bucketed into square cells on the X/Y plane.  Each frame, only the cells near the
+ * camera are examined, and each one is classified using its bounding box:  Entirely out of
+ * range (its items are deactivated, once), entirely within the fully opaque region (its items
+ * are activated with a fade of 1, once) or in the fade band, in which case its items are
+ * examined individually.  The set of nearby cells is only recomputed when the camera moves to a
+ * different cell.  So a frame costs a few box tests plus the items in the fade band, regardless
+ * of the total number of items, and nothing at all if the camera has not moved.
+ *
+ * The owner keeps whatever else it needs about an item (orientation, GPU ticket) in its own
+ * array, indexed the same way, and is told about changes through a callback object with these
+ * members:
+ *
+ *   bool activate (unsigned index, float fade);  // false if it could not be activated
+ *   void deactivate (unsigned index);
+ *   void fade (unsigned index, float fade);
+ */
+class RangedCellGrid {
+
+    protected:
+
+    enum CellState {
+        // No items active.
+        CELL_OUT,
+        // Items examined individually every frame.
+        CELL_BAND,
+        // All items active with a fade of 1.
+        CELL_FULL
+    };
+
+    struct Cell {
+        std::vector<unsigned> items;
+        float minX, minY, minZ, maxX, maxY, maxZ;
+        float minRange, maxRange;
+        unsigned active;
+        CellState state;
+        // Value of watchGeneration when this cell was last put in the watched list.
+        unsigned watched;
+    };
+
+    // Per item, in the order they were added.
+    std::vector<float> xs, ys, zs, ranges;
+    std::vector<float> lastFade;
+    std::vector<bool> activated;
+
+    std::vector<Cell> cells;
+    std::unordered_map<uint64_t, unsigned> cellIndex;
+
+    // Cells near enough to the camera to be examined every frame.
+    std::vector<unsigned> watchedCells;
+    unsigned watchGeneration;
+    bool watchDirty;
+    int watchX, watchY;
+    float watchVisibility;
+
+    float cellSize;
+    float maxRange;
+
+    // Arguments of the last update, which need not be repeated if nothing has changed.
+    float lastX, lastY, lastZ, lastVisibility, lastFadeOut;
+    // Set when added items or failed activations need another update.
+    bool pending;
+
+    static uint64_t key (int x, int y)
+    {
+        return (uint64_t(uint32_t(x)) << 32) | uint32_t(y);
+    }
+
+    int cellCoord (float v) const { return int(std::floor(v / cellSize)); }
+
+    // Squared distances from the point to the nearest and furthest points of the cell's box.
+    static void distances (const Cell &c, float x, float y, float z, float &near2, float &far2)
+    {
+        float nx = x < c.minX ? c.minX - x : x > c.maxX ? x - c.maxX : 0;
+        float ny = y < c.minY ? c.minY - y : y > c.maxY ? y - c.maxY : 0;
+        float nz = z < c.minZ ? c.minZ - z : z > c.maxZ ? z - c.maxZ : 0;
+        near2 = nx*nx + ny*ny + nz*nz;
+        float fx = std::fmax(std::fabs(x - c.minX), std::fabs(x - c.maxX));
+        float fy = std::fmax(std::fabs(y - c.minY), std::fabs(y - c.maxY));
+        float fz = std::fmax(std::fabs(z - c.minZ), std::fabs(z - c.maxZ));
+        far2 = fx*fx + fy*fy + fz*fz;
+    }
+
+    static float calcFade (float range2, float fade_out)
+    {
+        float range = std::sqrt(range2);
+        return range > fade_out ? (1 - range) / (1 - fade_out) : 1;
+    }
+
+    template<class C> void deactivateAll (Cell &c, C &callbacks)
+    {
+        if (c.active > 0) {
+            for (unsigned i : c.items) {
+                if (!activated[i]) continue;
+                callbacks.deactivate(i);
+                activated[i] = false;
+            }
+            c.active = 0;
+        }
+        c.state = CELL_OUT;
+    }
+
+    template<class C> void activateAll (Cell &c, C &callbacks)
+    {
+        for (unsigned i : c.items) {
+            if (activated[i]) {
+                if (lastFade[i] != 1) {
+                    callbacks.fade(i, 1);
+                    lastFade[i] = 1;
+                }
+            } else if (callbacks.activate(i, 1)) {
+                activated[i] = true;
+                lastFade[i] = 1;
+                c.active++;
+            } else {
+                pending = true;
+            }
+        }
+        // If some could not be activated, keep trying every frame.
+        c.state = c.active == c.items.size() ? CELL_FULL : CELL_BAND;
+    }
+
+    template<class C> void updateBand (Cell &c, float x, float y, float z, float vis2,
+                                       float fade_out, C &callbacks)
+    {
+        for (unsigned i : c.items) {
+            float dx = xs[i] - x, dy = ys[i] - y, dz = zs[i] - z;
+            float range2 = (dx*dx + dy*dy + dz*dz) / (ranges[i] * ranges[i]) / vis2;
+            if (range2 > 1) {
+                if (activated[i]) {
+                    callbacks.deactivate(i);
+                    activated[i] = false;
+                    c.active--;
+                }
+                continue;
+            }
+            float fade = calcFade(range2, fade_out);
+            if (activated[i]) {
+                if (fade != lastFade[i]) {
+                    callbacks.fade(i, fade);
+                    lastFade[i] = fade;
+                }
+            } else if (callbacks.activate(i, fade)) {
+                activated[i] = true;
+                lastFade[i] = fade;
+                c.active++;
+            } else {
+                pending = true;
+            }
+        }
+        c.state = CELL_BAND;
+    }
+
+    template<class C> void rewatch (float x, float y, float visibility, C &callbacks)
+    {
+        watchX = cellCoord(x);
+        watchY = cellCoord(y);
+        watchVisibility = visibility;
+        watchDirty = false;
+        watchGeneration++;
+
+        // The camera can be anywhere within its cell, so allow one more.
+        int reach = int(std::ceil(maxRange * visibility / cellSize)) + 1;
+
+        std::vector<unsigned> old_watched;
+        old_watched.swap(watchedCells);
+        for (int cy = watchY - reach ; cy <= watchY + reach ; ++cy) {
+            for (int cx = watchX - reach ; cx <= watchX + reach ; ++cx) {
+                auto it = cellIndex.find(key(cx, cy));
+                if (it == cellIndex.end()) continue;
+                watchedCells.push_back(it->second);
+                cells[it->second].watched = watchGeneration;
+            }
+        }
+
+        // Cells no longer watched are out of range, so anything in them has to go.
+        for (unsigned ci : old_watched) {
+            Cell &c = cells[ci];
+            if (c.watched != watchGeneration) deactivateAll(c, callbacks);
+        }
+    }
+
+    public:
+
+    /** Cell size is in world units, it works best at about half the rendering distance. */
+    RangedCellGrid (float cell_size)
+      : watchGeneration(0), watchDirty(true), watchX(0), watchY(0), watchVisibility(0),
+        cellSize(cell_size), maxRange(0), lastX(0), lastY(0), lastZ(0), lastVisibility(0),
+        lastFadeOut(0), pending(true)
+    { }
+
+    void reserve (size_t s)
+    {
+        xs.reserve(s);
+        ys.reserve(s);
+        zs.reserve(s);
+        ranges.reserve(s);
+        lastFade.reserve(s);
+        activated.reserve(s);
+    }
+
+    size_t size (void) const { return xs.size(); }
+
+    /** Add an item, which gets the next index (starting from 0). */
+    unsigned add (float x, float y, float z, float range)
+    {
+        unsigned index = xs.size();
+        xs.push_back(x);
+        ys.push_back(y);
+        zs.push_back(z);
+        ranges.push_back(range);
+        lastFade.push_back(0);
+        activated.push_back(false);
+
+        int cx = cellCoord(x), cy = cellCoord(y);
+        auto it = cellIndex.find(key(cx, cy));
+        if (it == cellIndex.end()) {
+            Cell c;
+            c.minX = c.maxX = x;
+            c.minY = c.maxY = y;
+            c.minZ = c.maxZ = z;
+            c.minRange = c.maxRange = range;
+            c.active = 0;
+            c.state = CELL_OUT;
+            c.watched = 0;
+            it = cellIndex.insert(std::make_pair(key(cx, cy), unsigned(cells.size()))).first;
+            cells.push_back(c);
+            // The new cell may be near the camera.
+            watchDirty = true;
+        }
+        Cell &c = cells[it->second];
+        c.items.push_back(index);
+        c.minX = std::fmin(c.minX, x); c.maxX = std::fmax(c.maxX, x);
+        c.minY = std::fmin(c.minY, y); c.maxY = std::fmax(c.maxY, y);
+        c.minZ = std::fmin(c.minZ, z); c.maxZ = std::fmax(c.maxZ, z);
+        c.minRange = std::fmin(c.minRange, range);
+        c.maxRange = std::fmax(c.maxRange, range);
+        // Have the new item considered on the next update.
+        if (c.state == CELL_FULL) c.state = CELL_BAND;
+        pending = true;
+
+        if (range > maxRange) {
+            maxRange = range;
+            watchDirty = true;
+        }
+        return index;
+    }
+
+    /** Activate, deactivate, and fade items for the given camera position.
+     *
+     * An item is active when its distance to the camera is within its range times the
+     * visibility, and fades out linearly over the last (1 - fade_out) of that.
+     */
+    template<class C> void update (float x, float y, float z, float visibility, float fade_out,
+                                   C &callbacks)
+    {
+        if (!pending && x == lastX && y == lastY && z == lastZ && visibility == lastVisibility
+            && fade_out == lastFadeOut)
+            return;
+        lastX = x;
+        lastY = y;
+        lastZ = z;
+        lastVisibility = visibility;
+        lastFadeOut = fade_out;
+        pending = false;
+
+        if (watchDirty || visibility != watchVisibility
+            || cellCoord(x) != watchX || cellCoord(y) != watchY)
+            rewatch(x, y, visibility, callbacks);
+
+        const float vis2 = visibility * visibility;
+        for (unsigned ci : watchedCells) {
+            Cell &c = cells[ci];
+            float near2, far2;
+            distances(c, x, y, z, near2, far2);
+            float out = c.maxRange * visibility;
+            float opaque = c.minRange * visibility * fade_out;
+            if (near2 > out * out) {
+                if (c.state != CELL_OUT) deactivateAll(c, callbacks);
+            } else if (far2 <= opaque * opaque) {
+                if (c.state != CELL_FULL) activateAll(c, callbacks);
+            } else {
+                updateBand(c, x, y, z, vis2, fade_out, callbacks);
+            }
+        }
+    }
+
+    /** Deactivate everything, e.g. before destroying the owner's GPU resources. */
+    template<class C> void clear (C &callbacks)
+    {
+        for (Cell &c : cells) deactivateAll(c, callbacks);
+        watchDirty = true;
+        pending = true;
+    }
+
+    unsigned numCells (void) const { return cells.size(); }
+
+    /** Number of cells examined by each update, at the current camera position. */
+    unsigned numWatchedCells (void) const { return watchedCells.size(); }
+};
+
+#endif
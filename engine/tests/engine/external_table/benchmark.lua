@@ -0,0 +1,58 @@
+-- Field lookup throughput on a realistic set of classes and objects.
+
+local num_classes = 2000
+local num_objects = 10000
+local num_lookups = 1000000
+
+local BaseClass = {
+    castShadows = true,
+    placementZOffset = 0,
+}
+
+local function make_class(i)
+    return {
+        renderingDistance = 100 + i % 400,
+        gfxMesh = "/common/props/Prop" .. i .. ".mesh",
+        colMesh = "/common/props/Prop" .. i .. ".gcol",
+        lights = {
+            { pos = vec(0, 0, 2), diff = vec(1, 1, 0.8), range = 5, iangle = 30, oangle = 40 },
+        },
+        materialMap = { ["/common/props/Old"] = "/common/props/New" },
+        health = 100,
+        explodeRadius = 2.5,
+        breakable = i % 2 == 0,
+        spawnOffset = vec(0, 0, 0.5),
+        spawnOrient = quat(1, 0, 0, 0),
+        activate = function(self, instance) end,
+        deactivate = function(self) end,
+        stepCallback = function(self, elapsed) end,
+    }
+end
+
+for i = 1, num_classes do
+    class_add("/bench/Prop" .. i, BaseClass, make_class(i))
+end
+
+local objs = {}
+for i = 1, num_objects do
+    objs[i] = object_add("/bench/Prop" .. (i % num_classes + 1), vec(i, 0, 0), { health = i })
+end
+
+local keys = { "renderingDistance", "gfxMesh", "health", "activate", "castShadows", "missing" }
+
+local before = micros()
+local count = 0
+for i = 1, num_lookups do
+    local o = objs[i % num_objects + 1]
+    if o[keys[i % #keys + 1]] ~= nil then
+        count = count + 1
+    end
+end
+local us = micros() - before
+
+print(("%d object field lookups in %d us (%.1f per us), %d found"):format(num_lookups, us, num_lookups / us, count))
+
+object_all_del()
+for i = 1, num_classes do
+    class_del("/bench/Prop" .. i)
+end
@@ -0,0 +1,54 @@
+-- Schedule / fire throughput of future_event, plus sanity checks of cancel_event.
+
+clear_events()
+
+local num_events = 100000
+local fired = 0
+local function on_fire()
+    fired = fired + 1
+end
+
+-- Spread over 10 seconds, like a busy scene full of respawns, fades and AI ticks.
+local before = micros()
+local handles = {}
+for i = 1, num_events do
+    handles[i] = future_event(math.random() * 10, on_fire)
+end
+local schedule_us = micros() - before
+
+local cancelled = 0
+for i = 1, num_events, 10 do
+    if cancel_event(handles[i]) then
+        cancelled = cancelled + 1
+    end
+end
+if cancel_event(handles[1]) then
+    error("Event cancelled twice.")
+end
+
+-- Step at 60Hz until everything is due.
+before = micros()
+for i = 1, 11 * 60 do
+    do_events(1 / 60)
+end
+local fire_us = micros() - before
+
+if fired + cancelled ~= num_events then
+    error("Fired " .. fired .. " and cancelled " .. cancelled .. " of " .. num_events .. " events.")
+end
+
+-- Repeating events keep their handle.
+local repeats = 0
+local h = future_event(0.1, function()
+    repeats = repeats + 1
+    return 0.1
+end)
+for i = 1, 60 do
+    do_events(1 / 60)
+end
+if not cancel_event(h) or repeats == 0 then
+    error("Repeating event could not be cancelled.")
+end
+
+print(("Scheduled %d events in %d us (%.1f per ms)"):format(num_events, schedule_us, num_events / schedule_us * 1000))
+print(("Fired %d events in %d us (%.1f per ms)"):format(fired, fire_us, fired / fire_us * 1000))
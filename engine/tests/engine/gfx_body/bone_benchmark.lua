@@ -0,0 +1,76 @@
+-- CPU time to pose animated skeletons and build their bone matrixes each frame, on one thread and
+-- on all of them.  Skinned.mesh is Money.mesh skinned to a 24 bone skeleton with one looping
+-- animation.  The bodies are placed behind the camera, so the time is not hidden by rendering.
+
+gfx_colour_grade(`neutral.lut.png`)
+gfx_fade_dither_map `stipple.png`
+
+gfx_register_shader(`Money`, {
+    tex = {
+        uniformKind = "TEXTURE2D",
+    },
+    vertexCode = [[
+        var normal_ws = rotate_to_world(vert.normal.xyz);
+    ]],
+    dangsCode = [[
+        out.diffuse = sample(mat.tex, vert.coord0.xy).rgb;
+        out.gloss = 0;
+        out.specular = 0;
+        out.normal = normal_ws;
+    ]],
+})
+
+-- Used by Skinned.mesh.
+register_material(`Money`, {
+    shader = `Money`,
+    tex = `Money_d.dds`,
+})
+
+disk_resource_load(`Money_d.dds`)
+disk_resource_load(`Skinned.mesh`)
+
+gfx_option('SHADOW_CAST', false)
+
+local cam_pos = vec(0, 0, 2)
+local cam_dir = quat(1, 0, 0, 0)
+local frames = 20
+
+local function benchmark(num_bodies, threads)
+    gfx_option('ANIMATION_THREADS', threads)
+    local bodies = {}
+    for i = 1, num_bodies do
+        local b = gfx_body_make(`Skinned.mesh`)
+        b.castShadows = false
+        b.localPosition = vec(i % 100, -10 - math.floor(i / 100), 0)
+        b:setAnimationMask('Walk', 1)
+        bodies[i] = b
+    end
+
+    local total_pose, total_palette = 0, 0
+    for f = 1, frames do
+        for i = 1, num_bodies do
+            bodies[i]:setAnimationPosNormalised('Walk', (f / frames + i / num_bodies) % 1)
+        end
+        gfx_render(0.1, cam_pos, cam_dir)
+        local skeletons, bones, pose_us, palette_us = gfx_bone_update_stats()
+        if skeletons ~= num_bodies then
+            error(("Posed %d skeletons, expected %d"):format(skeletons, num_bodies))
+        end
+        total_pose = total_pose + pose_us
+        total_palette = total_palette + palette_us
+    end
+    print(("%5d skeletons, %s: pose %8.1f us/frame, palette %7.1f us/frame"):format(
+          num_bodies, threads == 1 and "1 thread   " or "all threads",
+          total_pose / frames, total_palette / frames))
+
+    for i = 1, num_bodies do
+        bodies[i]:destroy()
+    end
+end
+
+for _, n in ipairs({10, 200, 1000}) do
+    benchmark(n, 1)
+    benchmark(n, 0)
+end
+
+gfx_option('ANIMATION_THREADS', 0)
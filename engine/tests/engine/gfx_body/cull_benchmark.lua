@@ -0,0 +1,79 @@
+-- Time to cull a field of bodies that surrounds the camera, so most of them are outside the view
+-- frustum.  Also checks that the culled and visible counts add up to the number of bodies.
+
+gfx_colour_grade(`neutral.lut.png`)
+gfx_fade_dither_map `stipple.png`
+
+gfx_register_shader(`Money`, {
+    tex = {
+        uniformKind = "TEXTURE2D",
+    },
+    vertexCode = [[
+        var normal_ws = rotate_to_world(vert.normal.xyz);
+    ]],
+    dangsCode = [[
+        out.diffuse = sample(mat.tex, vert.coord0.xy).rgb;
+        out.gloss = 0;
+        out.specular = 0;
+        out.normal = normal_ws;
+    ]],
+})
+
+-- Used by Money.mesh.
+register_material(`Money`, {
+    shader = `Money`,
+    tex = `Money_d.dds`,
+})
+
+disk_resource_load(`Money_d.dds`)
+disk_resource_load(`Money.mesh`)
+
+gfx_option('SHADOW_CAST', false)
+
+local cam_pos = vec(0, 0, 2)
+local cam_dir = quat(1, 0, 0, 0)
+local frames = 20
+
+local function gbuffer_cull_stats()
+    -- The left gbuffer stats follow the 3 shadow stats.
+    local visible, culled, micros = select(10, gfx_cull_stats())
+    local occluded = select(4, gfx_occlusion_stats())
+    return visible, culled + occluded, micros
+end
+
+local function benchmark(side)
+    local bodies = {}
+    local spacing = 4
+    for y = 1, side do
+        for x = 1, side do
+            local b = gfx_body_make(`Money.mesh`)
+            b.castShadows = false
+            b.localPosition = vec((x - side / 2) * spacing, (y - side / 2) * spacing, 0)
+            bodies[#bodies + 1] = b
+        end
+    end
+
+    -- Compile everything before timing.
+    gfx_render(0.1, cam_pos, cam_dir)
+
+    local total_visible, total_micros = 0, 0
+    for f = 1, frames do
+        gfx_render(0.1, cam_pos, cam_dir)
+        local visible, culled, micros = gbuffer_cull_stats()
+        if visible + culled ~= #bodies then
+            error(("Culled %d and kept %d of %d bodies"):format(culled, visible, #bodies))
+        end
+        total_visible = total_visible + visible
+        total_micros = total_micros + micros
+    end
+    print(("%6d bodies: %6.0f visible, %8.1f us/frame culling"):format(
+          #bodies, total_visible / frames, total_micros / frames))
+
+    for i = 1, #bodies do
+        bodies[i]:destroy()
+    end
+end
+
+for _, side in ipairs({10, 100, 300}) do
+    benchmark(side)
+end
@@ -0,0 +1,102 @@
+-- A synthetic city: blocks of buildings with street furniture between and behind them, seen from
+-- street level.  The buildings are occluders, so most of the furniture is hidden.  Compares the
+-- gbuffer time and the number of objects drawn with and without occlusion culling.
+
+gfx_colour_grade(`neutral.lut.png`)
+gfx_fade_dither_map `stipple.png`
+
+gfx_register_shader(`Money`, {
+    tex = {
+        uniformKind = "TEXTURE2D",
+    },
+    vertexCode = [[
+        var normal_ws = rotate_to_world(vert.normal.xyz);
+    ]],
+    dangsCode = [[
+        out.diffuse = sample(mat.tex, vert.coord0.xy).rgb;
+        out.gloss = 0;
+        out.specular = 0;
+        out.normal = normal_ws;
+    ]],
+})
+
+-- Used by Money.mesh.
+register_material(`Money`, {
+    shader = `Money`,
+    tex = `Money_d.dds`,
+})
+
+disk_resource_load(`Money_d.dds`)
+disk_resource_load(`Money.mesh`)
+
+gfx_option('SHADOW_CAST', false)
+
+-- Money.mesh is a box of about 0.155 x 0.065 x 0.029.
+local mesh_size = vec(0.155, 0.065, 0.029)
+
+local block = 40
+local street = 10
+local blocks = 8
+local props_per_block = 50
+local frames = 20
+
+local cam_pos = vec(block / 2 + street / 2, 0, 2)
+local cam_dir = quat(1, 0, 0, 0)
+
+local objs = {}
+
+for bx = 0, blocks - 1 do
+    for by = 0, blocks - 1 do
+        local corner = vec(bx * (block + street) - block / 2, by * (block + street) + street, 0)
+        local building = gfx_body_make(`Money.mesh`)
+        building.localPosition = corner + vec(block / 2, block / 2, 30)
+        building.localScale = vec(block, block, 60) / mesh_size
+        building.occluder = true
+        objs[#objs + 1] = building
+        for i = 1, props_per_block do
+            -- Along the street in front of the block and its side.
+            local prop = gfx_body_make(`Money.mesh`)
+            local along = math.random() * (block + street)
+            if i % 2 == 0 then
+                prop.localPosition = corner + vec(along, -street / 2, 1)
+            else
+                prop.localPosition = corner + vec(-street / 2, along, 1)
+            end
+            prop.localScale = vec(10, 10, 10)
+            objs[#objs + 1] = prop
+        end
+    end
+end
+
+local function gbuffer_stats()
+    -- The left gbuffer stats follow the 3 shadow stats.
+    local batches, triangles, micros = select(10, gfx_last_frame_stats())
+    local visible, culled, cull_micros = select(10, gfx_cull_stats())
+    local occluded = select(4, gfx_occlusion_stats())
+    return micros, visible, occluded, cull_micros
+end
+
+local function benchmark(occlusion)
+    gfx_option('OCCLUSION_CULL', occlusion)
+    -- Compile everything before timing.
+    gfx_render(0.1, cam_pos, cam_dir)
+    local total_micros, total_visible, total_occluded, total_cull_micros = 0, 0, 0, 0
+    for f = 1, frames do
+        gfx_render(0.1, cam_pos, cam_dir)
+        local micros, visible, occluded, cull_micros = gbuffer_stats()
+        total_micros = total_micros + micros
+        total_visible = total_visible + visible
+        total_occluded = total_occluded + occluded
+        total_cull_micros = total_cull_micros + cull_micros
+    end
+    print(("Occlusion %-5s: %6d objects, %6.0f drawn, %6.0f occluded, %8.1f us culling, %8.1f us gbuffer"):format(
+          tostring(occlusion), #objs, total_visible / frames, total_occluded / frames,
+          total_cull_micros / frames, total_micros / frames))
+end
+
+benchmark(false)
+benchmark(true)
+
+for i = 1, #objs do
+    objs[i]:destroy()
+end
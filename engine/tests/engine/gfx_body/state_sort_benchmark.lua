@@ -0,0 +1,109 @@
+-- Bodies using materials of two shaders, placed at random so that neither queue order nor
+-- distance groups them.  Compares the state changes between consecutive draws, and the gbuffer
+-- time, with and without sorting the draws by state.
+
+gfx_colour_grade(`neutral.lut.png`)
+gfx_fade_dither_map `stipple.png`
+
+gfx_register_shader(`Plain`, {
+    tex = {
+        uniformKind = "TEXTURE2D",
+    },
+    vertexCode = [[
+        var normal_ws = rotate_to_world(vert.normal.xyz);
+    ]],
+    dangsCode = [[
+        out.diffuse = sample(mat.tex, vert.coord0.xy).rgb;
+        out.gloss = 0;
+        out.specular = 0;
+        out.normal = normal_ws;
+    ]],
+})
+
+gfx_register_shader(`Tinted`, {
+    tex = {
+        uniformKind = "TEXTURE2D",
+    },
+    tint = {
+        uniformKind = "PARAM",
+        valueKind = "FLOAT",
+        1, 1, 1,
+    },
+    vertexCode = [[
+        var normal_ws = rotate_to_world(vert.normal.xyz);
+    ]],
+    dangsCode = [[
+        out.diffuse = sample(mat.tex, vert.coord0.xy).rgb * mat.tint;
+        out.gloss = 0;
+        out.specular = 0;
+        out.normal = normal_ws;
+    ]],
+})
+
+-- Used by Money.mesh.
+register_material(`Money`, {
+    shader = `Plain`,
+    tex = `Money_d.dds`,
+})
+
+local materials = { `Money` }
+for i = 1, 7 do
+    local name = `Money` .. i
+    register_material(name, i % 2 == 0 and {
+        shader = `Plain`,
+        tex = `Money_d.dds`,
+    } or {
+        shader = `Tinted`,
+        tex = `Money_d.dds`,
+        tint = vec(1, i / 7, 1 - i / 7),
+    })
+    materials[#materials + 1] = name
+end
+
+disk_resource_load(`Money_d.dds`)
+disk_resource_load(`Money.mesh`)
+
+gfx_option('SHADOW_CAST', false)
+
+local cam_pos = vec(0, 0, 2)
+local cam_dir = quat(1, 0, 0, 0)
+local frames = 20
+
+local num_bodies = 5000
+local bodies = {}
+for i = 1, num_bodies do
+    local b = gfx_body_make(`Money.mesh`)
+    b.castShadows = false
+    b:setAllMaterials(materials[math.random(#materials)])
+    b.localPosition = vec(math.random(-50, 50), math.random(5, 100), math.random(-10, 10))
+    bodies[i] = b
+end
+
+local function benchmark(sort)
+    gfx_option('STATE_SORT', sort)
+    -- Compile everything before timing.
+    gfx_render(0.1, cam_pos, cam_dir)
+    local totals = { 0, 0, 0, 0, 0, 0 }
+    for f = 1, frames do
+        gfx_render(0.1, cam_pos, cam_dir)
+        local draws, programs, passes, buffers, sort_micros = gfx_draw_state_stats()
+        -- The left gbuffer stats follow the 3 shadow stats, 3 values each.
+        local gbuffer_micros = select(12, gfx_last_frame_stats())
+        local frame = { draws, programs, passes, buffers, sort_micros, gbuffer_micros }
+        for i = 1, #totals do
+            totals[i] = totals[i] + frame[i]
+        end
+    end
+    for i = 1, #totals do
+        totals[i] = totals[i] / frames
+    end
+    print(("Sort %-5s: %6.0f draws, %5.0f program, %5.0f pass, %5.0f buffer changes, "
+           .. "%7.1f us sorting, %8.1f us gbuffer"):format(tostring(sort), unpack(totals)))
+end
+
+benchmark(false)
+benchmark(true)
+
+for i = 1, num_bodies do
+    bodies[i]:destroy()
+end
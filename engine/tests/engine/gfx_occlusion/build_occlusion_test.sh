@@ -0,0 +1,3 @@
+#!/bin/bash
+
+g++ -Wall -Wextra -std=c++11 -O2 -I../../../../dependencies/grit-util occlusion_test.cpp ../../../gfx/gfx_occlusion.cpp -o occlusion_test
@@ -0,0 +1,194 @@
+// Checks GfxOcclusionBuffer on the CPU alone.  Known occluders are rasterised, then boxes that
+// they hide completely must be culled, and boxes that are partly visible, or that cross the near
+// clip plane, must never be.  The camera is at the origin looking down -z, as in OpenGL.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "../../../gfx/gfx_occlusion.h"
+
+static const unsigned width = 256;
+static const unsigned height = 144;
+static const float near_dist = 0.3f;
+static const float far_dist = 800;
+
+static unsigned failures = 0;
+
+static void check (bool ok, const char *what)
+{
+    if (ok) return;
+    std::cerr << "FAILED: " << what << std::endl;
+    failures++;
+}
+
+static GfxOcclusionMatrix perspective (void)
+{
+    GfxOcclusionMatrix m = { };
+    float t = 1 / std::tan(0.5f);
+    m.m[0][0] = t * height / width;
+    m.m[1][1] = t;
+    m.m[2][2] = (far_dist + near_dist) / (near_dist - far_dist);
+    m.m[2][3] = 2 * far_dist * near_dist / (near_dist - far_dist);
+    m.m[3][2] = -1;
+    return m;
+}
+
+// An axis aligned box, as an occluder mesh and as a box to test.
+struct Box {
+    Vector3 min, max;
+    float positions[24];
+    uint32_t indexes[36];
+
+    Box (const Vector3 &min, const Vector3 &max) : min(min), max(max)
+    {
+        for (unsigned i = 0 ; i < 8 ; ++i) {
+            positions[i * 3 + 0] = i & 1 ? max.x : min.x;
+            positions[i * 3 + 1] = i & 2 ? max.y : min.y;
+            positions[i * 3 + 2] = i & 4 ? max.z : min.z;
+        }
+        static const unsigned faces[6][4] = {
+            {0, 1, 3, 2}, {4, 5, 7, 6}, {0, 1, 5, 4}, {2, 3, 7, 6}, {0, 2, 6, 4}, {1, 3, 7, 5},
+        };
+        for (unsigned f = 0 ; f < 6 ; ++f) {
+            const unsigned *q = faces[f];
+            const unsigned tri[6] = { q[0], q[1], q[2], q[0], q[2], q[3] };
+            for (unsigned k = 0 ; k < 6 ; ++k) indexes[f * 6 + k] = tri[k];
+        }
+    }
+
+    // Whether the box is in the way of the segment from the eye to p.
+    bool hits (const Vector3 &p) const
+    {
+        float lo[3] = { min.x, min.y, min.z }, hi[3] = { max.x, max.y, max.z };
+        float d[3] = { p.x, p.y, p.z };
+        float t0 = 0, t1 = 1;
+        for (unsigned a = 0 ; a < 3 ; ++a) {
+            if (d[a] == 0) {
+                if (lo[a] > 0 || hi[a] < 0) return false;
+                continue;
+            }
+            float ta = lo[a] / d[a], tb = hi[a] / d[a];
+            if (ta > tb) std::swap(ta, tb);
+            t0 = std::max(t0, ta);
+            t1 = std::min(t1, tb);
+        }
+        // Stop short of p, so a box does not hide itself.
+        return t0 <= t1 && t0 < 0.999f;
+    }
+};
+
+static bool occluded (const GfxOcclusionBuffer &buf, const Box &b)
+{
+    return buf.isOccluded(perspective(), b.min, b.max);
+}
+
+// A wall 10 wide and 10 high, 10 in front of the camera, centred on the view.
+static void wall_cases (void)
+{
+    GfxOcclusionBuffer buf(width, height);
+    Box wall(Vector3(-5, -5, -11), Vector3(5, 5, -10));
+    buf.addOccluder(perspective(), wall.positions, wall.indexes, 36);
+    buf.finish();
+
+    check(occluded(buf, Box(Vector3(-1, -1, -30), Vector3(1, 1, -28))),
+          "box directly behind the wall is culled");
+    check(occluded(buf, Box(Vector3(-8, -8, -40), Vector3(8, 8, -38))),
+          "box larger than the wall but far enough behind it is culled");
+    check(!occluded(buf, Box(Vector3(-1, -1, -8), Vector3(1, 1, -6))),
+          "box in front of the wall is not culled");
+    check(!occluded(buf, Box(Vector3(-1, -1, -12), Vector3(1, 1, -9))),
+          "box intersecting the wall is not culled");
+    check(!occluded(buf, Box(Vector3(4, -1, -30), Vector3(20, 1, -28))),
+          "box sticking out past the edge of the wall is not culled");
+    check(!occluded(buf, Box(Vector3(-1, -1, -30), Vector3(1, 1, 5))),
+          "box behind the wall that crosses the near plane is not culled");
+    check(!occluded(buf, Box(Vector3(-0.1f, -0.1f, -0.5f), Vector3(0.1f, 0.1f, -0.2f))),
+          "box straddling the near plane is not culled");
+    check(!occluded(buf, Box(Vector3(100, -1, -30), Vector3(102, 1, -28))),
+          "box off to the side is not culled");
+
+    // Behind the wall, reaching past the silhouette of its near face by a fraction of a pixel.
+    // Pixels are square, so a pixel spans this much of x / -z in both directions.
+    float pixel = 2 * std::tan(0.5f) / height;
+    for (float frac = 0.05f ; frac < 1 ; frac += 0.1f) {
+        float reach = 29.9f * (0.5f + frac * pixel);
+        check(!occluded(buf, Box(Vector3(0, -1, -30), Vector3(reach, 1, -29.9f))),
+              "box reaching a fraction of a pixel past the wall is not culled");
+    }
+}
+
+// Triangles crossing the near plane are skipped, so cannot hide anything, even though this
+// slanted quad really does hide the box.
+static void near_plane_occluder (void)
+{
+    GfxOcclusionBuffer buf(width, height);
+    const float positions[] = { -5, -5, -10,  5, -5, -10,  5, 5, 1,  -5, 5, 1 };
+    const uint32_t indexes[] = { 0, 1, 2,  0, 2, 3 };
+    buf.addOccluder(perspective(), positions, indexes, 6);
+    buf.finish();
+    check(!occluded(buf, Box(Vector3(-1, -1, -30), Vector3(1, 1, -28))),
+          "occluder crossing the near plane hides nothing");
+}
+
+// A street of buildings, and many boxes at random, each checked against rays to points all over
+// its surface.  Any culled box with a point that no building hides is a failure.
+static void random_cases (void)
+{
+    GfxOcclusionBuffer buf(width, height);
+    std::vector<Box> buildings;
+    for (int gx = -4 ; gx < 4 ; ++gx) {
+        for (int gz = 1 ; gz <= 8 ; ++gz) {
+            buildings.emplace_back(Vector3(gx * 30 + 5.0f, -2, -gz * 30.0f),
+                                   Vector3(gx * 30 + 25.0f, 38, -gz * 30.0f + 20));
+        }
+    }
+    for (const Box &b : buildings)
+        buf.addOccluder(perspective(), b.positions, b.indexes, 36);
+    buf.finish();
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> x(-120, 120), y(-2, 8), z(-260, -1);
+    unsigned culled = 0, wrong = 0;
+    const unsigned n = 10000;
+    for (unsigned i = 0 ; i < n ; ++i) {
+        Vector3 min(x(rng), y(rng), z(rng));
+        Box box(min, Vector3(min.x + 1, min.y + 1, min.z + 1));
+        if (!occluded(buf, box)) continue;
+        culled++;
+        bool visible = false;
+        for (unsigned s = 0 ; s < 6 * 6 * 6 && !visible ; ++s) {
+            Vector3 p(min.x + (s % 6) / 5.0f, min.y + (s / 6 % 6) / 5.0f,
+                      min.z + (s / 36) / 5.0f);
+            bool hidden = false;
+            for (const Box &b : buildings) {
+                if (b.hits(p)) {
+                    hidden = true;
+                    break;
+                }
+            }
+            visible = !hidden;
+        }
+        if (visible) wrong++;
+    }
+    std::cout << "Random boxes: " << culled << " of " << n << " culled, " << wrong
+              << " of them partly visible." << std::endl;
+    check(wrong == 0, "no partly visible random box is culled");
+    check(culled > n / 2, "most random boxes behind the street are culled");
+}
+
+int main (void)
+{
+    wall_cases();
+    near_plane_occluder();
+    random_cases();
+    if (failures > 0) {
+        std::cerr << failures << " checks failed." << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "All checks passed." << std::endl;
+    return EXIT_SUCCESS;
+}
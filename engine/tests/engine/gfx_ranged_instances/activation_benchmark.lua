@@ -0,0 +1,71 @@
+-- Per-frame cost of activating / fading GfxRangedInstances items around a moving camera.
+
+gfx_colour_grade(`neutral.lut.png`)
+gfx_fade_dither_map `stipple.png`
+
+gfx_register_shader(`Money`, {
+    tex = {
+        uniformKind = "TEXTURE2D",
+    },
+    vertexCode = [[
+        var normal_ws = rotate_to_world(vert.normal.xyz);
+    ]],
+    dangsCode = [[
+        out.diffuse = sample(mat.tex, vert.coord0.xy).rgb;
+        out.gloss = 0;
+        out.specular = 0;
+        out.normal = normal_ws;
+    ]],
+})
+
+register_material(`Money`, {
+    shader = `Money`,
+    tex = `Money_d.dds`,
+    additionalLighting = false,
+})
+
+disk_resource_load(`Money_d.dds`)
+disk_resource_load(`Money.mesh`)
+
+local function bench(num_items)
+    local b = gfx_ranged_instances_make(`Money.mesh`)
+    b.castShadows = false
+    -- About one item per 4 square metres, e.g. grass or rocks.
+    local side = math.sqrt(num_items) * 2
+    local before = micros()
+    for i = 1, num_items do
+        b:addItem(vec(math.random() * side, math.random() * side, 0), quat(1, 0, 0, 0))
+    end
+    local add_us = micros() - before
+
+    local centre = vec(side / 2, side / 2, 1.5)
+    streamer_centre(centre)
+
+    local frames = 500
+    before = micros()
+    for f = 1, frames do
+        streamer_centre(centre)
+    end
+    local still_us = micros() - before
+
+    -- Walking pace at 60Hz.
+    before = micros()
+    for f = 1, frames do
+        streamer_centre(centre + vec(f * 0.025, 0, 0))
+    end
+    local walk_us = micros() - before
+
+    -- Driving pace at 60Hz.
+    before = micros()
+    for f = 1, frames do
+        streamer_centre(centre + vec(f * 0.5, 0, 0))
+    end
+    local drive_us = micros() - before
+
+    print(("%8d items: added in %d ms, %d active; per frame still %.1f us, walking %.1f us, driving %.1f us"):format(
+          num_items, add_us / 1000, b.instances, still_us / frames, walk_us / frames, drive_us / frames))
+    b:destroy()
+end
+
+bench(100000)
+bench(1000000)
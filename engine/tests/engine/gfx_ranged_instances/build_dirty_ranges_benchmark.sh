@@ -0,0 +1,3 @@
+#!/bin/bash
+
+g++ -Wall -Wextra -std=c++11 -O2 dirty_ranges_benchmark.cpp -o dirty_ranges_benchmark
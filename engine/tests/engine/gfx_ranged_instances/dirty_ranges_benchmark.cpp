@@ -0,0 +1,146 @@
+// Instance buffer upload traffic and CPU time of GfxDirtyRanges, against a mock GPU buffer so it
+// runs without a window or Ogre.  The host array is changed the way GfxInstances::update and
+// GfxInstances::del change it, then flushed into the mock buffer, which is checked against the
+// host array after every frame.  Each case is also timed re-uploading the whole buffer whenever
+// anything changed, which is what GfxInstances did before it tracked ranges.
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "../../../gfx/gfx_dirty_ranges.h"
+
+// As in gfx_instances.cpp.
+static const unsigned instance_data_floats = 13;
+static const unsigned instance_data_bytes = instance_data_floats*4;
+
+static const unsigned num_instances = 50000;
+static const unsigned frames = 30;
+
+struct MockBuffer {
+    std::vector<float> data;
+    unsigned long bytes;
+    unsigned long writes;
+    unsigned long fullUploads;
+
+    MockBuffer (void) : bytes(0), writes(0), fullUploads(0) { }
+
+    void writeData (unsigned from, unsigned to, const std::vector<float> &host, bool discard)
+    {
+        if (data.size() < host.size()) data.resize(host.size());
+        std::memcpy(&data[from * instance_data_floats], &host[from * instance_data_floats],
+                    (to - from) * instance_data_bytes);
+        bytes += (to - from) * instance_data_bytes;
+        writes++;
+        if (discard) fullUploads++;
+    }
+};
+
+struct Instances {
+    std::vector<float> host;
+    GfxDirtyRanges dirty;
+    bool ranges;
+    MockBuffer gpu;
+
+    Instances (bool ranges)
+      : host(num_instances * instance_data_floats), dirty(instance_data_bytes), ranges(ranges)
+    {
+        for (unsigned i=0 ; i<host.size() ; ++i) host[i] = float(i);
+        dirty.markAll();
+    }
+
+    unsigned size (void) const { return host.size() / instance_data_floats; }
+
+    void update (unsigned i, float fade)
+    {
+        host[i * instance_data_floats + 12] = fade;
+        dirty.mark(i, size());
+    }
+
+    void del (unsigned i)
+    {
+        unsigned last = size() - 1;
+        if (i != last) {
+            for (unsigned j=0 ; j<instance_data_floats ; ++j)
+                host[i * instance_data_floats + j] = host[last * instance_data_floats + j];
+            dirty.mark(i, last);
+        }
+        host.resize(last * instance_data_floats);
+    }
+
+    void copyToGPU (void)
+    {
+        if (dirty.empty()) return;
+        if (!ranges) {
+            dirty.markAll();
+            dirty.flush(size(), [] (unsigned, unsigned, bool) { });
+            gpu.writeData(0, size(), host, true);
+            return;
+        }
+        auto upload = [this] (unsigned from, unsigned to, bool discard) {
+            gpu.writeData(from, to, host, discard);
+        };
+        dirty.flush(size(), upload);
+    }
+
+    void check (void) const
+    {
+        if (std::memcmp(&gpu.data[0], &host[0], host.size() * sizeof(float)) != 0) {
+            std::cerr << "Mock buffer does not match the host array." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+};
+
+// Change n instances per frame (or delete them if del), after the initial upload.
+static void benchmark (bool ranges, unsigned n, bool del)
+{
+    std::mt19937 rng(42);
+    Instances insts(ranges);
+    insts.copyToGPU();
+    insts.check();
+    insts.gpu = MockBuffer();
+    insts.gpu.data = insts.host;
+
+    double total_micros = 0;
+    for (unsigned f=0 ; f<frames ; ++f) {
+        auto before = std::chrono::steady_clock::now();
+        for (unsigned j=0 ; j<n ; ++j) {
+            unsigned i = rng() % insts.size();
+            if (del) {
+                insts.del(i);
+            } else {
+                insts.update(i, (f % 10) / 10.0f);
+            }
+        }
+        insts.copyToGPU();
+        auto after = std::chrono::steady_clock::now();
+        total_micros += std::chrono::duration<double, std::micro>(after - before).count();
+        insts.check();
+    }
+
+    std::cout << (ranges ? "ranges" : "whole ") << "  "
+              << n << (del ? " deletes" : " updates") << "/frame: "
+              << insts.gpu.bytes / frames << " bytes/frame, "
+              << double(insts.gpu.writes) / frames << " writes/frame, "
+              << insts.gpu.fullUploads << " full uploads, "
+              << total_micros / frames << " us/frame" << std::endl;
+}
+
+int main (void)
+{
+    unsigned counts[] = { 1, 10, 100, 10000, 40000 };
+    for (unsigned n : counts) {
+        benchmark(false, n, false);
+        benchmark(true, n, false);
+    }
+    unsigned del_counts[] = { 1, 10, 100 };
+    for (unsigned n : del_counts) {
+        benchmark(false, n, true);
+        benchmark(true, n, true);
+    }
+    return EXIT_SUCCESS;
+}
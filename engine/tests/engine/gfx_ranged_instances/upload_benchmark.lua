@@ -0,0 +1,80 @@
+-- Instance buffer upload traffic for a large GfxInstances when only a few instances change.
+
+gfx_colour_grade(`neutral.lut.png`)
+gfx_fade_dither_map `stipple.png`
+
+gfx_register_shader(`Money`, {
+    tex = {
+        uniformKind = "TEXTURE2D",
+    },
+    vertexCode = [[
+        var normal_ws = rotate_to_world(vert.normal.xyz);
+    ]],
+    dangsCode = [[
+        out.diffuse = sample(mat.tex, vert.coord0.xy).rgb;
+        out.gloss = 0;
+        out.specular = 0;
+        out.normal = normal_ws;
+    ]],
+})
+
+register_material(`Money`, {
+    shader = `Money`,
+    tex = `Money_d.dds`,
+    additionalLighting = false,
+})
+
+disk_resource_load(`Money_d.dds`)
+disk_resource_load(`Money.mesh`)
+
+local cam_pos = vec(0, -10, 10)
+local cam_dir = quat(0.9238795, -0.3826834, 0, 0)
+
+local num_instances = 50000
+local b = gfx_instances_make(`Money.mesh`)
+b.castShadows = false
+local handles = {}
+for i = 1, num_instances do
+    handles[i] = b:add(vec(i % 250, math.floor(i / 250), 0), quat(1, 0, 0, 0), 1)
+end
+
+-- The first frame uploads everything.
+gfx_render(0.1, cam_pos, cam_dir)
+local bytes, writes, full = gfx_instances_upload_stats()
+print(("Initial upload: %d bytes in %d writes (%d full)"):format(bytes, writes, full))
+gfx_render(0.1, cam_pos, cam_dir)
+bytes = gfx_instances_upload_stats()
+if bytes ~= 0 then
+    error("Unchanged instances uploaded " .. bytes .. " bytes.")
+end
+
+local function fade_some(n, frames)
+    local total_bytes, total_writes, total_full = 0, 0, 0
+    local before = micros()
+    for f = 1, frames do
+        for j = 1, n do
+            local i = math.random(num_instances)
+            b:update(handles[i], vec(i % 250, math.floor(i / 250), 0), quat(1, 0, 0, 0), (f % 10) / 10)
+        end
+        gfx_render(0.1, cam_pos, cam_dir)
+        bytes, writes, full = gfx_instances_upload_stats()
+        total_bytes = total_bytes + bytes
+        total_writes = total_writes + writes
+        total_full = total_full + full
+    end
+    local us = micros() - before
+    print(("%5d updates/frame: %9.0f bytes/frame, %5.1f writes/frame, %d full uploads, %.1f ms/frame"):format(
+          n, total_bytes / frames, total_writes / frames, total_full, us / frames / 1000))
+    return total_bytes / frames
+end
+
+local one = fade_some(1, 30)
+if one > 1000 then
+    error("Updating a single instance uploaded " .. one .. " bytes per frame.")
+end
+fade_some(10, 30)
+fade_some(100, 30)
+fade_some(10000, 30)
+fade_some(40000, 30)
+
+b:destroy()
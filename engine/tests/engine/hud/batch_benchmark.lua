@@ -0,0 +1,48 @@
+-- Draw calls and CPU time of the HUD with thousands of elements.  Consecutive rects sharing a
+-- texture are drawn in one batch, every tenth rect has a label that switches to the font texture.
+
+include `font_impact50.lua`
+gfx_colour_grade(`neutral.lut.png`)
+gfx_option('POST_PROCESSING', false)
+
+gfx_hud_class_add(`Rect`, {
+})
+
+local frames = 30
+
+local function benchmark(desc, num)
+    local objs = {}
+    for i = 1, num do
+        local obj = gfx_hud_object_add(`Rect`)
+        obj.position = vec(math.random(0, 1024), math.random(0, 768))
+        obj.size = vec(32, 32)
+        obj.texture = `speech-bubble.png`
+        obj.cornered = i % 2 == 0
+        obj.colour = vec(math.random(), math.random(), math.random())
+        obj.zOrder = i % 4
+        objs[#objs + 1] = obj
+        if i % 10 == 0 then
+            local t = gfx_hud_text_add(`Impact50`)
+            t.parent = obj
+            t.text = "Label " .. i
+            objs[#objs + 1] = t
+        end
+    end
+    local total_batches, total_micros = 0, 0
+    for f = 1, frames do
+        gfx_render(0.1, vec(0, 0, 0), quat(1, 0, 0, 0))
+        local batches, triangles, micros = gfx_hud_render_stats()
+        total_batches = total_batches + batches
+        total_micros = total_micros + micros
+    end
+    print(("%6d %s: %6.1f draw calls/frame, %8.1f us/frame"):format(
+          num, desc, total_batches / frames, total_micros / frames))
+    -- Labels before their parents.
+    for i = #objs, 1, -1 do
+        objs[i]:destroy()
+    end
+end
+
+for _, n in ipairs({100, 1000, 10000}) do
+    benchmark("rects", n)
+end
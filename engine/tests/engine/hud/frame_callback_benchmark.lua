@@ -0,0 +1,44 @@
+-- CPU time of a frame with a large static HUD, where only a handful of objects animate.  Objects
+-- that do not set needsFrameCallbacks should not contribute to the frame time.
+
+gfx_colour_grade(`neutral.lut.png`)
+gfx_option('POST_PROCESSING', false)
+
+gfx_hud_class_add(`Static`, {
+})
+
+gfx_hud_class_add(`Spinner`, {
+    init = function (self)
+        self.needsFrameCallbacks = true
+    end,
+    frameCallback = function (self, elapsed)
+        self.orientation = (self.orientation + 90 * elapsed) % 360
+    end,
+})
+
+local frames = 30
+local animated = 10
+
+local function benchmark(num)
+    local objs = {}
+    for i = 1, num do
+        local obj = gfx_hud_object_add(i <= animated and `Spinner` or `Static`)
+        obj.position = vec(math.random(0, 1024), math.random(0, 768))
+        obj.size = vec(32, 32)
+        obj.texture = `speech-bubble.png`
+        objs[#objs + 1] = obj
+    end
+    local before = micros()
+    for f = 1, frames do
+        gfx_render(0.1, vec(0, 0, 0), quat(1, 0, 0, 0))
+    end
+    local total = micros() - before
+    print(("%6d objects, %d animated: %8.1f us/frame"):format(num, animated, total / frames))
+    for i = #objs, 1, -1 do
+        objs[i]:destroy()
+    end
+end
+
+for _, n in ipairs({100, 1000, 10000}) do
+    benchmark(n)
+end
@@ -0,0 +1,33 @@
+-- CPU time to append 100k lines to a scrolling text buffer, like the console or a chat log, and
+-- keep its last page on screen.  A frame is rendered every 100 lines.
+
+include `font_impact50.lua`
+gfx_colour_grade(`neutral.lut.png`)
+gfx_option('POST_PROCESSING', false)
+
+local lines = 100000
+local lines_per_frame = 100
+local page = vec(800, 600)
+
+local t = gfx_hud_text_add(`Impact50`)
+t.position = vec(512, 384)
+t.textWrap = page
+
+local before = micros()
+local render_micros = 0
+for i = 1, lines do
+    t:append("Player" .. i .. ": the quick brown fox jumped over the lazy dog.\n")
+    if i % lines_per_frame == 0 then
+        t.scroll = math.max(0, t.bufferHeight - page.y)
+        local before_render = micros()
+        gfx_render(0.1, vec(0, 0, 0), quat(1, 0, 0, 0))
+        render_micros = render_micros + micros() - before_render
+    end
+end
+local total = micros() - before
+
+print(("%d lines: %.1f ms total, %.1f us/line appending, %.1f us/frame rendering"):format(
+      lines, total / 1000, (total - render_micros) / lines,
+      render_micros / (lines / lines_per_frame)))
+
+t:destroy()
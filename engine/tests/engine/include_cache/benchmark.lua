@@ -0,0 +1,41 @@
+-- Time spent loading included files, with and without the precompiled chunk cache.
+
+local iterations = 200
+
+local function run(enabled)
+    lua_chunk_cache_enabled(enabled)
+    lua_chunk_cache_reset_stats()
+    local before = micros()
+    for i = 1, iterations do
+        local defs = include `classes.lua`
+        if defs.Crate == nil then
+            error("Included file returned the wrong value.")
+        end
+    end
+    local total_us = micros() - before
+    return total_us, lua_chunk_cache_stats()
+end
+
+if not lua_chunk_cache_enabled() then
+    print("Chunk cache disabled (GRIT_LUA_CACHE is empty), nothing to compare.")
+    return
+end
+
+local source_us, source_stats = run(false)
+-- Populates the cache if this is the first run.
+run(true)
+local cached_us, cached_stats = run(true)
+lua_chunk_cache_enabled(true)
+
+if source_stats.hits ~= 0 or source_stats.misses ~= 0 then
+    error("Cache was used while disabled.")
+end
+if cached_stats.hits ~= iterations then
+    error(("Expected %d cache hits, got %d (%d misses, %d write failures, dir \"%s\")."):format(
+          iterations, cached_stats.hits, cached_stats.misses, cached_stats.writeFailures,
+          cached_stats.dir))
+end
+
+print(("Included %d times from source in %d us (%.1f us each)"):format(iterations, source_us, source_us / iterations))
+print(("Included %d times from cache in %d us (%.1f us each, %.1f us in lua_load)"):format(
+      iterations, cached_us, cached_us / iterations, cached_stats.loadSeconds * 1E6 / iterations))
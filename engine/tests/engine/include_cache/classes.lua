@@ -0,0 +1,67 @@
+-- Stands in for a typical game script: a batch of class definitions with callbacks.
+
+local defs = {}
+
+for _, name in ipairs({"Crate", "Barrel", "Lamp", "Door", "Tree", "Rock", "Fence", "Sign"}) do
+    defs[name] = {
+        renderingDistance = 150,
+        castShadows = true,
+        placementZOffset = 0.5,
+
+        init = function (persistent)
+            persistent.spawnCount = 0
+            persistent.lastSeen = nil
+        end,
+
+        activate = function (self, instance)
+            local p = self.persistent
+            p.spawnCount = p.spawnCount + 1
+            instance.health = self.health or 100
+            instance.damage = {}
+            instance.timers = { fade = 0, respawn = 0 }
+            if self.lightColour ~= nil then
+                instance.lightIntensity = (self.lightColour.x + self.lightColour.y + self.lightColour.z) / 3
+            end
+            return false
+        end,
+
+        deactivate = function (self)
+            local instance = self.instance
+            for k, _ in pairs(instance.damage) do
+                instance.damage[k] = nil
+            end
+            self.persistent.lastSeen = instance.health
+            return false
+        end,
+
+        receiveDamage = function (self, amount, kind)
+            local instance = self.instance
+            if kind == "fire" then
+                amount = amount * 2
+            elseif kind == "water" then
+                amount = amount / 2
+            end
+            instance.damage[#instance.damage + 1] = { amount = amount, kind = kind }
+            instance.health = math.max(0, instance.health - amount)
+            if instance.health == 0 then
+                self:destroy()
+            end
+        end,
+
+        stepCallback = function (self, elapsed)
+            local t = self.instance.timers
+            t.fade = t.fade + elapsed
+            t.respawn = math.max(0, t.respawn - elapsed)
+            if t.fade > 1 then
+                t.fade = 0
+            end
+        end,
+
+        describe = function (self)
+            local i = self.instance
+            return ("%s health=%d damage_events=%d"):format(name, i.health, #i.damage)
+        end,
+    }
+end
+
+return defs
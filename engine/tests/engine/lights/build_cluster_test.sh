@@ -0,0 +1,3 @@
+#!/bin/bash
+
+g++ -Wall -Wextra -std=c++11 -O2 -I../../../../dependencies/grit-util cluster_test.cpp -o cluster_test
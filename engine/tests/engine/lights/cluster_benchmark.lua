@@ -0,0 +1,54 @@
+-- CPU time to bin the lights of a city street into the clusters of the deferred lighting pass.
+-- Street lamps are spot lights pointing down, muzzle flashes are small point lights.  Nothing is
+-- rendered.
+
+local cam_pos = vec(0, 0, 2)
+local cam_quat = quat(1, 0, 0, 0)
+local iterations = 100
+
+local function street_lamp(pos)
+    local l = gfx_light_make()
+    l.localPosition = pos
+    l.localOrientation = quat(-90, vec(1, 0, 0))
+    l.range = 15
+    l.innerAngle = 30
+    l.outerAngle = 40
+    l.diffuseColour = vec(1, 0.8, 0.5)
+    l.specularColour = vec(1, 0.8, 0.5)
+    return l
+end
+
+local function muzzle_flash(pos)
+    local l = gfx_light_make()
+    l.localPosition = pos
+    l.range = 4
+    l.diffuseColour = vec(4, 3, 1)
+    l.specularColour = vec(4, 3, 1)
+    return l
+end
+
+local function benchmark(num_lamps, num_flashes)
+    local lights = {}
+    for i = 1, num_lamps do
+        lights[#lights + 1] = street_lamp(vec(math.random(-400, 400), math.random(0, 800), 8))
+    end
+    for i = 1, num_flashes do
+        lights[#lights + 1] = muzzle_flash(
+            vec(math.random(-100, 100), math.random(0, 200), math.random(1, 3)))
+    end
+    local in_view, entries
+    local before = micros()
+    for i = 1, iterations do
+        in_view, entries = gfx_light_cluster_assign(cam_pos, cam_quat)
+    end
+    local us = (micros() - before) / iterations
+    print(("%5d lights, %5d in view, %6d list entries: %7.1f us/assign"):format(
+          #lights, in_view, entries, us))
+    for _, l in ipairs(lights) do
+        l:destroy()
+    end
+end
+
+benchmark(100, 20)
+benchmark(1000, 100)
+benchmark(5000, 500)
@@ -0,0 +1,157 @@
+// Checks GfxLightClusters on the CPU alone.  The SSE and scalar column/row tests must agree
+// exactly, and every light must be in the list of every cluster that its sphere overlaps.  The
+// source is included rather than linked so that both versions of the test, which are internal to
+// it, can be called directly.
+
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+#include "../../../gfx/gfx_light_cluster.cpp"
+
+static unsigned failures = 0;
+
+static void check (bool ok, const char *what)
+{
+    if (ok) return;
+    std::cerr << "FAILED: " << what << std::endl;
+    failures++;
+}
+
+static GfxLightClusterGrid make_grid (unsigned tiles_x, unsigned tiles_y, unsigned slices,
+                                      float left, float right, float bottom, float top)
+{
+    GfxLightClusterGrid g;
+    g.tilesX = tiles_x;
+    g.tilesY = tiles_y;
+    g.slices = slices;
+    g.left = left;
+    g.right = right;
+    g.bottom = bottom;
+    g.top = top;
+    g.nearClip = 0.3f;
+    g.farClip = 800;
+    return g;
+}
+
+// The column and row tests, on spheres at random and on spheres that just touch a plane, for
+// numbers of tiles that are and are not a multiple of 4.
+static void sse_matches_scalar (void)
+{
+    #ifdef GFX_LIGHT_CLUSTER_SSE
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> unit(-1, 1);
+    unsigned compared = 0;
+    for (unsigned tiles = 1 ; tiles <= 21 ; ++tiles) {
+        std::vector<float> xs(tiles + 1);
+        for (unsigned i = 0 ; i <= tiles ; ++i) xs[i] = -0.9f + 1.7f * i / tiles;
+        std::vector<float> lo_lat, lo_z, hi_lat, hi_z;
+        make_planes(xs, 0, tiles, 1, lo_lat, lo_z);
+        make_planes(xs, 1, tiles, 1, hi_lat, hi_z);
+
+        for (unsigned k = 0 ; k < 20000 ; ++k) {
+            float z = -1 - 100 * (unit(rng) + 1);
+            float lat = -z * 1.2f * unit(rng);
+            float r = 20 * (unit(rng) + 1);
+            if (k % 2 == 1) {
+                // Move the sphere so it just touches one of the planes.
+                unsigned p = (k / 2) % tiles;
+                float d = lo_lat[p] * lat + lo_z[p] * z;
+                r = std::abs(d);
+            }
+            unsigned first_sse = 0, last_sse = 0, first_scalar = 0, last_scalar = 0;
+            bool any_sse = touched_sse(&lo_lat[0], &lo_z[0], &hi_lat[0], &hi_z[0], tiles,
+                                       lat, z, r, first_sse, last_sse);
+            bool any_scalar = touched_scalar(&lo_lat[0], &lo_z[0], &hi_lat[0], &hi_z[0], 0, tiles,
+                                             lat, z, r, false, first_scalar, last_scalar);
+            check(any_sse == any_scalar, "SSE and scalar agree whether any tile is touched");
+            if (any_sse && any_scalar) {
+                check(first_sse == first_scalar && last_sse == last_scalar,
+                      "SSE and scalar agree on the touched tiles");
+            }
+            compared++;
+        }
+    }
+    std::cout << "Compared SSE and scalar tests on " << compared << " spheres." << std::endl;
+    #else
+    std::cout << "No SSE, so nothing to compare the scalar tests with." << std::endl;
+    #endif
+}
+
+// Which cluster a view space point is in, or false if it is outside the frustum.
+static bool cluster_at (const GfxLightClusterGrid &g, float x, float y, float z, unsigned &c)
+{
+    float depth = -z;
+    if (depth <= g.nearClip || depth >= g.farClip) return false;
+    float u = (x / depth - g.left) / (g.right - g.left);
+    float v = (g.top - y / depth) / (g.top - g.bottom);
+    if (u < 0 || u >= 1 || v < 0 || v >= 1) return false;
+    unsigned col = std::min(unsigned(u * g.tilesX), g.tilesX - 1);
+    unsigned row = std::min(unsigned(v * g.tilesY), g.tilesY - 1);
+    unsigned slice = slice_at(depth, g.nearClip, g.sliceScale(), g.slices);
+    c = g.index(col, row, slice);
+    return true;
+}
+
+static bool in_cluster (const GfxLightClusters &lc, unsigned c, uint32_t light)
+{
+    for (uint32_t k = 0 ; k < lc.counts[c] ; ++k) {
+        if (lc.indexes[lc.offsets[c] + k] == light) return true;
+    }
+    return false;
+}
+
+// Points at random inside each light's sphere, and on its surface, must be in a cluster that
+// lists the light.
+static void lights_reach_overlapped_clusters (const GfxLightClusterGrid &g, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> unit(-1, 1);
+    GfxLightClusters lc;
+    const unsigned n = 500;
+    for (unsigned i = 0 ; i < n ; ++i) {
+        Vector3 centre(300 * unit(rng), 150 * unit(rng), -415 + 435 * unit(rng));
+        lc.add(centre, 20.25f + 19.75f * unit(rng));
+    }
+    lc.assign(g);
+
+    unsigned tried = 0, missing = 0;
+    for (unsigned i = 0 ; i < n ; ++i) {
+        for (unsigned k = 0 ; k < 400 ; ++k) {
+            float dx = unit(rng), dy = unit(rng), dz = unit(rng);
+            float len2 = dx * dx + dy * dy + dz * dz;
+            if (len2 > 1 || len2 == 0) continue;
+            // Half of the points are pushed out to just inside the surface.
+            float scale = k % 2 == 0 ? 1 : 0.999f / std::sqrt(len2);
+            float x = lc.posX[i] + dx * scale * lc.radius[i];
+            float y = lc.posY[i] + dy * scale * lc.radius[i];
+            float z = lc.posZ[i] + dz * scale * lc.radius[i];
+            unsigned c;
+            if (!cluster_at(g, x, y, z, c)) continue;
+            tried++;
+            if (!in_cluster(lc, c, i)) missing++;
+        }
+    }
+    std::cout << "Grid " << g.tilesX << "x" << g.tilesY << "x" << g.slices << ": " << tried
+              << " points in view, " << missing << " in a cluster without their light."
+              << std::endl;
+    check(missing == 0, "every light is in every cluster it overlaps");
+    check(tried > 0, "some lights are in view");
+}
+
+int main (void)
+{
+    sse_matches_scalar();
+    // A 16:9 view with 55 degrees vertical field of view, one with a number of tiles that is not
+    // a multiple of 4, and an off-centre one as for one eye of a stereo pair.
+    float t = std::tan(0.48f);
+    lights_reach_overlapped_clusters(make_grid(16, 9, 24, -t * 16 / 9, t * 16 / 9, -t, t), 1);
+    lights_reach_overlapped_clusters(make_grid(15, 7, 17, -t * 16 / 9, t * 16 / 9, -t, t), 2);
+    lights_reach_overlapped_clusters(make_grid(16, 9, 24, -t * 1.3f, t * 0.7f, -t, t), 3);
+    if (failures > 0) {
+        std::cerr << failures << " checks failed." << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "All checks passed." << std::endl;
+    return EXIT_SUCCESS;
+}
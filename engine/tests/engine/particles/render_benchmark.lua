@@ -0,0 +1,47 @@
+-- CPU time to depth sort the particles and fill the instance buffer each frame, with the fill on
+-- one thread and on all of them.
+
+gfx_colour_grade(`neutral.lut.png`)
+gfx_fade_dither_map `stipple.png`
+gfx_particle_ambient(vec(1, 1, 1))
+
+gfx_particle_define(`Smoke`, {
+    map = `Smoke.png`,
+    -- Long enough that none expire during the benchmark.
+    life = 1000,
+    size = {1, 4},
+    alpha = {1, 0},
+})
+
+local cam_pos = vec(0, 0, 0)
+local cam_quat = quat(1, 0, 0, 0)
+local frames = 30
+
+local function benchmark(num_particles, threads)
+    gfx_option("PARTICLE_THREADS", threads)
+    for i = 1, num_particles do
+        local pos = vec(math.random(-100, 100), math.random(10, 300), math.random(-50, 50))
+        gfx_particle_emit(`Smoke`, pos, {})
+    end
+    local total_sort, total_fill = 0, 0
+    for f = 1, frames do
+        gfx_render(0.1, cam_pos, cam_quat)
+        local particles, sort_us, fill_us = gfx_particle_render_stats()
+        if particles ~= num_particles then
+            error("Rendered " .. particles .. " particles, expected " .. num_particles)
+        end
+        total_sort = total_sort + sort_us
+        total_fill = total_fill + fill_us
+    end
+    print(("%6d particles, %s: sort %7.1f us/frame, fill %7.1f us/frame"):format(
+          num_particles, threads == 1 and "1 thread   " or "all threads",
+          total_sort / frames, total_fill / frames))
+    gfx_particle_reset()
+end
+
+for _, n in ipairs({1000, 10000, 100000}) do
+    benchmark(n, 1)
+    benchmark(n, 0)
+end
+
+gfx_option("PARTICLE_THREADS", 0)
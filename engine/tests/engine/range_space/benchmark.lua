@@ -0,0 +1,34 @@
+-- Streamer range space throughput with each of the distance kernels the CPU supports.
+
+print("Automatically selected kernel: " .. range_space_kernel())
+
+class_add(`Prop`, {}, {renderingDistance = 100})
+
+local num_objects = 200000
+for i = 1, num_objects do
+    object_add(`Prop`, vec(math.random(-10000, 10000), math.random(-10000, 10000), 0))
+end
+
+-- Visit every object on each call, rather than a slice of them.
+core_option("STEP_SIZE", 20000)
+
+-- Far from everything, so nothing is activated and only the range test is timed.
+local far = vec(50000, 50000, 0)
+local iterations = 200
+
+for _, kernel in ipairs({"scalar", "sse2", "avx2", "avx512"}) do
+    if pcall(range_space_kernel, kernel) then
+        streamer_centre(far)
+        local before = micros()
+        for i = 1, iterations do
+            streamer_centre(far)
+        end
+        local us = micros() - before
+        print(("%-7s %.2f ns per object"):format(kernel, us * 1000 / iterations / 20000))
+    else
+        print(("%-7s not supported"):format(kernel))
+    end
+end
+
+range_space_kernel("")
+object_all_del()
@@ -0,0 +1,59 @@
+-- Precompile every permutation of a set of materials with different numbers of threads.  The
+-- shader cache is disabled so that each run generates all the code.
+
+local shader = {
+    tex = {
+        uniformKind = "TEXTURE2D",
+    },
+    tint = {
+        uniformKind = "PARAM",
+        valueKind = "FLOAT",
+        1, 1, 1,
+    },
+    vertexCode = [[
+        var normal_ws = rotate_to_world(vert.normal.xyz);
+    ]],
+    dangsCode = [[
+        out.diffuse = sample(mat.tex, vert.coord0.xy).rgb * mat.tint;
+        out.gloss = 0;
+        out.specular = 0;
+        out.normal = normal_ws;
+    ]],
+    additionalCode = [[
+        out.colour = sample(mat.tex, vert.coord0.xy).rgb * mat.tint;
+    ]],
+}
+
+gfx_register_shader(`Tinted`, shader)
+
+for i = 1, 20 do
+    register_material(`Tinted` .. i, {
+        shader = `Tinted`,
+        tex = i % 2 == 0 and `Money_d.dds` or nil,
+        tint = vec(1, i / 20, 0),
+        sceneBlend = i % 3 == 0 and "ALPHA" or "OPAQUE",
+        blendedBones = i % 4,
+    })
+end
+
+local cache_was_enabled = gfx_shader_cache_enabled()
+gfx_shader_cache_enabled(false)
+
+local expected
+for _, threads in ipairs{1, 2, 4, 8} do
+    -- Registering the shader again throws away all of its native programs.
+    gfx_register_shader(`Tinted`, shader)
+    local stats = gfx_material_precompile(threads)
+    if stats.failed ~= 0 then
+        error(("%d permutations failed to compile."):format(stats.failed))
+    end
+    expected = expected or stats.compiled
+    if stats.compiled ~= expected then
+        error(("Expected %d permutations on %d threads, got %d."):format(
+              expected, threads, stats.compiled))
+    end
+    print(("%d permutations on %d threads: %.1f ms"):format(
+          stats.compiled, stats.threads, stats.seconds * 1000))
+end
+
+gfx_shader_cache_enabled(cache_was_enabled)
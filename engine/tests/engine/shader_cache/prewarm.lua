@@ -0,0 +1,64 @@
+-- Prewarm the Gasoline shader cache for a list of materials, then time the same permutations
+-- being served from it.
+
+gfx_register_shader(`Tinted`, {
+    tex = {
+        uniformKind = "TEXTURE2D",
+    },
+    tint = {
+        uniformKind = "PARAM",
+        valueKind = "FLOAT",
+        1, 1, 1,
+    },
+    vertexCode = [[
+        var normal_ws = rotate_to_world(vert.normal.xyz);
+    ]],
+    dangsCode = [[
+        out.diffuse = sample(mat.tex, vert.coord0.xy).rgb * mat.tint;
+        out.gloss = 0;
+        out.specular = 0;
+        out.normal = normal_ws;
+    ]],
+    additionalCode = [[
+        out.colour = sample(mat.tex, vert.coord0.xy).rgb * mat.tint;
+    ]],
+})
+
+local materials = {}
+for i = 1, 20 do
+    local name = `Tinted` .. i
+    register_material(name, {
+        shader = `Tinted`,
+        tex = i % 2 == 0 and `Money_d.dds` or nil,
+        tint = vec(1, i / 20, 0),
+        sceneBlend = i % 3 == 0 and "ALPHA" or "OPAQUE",
+    })
+    materials[#materials + 1] = name
+end
+
+if not gfx_shader_cache_enabled() then
+    print("Shader cache disabled (GRIT_SHADER_CACHE is empty), nothing to compare.")
+    return
+end
+
+local function prewarm()
+    gfx_shader_cache_reset_stats()
+    local before = micros()
+    local n = gfx_shader_cache_prewarm(materials)
+    return n, micros() - before, gfx_shader_cache_stats()
+end
+
+-- Compiles whatever registering the materials did not (or nothing, if a previous run did).
+local n, first_us, first = prewarm()
+local _, second_us, second = prewarm()
+
+if second.hits ~= n or second.misses ~= 0 then
+    error(("Expected %d cache hits, got %d (%d misses, %d write failures, file \"%s\")."):format(
+          n, second.hits, second.misses, second.writeFailures, second.file))
+end
+
+print(("%d permutations for %d materials, %d entries in \"%s\""):format(
+      n, #materials, second.entries, second.file))
+print(("First prewarm: %d misses, %.1f ms compiling, %.1f ms total"):format(
+      first.misses, first.compileSeconds * 1000, first_us / 1000))
+print(("Second prewarm: %d hits, %.1f ms total"):format(second.hits, second_us / 1000))
@@ -0,0 +1,30 @@
+#!/bin/bash
+
+# Times gsl compiling every permutation of some shaders across different numbers of threads.
+
+set -e
+
+make -C ../../.. gsl
+
+BODY_PARAMS="-p alphaMask Float -p alphaRejectThreshold Float -p diffuseMap FloatTexture2 -p diffuseMask Float3 -p normalMap FloatTexture2 -p glossMap FloatTexture2 -p glossMask Float -p specularMask Float -p emissiveMap FloatTexture2 -p emissiveMask Float3 -U paintSelectionMap -u normalMap"
+PAINT_PARAMS="-p paintSelectionMap FloatTexture2 -p paintSelectionMask Float4 -p paintByDiffuseAlpha StaticFloat -p microflakesMap FloatTexture2"
+SKY_PARAMS="-p starfieldMap FloatTexture2 -p starfieldMask Float3 -p perlin FloatTexture2 -p perlinN FloatTexture2 -p emissiveMap FloatTexture2 -p emissiveMask Float3 -p alphaMask Float -p alphaRejectThreshold Float -p premultipliedAlpha StaticFloat -U emissiveMap -p volumeMap FloatTexture3 -u perlinN"
+
+TMP=$(tempfile)
+
+for TARGET in glsl33 cg ; do
+    TLANG=""
+    test $TARGET == "cg" && TLANG="-C"
+    for THREADS in 1 2 4 8 ; do
+        echo "FpDefault ${TARGET}:"
+        gsl $TLANG $BODY_PARAMS -B $THREADS FpDefault.{vert,dangs,add}.gsl FORWARD $TMP $TMP
+        echo "CarPaint ${TARGET}:"
+        gsl $TLANG $BODY_PARAMS $PAINT_PARAMS -B $THREADS CarPaint.{vert,dangs,add}.gsl FORWARD $TMP $TMP
+        for SHADER in SkyDefault SkyClouds SkyBackground ; do
+            echo "${SHADER} ${TARGET}:"
+            gsl $TLANG $SKY_PARAMS -B $THREADS ${SHADER}.vert.gsl /dev/null ${SHADER}.colour.gsl SKY $TMP $TMP
+        done
+    done
+done
+
+rm -f $TMP
@@ -123,6 +123,7 @@ do_tests() {
     test_sky ${TARGET} SkyClouds
     test_sky ${TARGET} SkyBackground
     test_sky ${TARGET} ForLoop
+    test_sky ${TARGET} Optimise
 
     for KIND in FORWARD ALPHA FIRST_PERSON FIRST_PERSON_WIREFRAME CAST ; do
         for INSTANCED in "" "-i"; do
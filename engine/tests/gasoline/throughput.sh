@@ -0,0 +1,42 @@
+#!/bin/bash
+
+# Times gsl compiling every permutation of each test shader on a single thread, to measure
+# front end and backend throughput (parsing, type checking, optimisation and code generation).
+
+set -e
+
+make -C ../../.. gsl
+
+REPEAT=${REPEAT:-5}
+
+BODY_PARAMS="-p alphaMask Float -p alphaRejectThreshold Float -p diffuseMap FloatTexture2 -p diffuseMask Float3 -p normalMap FloatTexture2 -p glossMap FloatTexture2 -p glossMask Float -p specularMask Float -p emissiveMap FloatTexture2 -p emissiveMask Float3 -U paintSelectionMap -u normalMap"
+PAINT_PARAMS="-p paintSelectionMap FloatTexture2 -p paintSelectionMask Float4 -p paintByDiffuseAlpha StaticFloat -p microflakesMap FloatTexture2"
+SKY_PARAMS="-p starfieldMap FloatTexture2 -p starfieldMask Float3 -p perlin FloatTexture2 -p perlinN FloatTexture2 -p emissiveMap FloatTexture2 -p emissiveMask Float3 -p alphaMask Float -p alphaRejectThreshold Float -p premultipliedAlpha StaticFloat -U emissiveMap -p volumeMap FloatTexture3 -u perlinN"
+HUD_PARAMS="-p colour Float3 -p alpha Float -p tex FloatTexture2"
+PARTICLE_PARAMS="--internal -p gbuffer0 FloatTexture2 -p particleAtlas FloatTexture2"
+
+TMP=$(tempfile)
+LOG=$(tempfile)
+
+for TARGET in glsl33 cg ; do
+    TLANG=""
+    test $TARGET == "cg" && TLANG="-C"
+    : > $LOG
+    for I in $(seq $REPEAT) ; do
+        for SHADER in FpDefault Empty ; do
+            gsl $TLANG $BODY_PARAMS -B 1 ${SHADER}.{vert,dangs,add}.gsl FORWARD $TMP $TMP >> $LOG
+        done
+        gsl $TLANG $BODY_PARAMS $PAINT_PARAMS -B 1 CarPaint.{vert,dangs,add}.gsl FORWARD $TMP $TMP >> $LOG
+        for SHADER in Empty SkyTest SkyDefault SkyClouds SkyBackground ForLoop Optimise ; do
+            gsl $TLANG $SKY_PARAMS -B 1 ${SHADER}.vert.gsl /dev/null ${SHADER}.colour.gsl SKY $TMP $TMP >> $LOG
+        done
+        for SHADER in HudRect HudText ; do
+            gsl $TLANG $HUD_PARAMS -B 1 ${SHADER}.vert.gsl /dev/null ${SHADER}.colour.gsl HUD $TMP $TMP >> $LOG
+        done
+        gsl $TLANG $PARTICLE_PARAMS -B 1 Particle.vert.gsl /dev/null Particle.add.gsl SKY $TMP $TMP >> $LOG
+    done
+    awk -v target=$TARGET '/permutations/ { n += $1; ms += $(NF - 2) }
+        END { printf "%s: %d permutations in %.1f ms, %.0f permutations/s\n", target, n, ms, n * 1000 / ms }' $LOG
+done
+
+rm -f $TMP $LOG
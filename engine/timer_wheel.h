@@ -0,0 +1,307 @@
+/* Copyright (c) The Grit Game Engine authors 2016
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <cstdint>
+#include <vector>
+
+// Hierarchical timer wheel, time is measured in integer ticks.
+//
+// There are LEVELS wheels of SLOTS slots each.  An event due within SLOTS ticks sits in the
+// level 0 slot for its exact tick.  Events further away sit in a coarser slot of a higher level,
+// and are cascaded down a level whenever the level below wraps around.  Insertion, cancellation
+// and expiry are O(1), a tick with nothing due costs a handful of compares.
+//
+// Entries are pooled in a vector and chained by index.  Cancelled entries stay in their slot as
+// tombstones until the slot is next visited, which keeps cancellation safe to call from inside an
+// expiry callback.
+//
+// Handles are small enough to be stored in a double without loss (< 2^52) and never zero.  A
+// handle becomes stale as soon as its event fires or is cancelled, even if the entry is reused.
+template<class T> class TimerWheel {
+
+    public:
+
+    typedef uint64_t Handle;
+
+    protected:
+
+    static const unsigned SLOT_BITS = 8;
+    static const unsigned SLOTS = 1 << SLOT_BITS;
+    static const unsigned SLOT_MASK = SLOTS - 1;
+    static const unsigned LEVELS = 4;
+    static const uint32_t NIL = 0xFFFFFFFF;
+    static const uint32_t GENERATION_MASK = 0xFFFFF;
+
+    enum State { FREE, PENDING, CANCELLED };
+
+    struct Entry {
+        uint64_t expiry;
+        uint32_t next;
+        uint32_t generation;
+        State state;
+        T payload;
+    };
+
+    struct Slot {
+        uint32_t head;
+        uint32_t tail;
+    };
+
+    std::vector<Entry> entries;
+    std::vector<uint32_t> freeList;
+    Slot slots[LEVELS][SLOTS];
+    // Entries linked into each level, including tombstones.
+    unsigned levelSize[LEVELS];
+    uint64_t now;
+    unsigned pending;
+
+    static Handle makeHandle (uint32_t index, uint32_t generation)
+    { return (Handle(generation) << 32) | index; }
+
+    Entry *lookup (Handle h)
+    {
+        uint32_t index = uint32_t(h & 0xFFFFFFFF);
+        uint32_t generation = uint32_t(h >> 32);
+        if (index >= entries.size()) return nullptr;
+        Entry &e = entries[index];
+        if (e.state != PENDING || e.generation != generation) return nullptr;
+        return &e;
+    }
+
+    void release (uint32_t index)
+    {
+        Entry &e = entries[index];
+        e.state = FREE;
+        e.payload = T();
+        // Skip generation 0 so that no handle is ever 0.
+        e.generation = (e.generation & GENERATION_MASK) + 1;
+        if (e.generation > GENERATION_MASK) e.generation = 1;
+        freeList.push_back(index);
+    }
+
+    void link (uint32_t index)
+    {
+        Entry &e = entries[index];
+        // Only an entry cascading into the slot that is about to be processed can have delta 0.
+        uint64_t delta = e.expiry - now;
+        unsigned level = 0;
+        while (level < LEVELS - 1 && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1))))
+            level++;
+        uint64_t t = e.expiry;
+        if (delta >= (uint64_t(1) << (SLOT_BITS * LEVELS))) {
+            // Beyond the horizon, park it in the furthest slot, it is re-linked on each cascade
+            // until it comes into range.
+            t = now + (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+        }
+        Slot &s = slots[level][(t >> (SLOT_BITS * level)) & SLOT_MASK];
+        levelSize[level]++;
+        e.next = NIL;
+        if (s.tail == NIL) {
+            s.head = index;
+        } else {
+            entries[s.tail].next = index;
+        }
+        s.tail = index;
+    }
+
+    // Unhook the whole slot, returning its first entry.
+    uint32_t detach (unsigned level, unsigned slot)
+    {
+        Slot &s = slots[level][slot];
+        uint32_t head = s.head;
+        s.head = NIL;
+        s.tail = NIL;
+        return head;
+    }
+
+    void cascade (unsigned level)
+    {
+        uint32_t index = detach(level, (now >> (SLOT_BITS * level)) & SLOT_MASK);
+        while (index != NIL) {
+            uint32_t next = entries[index].next;
+            levelSize[level]--;
+            if (entries[index].state == CANCELLED) {
+                release(index);
+            } else {
+                link(index);
+            }
+            index = next;
+        }
+    }
+
+    public:
+
+    TimerWheel (void)
+      : now(0), pending(0)
+    {
+        for (unsigned l = 0 ; l < LEVELS ; ++l) {
+            for (unsigned s = 0 ; s < SLOTS ; ++s) {
+                slots[l][s].head = NIL;
+                slots[l][s].tail = NIL;
+            }
+            levelSize[l] = 0;
+        }
+    }
+
+    /** The last tick that was processed. */
+    uint64_t currentTick (void) const { return now; }
+
+    /** Number of events that have neither fired nor been cancelled. */
+    unsigned size (void) const { return pending; }
+
+    /** Schedule payload to fire when tick is reached (at the next tick if it already has). */
+    Handle add (uint64_t tick, const T &payload)
+    {
+        uint32_t index;
+        if (freeList.empty()) {
+            index = entries.size();
+            Entry e;
+            e.generation = 1;
+            e.state = FREE;
+            entries.push_back(e);
+        } else {
+            index = freeList.back();
+            freeList.pop_back();
+        }
+        Entry &e = entries[index];
+        // Never schedule into the past, the earliest possible tick is the next one.
+        e.expiry = tick <= now ? now + 1 : tick;
+        e.state = PENDING;
+        e.payload = payload;
+        link(index);
+        pending++;
+        return makeHandle(index, e.generation);
+    }
+
+    /** Stop a pending event from firing.
+     *
+     * Returns false if the handle is stale.  Otherwise the payload is moved into out.
+     */
+    bool cancel (Handle h, T &out)
+    {
+        Entry *e = lookup(h);
+        if (e == nullptr) return false;
+        out = e->payload;
+        e->payload = T();
+        e->state = CANCELLED;
+        pending--;
+        return true;
+    }
+
+    /** Process every tick up to and including target, in tick order.
+     *
+     * For each event that comes due, f(payload, again) is called.  If it returns true, the same
+     * event is rescheduled to the tick it stored in again and its handle stays valid.  Otherwise
+     * done(payload) is called once the event is finished with.  f may add and cancel events, new
+     * events due at or before the tick being processed fire on the following tick.  The firing
+     * event stays pending while f runs, so if f cancels it (or clears the wheel) the payload goes
+     * to the canceller as usual, it is not rescheduled and done is not called for it.
+     */
+    template<class F, class D> void advance (uint64_t target, F &f, D &done)
+    {
+        while (now < target) {
+            if (pending == 0) {
+                // Nothing can fire, just drop any tombstones by jumping ahead.
+                now = target;
+                break;
+            }
+            // Skip straight to the next cascade of the lowest occupied level, the ticks in between
+            // cannot have anything in them.
+            unsigned lowest = 0;
+            while (lowest < LEVELS - 1 && levelSize[lowest] == 0) lowest++;
+            if (lowest > 0) {
+                uint64_t skip_to = now | ((uint64_t(1) << (SLOT_BITS * lowest)) - 1);
+                if (skip_to >= target) {
+                    now = target;
+                    break;
+                }
+                now = skip_to;
+            }
+            now++;
+            for (unsigned level = 1 ; level < LEVELS ; ++level) {
+                if (((now >> (SLOT_BITS * (level - 1))) & SLOT_MASK) != 0) break;
+                cascade(level);
+            }
+            uint32_t index = detach(0, now & SLOT_MASK);
+            while (index != NIL) {
+                uint32_t next = entries[index].next;
+                levelSize[0]--;
+                if (entries[index].state == PENDING) {
+                    T payload = entries[index].payload;
+                    uint64_t again = now;
+                    bool reschedule = f(payload, again);
+                    // Do not hold a reference across f, it may have grown the pool.
+                    Entry &e = entries[index];
+                    if (e.state == PENDING && reschedule) {
+                        e.expiry = again <= now ? now + 1 : again;
+                        link(index);
+                    } else {
+                        if (e.state == PENDING) {
+                            pending--;
+                            done(payload);
+                        }
+                        release(index);
+                    }
+                } else {
+                    release(index);
+                }
+                index = next;
+            }
+        }
+    }
+
+    /** Call f(tick, payload) for each pending event, in no particular order. */
+    template<class F> void forEach (F &f) const
+    {
+        for (const Entry &e : entries) {
+            if (e.state == PENDING) f(e.expiry, e.payload);
+        }
+    }
+
+    /** Cancel everything, calling f(payload) for each event that was pending. */
+    template<class F> void clear (F &f)
+    {
+        for (uint32_t i = 0 ; i < entries.size() ; ++i) {
+            if (entries[i].state == PENDING) {
+                T payload = entries[i].payload;
+                entries[i].state = CANCELLED;
+                pending--;
+                f(payload);
+            }
+        }
+        for (unsigned l = 0 ; l < LEVELS ; ++l) {
+            for (unsigned s = 0 ; s < SLOTS ; ++s) {
+                uint32_t index = detach(l, s);
+                while (index != NIL) {
+                    uint32_t next = entries[index].next;
+                    levelSize[l]--;
+                    release(index);
+                    index = next;
+                }
+            }
+        }
+    }
+};
+
+#endif